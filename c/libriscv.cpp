@@ -2,6 +2,7 @@
 
 #include <libriscv/util/load_binary_file.hpp>
 #include <libriscv/machine.hpp>
+#include <libriscv/fork_pool.hpp>
 #include <libriscv/native_heap.hpp>
 using namespace riscv;
 static const std::vector<std::string> env = {"LC_CTYPE=C", "LC_ALL=C", "USER=groot"};
@@ -249,7 +250,8 @@ int libriscv_run(RISCVMachine *m, uint64_t instruction_limit)
 		auto& machine = *MACHINE(m);
 		if (instruction_limit == 0) {
 			machine.cpu.simulate_inaccurate(machine.cpu.pc());
-			return machine.instruction_limit_reached() ? -RISCV_ERROR_TYPE_MACHINE_TIMEOUT : 0;
+			return machine.instruction_limit_reached() || machine.interrupt_requested()
+				? -RISCV_ERROR_TYPE_MACHINE_TIMEOUT : 0;
 		}
 		else {
 			return machine.simulate<false>(instruction_limit) ? 0 : -RISCV_ERROR_TYPE_MACHINE_TIMEOUT;
@@ -325,6 +327,17 @@ void libriscv_stop(RISCVMachine *m)
 	MACHINE(m)->stop();
 }
 
+extern "C"
+void libriscv_request_interrupt(RISCVMachine *m)
+{
+	MACHINE(m)->request_interrupt();
+}
+extern "C"
+void libriscv_clear_interrupt(RISCVMachine *m)
+{
+	MACHINE(m)->clear_interrupt();
+}
+
 extern "C"
 int64_t libriscv_return_value(RISCVMachine *m)
 {
@@ -537,121 +550,207 @@ int libriscv_load_binary_file(const char *filename, char **data)
 
 #ifdef RISCV_VIRTUAL_PAGING
 
-extern "C"
-RISCVMachine *libriscv_fast_fork(const RISCVMachine *parent, RISCVOptions *opts)
+static uint64_t fast_fork_memory_max(const Machine<RISCV_ARCH>* pm, const RISCVOptions *opts)
 {
-	auto* pm = CONST_MACHINE(parent);
-	UserData *u = nullptr;
-	try {
-		const uint64_t fork_memory_max = (opts && opts->max_memory > 0)
-			? opts->max_memory : pm->memory.memory_arena_size();
-		auto* m = new Machine<RISCV_ARCH>(*pm, MachineOptions<RISCV_ARCH>{
-			.memory_max = fork_memory_max,
-			.minimal_fork = true,
-			.use_memory_arena = false,
-			.default_exit_function = "fast_exit",
+	return (opts && opts->max_memory > 0)
+		? opts->max_memory : pm->memory.memory_arena_size();
+}
+
+static MachineOptions<RISCV_ARCH> fast_fork_options(uint64_t fork_memory_max)
+{
+	return MachineOptions<RISCV_ARCH>{
+		.memory_max = fork_memory_max,
+		.minimal_fork = true,
+		.use_memory_arena = false,
+		.default_exit_function = "fast_exit",
 #ifdef RISCV_BINARY_TRANSLATION
-			.translate_enabled = true,
-			.translation_use_arena = false,
+		.translate_enabled = true,
+		.translation_use_arena = false,
 #endif
-		});
-
-		u = new UserData {
-			.error = opts ? opts->error : nullptr,
-			.stdout = opts ? opts->stdout : nullptr,
-			.opaque = opts ? opts->opaque : nullptr,
-		};
-		u->fork_parent = pm;
-		u->max_owned_pages = fork_memory_max / Page::size();
-		m->set_userdata(u);
-		m->memory.set_stack_initial(m->cpu.reg(2) & ~0xFULL); // Align stack pointer to 16 bytes
-		setup_printer(m);
+	};
+}
 
-		// Default page fault: heap-allocated pages with limit
-		m->memory.set_page_fault_handler(
-			[](auto& mem, size_t pageno, bool init) -> Page& {
-				auto& ud = USERDATA((&mem.machine()));
-				if (ud.max_owned_pages > 0
-					&& ud.owned_page_count >= ud.max_owned_pages)
-					throw MachineException(OUT_OF_MEMORY,
-						"Fork page limit reached", pageno * Page::size());
-				ud.owned_page_count++;
-				return mem.allocate_page(pageno,
-					init ? PageData::INITIALIZED : PageData::UNINITIALIZED);
-			});
+// Installs the userdata, CoW page handlers and arena of a new fork
+static void setup_fast_fork(Machine<RISCV_ARCH>* m, const Machine<RISCV_ARCH>* pm,
+	const RISCVOptions *opts, uint64_t fork_memory_max)
+{
+	auto* u = new UserData {
+		.error = opts ? opts->error : nullptr,
+		.stdout = opts ? opts->stdout : nullptr,
+		.opaque = opts ? opts->opaque : nullptr,
+	};
+	u->fork_parent = pm;
+	u->max_owned_pages = fork_memory_max / Page::size();
+	m->set_userdata(u);
+	m->memory.set_stack_initial(m->cpu.reg(2) & ~0xFULL); // Align stack pointer to 16 bytes
+	setup_printer(m);
+
+	// Default page fault: heap-allocated pages with limit
+	m->memory.set_page_fault_handler(
+		[](auto& mem, size_t pageno, bool init) -> Page& {
+			auto& ud = USERDATA((&mem.machine()));
+			if (ud.max_owned_pages > 0
+				&& ud.owned_page_count >= ud.max_owned_pages)
+				throw MachineException(OUT_OF_MEMORY,
+					"Fork page limit reached", pageno * Page::size());
+			ud.owned_page_count++;
+			return mem.allocate_page(pageno,
+				init ? PageData::INITIALIZED : PageData::UNINITIALIZED);
+		});
 
-		// Default page read: install parent page as non-owning CoW
-		m->memory.set_page_readf_handler(
-			[](const Memory<RISCV_ARCH>& mem, auto pageno) -> const Page& {
-				auto* ud = mem.machine().template get_userdata<UserData>();
-				auto info = get_parent_page_readonly(*ud->fork_parent, pageno);
-				info.attr.non_owning = true;
-				info.attr.is_cow = info.attr.write;
-				info.attr.write = false;
-				return const_cast<Memory<RISCV_ARCH>&>(mem)
-					.allocate_page(pageno, info.attr, info.data);
-			});
+	// Default page read: install parent page as non-owning CoW
+	m->memory.set_page_readf_handler(
+		[](const Memory<RISCV_ARCH>& mem, auto pageno) -> const Page& {
+			auto* ud = mem.machine().template get_userdata<UserData>();
+			auto info = get_parent_page_readonly(*ud->fork_parent, pageno);
+			info.attr.non_owning = true;
+			info.attr.is_cow = info.attr.write;
+			info.attr.write = false;
+			return const_cast<Memory<RISCV_ARCH>&>(mem)
+				.allocate_page(pageno, info.attr, info.data);
+		});
 
-		// Default page write: make writable copy with limit
-		m->memory.set_page_write_handler(
-			[](auto& mem, auto pageno, Page& page) {
-				auto& ud = USERDATA((&mem.machine()));
-				if (ud.max_owned_pages > 0
-					&& ud.owned_page_count >= ud.max_owned_pages)
-					throw MachineException(OUT_OF_MEMORY,
-						"Fork write page limit reached", pageno * Page::size());
-				page.make_writable();
-				ud.owned_page_count++;
-			});
+	// Default page write: make writable copy with limit
+	m->memory.set_page_write_handler(
+		[](auto& mem, auto pageno, Page& page) {
+			auto& ud = USERDATA((&mem.machine()));
+			if (ud.max_owned_pages > 0
+				&& ud.owned_page_count >= ud.max_owned_pages)
+				throw MachineException(OUT_OF_MEMORY,
+					"Fork write page limit reached", pageno * Page::size());
+			page.make_writable();
+			ud.owned_page_count++;
+		});
 
-		// Set up arena at parent's high watermark
-		if (pm->has_arena()) {
-			const auto& parent_ud = *pm->template get_userdata<UserData>();
-			const auto watermark = pm->arena().high_watermark();
-			const auto arena_base = pm->memory.heap_address();
-			const auto total_size = parent_ud.arena_total_size;
-			const auto syscall_base = parent_ud.arena_syscall_base;
-			if (total_size > 0 && syscall_base > 0) {
-				const auto remaining = total_size - (watermark - arena_base);
-				m->setup_native_heap(syscall_base, watermark, remaining);
-
-				m->arena().on_unknown_free(
-					[](auto, auto*) -> int { return 0; });
-
-				const Arena* src_arena = &pm->arena();
-				m->arena().on_unknown_realloc(
-					[src_arena](auto ptr, auto newsize) -> Arena::ReallocResult {
-						const size_t old_len = src_arena->size(ptr);
-						return {0, old_len}; // Caller must malloc separately
-					});
-				// Fix: the on_unknown_realloc needs access to the fork's arena
-				// Re-install with a lambda that captures the fork machine
-				auto* fork_machine = m;
-				m->arena().on_unknown_realloc(
-					[src_arena, fork_machine](auto ptr, auto newsize) -> Arena::ReallocResult {
-						const size_t old_len = src_arena->size(ptr);
-						const auto new_ptr = fork_machine->arena().malloc(newsize);
-						return {new_ptr, old_len};
-					});
-			}
+	// Set up arena at parent's high watermark
+	if (pm->has_arena()) {
+		const auto& parent_ud = *pm->template get_userdata<UserData>();
+		const auto watermark = pm->arena().high_watermark();
+		const auto arena_base = pm->memory.heap_address();
+		const auto total_size = parent_ud.arena_total_size;
+		const auto syscall_base = parent_ud.arena_syscall_base;
+		if (total_size > 0 && syscall_base > 0) {
+			const auto remaining = total_size - (watermark - arena_base);
+			m->setup_native_heap(syscall_base, watermark, remaining);
+
+			m->arena().on_unknown_free(
+				[](auto, auto*) -> int { return 0; });
+
+			const Arena* src_arena = &pm->arena();
+			m->arena().on_unknown_realloc(
+				[src_arena](auto ptr, auto newsize) -> Arena::ReallocResult {
+					const size_t old_len = src_arena->size(ptr);
+					return {0, old_len}; // Caller must malloc separately
+				});
+			// Fix: the on_unknown_realloc needs access to the fork's arena
+			// Re-install with a lambda that captures the fork machine
+			auto* fork_machine = m;
+			m->arena().on_unknown_realloc(
+				[src_arena, fork_machine](auto ptr, auto newsize) -> Arena::ReallocResult {
+					const size_t old_len = src_arena->size(ptr);
+					const auto new_ptr = fork_machine->arena().malloc(newsize);
+					return {new_ptr, old_len};
+				});
 		}
+	}
+}
 
-		return (RISCVMachine *)m;
+template <typename Func>
+static bool report_exceptions(const RISCVOptions *opts, Func func)
+{
+	try {
+		func();
+		return true;
 	}
 	catch (const MachineException& me)
 	{
 		if (opts && opts->error)
 			opts->error(opts->opaque, RISCV_ERROR_TYPE_MACHINE_EXCEPTION, me.what(), me.data());
-		delete u;
-		return NULL;
 	}
 	catch (const std::exception& e)
 	{
 		if (opts && opts->error)
 			opts->error(opts->opaque, RISCV_ERROR_TYPE_GENERAL_EXCEPTION, e.what(), 0);
-		delete u;
+	}
+	return false;
+}
+
+extern "C"
+RISCVMachine *libriscv_fast_fork(const RISCVMachine *parent, RISCVOptions *opts)
+{
+	auto* pm = CONST_MACHINE(parent);
+	Machine<RISCV_ARCH>* m = nullptr;
+	const bool ok = report_exceptions(opts, [&] {
+		const uint64_t fork_memory_max = fast_fork_memory_max(pm, opts);
+		m = new Machine<RISCV_ARCH>(*pm, fast_fork_options(fork_memory_max));
+		setup_fast_fork(m, pm, opts, fork_memory_max);
+	});
+	if (!ok) {
+		if (m) {
+			delete m->get_userdata<UserData> ();
+			delete m;
+		}
 		return NULL;
 	}
+	return (RISCVMachine *)m;
+}
+
+/* A fork pool hands out forks that were set up like libriscv_fast_fork() */
+struct RISCVForkPool {
+	RISCVOptions opts;
+	ForkPool<RISCV_ARCH> pool;
+
+	RISCVForkPool(const Machine<RISCV_ARCH>* pm, unsigned size, const RISCVOptions *o, uint64_t fork_memory_max)
+		: opts(o ? *o : RISCVOptions{}),
+		  pool(*pm, size, fast_fork_options(fork_memory_max),
+			[this, pm, fork_memory_max] (auto& m) {
+				try {
+					setup_fast_fork(&m, pm, &opts, fork_memory_max);
+				} catch (...) {
+					delete m.template get_userdata<UserData> ();
+					throw;
+				}
+			},
+			[] (auto& m) {
+				// Forks are not reset, so they are never reused
+				delete m.template get_userdata<UserData> ();
+				m.set_userdata((UserData *)nullptr);
+				return false;
+			})
+	{}
+};
+
+extern "C"
+RISCVForkPool *libriscv_fork_pool_create(const RISCVMachine *parent, unsigned size, RISCVOptions *opts)
+{
+	auto* pm = CONST_MACHINE(parent);
+	RISCVForkPool* pool = nullptr;
+	report_exceptions(opts, [&] {
+		pool = new RISCVForkPool(pm, size, opts, fast_fork_memory_max(pm, opts));
+	});
+	return pool;
+}
+
+extern "C"
+RISCVMachine *libriscv_fork_pool_acquire(RISCVForkPool *pool)
+{
+	ForkPool<RISCV_ARCH>::fork_t fork;
+	report_exceptions(&pool->opts, [&] {
+		fork = pool->pool.acquire();
+	});
+	return (RISCVMachine *)fork.release();
+}
+
+extern "C"
+void libriscv_fork_pool_release(RISCVForkPool *pool, RISCVMachine *fork)
+{
+	pool->pool.release(ForkPool<RISCV_ARCH>::fork_t(MACHINE(fork)));
+}
+
+extern "C"
+void libriscv_fork_pool_destroy(RISCVForkPool *pool)
+{
+	delete pool;
 }
 
 extern "C"
@@ -686,6 +785,31 @@ RISCVMachine *libriscv_fast_fork(const RISCVMachine *, RISCVOptions *opts)
 	return NULL;
 }
 
+extern "C"
+RISCVForkPool *libriscv_fork_pool_create(const RISCVMachine *, unsigned, RISCVOptions *opts)
+{
+	if (opts && opts->error)
+		opts->error(opts->opaque, RISCV_ERROR_TYPE_GENERAL_EXCEPTION,
+			"Forking requires enabling virtual paging", 0);
+	return NULL;
+}
+
+extern "C"
+RISCVMachine *libriscv_fork_pool_acquire(RISCVForkPool *)
+{
+	return NULL;
+}
+
+extern "C"
+void libriscv_fork_pool_release(RISCVForkPool *, RISCVMachine *)
+{
+}
+
+extern "C"
+void libriscv_fork_pool_destroy(RISCVForkPool *)
+{
+}
+
 extern "C"
 int libriscv_is_forked(const RISCVMachine *)
 {
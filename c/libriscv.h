@@ -128,6 +128,13 @@ LIBRISCVAPI char * libriscv_writable_memview(RISCVMachine *m, uint64_t src, unsi
 /* Stops execution normally. Only possible from a system call and EBREAK. */
 LIBRISCVAPI void libriscv_stop(RISCVMachine *m);
 
+/* Stops execution as soon as possible, making libriscv_run() report a timeout.
+   Safe to call from any thread. The request remains until libriscv_clear_interrupt(). */
+LIBRISCVAPI void libriscv_request_interrupt(RISCVMachine *m);
+
+/* Clears a requested interrupt, so that execution can be resumed with libriscv_run(). */
+LIBRISCVAPI void libriscv_clear_interrupt(RISCVMachine *m);
+
 /* Return current instruction counter value. */
 LIBRISCVAPI uint64_t libriscv_instruction_counter(RISCVMachine *m);
 
@@ -197,6 +204,28 @@ typedef struct {
    Uses opts only for error, stdout, and opaque. Returns NULL on failure. */
 LIBRISCVAPI RISCVMachine *libriscv_fast_fork(const RISCVMachine *parent, RISCVOptions *opts);
 
+/* A pool of ready fast forks of a parent machine. Forks are created and
+   destroyed on a background thread, so that acquiring one is cheap. */
+struct RISCVForkPool;
+typedef struct RISCVForkPool RISCVForkPool;
+
+/* Create a pool that keeps size forks of parent ready. The forks are set up
+   like libriscv_fast_fork() does, using a copy of opts. The parent must outlive
+   the pool, and must not be modified while the pool exists. Returns NULL on failure. */
+LIBRISCVAPI RISCVForkPool *libriscv_fork_pool_create(const RISCVMachine *parent, unsigned size, RISCVOptions *opts);
+
+/* Take a fork from the pool. When the pool is empty, the fork is created on the
+   calling thread instead. Returns NULL on failure. */
+LIBRISCVAPI RISCVMachine *libriscv_fork_pool_acquire(RISCVForkPool *pool);
+
+/* Give a fork from libriscv_fork_pool_acquire() back to the pool, which
+   destroys it on its background thread. */
+LIBRISCVAPI void libriscv_fork_pool_release(RISCVForkPool *pool, RISCVMachine *fork);
+
+/* Destroy the pool and the forks it still holds. Forks that were acquired
+   and not released must be deleted with libriscv_delete(). */
+LIBRISCVAPI void libriscv_fork_pool_destroy(RISCVForkPool *pool);
+
 /* Returns non-zero if the machine is a fork. */
 LIBRISCVAPI int libriscv_is_forked(const RISCVMachine *m);
 
@@ -256,6 +256,31 @@ void test_fast_fork(RISCVMachine *master)
 		struct timespec t1 = time_now();
 		printf("Fork-call-destruct x 1000 took %" PRId64 " ns. You can serve requests in %.2f micros/req\n",
 			nanodiff(t0, t1), nanodiff(t0, t1) / 1e6); // 1000 reqs * 1e3 micros/ns
+
+		/* The same, with forks created and destroyed in the background */
+		RISCVForkPool *pool = libriscv_fork_pool_create(master, 16, &opts);
+		if (!pool) {
+			fprintf(stderr, "Failed to create fork pool!\n");
+			return;
+		}
+		t0 = time_now();
+
+		for (int i = 0; i < 1000; i++) {
+			RISCVMachine *fork = libriscv_fork_pool_acquire(pool);
+			if (!fork) {
+				fprintf(stderr, "Failed to acquire fork from pool!\n");
+				break;
+			}
+			if (libriscv_setup_vmcall(fork, bench_vaddr) == 0) {
+				libriscv_run(fork, 100000000ull);
+			}
+			libriscv_fork_pool_release(pool, fork);
+		}
+
+		t1 = time_now();
+		printf("Pooled fork-call-release x 1000 took %" PRId64 " ns. You can serve requests in %.2f micros/req\n",
+			nanodiff(t0, t1), nanodiff(t0, t1) / 1e6);
+		libriscv_fork_pool_destroy(pool);
 	} else {
 		printf("No 'do_nothing' symbol found, skipping fork function call\n");
 	}
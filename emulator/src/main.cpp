@@ -40,6 +40,8 @@ struct Arguments {
 	bool background = riscv::libtcc_enabled || riscv::asmjit_enabled; // Run translation in background thread
 	bool proxy_mode = false;  // Proxy mode for system calls
 	bool libc_fastpath = false; // Hot-patch known libc functions
+	bool trace_tier = false; // Compile hot loops into register-window traces
+	bool statistics = false; // Count and print machine events
 	uint64_t fuel = 30'000'000'000ULL; // Default: Timeout after ~30bn instructions
 	uint64_t max_memory = 0;
 	std::vector<std::string> allowed_files;
@@ -86,6 +88,8 @@ static const struct option long_options[] = {
 	{"verbose-syscalls", no_argument, 0, 1004},
 	{"ebreak", required_argument, 0, 1005},
 	{"libc-fastpath", no_argument, 0, 1006},
+	{"trace-tier", no_argument, 0, 1007},
+	{"statistics", no_argument, 0, 1008},
 	{0, 0, 0, 0}
 };
 
@@ -126,6 +130,8 @@ static void print_help(const char* name)
 		"  -I, --ignore-text  Ignore .text section, and use segments only\n"
 		"  -c, --call func    Call a function after loading the program\n"
 		"      --libc-fastpath  Hot-patch memcpy, memset, strlen etc. with native implementations\n"
+		"      --trace-tier  Compile hot loops into register-window traces\n"
+		"      --statistics  Print system call, page fault and native code statistics\n"
 		"\n"
 	);
 	printf("libriscv v%d.%d is compiled with:\n"
@@ -168,6 +174,11 @@ static void print_help(const char* name)
 #define _STR(x) #x
 #define STR(x) _STR(x)
 		"-  " STR(RISCV_ENCOMPASSING_ARENA_BITS) "-bit masked address space is enabled (experimental)\n"
+#endif
+#ifdef RISCV_GUARDED_ARENA_BITS
+#define _STR(x) #x
+#define STR(x) _STR(x)
+		"-  " STR(RISCV_GUARDED_ARENA_BITS) "-bit guarded arena is enabled (experimental)\n"
 #endif
 		"\n",
 		RISCV_VERSION_MAJOR, RISCV_VERSION_MINOR
@@ -212,6 +223,8 @@ static int parse_arguments(int argc, const char** argv, Arguments& args)
 			case 1004: args.verbose_syscalls = true; break;
 			case 1005: args.ebreak_locations.push_back(optarg); break;
 			case 1006: args.libc_fastpath = true; break;
+			case 1007: args.trace_tier = true; break;
+			case 1008: args.statistics = true; break;
 			case 'm': // --memory
 				if (optarg) {
 					char* endptr;
@@ -280,6 +293,27 @@ template <int W>
 static void run_sighandler(riscv::Machine<W>&, int signal);
 static int signal_for_exception(int type);
 
+static void print_statistics(const riscv::MachineStatistics& stats)
+{
+	printf("System calls: %" PRIu64 " (unknown: %" PRIu64 ")\n",
+		stats.total_syscalls(), stats.unknown_syscalls);
+	for (size_t i = 0; i < stats.syscalls.size(); i++) {
+		const auto& sc = stats.syscalls[i];
+		if (sc.calls == 0)
+			continue;
+		printf("  %4zu: %10" PRIu64 " calls  %10.3f ms  (avg %.1f us)\n",
+			i, sc.calls, sc.nanoseconds / 1e6, sc.nanoseconds / 1e3 / sc.calls);
+	}
+	printf("Page faults: %" PRIu64 "  CoW copies: %" PRIu64 "  Timeouts: %" PRIu64 "\n",
+		stats.page_faults, stats.cow_copies, stats.timeouts);
+	printf("Execute segments created: %" PRIu64 "  Lookups: %" PRIu64 "  Decoder cache misses: %" PRIu64 "\n",
+		stats.execute_segments, stats.segment_lookups, stats.decoder_cache_misses);
+	printf("Native code: binary translation %" PRIu64 " entries, %" PRIu64 " exits;"
+		" asmjit %" PRIu64 " entries, %" PRIu64 " exits; %" PRIu64 " live-patch switches\n",
+		stats.bintr_entries, stats.bintr_exits, stats.asmjit_entries, stats.asmjit_exits,
+		stats.livepatch_switches);
+}
+
 template <int W>
 static void run_program(
 	const Arguments& cli_args,
@@ -319,6 +353,7 @@ static void run_program(
 		.use_shared_execute_segments = false, // We are only creating one machine, disabling this can enable some optimizations
 		.ebreak_locations = std::move(ebreaks),
 		.libc_fastpath = cli_args.libc_fastpath,
+		.trace_enabled = cli_args.trace_tier,
 #ifdef RISCV_BINARY_TRANSLATION
 		.translate_enabled = !cli_args.no_translate,
 		.translate_future_segments = cli_args.proxy_mode && cli_args.translate_future,
@@ -371,6 +406,14 @@ static void run_program(
 	// operations that need to know the options. This is optional.
 	machine.set_options(std::move(options));
 
+	if (cli_args.statistics) {
+		try {
+			machine.enable_statistics();
+		} catch (const riscv::MachineException& e) {
+			fprintf(stderr, "Warning: %s\n", e.what());
+		}
+	}
+
 	if (cli_args.quit) { // Quit after instantiating the machine
 		return;
 	}
@@ -655,6 +698,9 @@ static void run_program(
 			machine.memory.pages_active() * riscv::Page::size() / uint64_t(1024),
 			machine.memory.memory_usage_total() / uint64_t(1024));
 	}
+	if (const auto* stats = machine.statistics()) {
+		print_statistics(*stats);
+	}
 
 	if (!cli_args.call_function.empty())
 	{
@@ -214,6 +214,7 @@ struct AjEmitter
 	const std::vector<address_t>& instrs;   // reachable addresses, ascending
 	address_t seg_end;    // execute segment end, for instruction reads
 	const AjInfo<W>& info;
+	const std::vector<HoistedLoop<W>>& loops;   // hoisted bounds checks, ascending
 
 	Gp cpu;               // arg0: CPU<W>*
 	Gp st;                // arg1: AjState<W>*
@@ -226,6 +227,7 @@ struct AjEmitter
 	std::bitset<32> readset;    // static: writeset + every rs1/rs2 it reads
 	bool needs_zero = false;
 	bool needs_arena = false;
+	bool writes_vectors = false; // inlined vector loads
 
 	// f-registers: same eager preload/writeback as integer, but f0 is ordinary.
 	std::array<Vec, 32> fvreg {};
@@ -236,16 +238,25 @@ struct AjEmitter
 	bool needs_canon64 = false;
 
 	std::set<address_t> branch_targets;         // in-region targets
+	std::vector<address_t> return_targets;      // in-region return addresses, ascending
 	std::unordered_map<address_t, Label> labels;
 	uint32_t pending = 0;       // instructions retired since the last counter flush
 
 	// Cold paths emitted after the body; each captures its `pending` at branch-off.
 	std::vector<std::function<void()>> deferred;
 
+	// Loop versioning: the loop is emitted again, without the checks that its
+	// back-edge has hoisted, right after the regular version.
+	size_t current = 0;         // index into instrs of the instruction being emitted
+	size_t next_loop = 0;       // the next loop in `loops`
+	bool unchecked = false;     // emitting the version without checks
+	Label unchecked_header, loop_end;
+
 	AjEmitter(UniCompiler& u, const uint8_t* s, const std::vector<address_t>& ens,
-		const std::vector<address_t>& list, address_t se, const AjInfo<W>& in)
+		const std::vector<address_t>& list, address_t se, const AjInfo<W>& in,
+		const std::vector<HoistedLoop<W>>& lps)
 		: uc(u), cc(*u.cc), seg(s), entries(ens), entry(ens.front()),
-		  instrs(list), seg_end(se), info(in) {}
+		  instrs(list), seg_end(se), info(in), loops(lps) {}
 
 	// Entry and emit order differ when a back-edge reaches below the entry.
 	bool entry_is_first() const noexcept { return entry == instrs.front(); }
@@ -317,6 +328,17 @@ struct AjEmitter
 			fvreg[i] = uc.new_vec128("f%u", i);
 			uc.v_loadu64_u64(fvreg[i], freg_mem(i));
 		}
+		// Native code writes the FP and vector files directly, where the
+		// interpreter marks them dirty through Registers::getfl() and rvv()
+		if (fp_writeset.any())
+			mark_dirty(info.fp_state);
+		if (writes_vectors)
+			mark_dirty(info.vector_state);
+	}
+	void mark_dirty(int32_t state_offset) {
+		Gp t = uc.new_gp32("dirty");
+		uc.mov(t, Imm(uint32_t(Registers<W>::ExtState::Dirty)));
+		uc.store_u8(mem_ptr(cpu, state_offset), t);
 	}
 	Gp get(unsigned i) {               // source register
 		if (i == 0) return zero;       // never written, so it can be shared
@@ -382,6 +404,107 @@ struct AjEmitter
 		uc.bind(ok);
 	}
 
+	// --- loop versioning ---
+	// A loop with hoisted bounds checks is emitted twice. The regular version
+	// comes first, and falls through past the version without checks.
+	void version_hoisted_loop(size_t& n, address_t& fallthrough_pc)
+	{
+		if (n == loops[next_loop].latch + 1) {
+			if (!unchecked) {
+				if (fallthrough_pc != 0) {
+					flush_counter();
+					uc.j(loop_end);
+				}
+				unchecked = true;
+				n = loops[next_loop].header;
+				uc.bind(unchecked_header);
+				pending = 0;   // only reachable through the back-edge
+				fallthrough_pc = instrs[n];
+				return;
+			}
+			if (fallthrough_pc != 0)
+				flush_counter();
+			uc.bind(loop_end);
+			unchecked = false;
+			if (++next_loop >= loops.size())
+				return;
+		}
+		if (n == loops[next_loop].header && !unchecked) {
+			unchecked_header = uc.new_label();
+			loop_end = uc.new_label();
+		}
+	}
+	/// @brief Check the ranges that the remaining iterations of a loop can
+	/// access, and enter the version of the loop without checks when they
+	/// are all inside the arena. See HoistedLoop for the iteration limit.
+	void emit_hoisted_check(const HoistedLoop<W>& loop)
+	{
+		using HL = HoistedLoop<W>;
+		Label skip = uc.new_label();
+		const unsigned shift = HL::shift_of(loop.step);
+		Gp d = new_ireg("hl_d");
+		if (loop.step > 0) uc.sub(d, get(loop.bound), get(loop.iv));
+		else               uc.sub(d, get(loop.iv), get(loop.bound));
+		Gp n = new_ireg("hl_n");
+		switch (loop.condition) {
+		case HL::NOT_EQUAL:
+			if (shift != 0) {
+				Gp rem = new_ireg("hl_rem");
+				uc.and_(rem, d, Imm((1u << shift) - 1));
+				uc.j(skip, test_nz(rem));
+				uc.shr(n, d, Imm(shift));
+			} else {
+				uc.mov(n, d);
+			}
+			break;
+		case HL::BEFORE:
+			uc.sub(n, d, Imm(1));
+			if (shift != 0) uc.shr(n, n, Imm(shift));
+			uc.add(n, n, Imm(1));
+			break;
+		case HL::UP_TO:
+			if (shift != 0) uc.shr(n, d, Imm(shift));
+			else            uc.mov(n, d);
+			uc.add(n, n, Imm(1));
+			break;
+		}
+		// Bounding the iterations keeps the ranges from overflowing
+		Gp limit = new_ireg("hl_limit");
+		uc.load(limit, mem_ptr(cpu, info.arena_rdbound));
+		if (loop.max_shift != 0) uc.shr(limit, limit, Imm(loop.max_shift));
+		uc.j(skip, ucmp_gt(n, limit));
+		for (const auto& range : loop.ranges) {
+			Gp first = new_ireg("hl_first");
+			Gp last  = new_ireg("hl_last");
+			alu_ri(OP_ADD, first, get(range.reg), int32_t(range.lo));
+			alu_ri(OP_ADD, last, get(range.reg), int32_t(range.hi - 1));
+			if (range.step != 0) {
+				Gp extent = new_ireg("hl_extent");
+				uc.shl(extent, n, Imm(HL::shift_of(range.step)));
+				if (range.step > 0) uc.add(last, last, extent);
+				else                uc.sub(first, first, extent);
+			}
+			uc.j(skip, ucmp_gt(first, last));
+			emit_arena_check(first, range.write, skip);
+			emit_arena_check(last, range.write, skip);
+		}
+		uc.j(unchecked_header);
+		uc.bind(skip);
+	}
+	// An in-region branch. The back-edge of a versioned loop stays within
+	// its version, and the regular version may switch to the other one.
+	void emit_region_branch(address_t target)
+	{
+		if (next_loop < loops.size() && current == loops[next_loop].latch) {
+			if (unchecked) {
+				uc.j(unchecked_header);
+				return;
+			}
+			emit_hoisted_check(loops[next_loop]);
+		}
+		uc.j(label_at(target));
+	}
+
 	// --- ALU helpers ---
 	// UniCompiler resolves dst/src aliasing, so RISC-V three-operand forms map directly.
 	enum Op { OP_ADD, OP_SUB, OP_AND, OP_OR, OP_XOR };
@@ -920,6 +1043,10 @@ struct AjEmitter
 			uc.sub(t, a, rvimm(address_t(Memory<W>::RWREAD_BEGIN)));
 		uc.j(slow, ucmp_ge(t, mem_ptr(cpu, is_write ? info.arena_wrbound : info.arena_rdbound)));
 	}
+	// Accesses through a base register that the loop's back-edge has checked
+	bool checked_access(unsigned rs1) const noexcept {
+		return arena_is_checked() && !(unchecked && loops[next_loop].covers(rs1));
+	}
 	void emit_load(address_t pc, unsigned funct3, unsigned rd, unsigned rs1, int32_t simm)
 	{
 		auto addr = address_of(rs1, simm);
@@ -928,8 +1055,10 @@ struct AjEmitter
 			call_load_helper(pc, funct3, dst, addr, pending - 1);
 			return;
 		}
+		const bool checked = checked_access(rs1);
 		Label slow = uc.new_label(), done = uc.new_label();
-		emit_arena_check(addr, false, slow);
+		if (checked)
+			emit_arena_check(addr, false, slow);
 		const Mem m = mem_ptr(arena, arena_index(addr));
 		switch (funct3) {
 		case 0x0: uc.load_i8 (dst, m); break;                        // LB
@@ -941,7 +1070,7 @@ struct AjEmitter
 		case 0x6: if constexpr (RV64) uc.load_u32(dst, m); break;    // LWU
 		}
 		uc.bind(done);
-		if (arena_is_checked()) {
+		if (checked) {
 			deferred.push_back([=, this, pend = pending - 1] {
 				uc.bind(slow);
 				call_load_helper(pc, funct3, dst, addr, pend);
@@ -957,8 +1086,10 @@ struct AjEmitter
 			call_store_helper(pc, funct3, src, addr, pending - 1);
 			return;
 		}
+		const bool checked = checked_access(rs1);
 		Label slow = uc.new_label(), done = uc.new_label();
-		emit_arena_check(addr, true, slow);
+		if (checked)
+			emit_arena_check(addr, true, slow);
 		const Mem m = mem_ptr(arena, arena_index(addr));
 		switch (funct3) {
 		case 0x0: uc.store_u8 (m, src); break;                        // SB
@@ -967,7 +1098,7 @@ struct AjEmitter
 		case 0x3: if constexpr (RV64) uc.store_u64(m, src); break;    // SD
 		}
 		uc.bind(done);
-		if (arena_is_checked()) {
+		if (checked) {
 			deferred.push_back([=, this, pend = pending - 1] {
 				uc.bind(slow);
 				call_store_helper(pc, funct3, src, addr, pend);
@@ -1240,13 +1371,15 @@ struct AjEmitter
 			fp_result(dst, is_double);
 			return;
 		}
+		const bool checked = checked_access(rs1);
 		Label slow = uc.new_label(), done = uc.new_label();
-		emit_arena_check(addr, false, slow);
+		if (checked)
+			emit_arena_check(addr, false, slow);
 		const Mem m = mem_ptr(arena, arena_index(addr));
 		if (is_double) uc.v_loadu64_u64(dst, m);   // FLD
 		else           uc.v_loadu32_u32(dst, m);   // FLW
 		uc.bind(done);
-		if (arena_is_checked()) {
+		if (checked) {
 			deferred.push_back([=, this, pend = pending - 1] {
 				uc.bind(slow);
 				call_fp_load_helper(pc, is_double, dst, addr, pend);
@@ -1265,13 +1398,15 @@ struct AjEmitter
 			call_fp_store_helper(pc, is_double, src, addr, pending - 1);
 			return;
 		}
+		const bool checked = checked_access(rs1);
 		Label slow = uc.new_label(), done = uc.new_label();
-		emit_arena_check(addr, true, slow);
+		if (checked)
+			emit_arena_check(addr, true, slow);
 		const Mem m = mem_ptr(arena, arena_index(addr));
 		if (is_double) uc.v_storeu64_u64(m, src);  // FSD
 		else           uc.v_storeu32_u32(m, src);  // FSW
 		uc.bind(done);
-		if (arena_is_checked()) {
+		if (checked) {
 			deferred.push_back([=, this, pend = pending - 1] {
 				uc.bind(slow);
 				call_fp_store_helper(pc, is_double, src, addr, pend);
@@ -1558,12 +1693,14 @@ struct AjEmitter
 			return;
 		readset.set(vmi.rs1);
 		needs_arena = true;
+		writes_vectors |= !vmi.is_store;
 	}
 
-	// Single walk: collects read-set, write-set, and branch targets. Read-set must mirror get() usage.
+	// Single walk: collects read-set, write-set, branch and return targets. Read-set must mirror get() usage.
 	void prepass() {
 		for (const address_t pc : instrs) {
-			const auto i = aj_decode<W>(seg, pc, seg_end).instr;
+			const auto d = aj_decode<W>(seg, pc, seg_end);
+			const auto i = d.instr;
 			switch (i.opcode()) {
 			case RV32I_LUI:
 			case RV32I_AUIPC:
@@ -1595,10 +1732,12 @@ struct AjEmitter
 				readset.set(i.Stype.rs2);      // ...but the stored value does not
 				needs_arena |= info.inline_memory;
 				break;
-			case RV32I_JALR:
+			case RV32I_JALR: {
 				readset.set(i.Itype.rs1);
 				writeset.set(i.Itype.rd);
-				break;
+				const address_t ra = pc + d.length;
+				if (i.Itype.rd != 0 && in_region(ra)) return_targets.push_back(ra);
+				} break;
 			case RV32I_BRANCH: {
 				readset.set(i.Btype.rs1);
 				// A comparison against x0 becomes a compare against an immediate
@@ -1611,6 +1750,8 @@ struct AjEmitter
 				writeset.set(i.Jtype.rd);
 				const address_t t = pc + i.Jtype.jump_offset();
 				if (in_region(t)) branch_targets.insert(t);
+				const address_t ra = pc + d.length;
+				if (i.Jtype.rd != 0 && in_region(ra)) return_targets.push_back(ra);
 				} break;
 
 			case RV32I_SYSTEM:
@@ -1687,6 +1828,13 @@ struct AjEmitter
 				break;
 			}
 		}
+		// The checks at the back-edges of versioned loops read these
+		for (const auto& loop : loops) {
+			readset.set(loop.iv);
+			readset.set(loop.bound);
+			for (const auto& range : loop.ranges)
+				readset.set(range.reg);
+		}
 		// Conservative: an unused preload costs one prologue instruction.
 		readset |= writeset;      // written registers must be loaded too, see flush_regs
 		needs_zero = readset[0];
@@ -1701,6 +1849,12 @@ struct AjEmitter
 		else if (!entry_is_first())
 			branch_targets.insert(entry);
 
+		// Returns are predicted by jumping straight to the return address
+		std::sort(return_targets.begin(), return_targets.end());
+		return_targets.erase(std::unique(return_targets.begin(), return_targets.end()),
+			return_targets.end());
+		branch_targets.insert(return_targets.begin(), return_targets.end());
+
 		for (const address_t t : branch_targets)
 			labels.emplace(t, uc.new_label());
 	}
@@ -1729,6 +1883,32 @@ struct AjEmitter
 		emit_entry_search(pcv, mid, hi);
 	}
 
+	// Per-site inline cache for JALR: a target that is one of the region's
+	// return addresses continues in native code, anything else falls through
+	// to the region exit. Binary search, like the entry dispatch.
+	void emit_return_prediction(const Gp& target)
+	{
+		Label miss = uc.new_label();
+		// A predicted return can close a loop, so it is bounded like a back-edge
+		uc.j(miss, ucmp_ge(counter, mem_ptr(st, off_max())));
+		emit_return_search(target, 0, return_targets.size(), miss);
+		uc.bind(miss);
+	}
+	void emit_return_search(const Gp& target, size_t lo, size_t hi, const Label& miss)
+	{
+		if (hi - lo == 1) {
+			uc.j(label_at(return_targets[lo]), cmp_eq(target, rvimm(return_targets[lo])));
+			uc.j(miss);
+			return;
+		}
+		const size_t mid = lo + (hi - lo) / 2;
+		Label upper = uc.new_label();
+		uc.j(upper, ucmp_ge(target, rvimm(return_targets[mid])));
+		emit_return_search(target, lo, mid, miss);
+		uc.bind(upper);
+		emit_return_search(target, mid, hi, miss);
+	}
+
 	void emit_body()
 	{
 		// Labels bound only at branch targets. `fallthrough_pc` tracks linear control flow;
@@ -1739,9 +1919,14 @@ struct AjEmitter
 			uc.j(label_at(entry));
 		address_t fallthrough_pc =
 			(!needs_entry_dispatch() && entry_is_first()) ? instrs.front() : 0;
-		for (const address_t pc : instrs)
+		for (size_t n = 0; n < instrs.size(); n++)
 		{
-			const bool is_target = branch_targets.count(pc) != 0;
+			if (next_loop < loops.size())
+				version_hoisted_loop(n, fallthrough_pc);
+			current = n;
+			const address_t pc = instrs[n];
+			// The version of a loop without checks is only entered at its header
+			const bool is_target = branch_targets.count(pc) != 0 && !unchecked;
 			if (is_target) {   // merge point: settle the counter first
 				if (pc == fallthrough_pc) flush_counter();
 				else pending = 0;   // only reachable through the label
@@ -1970,7 +2155,7 @@ struct AjEmitter
 				}
 				if (in_region(target)) {
 					if (target <= pc) emit_backedge_check(target); // bound the loop
-					uc.j(label_at(target));   // vregs stay live across the back-edge
+					emit_region_branch(target);   // vregs stay live across the back-edge
 				} else {
 					emit_exit(target, 0);
 				}
@@ -2004,6 +2189,8 @@ struct AjEmitter
 				if (i.Itype.rd != 0)
 					uc.mov(def(i.Itype.rd), rvimm(next));
 				flush_counter();
+				if (!return_targets.empty())
+					emit_return_prediction(target);
 				emit_exit_reg(target, 0);
 				fallthrough_pc = 0;
 				} break;
@@ -2033,7 +2220,8 @@ template <int W>
 aj_block_func<W> aj_emit_region(AjCode& ajcode, const MachineOptions<W>& options,
 	const DecodedExecuteSegment<W>& exec, const AjInfo<W>& info,
 	const std::vector<address_type<W>>& entries,
-	const std::vector<address_type<W>>& instrs)
+	const std::vector<address_type<W>>& instrs,
+	const std::vector<HoistedLoop<W>>& loops)
 {
 	if (instrs.empty() || entries.empty())
 		return nullptr;
@@ -2053,7 +2241,7 @@ aj_block_func<W> aj_emit_region(AjCode& ajcode, const MachineOptions<W>& options
 	if (fn == nullptr)
 		return nullptr;
 
-	AjEmitter<W> e { cc, exec.exec_data(), entries, instrs, exec.exec_end(), info };
+	AjEmitter<W> e { cc, exec.exec_data(), entries, instrs, exec.exec_end(), info, loops };
 	e.cpu     = cc.new_gp_ptr("cpu");
 	e.st      = cc.new_gp_ptr("state");
 	e.counter = cc.new_gp64("counter");
@@ -2093,7 +2281,8 @@ bool aj_host_has_fma() noexcept
 template <int W>
 aj_block_func<W> aj_emit_region(AjCode&, const MachineOptions<W>&,
 	const DecodedExecuteSegment<W>&, const AjInfo<W>&,
-	const std::vector<address_type<W>>&, const std::vector<address_type<W>>&)
+	const std::vector<address_type<W>>&, const std::vector<address_type<W>>&,
+	const std::vector<HoistedLoop<W>>&)
 {
 	return nullptr;   // no code generator for this host
 }
@@ -2103,11 +2292,13 @@ aj_block_func<W> aj_emit_region(AjCode&, const MachineOptions<W>&,
 #ifdef RISCV_32I
 	template aj_block_func<4> aj_emit_region<4>(AjCode&, const MachineOptions<4>&,
 		const DecodedExecuteSegment<4>&, const AjInfo<4>&,
-		const std::vector<address_type<4>>&, const std::vector<address_type<4>>&);
+		const std::vector<address_type<4>>&, const std::vector<address_type<4>>&,
+		const std::vector<HoistedLoop<4>>&);
 #endif
 #ifdef RISCV_64I
 	template aj_block_func<8> aj_emit_region<8>(AjCode&, const MachineOptions<8>&,
 		const DecodedExecuteSegment<8>&, const AjInfo<8>&,
-		const std::vector<address_type<8>>&, const std::vector<address_type<8>>&);
+		const std::vector<address_type<8>>&, const std::vector<address_type<8>>&,
+		const std::vector<HoistedLoop<8>>&);
 #endif
 } // riscv
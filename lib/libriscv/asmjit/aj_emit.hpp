@@ -1,6 +1,7 @@
 #pragma once
 #include "../common.hpp"
 #include "../instruction_list.hpp"
+#include "../loop_analysis.hpp"
 #include "../rv32i_instr.hpp"
 #include "../rvfd.hpp"
 #include "../rvv.hpp"
@@ -24,6 +25,8 @@ namespace riscv
 	{
 		int32_t reg_offset      = 0;   ///< &cpu.registers().get(0) - &cpu
 		int32_t fpreg_offset    = 0;   ///< &cpu.registers().getfl(0) - &cpu
+		int32_t fp_state        = 0;   ///< &cpu.registers().fp_state_ref() - &cpu
+		int32_t vector_state    = 0;   ///< &cpu.registers().vector_state_ref() - &cpu
 		int32_t arena_ptr       = 0;   ///< &memory.m_arena.data    - &cpu
 		int32_t arena_rdbound   = 0;   ///< &memory.m_arena.read_boundary  - &cpu
 		int32_t arena_wrbound   = 0;   ///< &memory.m_arena.write_boundary - &cpu
@@ -658,11 +661,14 @@ namespace riscv
 	/// ascending and non-empty. More than one means the prologue dispatches on the
 	/// entry PC that the interpreter left in AjState::pc.
 	/// @param instrs The region's reachable instruction addresses, ascending.
+	/// @param loops Loops in the region whose bounds checks are hoisted to
+	/// their back-edge, ascending. Indices refer to `instrs`.
 	/// @return nullptr if the region could not be emitted for any reason.
 	/// @details Defined in aj_emit.cpp.
 	template <int W>
 	aj_block_func<W> aj_emit_region(AjCode&, const MachineOptions<W>&,
 		const DecodedExecuteSegment<W>&, const AjInfo<W>&,
 		const std::vector<address_type<W>>& entries,
-		const std::vector<address_type<W>>& instrs);
+		const std::vector<address_type<W>>& instrs,
+		const std::vector<HoistedLoop<W>>& loops);
 }
@@ -7,6 +7,7 @@
 #include "aj_emit.hpp"
 #include "aj_runtime.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <cstdio>
 #include <set>
@@ -93,11 +94,12 @@ namespace riscv
 	// Discover addresses reachable from `entry` by fall-through and direct
 	// branches. Stops at indirect jumps, unemittable instructions, and addresses
 	// already `claimed` by earlier regions (prevents O(N²) re-emission of
-	// shared tails).
+	// shared tails). With `follow_calls`, direct calls are followed into the
+	// callee, and the return address is added as well.
 	template <int W>
 	static std::vector<address_type<W>> aj_discover_region(const uint8_t* seg,
 		const AjSegmentMap<W>& map, address_type<W> entry, size_t max_instructions,
-		const std::set<address_type<W>>& claimed)
+		const std::set<address_type<W>>& claimed, bool follow_calls)
 	{
 		using address_t = address_type<W>;
 		std::set<address_t> seen;
@@ -121,15 +123,24 @@ namespace riscv
 			switch (d.instr.opcode()) {
 			case RV32I_JAL:
 				// A linking JAL is a call; following it would inline the callee
-				// and fragment it across callers via `claimed`. End the region at
-				// calls, keeping each to one function's CFG. Tail calls (rd==0)
-				// are still followed.
-				if (d.instr.Jtype.rd != 0)
-					break;
+				// and fragment it across callers via `claimed`. By default the
+				// region ends at calls, keeping each to one function's CFG. Tail
+				// calls (rd==0) are always followed.
+				if (d.instr.Jtype.rd != 0) {
+					if (!follow_calls)
+						break;
+					// The callee returns through a JALR, which predicts the
+					// return addresses emitted in its region.
+					work.push_back(pc + d.length);
+				}
 				work.push_back(pc + d.instr.Jtype.jump_offset());
 				break;
 			case RV32I_JALR:
-				break;   // indirect: always a region exit
+				// Indirect: always a region exit, but an indirect call returns
+				// to the next instruction.
+				if (follow_calls && d.instr.Itype.rd != 0)
+					work.push_back(pc + d.length);
+				break;
 			case RV32I_BRANCH:
 				work.push_back(pc + d.instr.Btype.signed_imm());
 				[[fallthrough]];
@@ -141,6 +152,55 @@ namespace riscv
 		return { seen.begin(), seen.end() };
 	}
 
+	// Loops whose bounds checks can be hoisted to the back-edge: straight runs
+	// of region instructions that end in a branch back to the first of them.
+	// Nothing is hoisted when accesses are not inlined, or need no check.
+	template <int W>
+	static std::vector<HoistedLoop<W>> aj_find_hoisted_loops(const uint8_t* seg,
+		const AjSegmentMap<W>& map, const std::vector<address_type<W>>& instrs,
+		const AjInfo<W>& info)
+	{
+		using address_t = address_type<W>;
+		std::vector<HoistedLoop<W>> loops;
+		if (!info.inline_memory || info.arena_mask != 0)
+			return loops;
+
+		// Leave room for what follows the loop, where both versions meet
+		for (size_t latch = 1; latch + 1 < instrs.size(); latch++)
+		{
+			const auto d = aj_decode<W>(seg, instrs[latch], map.end);
+			if (d.instr.opcode() != RV32I_BRANCH || d.instr.Btype.signed_imm() >= 0)
+				continue;
+			const address_t target = instrs[latch] + d.instr.Btype.signed_imm();
+			const auto it = std::lower_bound(instrs.begin(), instrs.begin() + latch, target);
+			if (it == instrs.begin() + latch || *it != target)
+				continue;
+			const size_t header = size_t(it - instrs.begin());
+			if (!loops.empty() && header <= loops.back().latch)
+				continue;
+
+			std::vector<address_t> pcs;
+			std::vector<rv32i_instruction> body;
+			bool contiguous = true;
+			for (size_t i = header; i <= latch; i++) {
+				const auto di = aj_decode<W>(seg, instrs[i], map.end);
+				if (i < latch && instrs[i] + di.length != instrs[i + 1])
+					contiguous = false;
+				pcs.push_back(instrs[i]);
+				body.push_back(di.instr);
+			}
+			if (!contiguous)
+				continue;
+			auto loop = HoistedLoop<W>::analyze(pcs, body);
+			if (!loop)
+				continue;
+			loop->header = header;
+			loop->latch = latch;
+			loops.push_back(std::move(*loop));
+		}
+		return loops;
+	}
+
 	template <int W>
 	static AjInfo<W> aj_machine_info(const CPU<W>& cpu)
 	{
@@ -152,6 +212,8 @@ namespace riscv
 		AjInfo<W> info;
 		info.reg_offset    = int32_t(uintptr_t(&cpu.registers().get(0)) - cpu_addr);
 		info.fpreg_offset  = int32_t(uintptr_t(&cpu.registers().getfl(0)) - cpu_addr);
+		info.fp_state      = int32_t(uintptr_t(&cpu.registers().fp_state_ref()) - cpu_addr);
+		info.vector_state  = int32_t(uintptr_t(&cpu.registers().vector_state_ref()) - cpu_addr);
 		info.arena_ptr     = int32_t(uintptr_t(&mem.memory_arena_ptr_ref()) - cpu_addr);
 		info.arena_rdbound = int32_t(uintptr_t(&mem.memory_arena_read_boundary_ref()) - cpu_addr);
 		info.arena_wrbound = int32_t(uintptr_t(&mem.memory_arena_write_boundary_ref()) - cpu_addr);
@@ -170,6 +232,10 @@ namespace riscv
 			info.inline_memory = mem.uses_Nbit_encompassing_arena();
 			info.arena_mask = info.inline_memory
 				? riscv::encompassing_arena_mask : 0;
+		} else if (mem.uses_guarded_arena()) {
+			// Guarded arena: mask only, the guard pages catch the rest.
+			info.inline_memory = true;
+			info.arena_mask = riscv::guarded_arena_mask;
 		} else {
 			// Flat arena: single-sided bounds check per access; disabled with
 			// unaligned slow paths.
@@ -236,7 +302,8 @@ namespace riscv
 			if (claimed_addrs.count(entry))
 				continue;   // an earlier region emitted it; it becomes an entry of that one
 			auto instrs = aj_discover_region<W>(seg, map, entry,
-				options.asmjit_region_instr_max, claimed_addrs);
+				options.asmjit_region_instr_max, claimed_addrs,
+				options.asmjit_follow_calls);
 			if (instrs.empty())
 				continue;   // nothing emittable at this address
 			emitted_instrs += instrs.size();
@@ -264,8 +331,9 @@ namespace riscv
 
 		unsigned live = 0;
 		for (size_t i = 0; i < regions.size(); i++) {
+			const auto loops = aj_find_hoisted_loops<W>(seg, map, regions[i].instrs, info);
 			mappings[i] = aj_emit_region<W>(*ajcode, options, exec, info,
-				regions[i].entries, regions[i].instrs);
+				regions[i].entries, regions[i].instrs, loops);
 			if (mappings[i]) live++;
 		}
 		if (live == 0) {
@@ -925,6 +925,117 @@ INSTRUCTION(RV32C_BC_FUNCTION, rv32c_func) {
 }
 #endif
 
+/**
+ * Fused instruction pairs, see DecodedExecuteSegment::threaded_fuse().
+ * The second instruction is executed from its own decoder entry, which
+ * also keeps the PC exact should the second instruction fault.
+*/
+INSTRUCTION(RV32I_BC_LUI_ADDI, rv32i_lui_addi) {
+	{
+		VIEW_INSTR_AS(fi, FasterJtype);
+		REG(fi.rd) = fi.upper_imm();
+	}
+	SKIP_INSTR();
+	VIEW_INSTR_AS(fi, FasterItype);
+	REG(fi.get_rs1()) =
+		REG(fi.get_rs2()) + fi.signed_imm();
+	NEXT_INSTR();
+}
+INSTRUCTION(RV32I_BC_AUIPC_ADDI, rv32i_auipc_addi) {
+	{
+		VIEW_INSTR_AS(fi, FasterJtype);
+		REG(fi.rd) = (pc - DECODER().block_bytes()) + fi.upper_imm();
+	}
+	SKIP_INSTR();
+	VIEW_INSTR_AS(fi, FasterItype);
+	REG(fi.get_rs1()) =
+		REG(fi.get_rs2()) + fi.signed_imm();
+	NEXT_INSTR();
+}
+#ifdef RISCV_64I
+INSTRUCTION(RV64I_BC_LDD_LDD, rv64i_ldd_ldd) {
+	if constexpr (W >= 8) {
+		{
+			VIEW_INSTR_AS(fi, FasterItype);
+			const auto addr = REG(fi.get_rs2()) + fi.signed_imm();
+			REG(fi.get_rs1()) =
+				(int64_t)CPU().memory().template read<uint64_t>(addr);
+		}
+		SKIP_INSTR();
+		VIEW_INSTR_AS(fi, FasterItype);
+		const auto addr = REG(fi.get_rs2()) + fi.signed_imm();
+		REG(fi.get_rs1()) =
+			(int64_t)CPU().memory().template read<uint64_t>(addr);
+		NEXT_INSTR();
+	}
+	else UNUSED_FUNCTION();
+}
+INSTRUCTION(RV64I_BC_STD_STD, rv64i_std_std) {
+	if constexpr (W >= 8) {
+		{
+			VIEW_INSTR_AS(fi, FasterItype);
+			const auto addr = REG(fi.get_rs1()) + fi.signed_imm();
+			CPU().memory().template write<uint64_t>(addr, REG(fi.get_rs2()));
+		}
+		SKIP_INSTR();
+		VIEW_INSTR_AS(fi, FasterItype);
+		const auto addr = REG(fi.get_rs1()) + fi.signed_imm();
+		CPU().memory().template write<uint64_t>(addr, REG(fi.get_rs2()));
+		NEXT_INSTR();
+	}
+	else UNUSED_FUNCTION();
+}
+INSTRUCTION(RV64I_BC_AUIPC_LDD, rv64i_auipc_ldd) {
+	if constexpr (W >= 8) {
+		{
+			VIEW_INSTR_AS(fi, FasterJtype);
+			REG(fi.rd) = (pc - DECODER().block_bytes()) + fi.upper_imm();
+		}
+		SKIP_INSTR();
+		VIEW_INSTR_AS(fi, FasterItype);
+		const auto addr = REG(fi.get_rs2()) + fi.signed_imm();
+		REG(fi.get_rs1()) =
+			(int64_t)CPU().memory().template read<uint64_t>(addr);
+		NEXT_INSTR();
+	}
+	else UNUSED_FUNCTION();
+}
+#endif // RISCV_64I
+#ifdef RISCV_EXT_COMPRESSED
+INSTRUCTION(RV32C_BC_LDD_LDD, rv32c_ldd_ldd) {
+	if constexpr (W >= 8) {
+		{
+			VIEW_INSTR_AS(fi, FasterItype);
+			const auto addr = REG(fi.get_rs2()) + fi.signed_imm();
+			REG(fi.get_rs1()) =
+				(int64_t)CPU().memory().template read<uint64_t>(addr);
+		}
+		SKIP_C_INSTR();
+		VIEW_INSTR_AS(fi, FasterItype);
+		const auto addr = REG(fi.get_rs2()) + fi.signed_imm();
+		REG(fi.get_rs1()) =
+			(int64_t)CPU().memory().template read<uint64_t>(addr);
+		NEXT_C_INSTR();
+	}
+	else UNUSED_FUNCTION();
+}
+INSTRUCTION(RV32C_BC_STD_STD, rv32c_std_std) {
+	if constexpr (W >= 8) {
+		{
+			VIEW_INSTR_AS(fi, FasterItype);
+			const auto addr = REG(fi.get_rs1()) + fi.signed_imm();
+			CPU().memory().template write<uint64_t>(addr, REG(fi.get_rs2()));
+		}
+		SKIP_C_INSTR();
+		VIEW_INSTR_AS(fi, FasterItype);
+		const auto addr = REG(fi.get_rs1()) + fi.signed_imm();
+		CPU().memory().template write<uint64_t>(addr, REG(fi.get_rs2()));
+		NEXT_C_INSTR();
+	}
+	else UNUSED_FUNCTION();
+}
+#endif // RISCV_EXT_COMPRESSED
+
 #ifdef RISCV_EXT_VECTOR
 // All vector instructions execute through RV32I_BC_FUNCTION.
 #endif // RISCV_EXT_VECTOR
@@ -934,6 +1045,7 @@ INSTRUCTION(RV32I_BC_LIVEPATCH, execute_livepatch) {
 	case 0: { // Live-patch native code (binary translation or asmjit)
 #if defined(RISCV_BINARY_TRANSLATION) || defined(RISCV_ASMJIT)
 		// Special bytecode that does not read any decoder data
+		RISCV_STAT_INC(MACHINE(), livepatch_switches);
 		// 1. Wind back PC to the current decoder position
 		pc = pc - DECODER().block_bytes();
 #  ifdef DISPATCH_MODE_TAILCALL
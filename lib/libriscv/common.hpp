@@ -44,6 +44,16 @@
 #define RISCV_MAX_EXECUTE_SEGS  16
 #endif
 
+#ifndef RISCV_MAX_THREADS
+#define RISCV_MAX_THREADS  4096
+#endif
+
+#ifndef RISCV_INTERRUPT_SLICE
+// Generated code that counts instructions runs at most this many
+// instructions between checks for Machine::request_interrupt()
+#define RISCV_INTERRUPT_SLICE  (1ull << 18)
+#endif
+
 namespace riscv
 {
 	template <int W> struct Memory;
@@ -138,6 +148,12 @@ namespace riscv
 		/// translated code between machines. (Prevents some optimizations)
 		bool use_shared_execute_segments = true;
 
+		/// @brief The maximum number of execute segments besides the main one,
+		/// eg. dynamically loaded shared objects and JIT-produced code.
+		/// @details Jumps between segments are resolved with a binary search
+		/// over the segments, so large limits stay cheap.
+		unsigned max_execute_segments = RISCV_MAX_EXECUTE_SEGS;
+
 		/// @brief Share read-only memory between machines.
 		/// @details Machines loaded from the same binary map one sealed image of
 		/// the programs text and rodata over the low part of their arena, instead
@@ -154,6 +170,13 @@ namespace riscv
 		/// @brief Provide a custom page-fault handler at construction.
 		riscv::Function<struct Page&(Memory<W>&, address_type<W>, bool)> page_fault_handler = nullptr;
 
+		/// @brief Allocate this many pages together when the default page fault
+		/// handler creates a page outside of the memory arena. The missing pages
+		/// that follow the faulting page are pre-faulted from the same allocation,
+		/// which makes heap growth and large memsets much cheaper, at the cost of
+		/// pages that may never be used. 0 or 1 allocates one page per fault.
+		unsigned page_fault_batch = 0;
+
 		/// @brief Call ebreak for each of the addresses in the vector.
 		/// @details This is useful for debugging and live-patching programs.
 		std::vector<std::variant<address_type<W>, std::string>> ebreak_locations {};
@@ -164,6 +187,16 @@ namespace riscv
 		/// only the decoder cache is modified, preserving the original machine code.
 		bool libc_fastpath = false;
 
+		/// @brief Enable the trace tier of the threaded dispatch: hot loops are
+		/// recorded once, and then run as micro-ops over cached registers.
+		/// @details Only loops made of integer arithmetic, loads, stores and
+		/// branches are traced. Anything else stays in the decoder cache, which
+		/// is also where a trace exits to when the loop takes another path.
+		/// Has no effect with switch-based dispatch.
+		bool trace_enabled = false;
+		/// @brief The number of times a loop must be entered before it is traced.
+		unsigned trace_threshold = 1000;
+
 #ifdef RISCV_BINARY_TRANSLATION
 		/// @brief Enable the binary translator.
 		bool translate_enabled = true;
@@ -226,6 +259,13 @@ namespace riscv
 		/// @details This will remove checks that prevent the program from crashing, such
 		/// as memory access checks, and other checks that sandboxes normally provide.
 		bool translate_unsafe_remove_checks = false;
+		/// @brief Run the optimization passes of the binary translator.
+		/// @details Each block is first lowered to a simple IR, where constants
+		/// are propagated, dead register writes removed, repeated loads served
+		/// from registers and comparisons fused into the branches that test them.
+		/// The generated C is then smaller and faster, which matters the most
+		/// with libtcc, as it does not optimize on its own.
+		bool translate_ir_passes = true;
 		/// @brief Enable recording of slowpaths to jump hints for the binary translator.
 		/// @note This option is only available when RISCV_DEBUG and the binary translator is enabled.
 		/// @details This will record slowpaths to the MachineOptions jump hints vector.
@@ -311,6 +351,14 @@ namespace riscv
 		/// a region cut short in the middle of a loop exits to the interpreter on
 		/// every iteration, which costs far more than the emission it saves.
 		unsigned asmjit_region_instr_max = 1024;
+		/// @brief Follow calls into their callees when growing a region.
+		/// @details A callee that is reached this way is emitted into the
+		/// caller's region along with the return address, and every JALR in
+		/// the region checks its target against the region's return addresses
+		/// before leaving it. Small functions called from a loop then stay in
+		/// native code. A callee claimed by an earlier region is still left
+		/// through the dispatcher, which chains into the owning region.
+		bool asmjit_follow_calls = false;
 		/// @brief Enable background translation, using a user-provided callback to
 		/// run the translation step on another thread.
 		/// @details Short-lived programs should leave this disabled, as the
@@ -410,6 +458,15 @@ namespace riscv
 	static constexpr int encompassing_Nbit_arena = 0;
 	static constexpr uint64_t encompassing_arena_mask = 0;
 #endif
+#ifdef RISCV_GUARDED_ARENA_BITS
+	static constexpr int guarded_arena_bits = RISCV_GUARDED_ARENA_BITS;
+	static constexpr uint64_t guarded_arena_mask = (1ull << RISCV_GUARDED_ARENA_BITS) - 1;
+	static_assert(guarded_arena_bits > 32 && guarded_arena_bits <= 46,
+		"The guarded arena window must be larger than 4GB and fit in the host address space");
+#else
+	static constexpr int guarded_arena_bits = 0;
+	static constexpr uint64_t guarded_arena_mask = 0;
+#endif
 #ifdef RISCV_LIBTCC
 	static constexpr bool libtcc_enabled = true;
 #else
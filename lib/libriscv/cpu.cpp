@@ -41,7 +41,8 @@ namespace riscv
 
 	template <int W>
 	CPU<W>::CPU(Machine<W>& machine, const Machine<W>& other, const MachineOptions<W>& options)
-		: m_machine { machine }, m_exec(other.cpu.m_exec)
+		: m_machine { machine }, m_exec(other.cpu.m_exec),
+		  m_prev_exec(empty_execute_segment().get())
 	{
 		// Copy all registers, with vector state conditional on options.preserve_vector_registers
 		this->registers().copy_from(
@@ -94,8 +95,11 @@ namespace riscv
 	} // CPU::init_execute_area
 
 	template<int W> RISCV_NOINLINE
-	typename CPU<W>::NextExecuteReturn CPU<W>::next_execute_segment(address_t pc)
+	typename CPU<W>::NextExecuteReturn CPU<W>::lookup_execute_segment(address_t pc)
 	{
+		RISCV_STAT_INC(machine(), segment_lookups);
+		if (!this->m_exec->empty())
+			this->m_prev_exec = this->m_exec;
 		// Find previously decoded execute segment
 		this->m_exec = machine().memory.exec_segment_for(pc).get();
 		if (LIKELY(!this->m_exec->empty() && !this->m_exec->is_stale())) {
@@ -103,6 +107,7 @@ namespace riscv
 			this->m_stale_restart_pc = ~address_t(0);
 			return {this->m_exec, pc};
 		}
+		RISCV_STAT_INC(machine(), decoder_cache_misses);
 
 		// We absolutely need to write PC here because even read-fault handlers
 		// like get_pageno() slowpaths could be reading PC.
@@ -352,7 +357,12 @@ restart_precise_sim:
 		while (true)
 		{
 			if (this->guest_rewrote_code(exec, pc)) {
-				exec.set_stale(true);
+				// Decode the rewritten page again, or rebuild the segment
+				const address_t page = pc & ~address_t(Page::size() - 1);
+				// The last page of the address space ends at the segment end
+				const address_t page_end = (page + Page::size() > page) ? page + Page::size() : exec.exec_end();
+				if (!machine().memory.refresh_execute_segment(exec, page, page_end))
+					exec.set_stale(true);
 				break;
 			}
 
@@ -432,6 +442,10 @@ restart_precise_sim:
 				"Breakpoint address is not within the execute segment", addr);
 		}
 
+		// Traces may run through the entry, and loop heads hide the original bytecode
+		if (auto* heads = exec.trace_heads())
+			heads->uninstall(exec);
+
 		auto* exec_decoder = exec.decoder_cache();
 		auto* decoder_begin = &exec_decoder[exec.exec_begin() / DecoderData<W>::DIVISOR];
 
@@ -471,6 +485,12 @@ restart_precise_sim:
 			throw MachineException(INVALID_PROGRAM,
 				"Last instruction in breakpoint block was not aligned", patched_addr);
 		}
+		// 4. A fused instruction in front of this one would still execute
+		// the original instruction here, so restore its original bytecode
+		const auto* fused_begin = std::max(&cache_entry - (compressed_enabled ? 2 : 1), decoder_begin);
+		for (auto* dd = &cache_entry - 1; dd >= fused_begin; dd--) {
+			dd->set_bytecode(unfused_bytecode(dd->get_bytecode()));
+		}
 
 		return cache_entry;
 	}
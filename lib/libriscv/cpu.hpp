@@ -2,6 +2,7 @@
 #include "common.hpp"
 #include "page.hpp"
 #include "registers.hpp"
+#include "statistics.hpp"
 #ifdef RISCV_EXT_ATOMICS
 #include "rva.hpp"
 #endif
@@ -154,6 +155,8 @@ namespace riscv
 			address_t pc;
 		};
 		NextExecuteReturn next_execute_segment(address_t pc);
+		// Forget the previously active execute segment, before it is evicted
+		void reset_previous_execute_segment() noexcept { m_prev_exec = empty_execute_segment().get(); }
 		static std::shared_ptr<DecodedExecuteSegment<W>>& empty_execute_segment() noexcept;
 		bool is_executable(address_t addr) const noexcept;
 
@@ -207,6 +210,9 @@ namespace riscv
 
 		// ELF programs linear .text segment (initialized as empty segment)
 		DecodedExecuteSegment<W>* m_exec;
+		// The execute segment that was active before the current one
+		DecodedExecuteSegment<W>* m_prev_exec;
+		NextExecuteReturn lookup_execute_segment(address_t pc);
 
 		// Guard against no-progress execute-segment rebuild loops
 		address_t m_stale_restart_pc = ~address_t(0);
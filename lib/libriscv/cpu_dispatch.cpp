@@ -34,6 +34,13 @@ namespace riscv
 #define NEXT_C_INSTR() \
 	decoder += 1;      \
 	EXECUTE_INSTR();
+#define SKIP_INSTR()                  \
+	if constexpr (compressed_enabled) \
+		decoder += 2;                 \
+	else                              \
+		decoder += 1;
+#define SKIP_C_INSTR() \
+	decoder += 1;
 
 #define NEXT_BLOCK(len, OF)                 \
 	pc += len;                              \
@@ -93,7 +100,7 @@ bool CPU<W>::simulate(address_t pc, uint64_t inscounter, uint64_t maxcounter)
 	DecoderData<W>* exec_decoder = exec->decoder_cache();
 	DecoderData<W>* decoder;
 
-	InstrCounter counter{inscounter, maxcounter};
+	InstrCounter counter{inscounter, maxcounter, machine().interrupt_flag()};
 
 	// We need an execute segment matching current PC
 	if (UNLIKELY(!(pc >= current_begin && pc < current_end)))
@@ -168,15 +175,21 @@ begin_translated_function:
 	auto max = counter.max();
 	auto cnt = counter.value();
 retry_translated_function:
+	RISCV_STAT_INC(MACHINE(), bintr_entries);
 	// Invoke translated code
+	const auto slice = interrupt_slice(cnt, max);
 	auto bintr_results = 
-		exec->unchecked_mapping_at(decoder->instr)(*this, cnt, max, pc);
+		exec->unchecked_mapping_at(decoder->instr)(*this, cnt, slice, pc);
 	pc = REGISTERS().pc;
 	cnt = bintr_results.counter;
-	max = bintr_results.max_counter;
+	// A changed limit (eg. from stop()) replaces the real one
+	if (bintr_results.max_counter != slice)
+		max = bintr_results.max_counter;
 
-	if (LIKELY(cnt < max && (pc - current_begin < current_end - current_begin))) {
+	if (LIKELY(cnt < max && (pc - current_begin < current_end - current_begin)
+		&& !counter.interrupted())) {
 		if (UNLIKELY(exec->is_stale())) {
+			RISCV_STAT_INC(MACHINE(), bintr_exits);
 			// check_jump would send us back into the segment we just invalidated
 			counter.set_counters(cnt, max);
 			goto new_execute_segment;
@@ -185,9 +198,11 @@ retry_translated_function:
 		if (decoder->get_bytecode() == RV32I_BC_TRANSLATOR) {
 			goto retry_translated_function;
 		}
+		RISCV_STAT_INC(MACHINE(), bintr_exits);
 		counter.set_counters(cnt, max);
 		goto continue_segment;
 	}
+	RISCV_STAT_INC(MACHINE(), bintr_exits);
 	counter.set_counters(cnt, max);
 	goto check_jump;
 }
@@ -199,27 +214,66 @@ INSTRUCTION(RV32I_BC_ASMJIT, asmjit_function) {
 	counter.increment_counter(-int64_t(decoder->instruction_count()));
 begin_asmjit_function:
 	AjState<W> state { counter.value(), counter.max(), pc };
+	uint64_t asmjit_max = counter.max();
 retry_asmjit_function:
+	RISCV_STAT_INC(MACHINE(), asmjit_entries);
 	// Invoke asmjit-generated code. Re-entering here without rebuilding state is
-	// correct: the callee already wrote counter, max_counter and pc into it.
+	// correct: the callee already wrote counter and pc into it.
+	const uint64_t asmjit_slice = interrupt_slice(state.counter, asmjit_max);
+	state.max_counter = asmjit_slice;
 	exec->unchecked_asmjit_mapping_at(decoder->instr)(*this, &state);
+	// A changed limit (eg. from stop()) replaces the real one
+	if (state.max_counter == asmjit_slice)
+		state.max_counter = asmjit_max;
+	asmjit_max = state.max_counter;
 	if (UNLIKELY(CPU().has_current_exception()))
 		goto handle_rethrow_exception;
 	pc = state.pc;
 	if (LIKELY(state.counter < state.max_counter
-		&& (pc - current_begin < current_end - current_begin)))
+		&& (pc - current_begin < current_end - current_begin)
+		&& !counter.interrupted()))
 	{
 		decoder = &exec_decoder[pc >> DecoderData<W>::SHIFT];
 		if (decoder->get_bytecode() == RV32I_BC_ASMJIT)
 			goto retry_asmjit_function;
+		RISCV_STAT_INC(MACHINE(), asmjit_exits);
 		counter.set_counters(state.counter, state.max_counter);
 		goto continue_segment;
 	}
+	RISCV_STAT_INC(MACHINE(), asmjit_exits);
 	counter.set_counters(state.counter, state.max_counter);
 	goto check_jump;
 }
 #endif // RISCV_ASMJIT
 
+#ifdef DISPATCH_MODE_THREADED
+INSTRUCTION(RV32I_BC_TRACE, trace_function) {
+	if (DECODER().m_handler != 0) {
+		// Still counting, so run the original instruction
+		auto* head = exec->trace_heads()->hit(RECONSTRUCT_PC());
+		if (LIKELY(head == nullptr))
+			goto *computed_opcode[DECODER().m_handler];
+		// The loop became hot: record it from the loop head
+		counter.increment_counter(-int64_t(decoder->instruction_count()));
+		REGISTERS().pc = RECONSTRUCT_PC();
+		counter.apply(MACHINE());
+		exec->trace_heads()->record(*this, *exec, *head);
+		counter.retrieve_counters(MACHINE());
+		pc = REGISTERS().pc;
+		goto check_jump;
+	}
+	// Undo the counter increment that continue_segment applied for this entry.
+	counter.increment_counter(-int64_t(decoder->instruction_count()));
+	{
+		auto* trace = exec->trace_heads()->trace_at(RECONSTRUCT_PC());
+		const auto results = trace->run(*this, counter.value(), counter.max());
+		counter.set_counters(results.counter, counter.max());
+		pc = results.pc;
+	}
+	goto check_jump;
+}
+#endif // DISPATCH_MODE_THREADED
+
 INSTRUCTION(RV32I_BC_SYSCALL, rv32i_syscall) {
 	// Make the current PC visible
 	REGISTERS().pc = pc;
@@ -24,6 +24,8 @@ namespace riscv
 #undef VIEW_INSTR_AS
 #undef NEXT_INSTR
 #undef NEXT_C_INSTR
+#undef SKIP_INSTR
+#undef SKIP_C_INSTR
 #undef NEXT_BLOCK
 #undef SAFE_INSTR_NEXT
 #undef NEXT_SEGMENT
@@ -45,6 +47,13 @@ namespace riscv
 #define NEXT_C_INSTR() \
 	decoder += 1;      \
 	EXECUTE_INSTR();
+#define SKIP_INSTR()                  \
+	if constexpr (compressed_enabled) \
+		decoder += 2;                 \
+	else                              \
+		decoder += 1;
+#define SKIP_C_INSTR() \
+	decoder += 1;
 
 #define NEXT_BLOCK(len, OF)                                    \
 	pc += len;                                                 \
@@ -66,11 +75,20 @@ namespace riscv
 #define PERFORM_BRANCH()                                                                                        \
 	if constexpr (VERBOSE_JUMPS)                                                                                \
 		fprintf(stderr, "Branch 0x%lX >= 0x%lX (decoder=%p)\n", long(pc), long(pc + fi.signed_imm()), decoder); \
+	if (UNLIKELY(interrupt.load(std::memory_order_relaxed))) {                                                  \
+		pc += fi.signed_imm();                                                                                  \
+		goto execute_interrupted;                                                                               \
+	}                                                                                                           \
 	NEXT_BLOCK(fi.signed_imm(), false);
 
-#define PERFORM_FORWARD_BRANCH PERFORM_BRANCH
+#define PERFORM_FORWARD_BRANCH()                                                                                \
+	if constexpr (VERBOSE_JUMPS)                                                                                \
+		fprintf(stderr, "Fw.Branch 0x%lX >= 0x%lX\n", long(pc), long(pc + fi.signed_imm()));                     \
+	NEXT_BLOCK(fi.signed_imm(), false);
 
 #define OVERFLOW_CHECKED_JUMP()                                   \
+	if (UNLIKELY(interrupt.load(std::memory_order_relaxed)))      \
+		goto execute_interrupted;                                 \
 	if (LIKELY(pc - exec->exec_begin() < exec->exec_end() - exec->exec_begin())) \
 		goto continue_segment;                                    \
 	else                                                          \
@@ -89,6 +107,8 @@ namespace riscv
 
 		machine().set_instruction_counter(0);
 		machine().set_max_instructions(UINT64_MAX);
+		// Without instruction counting, jumps and branches still poll for interrupts
+		auto& interrupt = machine().interrupt_flag();
 
 		DecodedExecuteSegment<W> *exec = this->m_exec;
 		DecoderData<W> *exec_decoder = exec->decoder_cache();
@@ -164,10 +184,13 @@ INSTRUCTION(RV32I_BC_SYSTEM, rv32i_system)
 INSTRUCTION(RV32I_BC_TRANSLATOR, translated_function)
 {
 retry_translated_function:
-	// Invoke translated code
+	RISCV_STAT_INC(MACHINE(), bintr_entries);
+	// Invoke translated code, which returns every RISCV_INTERRUPT_SLICE
+	// instructions so that interrupts are noticed
 	auto bintr_results =
-		exec->unchecked_mapping_at(decoder->instr)(*this, 0, ~0ULL, pc);
+		exec->unchecked_mapping_at(decoder->instr)(*this, 0, RISCV_INTERRUPT_SLICE, pc);
 	if (bintr_results.max_counter == 0) {
+		RISCV_STAT_INC(MACHINE(), bintr_exits);
 #ifdef RISCV_LIBTCC
 		// We need to check if we have a current exception
 		if (UNLIKELY(CPU().has_current_exception()))
@@ -177,7 +200,8 @@ retry_translated_function:
 	}
 
 	pc = REGISTERS().pc;
-	if (LIKELY(bintr_results.max_counter != 0 && (pc - exec->exec_begin() < exec->exec_end() - exec->exec_begin())))
+	if (LIKELY(bintr_results.max_counter != 0 && (pc - exec->exec_begin() < exec->exec_end() - exec->exec_begin())
+		&& !interrupt.load(std::memory_order_relaxed)))
 	{
 		if (UNLIKELY(exec->is_stale()))
 			goto new_execute_segment;
@@ -185,13 +209,15 @@ retry_translated_function:
 		if (decoder->get_bytecode() == RV32I_BC_TRANSLATOR) {
 			goto retry_translated_function;
 		}
+		RISCV_STAT_INC(MACHINE(), bintr_exits);
 #ifdef RISCV_DEBUG
 		if (exec->is_recording_slowpaths())
 			exec->insert_slowpath_address(pc);
 #endif
 		goto continue_segment;
-	} else
-		goto check_jump;
+	}
+	RISCV_STAT_INC(MACHINE(), bintr_exits);
+	goto check_jump;
 }
 #endif // RISCV_BINARY_TRANSLATION
 
@@ -200,25 +226,52 @@ INSTRUCTION(RV32I_BC_ASMJIT, asmjit_function)
 {
 begin_asmjit_function:
 	// The inaccurate dispatch does not count instructions, so the region only
-	// ever exits on control flow it cannot handle, or when a helper faults.
-	AjState<W> state { 0, ~0ULL, pc };
+	// exits on control flow it cannot handle, when a helper faults, or every
+	// RISCV_INTERRUPT_SLICE instructions so that interrupts are noticed.
+	AjState<W> state { 0, RISCV_INTERRUPT_SLICE, pc };
 retry_asmjit_function:
+	RISCV_STAT_INC(MACHINE(), asmjit_entries);
+	state.counter = 0;
 	exec->unchecked_asmjit_mapping_at(decoder->instr)(*this, &state);
 	if (UNLIKELY(CPU().has_current_exception()))
 		goto handle_rethrow_exception;
-	if (UNLIKELY(state.max_counter == 0))
+	if (UNLIKELY(state.max_counter == 0)) {
+		RISCV_STAT_INC(MACHINE(), asmjit_exits);
 		return;
+	}
 	pc = state.pc;
-	if (LIKELY(pc - exec->exec_begin() < exec->exec_end() - exec->exec_begin())) {
+	if (LIKELY(pc - exec->exec_begin() < exec->exec_end() - exec->exec_begin()
+		&& !interrupt.load(std::memory_order_relaxed))) {
 		decoder = &exec_decoder[pc >> DecoderData<W>::SHIFT];
 		if (decoder->get_bytecode() == RV32I_BC_ASMJIT)
 			goto retry_asmjit_function;
+		RISCV_STAT_INC(MACHINE(), asmjit_exits);
 		goto continue_segment;
 	}
+	RISCV_STAT_INC(MACHINE(), asmjit_exits);
 	goto check_jump;
 }
 #endif // RISCV_ASMJIT
 
+#ifdef DISPATCH_MODE_THREADED
+INSTRUCTION(RV32I_BC_TRACE, trace_function)
+{
+	if (DECODER().m_handler != 0) {
+		// Still counting, so run the original instruction
+		auto* head = exec->trace_heads()->hit(RECONSTRUCT_PC());
+		if (LIKELY(head == nullptr))
+			goto *computed_opcode[DECODER().m_handler];
+		// The loop became hot: record it from the loop head
+		REGISTERS().pc = RECONSTRUCT_PC();
+		exec->trace_heads()->record(*this, *exec, *head);
+		pc = REGISTERS().pc;
+		goto check_jump;
+	}
+	pc = exec->trace_heads()->trace_at(RECONSTRUCT_PC())->run(*this, 0, UINT64_MAX).pc;
+	goto check_jump;
+}
+#endif // DISPATCH_MODE_THREADED
+
 INSTRUCTION(RV32I_BC_SYSCALL, rv32i_syscall)
 {
 	// Make the current PC visible
@@ -257,6 +310,8 @@ INSTRUCTION(RV32I_BC_STOP, rv32i_stop)
 #endif
 
 	check_jump:
+		if (UNLIKELY(interrupt.load(std::memory_order_relaxed)))
+			goto execute_interrupted;
 		if (LIKELY(pc - exec->exec_begin() < exec->exec_end() - exec->exec_begin()))
 			goto continue_segment;
 
@@ -285,6 +340,11 @@ INSTRUCTION(RV32I_BC_STOP, rv32i_stop)
 		registers().pc = pc;
 		trigger_exception(ILLEGAL_OPCODE, decoder->instr);
 
+	execute_interrupted:
+		// Stop where execution can be resumed, see Machine::request_interrupt()
+		registers().pc = pc;
+		return;
+
 #if (defined(RISCV_BINARY_TRANSLATION) && defined(RISCV_LIBTCC)) || defined(RISCV_ASMJIT)
 	handle_rethrow_exception:
 		// We have an exception, so we need to rethrow it
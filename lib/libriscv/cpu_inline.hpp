@@ -19,7 +19,8 @@ const Memory<W>& CPU<W>::memory() const noexcept { return machine().memory; }
 
 template <int W>
 inline CPU<W>::CPU(Machine<W>& machine)
-	: m_machine { machine }, m_exec(empty_execute_segment().get())
+	: m_machine { machine }, m_exec(empty_execute_segment().get()),
+	  m_prev_exec(empty_execute_segment().get())
 {
 }
 template <int W>
@@ -74,3 +75,19 @@ inline void CPU<W>::increment_pc(int delta) noexcept
 {
 	registers().pc += delta;
 }
+
+template <int W> inline
+typename CPU<W>::NextExecuteReturn CPU<W>::next_execute_segment(address_t pc)
+{
+	// Calls between a program and a shared object, or JIT-produced code,
+	// go back and forth between two segments without looking them up
+	auto* previous = this->m_prev_exec;
+	if (LIKELY(previous->is_within(pc) && !previous->is_stale())) {
+		RISCV_STAT_INC(machine(), segment_lookups);
+		this->m_prev_exec = this->m_exec;
+		this->m_exec = previous;
+		this->m_stale_restart_pc = ~address_t(0);
+		return {previous, pc};
+	}
+	return this->lookup_execute_segment(pc);
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include <memory>
 #include "types.hpp"
+#include "trace.hpp"
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
@@ -59,6 +60,7 @@ namespace riscv
 		~DecodedExecuteSegment();
 
 		size_t threaded_rewrite(size_t bytecode, address_t pc, rv32i_instruction& instr);
+		void threaded_fuse(address_t from, address_t to);
 
 		uint32_t crc32c_hash() const noexcept { return m_crc32c_hash; }
 		void set_crc32c_hash(uint32_t hash) { m_crc32c_hash = hash; }
@@ -154,6 +156,9 @@ namespace riscv
 		bool is_stale() const noexcept { return m_is_stale; }
 		void set_stale(bool is_stale) { m_is_stale = is_stale; }
 
+		TraceHeads<W>* trace_heads() const noexcept { return m_trace_heads.get(); }
+		void set_trace_heads(std::unique_ptr<TraceHeads<W>> heads) { m_trace_heads = std::move(heads); }
+
 	private:
 		address_t m_vaddr_begin = 0;
 		address_t m_vaddr_end   = 0;
@@ -169,6 +174,9 @@ namespace riscv
 		size_t          m_decoder_cache_size = 0;
 		std::unique_ptr<DecoderData<W>[]> m_decoder_cache = nullptr;
 
+		// Hot loops of the trace tier, see trace.hpp
+		std::unique_ptr<TraceHeads<W>> m_trace_heads = nullptr;
+
 #ifdef RISCV_BINARY_TRANSLATION
 		std::vector<bintr_block_func<W>> m_translator_mappings;
 		mutable void* m_bintr_dl = nullptr;
@@ -228,6 +236,7 @@ namespace riscv
 
 		m_decoder_cache_size = other.m_decoder_cache_size;
 		m_decoder_cache = std::move(other.m_decoder_cache);
+		m_trace_heads = std::move(other.m_trace_heads);
 
 #ifdef RISCV_BINARY_TRANSLATION
 		m_translator_mappings = std::move(other.m_translator_mappings);
@@ -101,6 +101,21 @@ namespace riscv
 			}
 		}
 
+		// Take a segment out of sharing, when no other machine is using it
+		bool try_unshare(key_t key, const std::shared_ptr<DecodedExecuteSegment<W>>& segment) {
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = m_segments.find(key);
+			if (it == m_segments.end())
+				return segment.use_count() == 1;
+			std::scoped_lock lock2(it->second.mutex);
+			const bool registered = it->second.segment == segment;
+			if (segment.use_count() != (registered ? 2 : 1))
+				return false;
+			if (registered)
+				it->second.segment = nullptr;
+			return true;
+		}
+
 		auto& get_segment(key_t key) {
 			std::scoped_lock lock(mutex);
 			auto& entry = m_segments[key];
@@ -548,6 +563,7 @@ namespace riscv
 		TIME_POINT(t3);
 
 		realize_fastsim<W>(addr, dst, exec_segment, exec_decoder);
+		exec.threaded_fuse(addr, dst);
 
 		// Debugging: EBREAK locations
 		for (auto& loc : options.ebreak_locations) {
@@ -569,6 +585,13 @@ namespace riscv
 			if (options.libc_fastpath && is_initial) {
 				machine().install_libc_fastpath(exec, options.verbose_loader);
 			}
+			// Loop heads are installed last, as they hide the original bytecode
+			if (trace_tier_available && options.trace_enabled) {
+				exec.set_trace_heads(TraceHeads<W>::install(exec, addr, dst, options.trace_threshold));
+				if (options.verbose_loader && exec.trace_heads() != nullptr) {
+					printf("libriscv: Installed %zu trace loop heads\n", exec.trace_heads()->size());
+				}
+			}
 		}
 
 		TIME_POINT(t4);
@@ -657,6 +680,7 @@ namespace riscv
 
 			if (segment.segment != nullptr) {
 				free_slot = segment.segment;
+				this->index_execute_segments();
 				return *free_slot;
 			}
 
@@ -671,6 +695,7 @@ namespace riscv
 			free_slot->set_crc32c_hash(hash);
 
 			this->generate_decoder_cache(options, free_slot, is_initial);
+			RISCV_STAT_INC(m_machine, execute_segments);
 
 			// Share the execute segment. NOTE: We already hold segment.mutex,
 			// and we must not take the global mutex here (which get_segment()
@@ -688,8 +713,10 @@ namespace riscv
 			free_slot->set_crc32c_hash(hash);
 
 			this->generate_decoder_cache(options, free_slot, is_initial);
+			RISCV_STAT_INC(m_machine, execute_segments);
 		}
 
+		this->index_execute_segments();
 		return *free_slot;
 	}
 
@@ -699,11 +726,28 @@ namespace riscv
 		if (!m_main_exec_segment) {
 			return m_main_exec_segment;
 		}
-		if (LIKELY(m_exec.size() < RISCV_MAX_EXECUTE_SEGS)) {
+		// Reuse the slot of an evicted segment
+		for (auto& slot : m_exec) {
+			if (slot == nullptr)
+				return slot;
+		}
+		if (LIKELY(m_exec.size() < m_max_exec_segments)) {
 			m_exec.push_back(nullptr);
 			return m_exec.back();
 		}
-		throw MachineException(INVALID_PROGRAM, "Max execute segments reached");
+		throw MachineException(INVALID_PROGRAM, "Max execute segments reached", m_max_exec_segments);
+	}
+
+	template <int W>
+	void Memory<W>::index_execute_segments()
+	{
+		m_exec_ranges.clear();
+		for (size_t slot = 0; slot < m_exec.size(); slot++) {
+			if (m_exec[slot] && !m_exec[slot]->empty())
+				m_exec_ranges.push_back({m_exec[slot]->exec_begin(), m_exec[slot]->exec_end(), slot});
+		}
+		std::sort(m_exec_ranges.begin(), m_exec_ranges.end(),
+			[] (const ExecuteRange& a, const ExecuteRange& b) { return a.begin < b.begin; });
 	}
 
 	template <int W>
@@ -717,6 +761,8 @@ namespace riscv
 	{
 		// destructor could throw, so let's invalidate early
 		machine().cpu.set_execute_segment(*CPU<W>::empty_execute_segment());
+		machine().cpu.reset_previous_execute_segment();
+		m_exec_ranges.clear();
 
 #if defined(RISCV_BINARY_TRANSLATION) || defined(RISCV_ASMJIT)
 		// A background translation holds a reference to the execute segment, but
@@ -779,8 +825,10 @@ namespace riscv
 			? end : segment.exec_end();
 		memory.machine().penalize((hi - lo) / 4);
 		try {
-			if (memory.memcmp(segment.exec_data(lo), lo, hi - lo) != 0)
-				segment.set_stale(true);
+			if (memory.memcmp(segment.exec_data(lo), lo, hi - lo) != 0) {
+				if (!memory.refresh_execute_segment(segment, lo, hi))
+					segment.set_stale(true);
+			}
 		} catch (...) {
 			segment.set_stale(true);
 		}
@@ -797,6 +845,138 @@ namespace riscv
 		}
 	}
 
+	template <int W>
+	void Memory<W>::flush_execute_segments() noexcept
+	{
+		for (auto& segment : m_exec) {
+			if (segment)
+				flush_execute_segment<W>(*this, *segment, segment->exec_begin(), segment->exec_end());
+		}
+	}
+
+	// Where the block that starts at block_pc ends, the way realize_fastsim()
+	// measures it, or the end of the first block after it that ends at or
+	// after min_pc.
+	template <int W>
+	static address_type<W> block_end_at_or_after(const DecodedExecuteSegment<W>& exec,
+		address_type<W> block_pc, address_type<W> min_pc)
+	{
+		const auto end_pc = exec.exec_end();
+		address_type<W> pc = block_pc;
+		unsigned halfwords = 0;
+		while (pc < end_pc) {
+			const auto instruction = read_instruction(exec.exec_data(), pc, end_pc);
+			const unsigned length = compressed_enabled ? instruction.length() : 4;
+			pc += length;
+			halfwords += length >> 1;
+
+			bool ends_block;
+			if (compressed_enabled && length == 2) {
+				ends_block = !is_regular_compressed<W>(instruction.half[0]);
+			} else {
+				const unsigned opcode = instruction.opcode();
+				ends_block = opcode == RV32I_BRANCH || opcode == RV32I_SYSTEM
+					|| opcode == RV32I_JAL || opcode == RV32I_JALR;
+			}
+			// Long blocks are split up, see realize_fastsim()
+			if (compressed_enabled && halfwords >= 255)
+				ends_block = true;
+			if (ends_block) {
+				if (pc >= min_pc)
+					return pc;
+				halfwords = 0;
+			}
+		}
+		return end_pc;
+	}
+
+	template <int W>
+	bool Memory<W>::refresh_execute_segment(DecodedExecuteSegment<W>& exec, address_t begin, address_t end) noexcept
+	{
+		// Native code covers whole functions, and can not be patched
+		if (exec.is_binary_translated() || exec.is_asmjit_translated())
+			return false;
+#if defined(RISCV_BINARY_TRANSLATION) || defined(RISCV_ASMJIT)
+		if (exec.patched_decoder_cache() != nullptr || exec.is_background_compiling())
+			return false;
+#endif
+		begin = std::max(begin, exec.exec_begin()) & ~address_t(DecoderData<W>::DIVISOR - 1);
+		end   = std::min(end, exec.exec_end());
+		if (begin >= end)
+			return true;
+
+		std::shared_ptr<DecodedExecuteSegment<W>>* slot = nullptr;
+		if (m_main_exec_segment.get() == &exec)
+			slot = &m_main_exec_segment;
+		for (auto& segment : m_exec) {
+			if (segment.get() == &exec)
+				slot = &segment;
+		}
+		if (slot == nullptr)
+			return false;
+		// Other machines would see the new code too
+		if (!shared_execute_segments<W>.try_unshare(SegmentKey::from(exec, memory_arena_size()), *slot))
+			return false;
+
+		try {
+			std::vector<uint8_t> code(end - begin);
+			this->memcpy_out(code.data(), begin, code.size());
+			// Narrow the range down to the bytes that changed
+			const uint8_t* old_code = exec.exec_data(begin);
+			size_t first = 0;
+			while (first < code.size() && old_code[first] == code[first])
+				first++;
+			if (first == code.size())
+				return true;
+			size_t last = code.size();
+			while (old_code[last - 1] == code[last - 1])
+				last--;
+			std::memcpy(exec.exec_data(begin), code.data(), code.size());
+
+			const address_t lo = (begin + first) & ~address_t(DecoderData<W>::DIVISOR - 1);
+			const address_t hi = begin + last;
+
+			// Loop heads hide the original bytecodes
+			unsigned trace_threshold = 0;
+			if (auto* heads = exec.trace_heads(); heads != nullptr) {
+				trace_threshold = heads->threshold();
+				heads->uninstall(exec);
+				exec.set_trace_heads(nullptr);
+			}
+
+			// Find the beginning of the first block that reaches into the
+			// changed bytes. Each entry knows where its block ends.
+			auto* exec_decoder = exec.decoder_cache();
+			static constexpr size_t MAX_BLOCK_ENTRIES = compressed_enabled ? 256 : 65536;
+			address_t block_pc = lo;
+			address_t pc = lo;
+			for (size_t n = 0; n < MAX_BLOCK_ENTRIES && pc > exec.exec_begin(); n++) {
+				pc -= DecoderData<W>::DIVISOR;
+				const auto& entry = exec_decoder[pc / DecoderData<W>::DIVISOR];
+				if (entry.get_bytecode() == RV32I_BC_INVALID)
+					continue; // Between instructions, or not an instruction
+				// The last instruction of the block may be 4 bytes long
+				if (pc + entry.block_bytes() + 4 <= lo)
+					break;
+				block_pc = pc;
+			}
+			// Decode every block from there up to where the changes end
+			const address_t end_pc = block_end_at_or_after<W>(exec, block_pc, hi);
+			this->decode_execute_range(exec, block_pc, end_pc);
+			realize_fastsim<W>(block_pc, end_pc, exec.exec_data(), exec_decoder);
+			exec.threaded_fuse(block_pc, end_pc);
+
+			if (trace_threshold != 0) {
+				exec.set_trace_heads(TraceHeads<W>::install(exec,
+					exec.exec_begin(), exec.exec_end(), trace_threshold));
+			}
+			exec.set_crc32c_hash(crc32c(exec.exec_data(exec.exec_begin()), exec.exec_end() - exec.exec_begin()));
+			return true;
+		} catch (...) {
+			return false;
+		}
+	}
+
 	template <int W>
 	void Memory<W>::evict_execute_segment(DecodedExecuteSegment<W>& segment)
 	{
@@ -805,6 +985,7 @@ namespace riscv
 		// the Machine it was started from.
 		segment.wait_for_compilation_complete();
 #endif
+		machine().cpu.reset_previous_execute_segment();
 		const SegmentKey key = SegmentKey::from(segment, memory_arena_size());
 		if (m_main_exec_segment.get() == &segment) {
 			m_main_exec_segment = nullptr;
@@ -819,6 +1000,7 @@ namespace riscv
 				break;
 			}
 		}
+		this->index_execute_segments();
 		shared_execute_segments<W>.remove_if_unique(key);
 	}
 
@@ -0,0 +1,230 @@
+#pragma once
+#include "machine.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace riscv
+{
+	/**
+	 * A pool of ready forks of a master machine. Forks are created and
+	 * destroyed on a background thread, so that handing one out is only
+	 * a matter of taking it from a list:
+	 *
+	 * riscv::ForkPool<RISCV64> pool(master, 16, { .use_memory_arena = false },
+	 *     [] (auto& fork) { fork.set_userdata(...); fork.set_printer(...); });
+	 * auto fork = pool.acquire();
+	 * fork->vmcall("on_request", ...);
+	 * pool.release(std::move(fork));
+	 *
+	 * The master machine must outlive the pool, and must not be modified
+	 * while the pool exists, as forks are created from it concurrently.
+	**/
+	template <int W>
+	struct ForkPool
+	{
+		using machine_t = Machine<W>;
+		using fork_t = std::unique_ptr<machine_t>;
+		/// @brief Configures a new fork before it is handed out, eg. with
+		/// set_userdata(), set_printer() and page handlers. It is called
+		/// from the pool thread, and from acquire() when the pool is empty.
+		using setup_t = std::function<void(machine_t&)>;
+		/// @brief Called from the pool thread with each returned fork.
+		/// Returns true to put the fork back into the pool, otherwise it
+		/// is destroyed and replaced with a new fork. Forks that are still
+		/// in the pool when it is destroyed are also passed to it, so that
+		/// anything setup attached to them can be freed.
+		using recycle_t = std::function<bool(machine_t&)>;
+
+		/// @brief Create a pool of forks of @master, and start filling it.
+		/// @param master The machine to fork from.
+		/// @param size The number of ready forks to keep.
+		/// @param options The options each fork is created with.
+		/// @param setup Configures each new fork.
+		/// @param recycle Decides whether returned forks are reused.
+		ForkPool(const machine_t& master, size_t size, const MachineOptions<W>& options = {},
+			setup_t setup = nullptr, recycle_t recycle = nullptr);
+		~ForkPool();
+
+		/// @brief Take a ready fork from the pool. When the pool is empty,
+		/// a fork is created on the calling thread instead.
+		/// @return A configured fork, owned by the caller.
+		fork_t acquire();
+
+		/// @brief Give a fork back to the pool. It is recycled or destroyed
+		/// on the pool thread.
+		/// @param fork A fork from acquire().
+		void release(fork_t fork);
+
+		/// @brief The number of forks the pool keeps ready.
+		size_t size() const noexcept { return m_size; }
+		/// @brief The number of forks that are ready right now.
+		size_t ready() const;
+		/// @brief The number of times acquire() found the pool empty.
+		uint64_t misses() const noexcept { return m_misses.load(std::memory_order_relaxed); }
+		/// @brief The machine that forks are created from.
+		const machine_t& master() const noexcept { return m_master; }
+
+		ForkPool(const ForkPool&) = delete;
+		ForkPool& operator=(const ForkPool&) = delete;
+	private:
+		fork_t create() const;
+		bool recycle(machine_t&) const noexcept;
+		void run();
+
+		const machine_t& m_master;
+		const size_t     m_size;
+		const MachineOptions<W> m_options;
+		const setup_t    m_setup;
+		const recycle_t  m_recycle;
+
+		mutable std::mutex m_mutex;
+		std::condition_variable m_cv;
+		std::vector<fork_t> m_ready;
+		std::vector<fork_t> m_returned;
+		std::atomic<uint64_t> m_misses = 0;
+		// Set when creating a fork failed, and cleared by acquire(),
+		// so that a failing setup does not keep the pool thread busy
+		bool m_failed = false;
+		bool m_stop = false;
+		std::thread m_thread;
+	};
+
+	template <int W>
+	inline ForkPool<W>::ForkPool(const machine_t& master, size_t size,
+		const MachineOptions<W>& options, setup_t setup, recycle_t recycle)
+		: m_master(master), m_size(size), m_options(options),
+		  m_setup(std::move(setup)), m_recycle(std::move(recycle))
+	{
+		m_ready.reserve(size);
+		m_thread = std::thread([this] { this->run(); });
+	}
+
+	template <int W>
+	inline ForkPool<W>::~ForkPool()
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			m_stop = true;
+		}
+		m_cv.notify_one();
+		m_thread.join();
+	}
+
+	template <int W>
+	inline typename ForkPool<W>::fork_t ForkPool<W>::create() const
+	{
+		auto fork = std::make_unique<machine_t>(m_master, m_options);
+		if (m_setup)
+			m_setup(*fork);
+		return fork;
+	}
+
+	template <int W>
+	inline typename ForkPool<W>::fork_t ForkPool<W>::acquire()
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			m_failed = false;
+			if (!m_ready.empty()) {
+				fork_t fork = std::move(m_ready.back());
+				m_ready.pop_back();
+				m_cv.notify_one();
+				return fork;
+			}
+		}
+		m_misses.fetch_add(1, std::memory_order_relaxed);
+		m_cv.notify_one();
+		return create();
+	}
+
+	template <int W>
+	inline void ForkPool<W>::release(fork_t fork)
+	{
+		if (fork == nullptr)
+			return;
+		{
+			std::lock_guard lock(m_mutex);
+			m_returned.push_back(std::move(fork));
+		}
+		m_cv.notify_one();
+	}
+
+	template <int W>
+	inline size_t ForkPool<W>::ready() const
+	{
+		std::lock_guard lock(m_mutex);
+		return m_ready.size();
+	}
+
+	template <int W>
+	inline void ForkPool<W>::run()
+	{
+		std::unique_lock lock(m_mutex);
+		while (true)
+		{
+			m_cv.wait(lock, [this] {
+				return m_stop || !m_returned.empty()
+					|| (m_ready.size() < m_size && !m_failed);
+			});
+			if (m_stop)
+				break;
+
+			if (!m_returned.empty()) {
+				std::vector<fork_t> returned = std::move(m_returned);
+				m_returned.clear();
+				lock.unlock();
+				for (auto& fork : returned) {
+					if (this->recycle(*fork)) {
+						std::lock_guard relock(m_mutex);
+						if (m_ready.size() < m_size) {
+							m_ready.push_back(std::move(fork));
+							continue;
+						}
+					}
+					fork.reset();
+				}
+				lock.lock();
+				continue;
+			}
+
+			// Create forks one at a time, so that returned forks
+			// and the destructor are not kept waiting
+			lock.unlock();
+			fork_t fork;
+			try {
+				fork = create();
+			} catch (...) {
+			}
+			lock.lock();
+			if (fork == nullptr)
+				m_failed = true;
+			else if (m_ready.size() < m_size)
+				m_ready.push_back(std::move(fork));
+		}
+		// Remaining forks are destroyed on the pool thread as well
+		for (auto& fork : m_ready)
+			this->recycle(*fork);
+		for (auto& fork : m_returned)
+			this->recycle(*fork);
+		m_ready.clear();
+		m_returned.clear();
+	}
+
+	template <int W>
+	inline bool ForkPool<W>::recycle(machine_t& fork) const noexcept
+	{
+		if (!m_recycle)
+			return false;
+		try {
+			return m_recycle(fork);
+		} catch (...) {
+			return false;
+		}
+	}
+
+} // riscv
@@ -0,0 +1,150 @@
+#include "guarded_arena.hpp"
+
+#if defined(__linux__) || defined(__FreeBSD__)
+#include <csetjmp>
+#include <csignal>
+#include <mutex>
+#include <sys/mman.h>
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+#define RISCV_HAS_GUARDED_ARENAS 1
+#endif
+
+namespace riscv
+{
+#ifdef RISCV_HAS_GUARDED_ARENAS
+	struct GuardedCall
+	{
+		sigjmp_buf env;
+		uintptr_t  begin;
+		uintptr_t  end;
+		volatile uintptr_t fault = 0;
+	};
+	// The innermost guarded call on this thread. Outer calls are not
+	// considered, as jumping to them would abandon the host frames of the
+	// system call that started the inner one.
+	static thread_local GuardedCall* current_call = nullptr;
+	static struct sigaction previous_segv;
+	static struct sigaction previous_bus;
+
+	static void forward_fault(int sig, siginfo_t* info, void* context)
+	{
+		const struct sigaction& prev = (sig == SIGBUS) ? previous_bus : previous_segv;
+		if (prev.sa_flags & SA_SIGINFO) {
+			prev.sa_sigaction(sig, info, context);
+		} else if (prev.sa_handler != SIG_DFL && prev.sa_handler != SIG_IGN) {
+			prev.sa_handler(sig);
+		} else {
+			// The faulting access is retried on return, and then
+			// gets the default action
+			signal(sig, SIG_DFL);
+		}
+	}
+
+	static void guarded_fault_handler(int sig, siginfo_t* info, void* context)
+	{
+		GuardedCall* call = current_call;
+		const uintptr_t addr = uintptr_t(info->si_addr);
+		if (call != nullptr && addr >= call->begin && addr < call->end) {
+			call->fault = addr;
+			siglongjmp(call->env, 1);
+		}
+		forward_fault(sig, info, context);
+	}
+
+	static void install_fault_handler()
+	{
+		static std::once_flag once;
+		std::call_once(once, [] {
+			struct sigaction sa {};
+			sa.sa_sigaction = guarded_fault_handler;
+			// The handler leaves through siglongjmp without restoring the
+			// signal mask, so the signal must not be blocked while it runs
+			sa.sa_flags = SA_SIGINFO | SA_NODEFER | SA_ONSTACK;
+			sigemptyset(&sa.sa_mask);
+			sigaction(SIGSEGV, &sa, &previous_segv);
+			sigaction(SIGBUS, &sa, &previous_bus);
+		});
+	}
+#endif
+
+	bool guarded_arenas_supported() noexcept
+	{
+#ifdef RISCV_HAS_GUARDED_ARENAS
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	uint8_t* reserve_guarded_window(size_t len) noexcept
+	{
+#ifdef RISCV_HAS_GUARDED_ARENAS
+		void* ptr = mmap(nullptr, len, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (ptr == MAP_FAILED)
+			return nullptr;
+		try {
+			install_fault_handler();
+		} catch (...) {
+			munmap(ptr, len);
+			return nullptr;
+		}
+		return (uint8_t *)ptr;
+#else
+		(void)len;
+		return nullptr;
+#endif
+	}
+
+	bool protect_guarded_range(void* ptr, size_t len, bool read, bool write) noexcept
+	{
+#ifdef RISCV_HAS_GUARDED_ARENAS
+		const int prot = (read ? PROT_READ : 0) | (write ? PROT_WRITE : 0);
+		return mprotect(ptr, len, prot) == 0;
+#else
+		(void)ptr; (void)len; (void)read; (void)write;
+		return false;
+#endif
+	}
+
+	void release_guarded_window(void* ptr, size_t len) noexcept
+	{
+#ifdef RISCV_HAS_GUARDED_ARENAS
+		munmap(ptr, len);
+#else
+		(void)ptr; (void)len;
+#endif
+	}
+
+	bool run_guarded(const void* begin, const void* end,
+		void (*func)(void*), void* arg, uintptr_t& fault)
+	{
+#ifdef RISCV_HAS_GUARDED_ARENAS
+		GuardedCall call;
+		call.begin = uintptr_t(begin);
+		call.end   = uintptr_t(end);
+		GuardedCall* const outer = current_call;
+		// The handler does not block the signal, so there is no mask to save
+		if (sigsetjmp(call.env, 0) != 0) {
+			current_call = outer;
+			fault = call.fault;
+			return false;
+		}
+		current_call = &call;
+		try {
+			func(arg);
+		} catch (...) {
+			current_call = outer;
+			throw;
+		}
+		current_call = outer;
+		return true;
+#else
+		(void)begin; (void)end; (void)fault;
+		func(arg);
+		return true;
+#endif
+	}
+}
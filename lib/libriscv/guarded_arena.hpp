@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace riscv
+{
+	/// @brief True when this platform can surround a memory arena with
+	/// guard pages, and recover from accesses to them.
+	bool guarded_arenas_supported() noexcept;
+
+	/// @brief Reserve len bytes of inaccessible host address space.
+	/// @details The first reservation installs a SIGSEGV and SIGBUS handler,
+	/// which passes on every fault that does not belong to run_guarded().
+	/// @return The window, or nullptr on failure.
+	uint8_t* reserve_guarded_window(size_t len) noexcept;
+
+	/// @brief Make the page-aligned range [ptr, ptr + len) of a window
+	/// accessible, or inaccessible again.
+	bool protect_guarded_range(void* ptr, size_t len, bool read, bool write) noexcept;
+
+	/// @brief Release a window from reserve_guarded_window().
+	void release_guarded_window(void* ptr, size_t len) noexcept;
+
+	/// @brief Call func(arg), and turn a host fault inside the window
+	/// [begin, end) into a return from this function.
+	/// @details Only generated code may fault: the host frames in between are
+	/// abandoned, so they must not own anything. Library code checks guest
+	/// addresses before it touches an arena, and never relies on its guard
+	/// pages. Nested calls only catch faults in their own window.
+	/// @return True when func returned, or false after a fault, with the
+	/// faulting host address in fault.
+	bool run_guarded(const void* begin, const void* end,
+		void (*func)(void*), void* arg, uintptr_t& fault);
+}
@@ -1,17 +1,27 @@
+#include "common.hpp"
+#include <atomic>
 #include <cstdint>
 
 namespace riscv
 {
     template <int W> struct Machine;
 
+	// Generated code that counts instructions does not poll for interrupts.
+	// It is handed a limit at most RISCV_INTERRUPT_SLICE instructions away
+	// instead, and the dispatch checks for interrupts when it returns.
+	inline uint64_t interrupt_slice(uint64_t counter, uint64_t max) noexcept {
+		return (max > counter && max - counter > RISCV_INTERRUPT_SLICE) ? counter + RISCV_INTERRUPT_SLICE : max;
+	}
+
 	// In fastsim mode the instruction counter becomes a register
 	// the function, and we only update m_counter in Machine on exit
 	// When binary translation is enabled we cannot do this optimization.
 	struct InstrCounter
 	{
-		InstrCounter(uint64_t icounter, uint64_t maxcounter)
+		InstrCounter(uint64_t icounter, uint64_t maxcounter, const std::atomic<uint8_t>& interrupt)
 		  : m_counter(icounter),
-			m_max(maxcounter)
+			m_max(maxcounter),
+			m_interrupt(interrupt)
 		{}
 		~InstrCounter() = default;
 
@@ -57,11 +67,17 @@ namespace riscv
 		void increment_counter(uint64_t cnt) {
 			m_counter += cnt;
 		}
+		// Also true when an interrupt was requested, which leaves the
+		// dispatch the same way that running out of instructions does
 		bool overflowed() const noexcept {
-			return m_counter >= m_max;
+			return m_counter >= m_max || interrupted();
+		}
+		bool interrupted() const noexcept {
+			return m_interrupt.load(std::memory_order_relaxed) != 0;
 		}
 	private:
 		uint64_t m_counter;
 		uint64_t m_max;
+		const std::atomic<uint8_t>& m_interrupt;
 	};
 } // riscv
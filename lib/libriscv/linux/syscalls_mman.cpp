@@ -2,6 +2,7 @@
 /// Works on all platforms
 #define LINUX_MAP_ANONYMOUS        0x20
 #define LINUX_MAP_NORESERVE     0x04000
+#define LINUX_MAP_POPULATE      0x08000
 #define LINUX_MAP_FIXED         0x10
 #define LINUX_MAP_FIXED_NOREPLACE 0x100000
 
@@ -16,6 +17,7 @@ static void add_mman_syscalls()
 		if (addr + len < addr)
 			throw MachineException(SYSTEM_CALL_FAILED, "munmap() arguments overflow");
 		machine.memory.free_pages(addr, len);
+		machine.memory.munmap_file(addr, len);
 		if (addr >= machine.memory.mmap_start() && addr + len <= machine.memory.mmap_address()) {
 			machine.memory.mmap_unmap(addr, len);
 		}
@@ -64,8 +66,6 @@ static void add_mman_syscalls()
 		{
 			if (machine.has_file_descriptors())
 			{
-				const int real_fd = machine.fds().translate(vfd);
-
 				address_type<W> dst = 0x0;
 				if (addr_g == 0x0) {
 					if (nextfree + length < nextfree)
@@ -77,7 +77,22 @@ static void add_mman_syscalls()
 						MMAP_HAS_FAILED();
 					dst = addr_g;
 				}
-				// Make the area read-write
+				// Files in the virtual filesystem are served from its image
+				if (auto* vf = machine.fds().get_virtual(vfd); vf != nullptr) {
+					if (!vfs_mmap(machine, *vf, dst, length, voff, attr))
+						MMAP_HAS_FAILED();
+					machine.set_result(dst);
+					return;
+				}
+				const int real_fd = machine.fds().translate(vfd);
+				// Map the file lazily, without reading it into guest memory
+				if (machine.memory.mmap_file(dst, length, real_fd, voff, attr)) {
+					machine.set_result(dst);
+					SYSPRINT("<<< mmap(addr 0x%lX, len %zu, ...) = 0x%lX (file-backed)\n",
+						(long)addr_g, (size_t)length, (long)dst);
+					return;
+				}
+				// Otherwise, make the area read-write
 				machine.memory.set_page_attr(dst, length, PageAttributes{});
 				// Readv into the area
 				std::array<riscv::vBuffer, 256> buffers;
@@ -208,6 +223,7 @@ static void add_mman_syscalls()
 		const bool untouched = (result >= prev_nextfree);
 		// anon pages need to be zeroed
 		if (flags & LINUX_MAP_ANONYMOUS) {
+			machine.memory.munmap_file(result, length);
 			machine.memory.memdiscard(result, length, true);
 		}
 		// avoid potentially creating pages when MAP_NORESERVE is set
@@ -215,6 +231,14 @@ static void add_mman_syscalls()
 		{
 			machine.memory.set_page_attr(result, length, attr);
 		}
+		// MAP_POPULATE pre-faults writable mappings in one go. Like on Linux,
+		// running out of memory here does not make the mapping fail.
+		if ((flags & LINUX_MAP_POPULATE) != 0 && attr.write)
+		{
+			try {
+				machine.memory.prefault(result, length);
+			} catch (const MachineException&) {}
+		}
 		machine.set_result(result);
 		SYSPRINT("<<< mmap(addr 0x%lX, len %zu, ...) = 0x%lX\n",
 				(long)addr_g, (size_t)length, (long)result);
@@ -309,4 +333,12 @@ static void add_mman_syscalls()
 		SYSPRINT(">>> madvise(0x%lX, len=%zu, advice=%x) => %d\n",
 			(uint64_t)addr, (size_t)len, advice, (int)machine.return_value());
 	});
+
+	// The memory layout only depends on the guest, so replays run these
+	// again. File-backed mappings read from the host, and are recorded.
+	for (size_t sysnum : {215, 216, 226, 233})
+		Machine<W>::set_deterministic_syscall(sysnum);
+	Machine<W>::set_deterministic_syscall(222, [] (const Machine<W>& machine) {
+		return machine.template sysarg<int>(4) == -1;
+	});
 }
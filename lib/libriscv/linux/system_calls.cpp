@@ -2,6 +2,7 @@
 
 #include "../internal_common.hpp"
 #include "../threads.hpp"
+#include "../posix/vfs.hpp"
 
 //#define SYSCALL_VERBOSE 1
 #ifdef SYSCALL_VERBOSE
@@ -14,6 +15,7 @@ static constexpr bool verbose_syscalls = true;
 static constexpr bool verbose_syscalls = false;
 #endif
 
+#include <climits>
 #include <fcntl.h>
 #include <signal.h>
 #undef sa_handler
@@ -90,7 +92,7 @@ static void syscall_riscv_flush_icache(Machine<W>& machine) {
 	if (begin < end)
 		machine.memory.flush_execute_segments(begin, end);
 	else
-		machine.memory.mark_execute_segments_stale();
+		machine.memory.flush_execute_segments();
 	machine.set_result(0);
 }
 
@@ -267,6 +269,136 @@ static void syscall_sigaction(Machine<W>& machine)
 	machine.set_result(0);
 }
 
+// Guest (Linux) values, which are not necessarily the same on the host
+static constexpr int LINUX_AT_FDCWD = -100;
+static constexpr int LINUX_AT_SYMLINK_NOFOLLOW = 0x100;
+static constexpr int LINUX_AT_EMPTY_PATH = 0x1000;
+static constexpr int LINUX_O_ACCMODE = 03;
+static constexpr int LINUX_O_CREAT = 0100;
+static constexpr int LINUX_O_TRUNC = 01000;
+static constexpr int LINUX_O_DIRECTORY = 0200000;
+static constexpr int LINUX_O_NOFOLLOW = 0400000;
+// vfs_resolve() result for paths that the host filesystem should serve
+static constexpr int VFS_MISS = INT_MIN;
+
+// Resolve a path in the virtual filesystem, relative to dir_fd. Returns
+// the node, a negative errno, or VFS_MISS.
+template <int W>
+static int vfs_resolve(Machine<W>& machine, int dir_fd, const std::string& path, bool follow)
+{
+	auto& fds = machine.fds();
+	if (fds.vfs == nullptr)
+		return VFS_MISS;
+	int res;
+	if (!path.empty() && path[0] == '/')
+		res = fds.vfs->lookup(path, VirtualFS::ROOT, follow);
+	else if (dir_fd == LINUX_AT_FDCWD)
+		res = fds.vfs->lookup(fds.cwd + "/" + path, VirtualFS::ROOT, follow);
+	else if (auto* dir = fds.get_virtual(dir_fd); dir != nullptr)
+		return fds.vfs->lookup(path, dir->node, follow);
+	else
+		return VFS_MISS; // Relative to a host directory
+	// Paths that are not in the image may still be on the host
+	if (res == -ENOENT && fds.permit_filesystem)
+		return VFS_MISS;
+	return res;
+}
+
+template <int W>
+static long vfs_read(Machine<W>& machine, const FileDescriptors::VirtualFile& vf,
+	address_type<W> address, size_t len, uint64_t offset)
+{
+	const auto& vfs = *machine.fds().vfs;
+	const auto& node = vfs.node(vf.node);
+	if (node.is_dir())
+		return -EISDIR;
+	if (offset >= node.size)
+		return 0;
+	len = std::min(len, size_t(node.size - offset));
+	machine.copy_to_guest(address, vfs.data(node) + offset, len);
+	return long(len);
+}
+
+template <int W>
+static long vfs_getdents64(Machine<W>& machine, FileDescriptors::VirtualFile& vf,
+	address_type<W> g_dirp, size_t count)
+{
+	const auto& vfs = *machine.fds().vfs;
+	const auto& dir = vfs.node(vf.node);
+	if (!dir.is_dir())
+		return -ENOTDIR;
+
+	std::vector<uint8_t> buffer;
+	// Entry 0 is ".", entry 1 is "..", and the children follow
+	while (vf.offset < dir.children.size() + 2)
+	{
+		uint32_t idx;
+		std::string_view name;
+		if (vf.offset < 2) {
+			idx  = (vf.offset == 0) ? vf.node : dir.parent;
+			name = (vf.offset == 0) ? "." : "..";
+		} else {
+			idx  = dir.children[vf.offset - 2];
+			name = vfs.node(idx).name;
+		}
+		const auto& node = vfs.node(idx);
+		// struct linux_dirent64: ino, off, reclen, type, name
+		const size_t reclen = (8 + 8 + 2 + 1 + name.size() + 1 + 7) & ~size_t(7);
+		if (buffer.size() + reclen > count)
+			break;
+		const size_t pos = buffer.size();
+		buffer.resize(pos + reclen);
+		const uint64_t ino = idx + 1;
+		const int64_t  off = int64_t(vf.offset + 1);
+		const uint16_t len = uint16_t(reclen);
+		const uint8_t type = node.is_dir() ? 4 : (node.type == VirtualFS::SYMLINK ? 10 : 8);
+		std::memcpy(&buffer[pos + 0], &ino, 8);
+		std::memcpy(&buffer[pos + 8], &off, 8);
+		std::memcpy(&buffer[pos + 16], &len, 2);
+		buffer[pos + 18] = type;
+		std::memcpy(&buffer[pos + 19], name.data(), name.size());
+		vf.offset++;
+	}
+	if (buffer.empty() && vf.offset < dir.children.size() + 2)
+		return -EINVAL; // Buffer too small
+	machine.copy_to_guest(g_dirp, buffer.data(), buffer.size());
+	return long(buffer.size());
+}
+
+// Map a file from the virtual filesystem. Whole pages are mapped straight out
+// of the image when the file is page-aligned in a mapped image, and the rest
+// is copied.
+template <int W>
+static bool vfs_mmap(Machine<W>& machine, const FileDescriptors::VirtualFile& vf,
+	address_type<W> dst, address_type<W> len, uint64_t offset, PageAttributes attr)
+{
+	const auto& vfs = *machine.fds().vfs;
+	const auto& node = vfs.node(vf.node);
+	if (node.type != VirtualFS::REGULAR || offset % Page::size() != 0)
+		return false;
+
+	address_type<W> mapped = 0;
+	if (vfs.image_file() != nullptr && offset < node.size) {
+		mapped = machine.memory.mmap_file_pages(dst, len, vfs.image_file(),
+			node.offset + offset, node.offset + node.size, attr);
+	}
+	if (mapped < len) {
+		const address_type<W> rest = dst + mapped;
+		const address_type<W> rest_len = len - mapped;
+		machine.memory.free_pages(rest, rest_len);
+		machine.memory.munmap_file(rest, rest_len);
+		machine.memory.memdiscard(rest, rest_len, true);
+		machine.memory.set_page_attr(rest, rest_len, PageAttributes{});
+		const uint64_t file_offset = offset + mapped;
+		if (file_offset < node.size) {
+			machine.copy_to_guest(rest, vfs.data(node) + file_offset,
+				size_t(std::min(uint64_t(rest_len), node.size - file_offset)));
+		}
+		machine.memory.set_page_attr(rest, rest_len, attr);
+	}
+	return true;
+}
+
 template <int W>
 void syscall_getdents64(Machine<W>& machine)
 {
@@ -278,7 +410,12 @@ void syscall_getdents64(Machine<W>& machine)
 		fd, (long)g_dirp, count);
 	(void)count;
 
-	if (machine.has_file_descriptors() && machine.fds().proxy_mode) {
+	if (machine.has_file_descriptors() && machine.fds().get_virtual(fd) != nullptr) {
+		if (count < 0)
+			machine.set_result(-EINVAL);
+		else
+			machine.set_result(vfs_getdents64(machine, *machine.fds().get_virtual(fd), g_dirp, size_t(count)));
+	} else if (machine.has_file_descriptors() && machine.fds().proxy_mode) {
 #if defined(__linux__) && defined(__LP64__)
 		const int real_fd = machine.fds().translate(fd);
 
@@ -307,7 +444,24 @@ void syscall_lseek(Machine<W>& machine)
 	SYSPRINT("SYSCALL lseek, fd: %d, offset: 0x%lX, whence: %d\n",
 		fd, (long)offset, whence);
 
-	if (machine.has_file_descriptors()) {
+	if (machine.has_file_descriptors() && machine.fds().get_virtual(fd) != nullptr) {
+		auto& vf = *machine.fds().get_virtual(fd);
+		const auto& node = machine.fds().vfs->node(vf.node);
+		int64_t base;
+		switch (whence) {
+			case SEEK_SET: base = 0; break;
+			case SEEK_CUR: base = int64_t(vf.offset); break;
+			case SEEK_END: base = int64_t(node.size); break;
+			default: base = -1; break;
+		}
+		const int64_t pos = base + int64_t(std::make_signed_t<address_type<W>>(offset));
+		if (base < 0 || pos < 0 || (node.is_dir() && whence != SEEK_SET)) {
+			machine.set_result(-EINVAL);
+		} else {
+			vf.offset = uint64_t(pos);
+			machine.set_result(pos);
+		}
+	} else if (machine.has_file_descriptors()) {
 		const int real_fd = machine.fds().get(fd);
 #ifndef __wasm__
 		long res = lseek(real_fd, offset, whence);
@@ -342,6 +496,12 @@ static void syscall_read(Machine<W>& machine)
 		}
 		machine.set_result_or_error(result);
 		return;
+	} else if (machine.has_file_descriptors() && machine.fds().get_virtual(vfd) != nullptr) {
+		auto& vf = *machine.fds().get_virtual(vfd);
+		const long res = vfs_read(machine, vf, address, len, vf.offset);
+		if (res > 0)
+			vf.offset += res;
+		machine.set_result(res);
 	} else if (machine.has_file_descriptors()) {
 		const int real_fd = machine.fds().translate(vfd);
 
@@ -367,7 +527,9 @@ static void syscall_pread64(Machine<W>& machine)
 	const auto offset  = machine.sysarg(3);
 	SYSPRINT("SYSCALL pread64, vfd: %d addr: 0x%lX, len: %zu, offset: %lu\n",
 		vfd, (long)address, len, (long)offset);
-	if (machine.has_file_descriptors()) {
+	if (machine.has_file_descriptors() && machine.fds().get_virtual(vfd) != nullptr) {
+		machine.set_result(vfs_read(machine, *machine.fds().get_virtual(vfd), address, len, offset));
+	} else if (machine.has_file_descriptors()) {
 		const int real_fd = machine.fds().translate(vfd);
 
 		std::array<riscv::vBuffer, 512> buffers;
@@ -481,6 +643,27 @@ static void syscall_readv(Machine<W>& machine)
 		return;
 	} else if (vfd == 1 || vfd == 2) {
 		real_fd = -1;
+	} else if (machine.has_file_descriptors() && machine.fds().get_virtual(vfd) != nullptr) {
+		auto& vf = *machine.fds().get_virtual(vfd);
+		std::array<guest_iovec<W>, 128> g_vec;
+		machine.copy_from_guest(g_vec.data(), iov_g, sizeof(guest_iovec<W>) * count);
+
+		long total = 0;
+		for (int i = 0; i < count; i++) {
+			const long res = vfs_read(machine, vf, g_vec[i].iov_base, g_vec[i].iov_len, vf.offset);
+			if (res < 0) {
+				total = (total > 0) ? total : res;
+				break;
+			}
+			vf.offset += res;
+			total += res;
+			if (size_t(res) < g_vec[i].iov_len)
+				break;
+		}
+		machine.set_result(total);
+		SYSPRINT("SYSCALL readv(vfd: %d iov: 0x%lX cnt: %d) = %ld\n",
+			vfd, (long)iov_g, count, (long)machine.return_value());
+		return;
 	} else if (machine.has_file_descriptors()) {
 		real_fd = machine.fds().translate(vfd);
 	}
@@ -585,6 +768,26 @@ static void syscall_openat(Machine<W>& machine)
 	SYSPRINT("SYSCALL openat, dir_fd: %d path: %s flags: %X mode: %o\n",
 		dir_fd, path.c_str(), flags, mode);
 
+	if (machine.has_file_descriptors()) {
+		const int node = vfs_resolve(machine, dir_fd, path, (flags & LINUX_O_NOFOLLOW) == 0);
+		if (node != VFS_MISS) {
+			const auto& vfs = *machine.fds().vfs;
+			if (node < 0)
+				machine.set_result(node);
+			else if ((flags & (LINUX_O_ACCMODE | LINUX_O_CREAT | LINUX_O_TRUNC)) != 0)
+				machine.set_result(-EROFS);
+			else if ((flags & LINUX_O_DIRECTORY) != 0 && !vfs.node(node).is_dir())
+				machine.set_result(-ENOTDIR);
+			else if (vfs.node(node).type == VirtualFS::SYMLINK)
+				machine.set_result(-ELOOP); // O_NOFOLLOW
+			else
+				machine.set_result(machine.fds().assign_virtual(node));
+			SYSPRINT("SYSCALL openat(path: %s) => %d (vfs)\n",
+				path.c_str(), machine.template return_value<int>());
+			return;
+		}
+	}
+
 	if (machine.has_file_descriptors() && machine.fds().permit_filesystem) {
 
 		if (machine.fds().filter_open != nullptr) {
@@ -621,6 +824,8 @@ static void syscall_close(riscv::Machine<W>& machine)
 	if (vfd >= 0 && vfd <= 2) {
 		// TODO: Do we really want to close them?
 		machine.set_result(0);
+	} else if (machine.has_file_descriptors() && machine.fds().erase_virtual(vfd)) {
+		machine.set_result(0);
 	} else if (machine.has_file_descriptors()) {
 		const int res = machine.fds().erase(vfd);
 		if (res > 0) {
@@ -734,7 +939,17 @@ static void syscall_fcntl(Machine<W>& machine)
 	const auto arg3 = machine.sysarg(4);
 	int real_fd = -EBADFD;
 
-	if (machine.has_file_descriptors()) {
+	if (machine.has_file_descriptors() && machine.fds().get_virtual(vfd) != nullptr) {
+		// Files in the virtual filesystem are always read-only, and
+		// there is nothing to inherit across exec
+		switch (cmd) {
+			case F_GETFD: case F_SETFD: case F_GETFL: case F_SETFL:
+				machine.set_result(0);
+				break;
+			default:
+				machine.set_result(-EINVAL);
+		}
+	} else if (machine.has_file_descriptors()) {
 		real_fd = machine.fds().translate(vfd);
 		int res = fcntl(real_fd, cmd, arg1, arg2, arg3);
 		machine.set_result_or_error(res);
@@ -805,6 +1020,24 @@ void syscall_readlinkat(Machine<W>& machine)
 	SYSPRINT("SYSCALL readlinkat, fd: %d path: %s buffer: 0x%lX size: %zu\n",
 		vfd, original_path.c_str(), (long)g_buf, (size_t)bufsize);
 
+	if (machine.has_file_descriptors()) {
+		const int node = vfs_resolve(machine, vfd, original_path, false);
+		if (node != VFS_MISS) {
+			const auto& vfs = *machine.fds().vfs;
+			if (node < 0) {
+				machine.set_result(node);
+			} else if (vfs.node(node).type != VirtualFS::SYMLINK) {
+				machine.set_result(-EINVAL);
+			} else {
+				const auto& target = vfs.node(node).target;
+				const size_t len = std::min(size_t(bufsize), target.size());
+				machine.copy_to_guest(g_buf, target.data(), len);
+				machine.set_result(len);
+			}
+			return;
+		}
+	}
+
 	char buffer[1024];
 	if (bufsize > sizeof(buffer)) {
 		machine.set_result(-ENOMEM);
@@ -909,6 +1142,21 @@ inline void copy_stat_buffer(struct stat& st, struct riscv_stat& rst)
 	#endif
 }
 
+static void vfs_stat(const VirtualFS& vfs, uint32_t idx, struct riscv_stat& rst)
+{
+	const auto& node = vfs.node(idx);
+	std::memset(&rst, 0, sizeof(rst));
+	rst.st_ino = idx + 1;
+	rst.st_mode = node.st_mode();
+	rst.st_nlink = node.is_dir() ? 2 : 1;
+	rst.st_size = node.size;
+	rst.st_blksize = 4096;
+	rst.st_blocks = (node.size + 511) / 512;
+	rst.rv_atime = node.mtime;
+	rst.rv_mtime = node.mtime;
+	rst.rv_ctime = node.mtime;
+}
+
 
 template <int W>
 static void syscall_getcwd(Machine<W>& machine)
@@ -944,6 +1192,27 @@ static void syscall_fstatat(Machine<W>& machine)
 
 	std::string path = machine.memory.memstring(g_path);
 
+	if (machine.has_file_descriptors()) {
+		int node = VFS_MISS;
+		if (path.empty() && (flags & LINUX_AT_EMPTY_PATH) != 0) {
+			if (auto* vf = machine.fds().get_virtual(vfd); vf != nullptr)
+				node = int(vf->node);
+		} else {
+			node = vfs_resolve(machine, vfd, path, (flags & LINUX_AT_SYMLINK_NOFOLLOW) == 0);
+		}
+		if (node != VFS_MISS) {
+			if (node >= 0) {
+				struct riscv_stat rst;
+				vfs_stat(*machine.fds().vfs, node, rst);
+				machine.copy_to_guest(g_buf, &rst, sizeof(rst));
+			}
+			machine.set_result(node >= 0 ? 0 : node);
+			SYSPRINT("SYSCALL fstatat, fd: %d path: %s (vfs) => %d\n",
+				vfd, path.c_str(), (int)machine.return_value());
+			return;
+		}
+	}
+
 	if (machine.has_file_descriptors() && machine.fds().permit_filesystem) {
 
 		int real_fd = machine.fds().translate(vfd);
@@ -992,6 +1261,17 @@ static void syscall_faccessat(Machine<W>& machine)
 	SYSPRINT("SYSCALL faccessat, fd: %d path: %s)\n",
 			vfd, path.c_str());
 
+	if (machine.has_file_descriptors()) {
+		const int node = vfs_resolve(machine, vfd, path, (flags & LINUX_AT_SYMLINK_NOFOLLOW) == 0);
+		if (node != VFS_MISS) {
+			if (node < 0)
+				machine.set_result(node);
+			else
+				machine.set_result((mode & W_OK) ? -EROFS : 0);
+			return;
+		}
+	}
+
 	if (!machine.has_file_descriptors() || !machine.fds().permit_filesystem) {
 		machine.set_result(-ENOSYS);
 		return;
@@ -1016,7 +1296,12 @@ static void syscall_fstat(Machine<W>& machine)
 	const auto vfd = machine.template sysarg<int> (0);
 	const auto g_buf = machine.sysarg(1);
 
-	if (machine.has_file_descriptors()) {
+	if (machine.has_file_descriptors() && machine.fds().get_virtual(vfd) != nullptr) {
+		struct riscv_stat rst;
+		vfs_stat(*machine.fds().vfs, machine.fds().get_virtual(vfd)->node, rst);
+		machine.copy_to_guest(g_buf, &rst, sizeof(rst));
+		machine.set_result(0);
+	} else if (machine.has_file_descriptors()) {
 
 		const int real_fd = machine.fds().translate(vfd);
 
@@ -1118,17 +1403,21 @@ static void nanosleep_clamp_and_penalize(Machine<W>& machine, struct timespec& t
 		ts_req.tv_sec = NANOSLEEP_MAX_SECONDS;
 	// One instruction per microsecond requested
 	machine.penalize(requested_ns / 1000);
+}
 
-	// Cooperative threading: sleeping on the host blocks every guest thread,
-	// not just this one. When another thread is runnable, sleep only briefly
-	// and let the yield below hand the time over to it instead.
-	if (machine.has_threads() && !machine.threads().suspended_threads().empty()) {
-		static constexpr long SHARED_SLEEP_MAX_NS = 1'000'000L; // 1ms
-		if (ts_req.tv_sec > 0 || ts_req.tv_nsec > SHARED_SLEEP_MAX_NS) {
-			ts_req.tv_sec  = 0;
-			ts_req.tv_nsec = SHARED_SLEEP_MAX_NS;
-		}
-	}
+/// @brief Sleep as a green thread, while the other guest threads run.
+/// @details Sleeping on the host blocks every guest thread, not just this
+/// one. When another thread is runnable, this one waits in the scheduler
+/// instead, until rdtime() passes the end of the sleep.
+/// @return True when another thread is now running.
+template <int W>
+static bool nanosleep_as_thread(Machine<W>& machine, const struct timespec& ts_req)
+{
+	if (!machine.has_threads() || machine.threads().suspended_threads().empty())
+		return false;
+	const uint64_t micros =
+		uint64_t(ts_req.tv_sec) * 1'000'000ull + uint64_t(ts_req.tv_nsec) / 1000;
+	return machine.threads().sleep(machine.rdtime() + micros);
 }
 
 /// @brief Hand over to the other guest threads after sleeping.
@@ -1158,6 +1447,8 @@ static void syscall_nanosleep(Machine<W>& machine)
 	if (!(machine.has_file_descriptors() && machine.fds().proxy_mode))
 		ts_req.tv_nsec &= ANTI_FINGERPRINTING_MASK_NANOS();
 	nanosleep_clamp_and_penalize(machine, ts_req);
+	if (nanosleep_as_thread(machine, ts_req))
+		return;
 
 	struct timespec ts_rem;
 	if (g_rem)
@@ -1188,6 +1479,8 @@ static void syscall_clock_nanosleep(Machine<W>& machine)
 	if (!(machine.has_file_descriptors() && machine.fds().proxy_mode))
 		ts_req.tv_nsec &= ANTI_FINGERPRINTING_MASK_NANOS();
 	nanosleep_clamp_and_penalize(machine, ts_req);
+	if (nanosleep_as_thread(machine, ts_req))
+		return;
 
 	const int res = nanosleep(&ts_req, &ts_rem);
 	if (res >= 0 && g_remain != 0x0) {
@@ -1342,17 +1635,39 @@ static void syscall_getrandom(Machine<W>& machine)
 	}
 }
 
-#if defined(__linux__) && !defined(__ANDROID__)
+// The statx structure is the same on every architecture
+struct riscv_statx_timestamp {
+	int64_t  tv_sec;
+	uint32_t tv_nsec;
+	int32_t  __reserved;
+};
+struct riscv_statx {
+	uint32_t stx_mask;
+	uint32_t stx_blksize;
+	uint64_t stx_attributes;
+	uint32_t stx_nlink;
+	uint32_t stx_uid;
+	uint32_t stx_gid;
+	uint16_t stx_mode;
+	uint16_t __spare0;
+	uint64_t stx_ino;
+	uint64_t stx_size;
+	uint64_t stx_blocks;
+	uint64_t stx_attributes_mask;
+	riscv_statx_timestamp stx_atime, stx_btime, stx_ctime, stx_mtime;
+	uint32_t stx_rdev_major, stx_rdev_minor;
+	uint32_t stx_dev_major, stx_dev_minor;
+	uint64_t __spare2[14];
+};
+static_assert(sizeof(riscv_statx) == 256);
+
 template <int W>
 static void syscall_statx(Machine<W>& machine)
 {
-	machine.set_result(-ENOSYS);
-	return;
-
 	const int   dir_fd = machine.template sysarg<int> (0);
 	const auto  g_path = machine.sysarg(1);
 	const int    flags = machine.template sysarg<int> (2);
-	const auto    mask = machine.template sysarg<uint32_t> (3);
+	[[maybe_unused]] const auto mask = machine.template sysarg<uint32_t> (3);
 	const auto  buffer = machine.sysarg(4);
 
 	const auto path = machine.memory.memstring(g_path);
@@ -1360,6 +1675,42 @@ static void syscall_statx(Machine<W>& machine)
 	SYSPRINT("SYSCALL statx, fd: %d path: %s flags: %x buf: 0x%lX)\n",
 			dir_fd, path.c_str(), flags, (long)buffer);
 
+	if (machine.has_file_descriptors()) {
+		int node = VFS_MISS;
+		if (path.empty() && (flags & LINUX_AT_EMPTY_PATH) != 0) {
+			if (auto* vf = machine.fds().get_virtual(dir_fd); vf != nullptr)
+				node = int(vf->node);
+		} else {
+			node = vfs_resolve(machine, dir_fd, path, (flags & LINUX_AT_SYMLINK_NOFOLLOW) == 0);
+		}
+		if (node != VFS_MISS) {
+			if (node >= 0) {
+				struct riscv_stat rst;
+				vfs_stat(*machine.fds().vfs, node, rst);
+				struct riscv_statx stx;
+				std::memset(&stx, 0, sizeof(stx));
+				stx.stx_mask = 0x7FF; // STATX_BASIC_STATS
+				stx.stx_blksize = rst.st_blksize;
+				stx.stx_nlink = rst.st_nlink;
+				stx.stx_mode = uint16_t(rst.st_mode);
+				stx.stx_ino = rst.st_ino;
+				stx.stx_size = rst.st_size;
+				stx.stx_blocks = rst.st_blocks;
+				stx.stx_atime.tv_sec = rst.rv_atime;
+				stx.stx_ctime.tv_sec = rst.rv_ctime;
+				stx.stx_mtime.tv_sec = rst.rv_mtime;
+				machine.copy_to_guest(buffer, &stx, sizeof(stx));
+			}
+			machine.set_result(node >= 0 ? 0 : node);
+			return;
+		}
+	}
+
+	machine.set_result(-ENOSYS);
+#if defined(__linux__) && !defined(__ANDROID__)
+	// Host statx is disabled
+	return;
+
 	if (machine.has_file_descriptors() && machine.fds().proxy_mode) {
 		if (machine.fds().filter_stat != nullptr) {
 			if (!machine.fds().filter_stat(machine.template get_userdata<void>(), path)) {
@@ -1377,8 +1728,8 @@ static void syscall_statx(Machine<W>& machine)
 		return;
 	}
 	machine.set_result(-ENOSYS);
-}
 #endif // __linux__
+}
 
 #include "syscalls_mman.cpp"
 
@@ -1402,6 +1753,8 @@ void Machine<W>::setup_newlib_syscalls()
 	install_syscall_handler(169, syscall_gettimeofday<W>);
 	install_syscall_handler(214, syscall_brk<W>);
 	install_syscall_handler(403, syscall_clock_gettime64<W>);
+	set_deterministic_syscall(93);
+	set_deterministic_syscall(214);
 }
 template <int W>
 void Machine<W>::setup_newlib_syscalls(bool filesystem)
@@ -1571,13 +1924,19 @@ void Machine<W>::setup_linux_syscalls(bool filesystem, bool sockets)
 
 	install_syscall_handler(278, syscall_getrandom<W>);
 
-#if defined(__linux__) && !defined(__ANDROID__)
 	// statx
 	install_syscall_handler(291, syscall_statx<W>);
-#endif
 	// rseq
 	install_syscall_handler(293, syscall_stub_nosys<W>);
 
+	// Replays run the system calls that only depend on the machine again
+	for (size_t sysnum : {93, 94, 132, 134, 135, 139, 214, 259})
+		set_deterministic_syscall(sysnum);
+	if (!this->has_threads()) {
+		for (size_t sysnum : {96, 99, 261})
+			set_deterministic_syscall(sysnum);
+	}
+
 	add_mman_syscalls<W>();
 
 	if (filesystem || sockets) {
@@ -0,0 +1,257 @@
+#pragma once
+#include "instruction_list.hpp"
+#include "rv32i_instr.hpp"
+#include "types.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace riscv
+{
+	/// @brief A counted loop whose memory accesses can be bounds-checked once,
+	/// each time its back-edge is taken, instead of once per access.
+	/// @details The loop is a straight run of instructions from the target of
+	/// its latch, the backward branch at the end, to the latch itself. The
+	/// latch is the only way back to the header and every other branch leaves
+	/// the loop, so each iteration runs the whole body once. A base register is
+	/// covered when the loop leaves it alone, or when it is an induction
+	/// variable, stepped by a constant once per iteration. The latch compares
+	/// an induction variable against a register that the loop leaves alone,
+	/// which limits how many iterations can follow a taken back-edge. Within
+	/// that limit, all accesses through one covered register fall in a single
+	/// range of addresses. When every range is inside the arena, the back-edge
+	/// enters a second version of the loop, which has no checks on them.
+	template <int W>
+	struct HoistedLoop
+	{
+		using address_t = address_type<W>;
+		// More ranges make the check at the back-edge more expensive than
+		// what is saved by removing the checks inside the loop
+		static constexpr size_t MAX_RANGES = 8;
+
+		// How the latch keeps the loop going. D is the distance from the
+		// induction variable to the bound, in the direction of the step.
+		enum Condition : uint8_t {
+			NOT_EQUAL, // BNE: D / |step| iterations, when |step| divides D
+			BEFORE,    // BLT, BLTU: (D - 1) / |step| + 1 iterations
+			UP_TO,     // BGE, BGEU: D / |step| + 1 iterations
+		};
+
+		/// @brief The accesses through `reg` touch [reg + lo, reg + hi) in the
+		/// first iteration, and `reg` changes by `step` in each iteration.
+		struct Range {
+			uint8_t  reg = 0;
+			bool     write = false;
+			int32_t  step = 0;
+			int64_t  lo = 0;
+			int64_t  hi = 0;
+		};
+
+		size_t    header = 0;    // Index of the first instruction of the loop
+		size_t    latch = 0;     // Index of the backward branch
+		uint8_t   iv = 0;        // The induction variable the latch tests
+		uint8_t   bound = 0;     // The register it is tested against
+		int32_t   step = 0;      // How much iv changes per iteration
+		Condition condition = NOT_EQUAL;
+		uint32_t  covered = 0;   // Base registers whose accesses are in a range
+		unsigned  max_shift = 0; // The largest shift_of() of a range step
+		std::vector<Range> ranges;
+
+		bool covers(unsigned reg) const noexcept { return (covered >> reg) & 1; }
+		/// @brief log2(|step|), for the power-of-two steps an induction variable has.
+		static unsigned shift_of(int32_t step) noexcept {
+			unsigned shift = 0;
+			for (uint32_t s = (step < 0) ? uint32_t(-int64_t(step)) : uint32_t(step); s > 1; s >>= 1)
+				shift++;
+			return shift;
+		}
+
+		/// @brief Analyze a loop, given as the instructions from its header to
+		/// its latch, and their addresses.
+		/// @param pcs The address of each instruction.
+		/// @param instrs The instructions, with compressed ones already expanded.
+		/// @return The loop, with `header` 0 and `latch` the last index, or
+		/// nothing when the loop does not qualify, or has nothing to gain.
+		static std::optional<HoistedLoop> analyze(const std::vector<address_t>& pcs,
+			const std::vector<rv32i_instruction>& instrs)
+		{
+			if (instrs.size() < 2 || pcs.size() != instrs.size())
+				return std::nullopt;
+			const address_t first_pc = pcs.front();
+			const address_t latch_pc = pcs.back();
+
+			struct Access {
+				uint8_t base;
+				bool    write;
+				int32_t offset;
+				unsigned size;
+			};
+			std::vector<Access> accesses;
+			std::array<uint8_t, 32> writes {};
+			std::array<int32_t, 32> steps {};
+			const auto write = [&] (unsigned reg) {
+				if (reg != 0 && writes[reg] < 2) writes[reg]++;
+			};
+
+			for (size_t i = 0; i + 1 < instrs.size(); i++)
+			{
+				const auto& in = instrs[i];
+				switch (in.opcode()) {
+				case RV32I_LUI:
+				case RV32I_AUIPC:
+				case RV32I_OP:
+				case RV64I_OP_IMM32:
+				case RV64I_OP32:
+					write(in.Itype.rd);
+					break;
+				case RV32I_OP_IMM:
+					write(in.Itype.rd);
+					// ADDI x, x, imm is a candidate induction variable
+					if (in.Itype.funct3 == 0x0 && in.Itype.rd == in.Itype.rs1)
+						steps[in.Itype.rd] = in.Itype.signed_imm();
+					break;
+				case RV32I_LOAD:
+					if (!valid_load(in.Itype.funct3))
+						return std::nullopt;
+					write(in.Itype.rd);
+					accesses.push_back({ uint8_t(in.Itype.rs1), false,
+						in.Itype.signed_imm(), 1u << (in.Itype.funct3 & 0x3) });
+					break;
+				case RV32I_STORE:
+					if (in.Stype.funct3 > ((W == 4) ? 2u : 3u))
+						return std::nullopt;
+					accesses.push_back({ uint8_t(in.Stype.rs1), true,
+						in.Stype.signed_imm(), 1u << in.Stype.funct3 });
+					break;
+				case RV32F_LOAD:
+					// FLH, FLW and FLD. Vector loads share the opcode.
+					if (in.Itype.funct3 < 0x1 || in.Itype.funct3 > 0x3)
+						return std::nullopt;
+					accesses.push_back({ uint8_t(in.Itype.rs1), false,
+						in.Itype.signed_imm(), 1u << in.Itype.funct3 });
+					break;
+				case RV32F_STORE:
+					if (in.Stype.funct3 < 0x1 || in.Stype.funct3 > 0x3)
+						return std::nullopt;
+					accesses.push_back({ uint8_t(in.Stype.rs1), true,
+						in.Stype.signed_imm(), 1u << in.Stype.funct3 });
+					break;
+				case RV32F_FMADD:
+				case RV32F_FMSUB:
+				case RV32F_FNMSUB:
+				case RV32F_FNMADD:
+					break;
+				case RV32F_FPFUNC:
+					// FEQ/FLT/FLE, FCVT.W[U].* and FMV.X.*/FCLASS write x[rd]
+					switch (in.Rtype.funct7 >> 2) {
+					case RV32F__FEQ_LT_LE:
+					case RV32F__FCVT_W_SD:
+					case RV32F__FMV_X_W:
+						write(in.Rtype.rd);
+						break;
+					}
+					break;
+				case RV32I_BRANCH: {
+					// Only the latch may stay inside the loop
+					const address_t target = pcs[i] + in.Btype.signed_imm();
+					if (target >= first_pc && target <= latch_pc)
+						return std::nullopt;
+					if (in.Btype.funct3 == 0x2 || in.Btype.funct3 == 0x3)
+						return std::nullopt;
+					} break;
+				default:
+					// Calls, jumps, system calls, atomics and vectors
+					return std::nullopt;
+				}
+			}
+
+			const auto invariant = [&] (unsigned reg) {
+				return reg == 0 || writes[reg] == 0;
+			};
+			// Written exactly once, by ADDI x, x, imm, with a power-of-two imm
+			const auto induction = [&] (unsigned reg) -> int32_t {
+				if (reg == 0 || writes[reg] != 1)
+					return 0;
+				const int32_t step = steps[reg];
+				const uint32_t magnitude = (step < 0) ? uint32_t(-step) : uint32_t(step);
+				if (magnitude == 0 || (magnitude & (magnitude - 1)) != 0)
+					return 0;
+				return step;
+			};
+
+			HoistedLoop loop;
+			loop.header = 0;
+			loop.latch = instrs.size() - 1;
+			const auto& br = instrs.back();
+			if (br.opcode() != RV32I_BRANCH || pcs.back() + br.Btype.signed_imm() != first_pc)
+				return std::nullopt;
+			const unsigned rs1 = br.Btype.rs1, rs2 = br.Btype.rs2;
+			bool iv_first;
+			if (induction(rs1) != 0 && invariant(rs2)) {
+				loop.iv = rs1; loop.bound = rs2; iv_first = true;
+			} else if (induction(rs2) != 0 && invariant(rs1)) {
+				loop.iv = rs2; loop.bound = rs1; iv_first = false;
+			} else {
+				return std::nullopt;
+			}
+			loop.step = induction(loop.iv);
+			// The induction variable must move towards the bound
+			const bool upwards = (loop.step > 0) == iv_first;
+			switch (br.Btype.funct3) {
+			case 0x1: // BNE
+				loop.condition = NOT_EQUAL;
+				break;
+			case 0x4: // BLT
+			case 0x6: // BLTU
+				if (!upwards)
+					return std::nullopt;
+				loop.condition = BEFORE;
+				break;
+			case 0x5: // BGE
+			case 0x7: // BGEU
+				if (upwards)
+					return std::nullopt;
+				loop.condition = UP_TO;
+				break;
+			default:
+				return std::nullopt;
+			}
+
+			for (const auto& access : accesses)
+			{
+				int32_t step = 0;
+				if (!invariant(access.base)) {
+					step = induction(access.base);
+					if (step == 0)
+						continue; // Not covered, and keeps its checks
+				}
+				auto it = std::find_if(loop.ranges.begin(), loop.ranges.end(),
+					[&] (const Range& r) { return r.reg == access.base && r.write == access.write; });
+				if (it == loop.ranges.end()) {
+					if (loop.ranges.size() >= MAX_RANGES)
+						return std::nullopt;
+					loop.ranges.push_back({ access.base, access.write, step,
+						access.offset, int64_t(access.offset) + access.size });
+					loop.max_shift = std::max(loop.max_shift, shift_of(step));
+				} else {
+					it->lo = std::min(it->lo, int64_t(access.offset));
+					it->hi = std::max(it->hi, int64_t(access.offset) + access.size);
+				}
+				loop.covered |= 1u << access.base;
+			}
+			if (loop.ranges.empty())
+				return std::nullopt;
+			return loop;
+		}
+
+	private:
+		static bool valid_load(unsigned funct3) noexcept {
+			if constexpr (W == 4)
+				return funct3 <= 2 || funct3 == 4 || funct3 == 5;
+			else
+				return funct3 <= 6;
+		}
+	};
+}
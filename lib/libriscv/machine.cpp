@@ -1,10 +1,13 @@
 #include "machine.hpp"
+#include "guarded_arena.hpp"
 #include "internal_common.hpp"
 #include "native_heap.hpp"
+#include "replay.hpp"
 #include "rv32i_instr.hpp"
 #include "threads.hpp"
 #include "util/auxvec.hpp"
 #include <algorithm>
+#include <chrono>
 #include <errno.h> // Used by emulated POSIX system calls
 #include <random>
 #ifdef __GNUG__ /* Workaround for GCC bug */
@@ -35,9 +38,14 @@ namespace riscv
 	{
 		this->m_counter = other.m_counter;
 		this->m_max_counter = other.m_max_counter;
+		this->m_vdso_data = other.m_vdso_data;
 		if (other.m_mt) {
 			m_mt.reset(new MultiThreading {*this, *other.m_mt});
 		}
+#ifdef RISCV_STATISTICS
+		if (other.m_statistics)
+			this->enable_statistics();
+#endif
 		// TODO: transfer arena?
 	}
 
@@ -101,10 +109,80 @@ namespace riscv
 	template <int W> RISCV_COLD_PATH()
 	void Machine<W>::timeout_exception(uint64_t max_instr)
 	{
+		if (interrupt_requested())
+			throw MachineTimeoutException(EXECUTION_INTERRUPTED,
+				"Execution interrupted", max_instr);
 		throw MachineTimeoutException(MAX_INSTRUCTIONS_REACHED,
 			"Instruction count limit reached", max_instr);
 	}
 
+	template <int W>
+	void Machine<W>::enable_statistics(bool enabled)
+	{
+#ifdef RISCV_STATISTICS
+		if (enabled)
+			this->m_statistics = std::make_unique<MachineStatistics>();
+		else
+			this->m_statistics = nullptr;
+#else
+		if (enabled)
+			throw MachineException(FEATURE_DISABLED, "Statistics are not enabled (RISCV_STATISTICS)");
+#endif
+	}
+
+#ifdef RISCV_STATISTICS
+	template <int W>
+	void Machine<W>::counted_system_call(Machine<W>& machine, size_t sysnum, syscall_t handler)
+	{
+		// The handler may throw, and it may also disable statistics
+		struct Timer {
+			Machine<W>& machine;
+			size_t sysnum;
+			std::chrono::steady_clock::time_point begin;
+			~Timer() {
+				if (auto* stats = machine.statistics()) {
+					auto& sc = stats->syscalls[sysnum];
+					sc.calls++;
+					sc.nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+						std::chrono::steady_clock::now() - begin).count();
+				}
+			}
+		} timer { machine, sysnum, std::chrono::steady_clock::now() };
+		handler(machine);
+	}
+#endif
+
+	template <int W>
+	bool Machine<W>::simulate_guarded(address_t pc, uint64_t counter, uint64_t max_instr, bool inaccurate)
+	{
+		struct Call {
+			CPU<W>&   cpu;
+			address_t pc;
+			uint64_t  counter;
+			uint64_t  max_instr;
+			bool      inaccurate;
+			bool      result;
+		} call { cpu, pc, counter, max_instr, inaccurate, true };
+
+		// Generated code reaches the whole window, through masked addresses
+		auto* arena = (const uint8_t *)memory.memory_arena_ptr();
+		auto* window = arena - Memory<W>::OVERALLOCATE;
+		uintptr_t fault = 0;
+		const bool returned = run_guarded(window, window + Memory<W>::GUARDED_WINDOW_SIZE,
+			[] (void* arg) {
+				auto& c = *(Call *)arg;
+				if (c.inaccurate)
+					c.cpu.simulate_inaccurate(c.pc);
+				else
+					c.result = c.cpu.simulate(c.pc, c.counter, c.max_instr);
+			}, &call, fault);
+		if (UNLIKELY(!returned)) {
+			// The PC is the last one that the generated code made visible
+			CPU<W>::trigger_exception(PROTECTION_FAULT, address_t(fault - uintptr_t(arena)));
+		}
+		return call.result;
+	}
+
 	template <int W>
 	void Machine<W>::setup_argv(
 		const std::vector<std::string>& args,
@@ -183,6 +261,7 @@ namespace riscv
 
 		std::array<uint8_t, 16> canary;
 		std::generate(canary.begin(), canary.end(), [&] { return rand(rd); });
+		this->replay_input(canary.data(), canary.size());
 		push_down(*this, dst, canary.data(), canary.size());
 		const auto canary_addr = dst;
 
@@ -255,6 +334,8 @@ namespace riscv
 
 		// supplemental randomness
 		push_aux<W>(argv, {AT_RANDOM, canary_addr});
+		if (this->vdso_address() != 0)
+			push_aux<W>(argv, {AT_SYSINFO_EHDR, this->vdso_address()});
 		push_aux<W>(argv, {AT_NULL, 0});
 
 		// from this point on the stack is starting, pointing @ argc
@@ -445,10 +526,10 @@ namespace riscv
 					cpu.trigger_exception(ILLEGAL_OPERATION, instr.Itype.imm);
 					return;
 				}
-				if (rd) cpu.reg(instr.Itype.rd) = m_rdtime(*this);
+				if (rd) cpu.reg(instr.Itype.rd) = this->rdtime();
 				return;
 			case 0xC81: // CSR RDTIME (upper)
-				if (rd) cpu.reg(instr.Itype.rd) = m_rdtime(*this) >> 32u;
+				if (rd) cpu.reg(instr.Itype.rd) = this->rdtime() >> 32u;
 				return;
 			case 0xF11: // CSR marchid
 				// Machine-level CSRs are not accessible to the U-mode guest
@@ -491,7 +572,7 @@ namespace riscv
 					cpu.trigger_exception(ILLEGAL_OPERATION, instr.Itype.imm);
 					return;
 				}
-				if (rd) cpu.reg(instr.Itype.rd) = m_rdtime(*this);
+				if (rd) cpu.reg(instr.Itype.rd) = this->rdtime();
 				return;
 			}
 			break;
@@ -571,10 +652,10 @@ namespace riscv
 					cpu.trigger_exception(ILLEGAL_OPERATION, instr.Itype.imm);
 					return;
 				}
-				if (rd) cpu.reg(instr.Itype.rd) = m_rdtime(*this);
+				if (rd) cpu.reg(instr.Itype.rd) = this->rdtime();
 				return;
 			case 0xC81: // CSR RDTIME (upper)
-				if (rd) cpu.reg(instr.Itype.rd) = m_rdtime(*this) >> 32u;
+				if (rd) cpu.reg(instr.Itype.rd) = this->rdtime() >> 32u;
 				return;
 			default:
 				handle_unhandled_csr(*this, instr.Itype.imm, instr.Itype.rd, instr.Itype.rs1);
@@ -603,7 +684,7 @@ namespace riscv
 					cpu.trigger_exception(ILLEGAL_OPERATION, instr.Itype.imm);
 					return;
 				}
-				if (rd) cpu.reg(instr.Itype.rd) = m_rdtime(*this);
+				if (rd) cpu.reg(instr.Itype.rd) = this->rdtime();
 				return;
 			default:
 				handle_unhandled_csr(*this, instr.Itype.imm, instr.Itype.rd, instr.Itype.rs1);
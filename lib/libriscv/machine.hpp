@@ -4,6 +4,10 @@
 #include "riscvbase.hpp"
 #include "posix/filedesc.hpp"
 #include "posix/signals.hpp"
+#include "statistics.hpp"
+#include "watchdog.hpp"
+#include <atomic>
+#include <chrono>
 #ifdef __cpp_exceptions
 # include "guest_datatypes.hpp"
 #endif
@@ -13,6 +17,7 @@ namespace riscv
 	static constexpr int RISCV32  = 4; /* 32-bits CPU */
 	static constexpr int RISCV64  = 8; /* 64-bits CPU */
 	static constexpr int RISCV128 = 16; /* 128-bits CPU */
+	template <int W> struct ExecutionReplay;
 
 	/// Machine is a RISC-V emulator. The W template parameter is
 	/// used to determine the bit-architecture, like so:
@@ -37,6 +42,7 @@ namespace riscv
 		using printer_func = void(*)(const Machine&, const char*, size_t);
 		using stdin_func = long(*)(const Machine&, char*, size_t);
 		using rdtime_func = uint64_t(*)(const Machine&);
+		using syscall_filter_t = bool(*)(const Machine&);
 
 		/// The machine takes the binary as a const reference and does not
 		/// own it, instead the binary data must be kept alive with the machine
@@ -112,6 +118,23 @@ namespace riscv
 		template <bool Throw = true>
 		bool resume(uint64_t max_instructions);
 
+		/// @brief Simulate like simulate(), but also stop when @timeout of
+		/// wall-clock time has passed. The deadline is enforced from a shared
+		/// watchdog thread using request_interrupt(), so the guest pays
+		/// nothing for it while running. An execution stopped by the deadline
+		/// can be continued with resume(), like any other timeout.
+		/// @tparam Throw Throw a MachineTimeoutException if the deadline or
+		/// the instruction limit is reached.
+		/// @param timeout The wall-clock time budget.
+		/// @param max_instructions The maximum number of instructions to
+		/// execute before stopping.
+		/// @param counter Set the initial instruction count.
+		/// @return Returns true if the machine stopped normally, otherwise
+		/// it will return false, but only when Throw == false.
+		template <bool Throw = true>
+		bool simulate_for(std::chrono::nanoseconds timeout,
+			uint64_t max_instructions = UINT64_MAX, uint64_t counter = 0u);
+
 		/// @brief Sets the max instructions counter to zero, which effectively
 		/// causes the machine to stop. instruction_limit_reached() will return
 		/// false indicating that the machine did not stop because an instruction
@@ -134,6 +157,21 @@ namespace riscv
 		/// @return True if execution timed out.
 		bool instruction_limit_reached() const noexcept;
 
+		/// @brief Ask the machine to stop executing as soon as possible. The
+		/// request is noticed in every execution mode, including binary
+		/// translation without instruction counting. Translated code that
+		/// counts instructions notices it within RISCV_INTERRUPT_SLICE
+		/// instructions. It makes simulate() end as if it timed out (with an
+		/// EXECUTION_INTERRUPTED exception when throwing). Unlike stop(), this
+		/// is safe to call from any thread, and from signal handlers.
+		/// The request remains until clear_interrupt(), so that it also
+		/// unwinds nested calls into the guest, like preempt().
+		void request_interrupt() noexcept { m_interrupt.store(1, std::memory_order_relaxed); }
+		/// @brief Returns true if an interrupt has been requested.
+		bool interrupt_requested() const noexcept { return m_interrupt.load(std::memory_order_relaxed) != 0; }
+		/// @brief Clear a requested interrupt, so that execution can resume.
+		void clear_interrupt() noexcept { m_interrupt.store(0, std::memory_order_relaxed); }
+
 		/// @brief Returns the precise number of instructions executed so far.
 		/// Can be called after simulate() ends, or inside a system call handler.
 		/// @return The exact number of instructions executed so far.
@@ -152,6 +190,52 @@ namespace riscv
 		/// @param val The value to add to the instruction counter.
 		void     penalize(uint64_t val);
 
+		/// @brief Start or stop counting events in this machine, such as system
+		/// calls, page faults and entries into native code. Enabling resets the
+		/// counters. A fork of a machine that counts will count on its own,
+		/// starting from zero, so that the host can sum up a fleet of forks.
+		/// @note Requires building with RISCV_STATISTICS.
+		/// @param enabled Whether to count events from now on.
+		void     enable_statistics(bool enabled = true);
+		/// @brief The event counters of this machine.
+		/// @return The counters, or nullptr when statistics are not enabled.
+		MachineStatistics* statistics() const noexcept;
+
+		/// @brief Start recording the nondeterministic inputs of this machine:
+		/// the results of system calls and the guest memory their handlers
+		/// write to, RDTIME values and vDSO time data. The log begins with the
+		/// registers and instruction counter of the machine, and is cheap
+		/// enough to keep recording in production.
+		/// @details System calls marked with set_deterministic_syscall() are
+		/// not recorded, as replays run them again. Start recording before
+		/// setup_linux() in order to also record its stack canary. Threads
+		/// must not have been created before recording starts, and forks do
+		/// not record.
+		/// @note Requires building with RISCV_REPLAY.
+		void start_recording();
+		/// @brief Stop recording.
+		/// @return The log, for start_replay().
+		std::vector<uint8_t> stop_recording();
+		/// @brief Replay the inputs in a log instead of running system calls.
+		/// The machine must be created and set up like the recorded one was,
+		/// and be in the same state as when recording started, which is
+		/// verified. The host must call into it the same way, eg. simulate()
+		/// with the same instruction limits and execution mode (interpreter,
+		/// binary translation). Replays throw ILLEGAL_OPERATION on divergence.
+		/// @param log A log from stop_recording().
+		void start_replay(std::vector<uint8_t> log);
+		/// @brief Stop replaying.
+		/// @return True if the whole log was replayed.
+		bool stop_replay();
+		bool is_recording() const noexcept;
+		bool is_replaying() const noexcept;
+		/// @brief Record a nondeterministic input from the host while
+		/// recording, or replace it with the recorded input while replaying.
+		/// Does nothing otherwise.
+		/// @param data The input, which is read or written in place.
+		/// @param len The length of the input.
+		void replay_input(void* data, size_t len);
+
 		CPU<W>    cpu;
 		Memory<W> memory;
 
@@ -184,6 +268,16 @@ namespace riscv
 		/// @param env An array of program environment variables.
 		void setup_linux(const std::vector<std::string>& args, const std::vector<std::string>& env = {});
 
+		/// @brief Map a vDSO into the guest, which lets glibc and musl read
+		/// CLOCK_REALTIME and CLOCK_MONOTONIC without making a system call.
+		/// Call before setup_linux(), which advertises it with AT_SYSINFO_EHDR.
+		/// The time data is refreshed on each simulate(), and the vDSO falls
+		/// back to system calls when a custom RDTIME function is installed.
+		/// Only available for 64-bit RISC-V.
+		void setup_linux_vdso();
+		/// @brief Returns the guest address of the vDSO ELF image, or 0.
+		address_t vdso_address() const noexcept { return m_vdso_data ? m_vdso_data + Page::size() : 0; }
+
 		/// @brief Retrieve a single argument by its index for a system call.
 		/// Examples: const int arg0 = machine.sysarg <int> (0);
 		/// const std::string arg1 = machine.sysarg <std::string> (1);
@@ -318,7 +412,7 @@ namespace riscv
 		auto& get_stdin() const noexcept { return m_stdin; }
 		void set_stdin(stdin_func sin = default_stdin) noexcept { m_stdin = sin; }
 		// Monotonic time function (used by RDTIME and RDTIMEH)
-		uint64_t rdtime() const { return m_rdtime(*this); }
+		uint64_t rdtime() const;
 		auto& get_rdtime() const noexcept { return m_rdtime; }
 		void set_rdtime(rdtime_func tf = default_rdtime) noexcept { m_rdtime = tf; }
 
@@ -351,6 +445,18 @@ namespace riscv
 		/// @param handlers A list of system call handlers.
 		static void install_syscall_handlers(std::initializer_list<std::pair<size_t, syscall_t>>);
 
+		/// @brief Mark a system call as deterministic: it depends only on the
+		/// state of the machine, so replays run it again instead of feeding it
+		/// the recorded results (see start_recording()).
+		/// @note Installing a handler for the system call removes the mark.
+		/// @param sysnum The system call number.
+		/// @param filter Decides for each call, or nullptr to remove the mark.
+		static void set_deterministic_syscall(size_t sysnum, syscall_filter_t filter = always_deterministic);
+		static bool always_deterministic(const Machine&) noexcept { return true; }
+		// Filters for system calls that are marked as deterministic
+		static inline std::array<syscall_filter_t, RISCV_SYSCALLS_MAX>
+			deterministic_syscalls {};
+
 		static void unknown_syscall_handler(Machine<W>&);
 		static constexpr auto initialize_syscalls() noexcept {
 			std::array<syscall_t, RISCV_SYSCALLS_MAX> arr;
@@ -456,6 +562,7 @@ namespace riscv
 		int deserialize_from(const std::vector<uint8_t>& vec);
 
 		std::pair<uint64_t&, uint64_t&> get_counters() noexcept { return {m_counter, m_max_counter}; }
+		const std::atomic<uint8_t>& interrupt_flag() const noexcept { return m_interrupt; }
 		template <bool Throw = true>
 		bool simulate_with(uint64_t max_instructions, uint64_t counter, address_t pc);
 	private:
@@ -463,20 +570,40 @@ namespace riscv
 		auto resolve_args(std::index_sequence<indices...>) const;
 		static void setup_native_heap_internal(const size_t);
 		[[noreturn]] void timeout_exception(uint64_t);
+		void update_vdso();
+		bool simulate_guarded(address_t pc, uint64_t counter, uint64_t max_instr, bool inaccurate);
+#ifdef RISCV_STATISTICS
+		static void counted_system_call(Machine&, size_t sysnum, syscall_t handler);
+#endif
+		void execute_system_call(size_t sysnum);
+#ifdef RISCV_REPLAY
+		void replayed_system_call(size_t sysnum);
+		uint64_t replayed_rdtime() const;
+		friend struct ExecutionReplay<W>;
+#endif
 		static inline syscall_t m_libc_fastpath_ebreak = nullptr;
 		static inline syscall_t m_previous_ebreak_handler = nullptr;
 
 		uint64_t     m_counter = 0;
 		uint64_t     m_max_counter = 0;
+		// Generated code polls the interrupt right after the counters
+		std::atomic<uint8_t> m_interrupt = 0;
 		mutable void*        m_userdata = nullptr;
 		mutable printer_func m_printer = default_printer;
 		mutable stdin_func   m_stdin = default_stdin;
 		mutable rdtime_func  m_rdtime = default_rdtime;
+		address_t    m_vdso_data = 0;
 		std::unique_ptr<Arena> m_arena;
 		std::unique_ptr<MultiThreading<W>> m_mt = nullptr;
 		std::unique_ptr<FileDescriptors> m_fds = nullptr;
 		std::unique_ptr<Signals<W>> m_signals = nullptr;
 		std::shared_ptr<MachineOptions<W>> m_options = nullptr;
+#ifdef RISCV_STATISTICS
+		std::unique_ptr<MachineStatistics> m_statistics = nullptr;
+#endif
+#ifdef RISCV_REPLAY
+		std::unique_ptr<ExecutionReplay<W>> m_replay = nullptr;
+#endif
 
 		static_assert((W == 4 || W == 8 || W == 16), "Must be either 32-bit, 64-bit or 128-bit ISA");
 		static void default_printer(const Machine&, const char*, size_t);
@@ -16,7 +16,15 @@ template <int W>
 template <bool Throw>
 inline bool Machine<W>::simulate_with(uint64_t max_instr, uint64_t counter, address_t pc)
 {
-	const bool stopped_normally = cpu.simulate(pc, counter, max_instr);
+	if (UNLIKELY(m_vdso_data != 0))
+		this->update_vdso();
+	bool stopped_normally;
+	if (UNLIKELY(memory.uses_guarded_arena()))
+		stopped_normally = this->simulate_guarded(pc, counter, max_instr, false);
+	else
+		stopped_normally = cpu.simulate(pc, counter, max_instr);
+	if (UNLIKELY(!stopped_normally))
+		RISCV_STAT_INC(*this, timeouts);
 	if constexpr (Throw) {
 		// The simulation either ends normally, or it throws an exception
 		if (UNLIKELY(!stopped_normally))
@@ -43,6 +51,34 @@ inline bool Machine<W>::resume(uint64_t max_instr)
 	return this->simulate<Throw>(this->instruction_counter() + max_instr, this->instruction_counter());
 }
 
+template <int W>
+template <bool Throw>
+inline bool Machine<W>::simulate_for(std::chrono::nanoseconds timeout, uint64_t max_instr, uint64_t counter)
+{
+	const uint64_t deadline = Watchdog::arm(m_interrupt, Watchdog::clock::now() + timeout);
+	bool stopped_normally;
+	try {
+		stopped_normally = this->simulate_with<false>(max_instr, counter, cpu.pc());
+	} catch (...) {
+		if (Watchdog::disarm(deadline))
+			this->clear_interrupt();
+		throw;
+	}
+	// The interrupt was requested by the watchdog when the deadline passed
+	const bool expired = Watchdog::disarm(deadline);
+	if (expired)
+		this->clear_interrupt();
+	if constexpr (Throw) {
+		if (UNLIKELY(!stopped_normally)) {
+			if (expired)
+				throw MachineTimeoutException(EXECUTION_INTERRUPTED,
+					"Execution deadline reached", timeout.count());
+			timeout_exception(max_instr);
+		}
+	}
+	return stopped_normally;
+}
+
 template <int W>
 inline void Machine<W>::reset()
 {
@@ -77,6 +113,9 @@ void Machine<W>::install_syscall_handler(size_t sysn, syscall_t handler)
 	// A work-around for thread-sanitizer false positives (setting the same handler)
 	if (syscall_handlers.at(sysn) != handler)
 		syscall_handlers.at(sysn) = handler;
+	// A new handler is not known to be deterministic
+	if (deterministic_syscalls[sysn] != nullptr)
+		deterministic_syscalls[sysn] = nullptr;
 }
 template <int W> inline
 void Machine<W>::install_syscall_handlers(std::initializer_list<std::pair<size_t, syscall_t>> syscalls)
@@ -84,17 +123,61 @@ void Machine<W>::install_syscall_handlers(std::initializer_list<std::pair<size_t
 	for (auto& scall : syscalls)
 		install_syscall_handler(scall.first, scall.second);
 }
+template <int W> inline
+void Machine<W>::set_deterministic_syscall(size_t sysn, syscall_filter_t filter)
+{
+	deterministic_syscalls.at(sysn) = filter;
+}
+
+template <int W>
+inline MachineStatistics* Machine<W>::statistics() const noexcept
+{
+#ifdef RISCV_STATISTICS
+	return m_statistics.get();
+#else
+	return nullptr;
+#endif
+}
 
 template <int W>
 inline void Machine<W>::system_call(size_t sysnum)
 {
 	if (LIKELY(sysnum < syscall_handlers.size())) {
-		Machine::syscall_handlers[RISCV_SPECSAFE(sysnum)](*this);
+#ifdef RISCV_REPLAY
+		if (UNLIKELY(m_replay != nullptr)) {
+			this->replayed_system_call(sysnum);
+			return;
+		}
+#endif
+		this->execute_system_call(sysnum);
 	} else {
+		RISCV_STAT_INC(*this, unknown_syscalls);
 		on_unhandled_syscall(*this, sysnum);
 	}
 }
 
+template <int W>
+inline void Machine<W>::execute_system_call(size_t sysnum)
+{
+#ifdef RISCV_STATISTICS
+	if (UNLIKELY(m_statistics != nullptr)) {
+		counted_system_call(*this, sysnum, Machine::syscall_handlers[RISCV_SPECSAFE(sysnum)]);
+		return;
+	}
+#endif
+	Machine::syscall_handlers[RISCV_SPECSAFE(sysnum)](*this);
+}
+
+template <int W>
+inline uint64_t Machine<W>::rdtime() const
+{
+#ifdef RISCV_REPLAY
+	if (UNLIKELY(m_replay != nullptr))
+		return this->replayed_rdtime();
+#endif
+	return m_rdtime(*this);
+}
+
 template <int W>
 template <typename T>
 inline T Machine<W>::sysarg(int idx) const
@@ -54,7 +54,15 @@ inline address_type<W> Machine<W>::vmcall(address_t pc, Args&&... args)
 	this->setup_call(std::forward<Args>(args)...);
 	// execute guest function
 	if constexpr (MAXI == UINT64_MAX || MAXI == 0u) {
-		this->cpu.simulate_inaccurate(pc);
+		if (UNLIKELY(memory.uses_guarded_arena()))
+			this->simulate_guarded(pc, 0u, UINT64_MAX, true);
+		else
+			this->cpu.simulate_inaccurate(pc);
+		// Without an instruction limit, only an interrupt ends the call early
+		if constexpr (Throw) {
+			if (UNLIKELY(interrupt_requested()))
+				timeout_exception(MAXI);
+		}
 	} else {
 		this->simulate_with<Throw>(MAXI, 0u, pc);
 	}
@@ -0,0 +1,145 @@
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define RISCV_HAS_MAPPED_FILES 1
+#endif
+
+namespace riscv
+{
+#ifdef RISCV_HAS_MAPPED_FILES
+	struct MappedFileKey
+	{
+		uint64_t dev;
+		uint64_t ino;
+		uint64_t size;
+		int64_t  mtime_sec;
+		int64_t  mtime_nsec;
+
+		bool operator==(const MappedFileKey& other) const noexcept {
+			return dev == other.dev && ino == other.ino && size == other.size
+				&& mtime_sec == other.mtime_sec && mtime_nsec == other.mtime_nsec;
+		}
+	};
+	struct MappedFileKeyHash {
+		size_t operator()(const MappedFileKey& key) const noexcept {
+			size_t h = size_t(key.ino);
+			h = h * 1099511628211ull ^ size_t(key.dev);
+			h = h * 1099511628211ull ^ size_t(key.size);
+			h = h * 1099511628211ull ^ size_t(key.mtime_nsec);
+			return h;
+		}
+	};
+
+	// The cache only observes mappings, so the last machine to let go of
+	// a file also unmaps it.
+	static std::mutex mapped_files_mutex;
+	static std::unordered_map<MappedFileKey, std::weak_ptr<MappedFile>, MappedFileKeyHash> mapped_files;
+#endif
+
+	bool mapped_files_supported() noexcept
+	{
+#ifdef RISCV_HAS_MAPPED_FILES
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	MappedFile::~MappedFile()
+	{
+#ifdef RISCV_HAS_MAPPED_FILES
+		munmap((void *)m_data, m_size);
+#endif
+	}
+
+	std::shared_ptr<MappedFile> open_mapped_file([[maybe_unused]] int fd)
+	{
+#ifdef RISCV_HAS_MAPPED_FILES
+		struct stat st;
+		if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+			return nullptr;
+
+#ifdef __APPLE__
+		const MappedFileKey key { uint64_t(st.st_dev), uint64_t(st.st_ino), uint64_t(st.st_size),
+			int64_t(st.st_mtimespec.tv_sec), int64_t(st.st_mtimespec.tv_nsec) };
+#else
+		const MappedFileKey key { uint64_t(st.st_dev), uint64_t(st.st_ino), uint64_t(st.st_size),
+			int64_t(st.st_mtim.tv_sec), int64_t(st.st_mtim.tv_nsec) };
+#endif
+
+		std::lock_guard<std::mutex> lock(mapped_files_mutex);
+		auto it = mapped_files.find(key);
+		if (it != mapped_files.end()) {
+			if (auto file = it->second.lock(); file != nullptr)
+				return file;
+		}
+
+		// Mapping a file is rare and the lock is already held, so sweep the
+		// files that are no longer mapped by anyone
+		for (auto sit = mapped_files.begin(); sit != mapped_files.end(); ) {
+			if (sit->second.expired())
+				sit = mapped_files.erase(sit);
+			else
+				++sit;
+		}
+
+		void* data = mmap(NULL, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+		if (data == MAP_FAILED)
+			return nullptr;
+
+		auto file = std::make_shared<MappedFile>((const uint8_t *)data, size_t(st.st_size));
+		mapped_files.insert_or_assign(key, file);
+		return file;
+#else
+		return nullptr;
+#endif
+	}
+
+	bool map_file_private([[maybe_unused]] void* dst, [[maybe_unused]] size_t len,
+		[[maybe_unused]] int fd, [[maybe_unused]] uint64_t offset, size_t& mapped) noexcept
+	{
+		mapped = 0;
+#ifdef RISCV_HAS_MAPPED_FILES
+		struct stat st;
+		if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+			return false;
+		// Touching a page that begins past the end of the file raises SIGBUS
+		if (offset >= uint64_t(st.st_size))
+			return true;
+		const size_t pagesize = size_t(sysconf(_SC_PAGESIZE));
+		const uint64_t file_bytes = (uint64_t(st.st_size) - offset + pagesize - 1) & ~uint64_t(pagesize - 1);
+		const size_t bytes = size_t(std::min(uint64_t(len), file_bytes));
+		// The kernel would round a partial host page up, past the end of dst
+		if (bytes % pagesize != 0)
+			return false;
+		// MAP_FIXED replaces the existing pages atomically. On failure, eg.
+		// when dst is not aligned to a host page, they are left in place.
+		void* result = mmap(dst, bytes, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_FIXED, fd, off_t(offset));
+		if (result != dst)
+			return false;
+		mapped = bytes;
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	bool map_anonymous_over([[maybe_unused]] void* dst, [[maybe_unused]] size_t len) noexcept
+	{
+#ifdef RISCV_HAS_MAPPED_FILES
+		void* result = mmap(dst, len, PROT_READ | PROT_WRITE,
+			MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE | MAP_FIXED, -1, 0);
+		return result == dst;
+#else
+		return false;
+#endif
+	}
+}
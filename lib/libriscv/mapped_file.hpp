@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace riscv
+{
+	/// @brief A read-only host mapping of a whole file.
+	/// @details Machines that map the same unmodified file share one mapping,
+	/// so the file exists in host memory once, and only the pages that are
+	/// touched are ever read from disk. Guest pages point straight into it,
+	/// and writable guest mappings are copy-on-write.
+	struct MappedFile
+	{
+		MappedFile(const uint8_t* data, size_t size) noexcept
+			: m_data(data), m_size(size) {}
+		~MappedFile();
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		/// @brief The file contents, followed by zeroes up to the end of the
+		/// last page.
+		const uint8_t* data() const noexcept { return m_data; }
+		/// @brief The size of the file, in bytes.
+		size_t size() const noexcept { return m_size; }
+
+		bool contains(const void* ptr) const noexcept {
+			return (const uint8_t *)ptr >= m_data && (const uint8_t *)ptr < m_data + m_size;
+		}
+
+	private:
+		const uint8_t* m_data;
+		size_t m_size;
+	};
+
+	/// @brief True when this platform can map host files into guest memory.
+	bool mapped_files_supported() noexcept;
+
+	/// @brief Find or create the shared mapping of the regular file behind fd.
+	/// @details Files are told apart by device, inode, size and modification
+	/// time, so a file that is changed after mapping gets a new mapping.
+	/// Returns nullptr when the file can not be mapped, eg. when it is empty
+	/// or not a regular file.
+	std::shared_ptr<MappedFile> open_mapped_file(int fd);
+
+	/// @brief Map len bytes of the file behind fd privately over dst, which is
+	/// page-aligned host memory that is already mapped read-write.
+	/// @details Pages that begin past the end of the file are left in place,
+	/// and the number of bytes that were replaced is stored in mapped. On
+	/// failure the original memory is left in place.
+	bool map_file_private(void* dst, size_t len, int fd, uint64_t offset, size_t& mapped) noexcept;
+
+	/// @brief Replace len bytes at dst with zeroed, read-write anonymous memory.
+	bool map_anonymous_over(void* dst, size_t len) noexcept;
+}
@@ -1,6 +1,7 @@
 #include "machine.hpp"
 
 #include "decoder_cache.hpp"
+#include "guarded_arena.hpp"
 #include "internal_common.hpp"
 #include <algorithm>
 #include <inttypes.h>
@@ -48,6 +49,9 @@ namespace riscv
 				? pgmax * PAGE_TABLE_OVERCOMMIT : size_t(-1);
 		}
 
+		this->m_page_fault_batch = options.page_fault_batch;
+		this->m_max_exec_segments = options.max_execute_segments;
+
 		if (options.page_fault_handler != nullptr)
 		{
 			this->m_page_fault_handler = std::move(options.page_fault_handler);
@@ -83,6 +87,8 @@ namespace riscv
 					// while keeping arena at same logical address (relative to zero)
 					this->m_arena.data = (PageData *)(base_ptr + Memory::OVERALLOCATE);
 					this->m_arena.pages = (1ULL << encompassing_Nbit_arena) / Page::size();
+				} else if (W == 8 && sizeof(size_t) == 8 && guarded_arena_bits != 0) {
+					this->allocate_guarded_arena(pages_max);
 				} else {
 				// Over-allocate by one page on each side in order to avoid
 				// bounds-checking with size: the front page absorbs accesses
@@ -145,8 +151,7 @@ namespace riscv
 							return mem.allocate_page(page, attr, &mem.m_arena.data[page]);
 						}
 						// Create page on-demand
-						return mem.allocate_page(page,
-							init ? PageData::INITIALIZED : PageData::UNINITIALIZED);
+						return mem.allocate_faulted_page(page, anywhere_pages, init);
 					}
 					// Out of memory, which is (2 + 1) * anywhere_pages
 					throw MachineException(OUT_OF_MEMORY, "Out of memory", anywhere_pages * 3);
@@ -158,8 +163,7 @@ namespace riscv
 					if (mem.pages_active() < pages_max || mem.owned_pages_below(pages_max))
 					{
 						// Create page on-demand
-						return mem.allocate_page(page,
-							init ? PageData::INITIALIZED : PageData::UNINITIALIZED);
+						return mem.allocate_faulted_page(page, pages_max, init);
 					}
 					throw MachineException(OUT_OF_MEMORY, "Out of memory", pages_max);
 				};
@@ -213,6 +217,8 @@ namespace riscv
 			{
 				// munmap() the entire address space
 				munmap(base_ptr, UNBOUNDED_ARENA_SIZE);
+			} else if (this->m_arena.guarded) {
+				release_guarded_window(base_ptr, GUARDED_WINDOW_SIZE);
 			} else {
 				munmap(base_ptr, (this->m_arena.pages + 2) * Page::size());
 			}
@@ -224,6 +230,43 @@ namespace riscv
 		}
 	}
 
+	template <int W> RISCV_INTERNAL
+	void Memory<W>::allocate_guarded_arena(size_t pages_max)
+	{
+		// Generated code masks guest addresses to N bits, and memory
+		// beyond that would be unreachable
+		if (pages_max > (1ULL << guarded_arena_bits) / Page::size())
+			throw MachineException(OUT_OF_MEMORY, "Memory limit exceeds the guarded arena", pages_max);
+
+		auto* base_ptr = reserve_guarded_window(GUARDED_WINDOW_SIZE);
+		if (UNLIKELY(base_ptr == nullptr))
+			throw MachineException(OUT_OF_MEMORY, "Out of memory", GUARDED_WINDOW_SIZE);
+		// Guest memory, followed by the page that absorbs the tail of
+		// multi-byte accesses at the last guest address. The rest of the
+		// window stays inaccessible.
+		if (!protect_guarded_range(base_ptr + Memory::OVERALLOCATE, (pages_max + 1) * Page::size(), true, true)) {
+			release_guarded_window(base_ptr, GUARDED_WINDOW_SIZE);
+			throw MachineException(OUT_OF_MEMORY, "Out of memory", pages_max);
+		}
+		this->m_arena.data = (PageData *)(base_ptr + Memory::OVERALLOCATE);
+		this->m_arena.pages = pages_max;
+		this->m_arena.guarded = true;
+	}
+
+	template <int W> RISCV_INTERNAL
+	void Memory<W>::protect_guarded_arena()
+	{
+		// Generated code no longer checks what the read and write boundaries
+		// exclude, so the page protection has to. Reads below RWREAD_BEGIN
+		// fault, and so do writes to read-only data, but only in its whole
+		// pages: the rest shares a page with writable data.
+		auto* arena = (uint8_t *)this->m_arena.data;
+		protect_guarded_range(arena, RWREAD_BEGIN, false, false);
+		const address_t roend = this->m_arena.initial_rodata_end & ~address_t(Page::size()-1);
+		if (roend > RWREAD_BEGIN)
+			protect_guarded_range(arena + RWREAD_BEGIN, roend - RWREAD_BEGIN, true, false);
+	}
+
 	template <int W> RISCV_INTERNAL
 	void Memory<W>::reset()
 	{
@@ -237,6 +280,78 @@ namespace riscv
 	{
 		this->m_pages.clear();
 		this->invalidate_reset_cache();
+		this->free_page_slabs();
+		this->m_mapped_files.clear();
+	}
+
+	template <int W>
+	Page& Memory<W>::allocate_faulted_page(address_t pageno, size_t pages_max, bool init)
+	{
+		// Pre-fault the following pages, as long as they fit within the limit
+		const size_t active = this->pages_active();
+		if (m_page_fault_batch > 1 && active < pages_max) {
+			const size_t count = std::min(size_t(m_page_fault_batch), pages_max - active);
+			return this->allocate_page_run(pageno, count, init);
+		}
+		return this->allocate_page(pageno,
+			init ? PageData::INITIALIZED : PageData::UNINITIALIZED);
+	}
+
+	template <int W>
+	PageData* Memory<W>::allocate_page_slab(size_t pages)
+	{
+#if defined(__linux__) || defined(__FreeBSD__)
+		// Anonymous memory is already zeroed, and populating the whole slab
+		// up front is much cheaper than taking a host page fault per page
+#ifdef MAP_POPULATE
+		static constexpr int SLAB_FLAGS = MAP_ANONYMOUS | MAP_PRIVATE | MAP_POPULATE;
+#else
+		static constexpr int SLAB_FLAGS = MAP_ANONYMOUS | MAP_PRIVATE;
+#endif
+		void* ptr = mmap(NULL, pages * Page::size(), PROT_READ | PROT_WRITE, SLAB_FLAGS, -1, 0);
+		if (UNLIKELY(ptr == MAP_FAILED))
+			throw MachineException(OUT_OF_MEMORY, "Out of memory (page slab)", pages);
+		auto* data = (PageData *)ptr;
+#else
+		auto* data = new PageData[pages];
+#endif
+		const PageSlab slab { data, pages };
+		auto it = std::upper_bound(m_page_slabs.begin(), m_page_slabs.end(), slab,
+			[] (const PageSlab& a, const PageSlab& b) { return a.data < b.data; });
+		m_page_slabs.insert(it, slab);
+		return data;
+	}
+
+	template <int W>
+	void Memory<W>::free_page_slabs() noexcept
+	{
+		for (const auto& slab : m_page_slabs) {
+#if defined(__linux__) || defined(__FreeBSD__)
+			munmap(slab.data, slab.pages * Page::size());
+#else
+			delete[] slab.data;
+#endif
+		}
+		m_page_slabs.clear();
+		m_free_slab_pages.clear();
+		m_slab_pages_used = 0;
+	}
+
+	template <int W>
+	void Memory<W>::recycle_slab_page(const Page& page) noexcept
+	{
+		if (m_page_slabs.empty() || !page.attr.non_owning)
+			return;
+		PageData* data = page.m_page.get();
+		auto it = std::upper_bound(m_page_slabs.begin(), m_page_slabs.end(), data,
+			[] (const PageData* d, const PageSlab& slab) { return d < slab.data; });
+		if (it == m_page_slabs.begin())
+			return;
+		--it;
+		if (data < it->data + it->pages) {
+			m_free_slab_pages.push_back(data);
+			m_slab_pages_used--;
+		}
 	}
 
 	template <int W> RISCV_INTERNAL
@@ -718,6 +833,10 @@ namespace riscv
 				size_t(this->shared_rodata_end()));
 		}
 
+		// Loading is done, and the read-only parts of the arena can be sealed
+		if (this->uses_guarded_arena())
+			this->protect_guarded_arena();
+
 		if (UNLIKELY(options.verbose_loader)) {
 			printf("* Entry is at %p\n",
 				(void*)uintptr_t(this->start_address()));
@@ -730,6 +849,8 @@ namespace riscv
 	{
 #ifdef RISCV_VIRTUAL_PAGING
 		this->m_pages_max = master.memory.m_pages_max;
+		this->m_page_fault_batch = master.memory.m_page_fault_batch;
+		this->m_max_exec_segments = master.memory.m_max_exec_segments;
 
 		if (options.minimal_fork == false)
 		{
@@ -756,6 +877,8 @@ namespace riscv
 					attr, page.m_page.get()
 				);
 			}
+			// Loaned file pages keep the host mapping alive
+			this->m_mapped_files = master.memory.m_mapped_files;
 		}
 #else
 		(void)options;
@@ -772,6 +895,7 @@ namespace riscv
 		// Reference the same execute segments
 		this->m_main_exec_segment = master.memory.m_main_exec_segment;
 		this->m_exec = master.memory.m_exec;
+		this->m_exec_ranges = master.memory.m_exec_ranges;
 
 		if (options.use_memory_arena) {
 			// A fork references the arena of its master, image and all
@@ -782,8 +906,16 @@ namespace riscv
 			this->m_arena.read_boundary = master.memory.m_arena.read_boundary;
 			this->m_arena.write_boundary = master.memory.m_arena.write_boundary;
 			this->m_arena.initial_rodata_end = master.memory.m_arena.initial_rodata_end;
+			this->m_arena.guarded = master.memory.m_arena.guarded;
+			this->m_arena_file_mapped = master.memory.m_arena_file_mapped;
 		}
 
+#ifdef RISCV_VIRTUAL_PAGING
+		// Re-map I/O regions, which also marks their pages uncacheable
+		for (const auto& region : master.memory.m_mmio.regions())
+			this->map_mmio(region.begin, region.end, region.ops);
+#endif
+
 		// invalidate all cached pages, because references are invalidated
 		this->invalidate_reset_cache();
 	}
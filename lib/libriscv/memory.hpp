@@ -1,12 +1,15 @@
 #pragma once
 #include "elf.hpp"
 #include "page.hpp"
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <string_view>
 #include <unordered_map>
 #include "decoded_exec_segment.hpp"
 #include "mmap_cache.hpp"
+#include "mmio.hpp"
+#include "mapped_file.hpp"
 #include "shared_rodata.hpp"
 #include "util/buffer.hpp" // <string>
 #include "util/function.hpp"
@@ -19,6 +22,19 @@ namespace riscv
 	template<int W> struct Machine;
 	struct vBuffer { char* ptr; size_t len; };
 
+	/// @brief The guest memory that a system call handler wrote to, while
+	/// its machine records an execution (see Machine::start_recording()).
+	template <int W>
+	struct MemoryJournal
+	{
+		struct Range {
+			address_type<W> addr;
+			size_t len;
+			int    fill; // The value of a fill, or -1 for a range of contents
+		};
+		std::vector<Range> ranges;
+	};
+
 	template<int W>
 	struct alignas(RISCV_MACHINE_ALIGNMENT) Memory
 	{
@@ -31,6 +47,9 @@ namespace riscv
 		static constexpr address_t DYLINK_BASE  = 0x40000; // Dynamic link base address
 		static constexpr address_t RWREAD_BEGIN = 0x1000; // Default rw-arena rodata start
 		static constexpr address_t OVERALLOCATE = PageSize; // Arena overalloc on both ends (must be page-aligned for madvise)
+		// Host address space reserved for a guarded arena, which every masked
+		// guest address and the tail of any access at it falls inside
+		static constexpr uint64_t GUARDED_WINDOW_SIZE = (1ULL << guarded_arena_bits) + 2 * OVERALLOCATE;
 		// Guests routinely map more address space than they have memory for, and
 		// attribute-only pages hold no page data. A page table entry still costs
 		// ~64-88 bytes on the host, so the page table is bounded by this multiple
@@ -151,6 +170,16 @@ namespace riscv
 		bool mmap_relax(address_t addr, address_t size, address_t new_size);
 		// Unmap a memory range
 		bool mmap_unmap(address_t addr, address_t size);
+		// Map a range of a host file into guest memory without reading it.
+		// Returns false when the range has to be read into memory instead.
+		bool mmap_file(address_t addr, address_t size, int fd, uint64_t offset, PageAttributes attr);
+		// Point guest pages at the bytes [offset, end) of a shared file mapping.
+		// Only whole pages are mapped, and outside of the arena, so the number
+		// of bytes mapped is returned.
+		address_t mmap_file_pages(address_t addr, address_t size,
+			const std::shared_ptr<MappedFile>&, uint64_t offset, uint64_t end, PageAttributes attr);
+		// Replace files mapped over the arena in the range with zeroed memory
+		void munmap_file(address_t addr, address_t size);
 
 
 		Machine<W>& machine() noexcept { return this->m_machine; }
@@ -226,6 +255,15 @@ namespace riscv
 		// Page creation & destruction
 		template <typename... Args>
 		Page& allocate_page(address_t page, Args&& ...);
+		/// @brief Allocate the page at pageno, and pre-fault up to count-1 of
+		/// the pages that follow it, stopping at the first page that exists.
+		/// @details The pages are carved from a single slab owned by this
+		/// memory, instead of one allocation per page. Memory limits are
+		/// not checked here, as that is the job of the page fault handler.
+		Page& allocate_page_run(address_t pageno, size_t count, bool init = true);
+		/// @brief Create writable pages for every missing page in the range
+		/// through the page fault handler, so later accesses never fault.
+		void  prefault(address_t addr, size_t len);
 		void  invalidate_cache(address_t pageno, Page*) const noexcept;
 		void  invalidate_reset_cache() const noexcept;
 		bool  free_pageno(address_t pageno);
@@ -253,6 +291,21 @@ namespace riscv
 		static const Page& default_page_read(const Memory&, address_t);
 		// NOTE: use print_and_pause() to immediately break!
 		void trap(address_t page_addr, mmio_cb_t callback);
+		/// @brief Map a memory-mapped I/O region with typed handlers.
+		/// @param begin The first guest address of the region (no alignment required)
+		/// @param end The guest address one past the end of the region
+		/// @param ops The read and write handlers, and an optional host pointer
+		/// @details Unlike page traps, regions have byte granularity: the rest
+		/// of a page that a region partially covers is still ordinary memory.
+		/// Guest loads and stores reach the handlers after a single range check
+		/// on the memory slow-path, in every execution mode. Regions must lie
+		/// outside the flat memory arena, and are inherited by forks.
+		/// Requires RISCV_MEMORY_TRAPS.
+		void map_mmio(address_t begin, address_t end, MMIOOperations<W> ops);
+		/// @brief Remove the region that begins at the given address.
+		/// @return True if a region was removed.
+		bool unmap_mmio(address_t begin);
+		const auto& mmio_regions() const noexcept { return m_mmio.regions(); }
 		// shared pages (regular pages will have priority!)
 		Page&  install_shared_page(address_t pageno, const Page&);
 		// create pages for non-owned (shared) memory with given attributes
@@ -262,6 +315,7 @@ namespace riscv
 		size_t pages_active() const noexcept { return 0; }
 		size_t owned_pages_active() const noexcept { return 0; }
 		bool owned_pages_below(size_t) noexcept { return true; }
+		void  prefault(address_t, size_t) {}
 		void  invalidate_cache(address_t, Page*) const noexcept {}
 		void  invalidate_reset_cache() const noexcept {}
 #endif
@@ -271,11 +325,21 @@ namespace riscv
 		const std::shared_ptr<DecodedExecuteSegment<W>>& exec_segment_for(address_t vaddr) const;
 		DecodedExecuteSegment<W>& create_execute_segment(const MachineOptions<W>&, const void* data, address_t addr, size_t len, bool is_initial, bool is_likely_jit = false);
 		size_t execute_segments_count() const noexcept { return m_exec.size(); }
+		size_t max_execute_segments() const noexcept { return m_max_exec_segments; }
+		void set_max_execute_segments(size_t max) noexcept { m_max_exec_segments = max; }
 		// Evict all execute segments, also disabling the main execute segment
 		void evict_execute_segments();
 		void evict_execute_segment(DecodedExecuteSegment<W>&);
 		void mark_execute_segments_stale() noexcept;
+		// Bring execute segments up to date with guest code in a range, or
+		// in all segments besides the main one (FENCE.I)
 		void flush_execute_segments(address_t begin, address_t end) noexcept;
+		void flush_execute_segments() noexcept;
+		/// @brief Decode again, in place, the blocks of an execute segment that
+		/// no longer match the code in guest memory.
+		/// @return False when the segment must be rebuilt instead, eg. because
+		/// other machines share it or it has native code.
+		bool refresh_execute_segment(DecodedExecuteSegment<W>&, address_t begin, address_t end) noexcept;
 #ifdef RISCV_BINARY_TRANSLATION
 		std::vector<address_t> gather_jump_hints() const;
 #endif
@@ -287,6 +351,9 @@ namespace riscv
 
 		bool uses_flat_memory_arena() const noexcept { return riscv::flat_readwrite_arena && this->m_arena.data != nullptr; }
 		bool uses_Nbit_encompassing_arena() const noexcept { return riscv::encompassing_Nbit_arena != 0 && this->m_arena.data != nullptr; }
+		// The arena sits in a window of inaccessible pages, and generated code
+		// relies on host faults instead of bounds-checks (see guarded_arena.hpp)
+		bool uses_guarded_arena() const noexcept { return riscv::guarded_arena_bits != 0 && this->m_arena.guarded; }
 		void* memory_arena_ptr() const noexcept { return (void *)this->m_arena.data; }
 		auto& memory_arena_ptr_ref() const noexcept { return this->m_arena.data; }
 		size_t memory_arena_size() const noexcept { return this->m_arena.pages * Page::size(); }
@@ -304,6 +371,10 @@ namespace riscv
 		const address_t& memory_arena_write_boundary_ref() const noexcept { return this->m_arena.write_boundary; }
 		const address_t& initial_rodata_end_ref() const noexcept { return this->m_arena.initial_rodata_end; }
 
+		// Recording system calls: note guest memory that is being written to
+		void journal_write(address_t addr, size_t len, int fill = -1) const;
+		void set_journal(MemoryJournal<W>* journal) noexcept;
+
 		// Serializes the current memory state to an existing vector
 		// Returns the final size of the serialized state
 		size_t serialize_to(std::vector<uint8_t>& vec) const;
@@ -317,9 +388,18 @@ namespace riscv
 #ifdef RISCV_VIRTUAL_PAGING
 		void clear_all_pages();
 		void initial_paging();
+		Page& allocate_faulted_page(address_t pageno, size_t pages_max, bool init);
+		PageData* allocate_page_slab(size_t pages);
+		void free_page_slabs() noexcept;
+		void recycle_slab_page(const Page&) noexcept;
+		bool is_mapped_file_page(const Page&) const noexcept;
 #endif
 		[[noreturn]] static void protection_fault(address_t);
 #ifdef RISCV_VIRTUAL_PAGING
+		template <typename T>
+		T mmio_read(const typename MMIORegions<W>::Region&, address_t);
+		template <typename T>
+		void mmio_write(const typename MMIORegions<W>::Region&, address_t, T);
 		static void discard_page(Memory<W>&, Page&, address_t pageno,
 			address_t addr, size_t size, bool ignore_protections);
 #endif
@@ -392,6 +472,20 @@ namespace riscv
 		size_t m_owned_pages_limit = 0;
 		size_t m_owned_pages_amortized_scans = 0;
 		static constexpr size_t OWNED_PAGES_SCAN_LIMIT = 1024;
+
+		// Page slabs back the pages created by allocate_page_run(). Their
+		// pages are non-owning, and are recycled when they are freed.
+		struct PageSlab {
+			PageData* data;
+			size_t    pages;
+		};
+		std::vector<PageSlab> m_page_slabs; // Sorted by host address
+		std::vector<PageData*> m_free_slab_pages;
+		size_t   m_slab_pages_used = 0;
+		unsigned m_page_fault_batch = 0;
+
+		// Host files that non-owning pages point into
+		std::vector<std::shared_ptr<MappedFile>> m_mapped_files;
 #endif
 
 		const bool m_original_machine;
@@ -406,6 +500,9 @@ namespace riscv
 		page_fault_cb_t m_page_fault_handler = nullptr;
 		page_write_cb_t m_page_write_handler = default_page_write;
 		page_readf_cb_t m_page_readf_handler = default_page_read;
+
+		// Memory-mapped I/O regions, checked on the slow-path only
+		MMIORegions<W> m_mmio;
 #endif
 
 #ifdef RISCV_EXT_ATOMICS
@@ -416,11 +513,25 @@ namespace riscv
 		// every other machine loaded from the same binary
 		RodataKey m_rodata_key {};
 		std::shared_ptr<SharedRodataImage> m_rodata_image = nullptr;
+		// Set when a file has been mapped directly over the arena
+		bool m_arena_file_mapped = false;
 
 		// Execute segments
 		std::shared_ptr<DecodedExecuteSegment<W>> m_main_exec_segment;
 		std::vector<std::shared_ptr<DecodedExecuteSegment<W>>> m_exec; // not including main_exec_segment
 		std::shared_ptr<DecodedExecuteSegment<W>>& next_execute_segment();
+		// The slots of m_exec sorted by address, for exec_segment_for()
+		struct ExecuteRange {
+			address_t begin;
+			address_t end;
+			size_t    slot;
+		};
+		std::vector<ExecuteRange> m_exec_ranges;
+		void index_execute_segments();
+		size_t m_max_exec_segments = RISCV_MAX_EXECUTE_SEGS;
+
+		void allocate_guarded_arena(size_t pages_max);
+		void protect_guarded_arena();
 
 		// Linear arena at start of memory (mmap-backed)
 		struct {
@@ -429,7 +540,11 @@ namespace riscv
 			address_t write_boundary = 0;
 			address_t initial_rodata_end = 0;
 			size_t    pages = 0;
+			bool      guarded = false;
 		} m_arena;
+#ifdef RISCV_REPLAY
+		MemoryJournal<W>* m_journal = nullptr;
+#endif
 
 		friend struct CPU<W>;
 	};
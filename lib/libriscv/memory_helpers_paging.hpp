@@ -3,6 +3,7 @@
 template <int W> inline
 void Memory<W>::memset(address_t dst, uint8_t value, size_t len)
 {
+	journal_write(dst, len, value);
 #ifndef RISCV_VIRTUAL_PAGING
 	if (UNLIKELY(dst + len > memory_arena_size() || dst + len < dst || dst < initial_rodata_end()))
 		protection_fault(dst);
@@ -25,6 +26,7 @@ void Memory<W>::memset(address_t dst, uint8_t value, size_t len)
 template <int W> inline
 void Memory<W>::memcpy(address_t dst, const void* vsrc, size_t len)
 {
+	journal_write(dst, len);
 #ifndef RISCV_VIRTUAL_PAGING
 	if (UNLIKELY(dst + len > memory_arena_size() || dst + len < dst || dst < initial_rodata_end()))
 		protection_fault(dst);
@@ -86,6 +88,7 @@ bool Memory<W>::try_memmove(address_t dst, address_t src, size_t len)
 			src + len < memory_arena_size() && src + len > src)) {
 			char* p_src = &((char *)m_arena.data)[src];
 			char* p_dest = &((char *)m_arena.data)[dst];
+			journal_write(dst, len);
 			std::memmove(p_dest, p_src, len);
 			return true;
 		}
@@ -235,6 +238,7 @@ std::string_view Memory<W>::writable_memview(address_t addr, size_t len, size_t
 	if (len == 0)
 		return {};
 
+	journal_write(addr, len);
 	if constexpr (flat_readwrite_arena) {
 		if (LIKELY(addr + len - initial_rodata_end() < memory_arena_write_boundary() && addr < addr + len)) {
 			char* begin = &((char *)m_arena.data)[RISCV_SPECSAFE(addr)];
@@ -321,6 +325,7 @@ T* Memory<W>::try_memarray(address_t addr, size_t count, size_t maxbytes) const
 	} else if constexpr (flat_readwrite_arena) {
 		if (LIKELY(addr + len - initial_rodata_end() < memory_arena_write_boundary() && addr < addr + len)) {
 			char* begin = &((char *)m_arena.data)[RISCV_SPECSAFE(addr)];
+			journal_write(addr, len);
 			return (T*) begin;
 		}
 	}
@@ -501,6 +506,7 @@ template <int W> inline
 void Memory<W>::memcpy(
 	address_t dst, Machine<W>& srcm, address_t src, address_t len)
 {
+	journal_write(dst, len);
 	if constexpr (riscv::flat_readwrite_arena) {
 		// Fast-path: Find the entire source and destination buffers in the memory arena
 		if (uint8_t* srcptr = srcm.memory.template try_memarray<uint8_t> (src, len)) {
@@ -601,6 +607,7 @@ size_t Memory<W>::gather_writable_buffers_from_range(
 {
 	if (len == 0)
 		return 0;
+	journal_write(addr, len);
 #ifndef RISCV_VIRTUAL_PAGING
 	if (UNLIKELY(addr < initial_rodata_end() || addr + len > memory_arena_size() || addr + len < addr))
 		machine().cpu.trigger_exception(PROTECTION_FAULT, addr);
@@ -45,6 +45,12 @@ T Memory<W>::read(address_t address)
 	}
 
 #ifdef RISCV_VIRTUAL_PAGING
+	if constexpr (memory_traps_enabled) {
+		if (UNLIKELY(m_mmio.within(address))) {
+			if (const auto* region = m_mmio.find(address))
+				return mmio_read<T>(*region, address);
+		}
+	}
 	const auto& pagedata = cached_readable_page(address, sizeof(T));
 	return pagedata.template aligned_read<T>(offset);
 #else
@@ -58,6 +64,7 @@ template <int W>
 template <typename T> inline
 T& Memory<W>::writable_read(address_t address)
 {
+	journal_write(address, sizeof(T));
 	if constexpr (encompassing_Nbit_arena)
 	{
 		if constexpr (encompassing_Nbit_arena == 32)
@@ -77,6 +84,11 @@ T& Memory<W>::writable_read(address_t address)
 	}
 
 #ifdef RISCV_VIRTUAL_PAGING
+	if constexpr (memory_traps_enabled) {
+		// Read-modify-write (atomics) is not supported on I/O regions
+		if (UNLIKELY(m_mmio.within(address) && m_mmio.find(address) != nullptr))
+			protection_fault(address);
+	}
 	auto& pagedata = cached_writable_page(address);
 	return pagedata.template aligned_read<T>(address & memory_align_mask<T>());
 #else
@@ -90,6 +102,7 @@ template <int W>
 template <typename T> inline
 void Memory<W>::write(address_t address, T value)
 {
+	journal_write(address, sizeof(T));
 	if constexpr (encompassing_Nbit_arena)
 	{
 		if constexpr (encompassing_Nbit_arena == 32)
@@ -127,6 +140,14 @@ void Memory<W>::write(address_t address, T value)
 		entry.page->template aligned_write<T>(offset, value);
 		return;
 	}
+	if constexpr (memory_traps_enabled) {
+		if (UNLIKELY(m_mmio.within(address))) {
+			if (const auto* region = m_mmio.find(address)) {
+				mmio_write<T>(*region, address, value);
+				return;
+			}
+		}
+	}
 
 	auto& page = create_writable_pageno(pageno);
 	if (LIKELY(page.attr.is_cacheable())) {
@@ -151,6 +172,7 @@ template <int W>
 template <typename T> inline
 void Memory<W>::write_paging(address_t address, T value)
 {
+	journal_write(address, sizeof(T));
 	const auto offset = address & memory_align_mask<T>();
 	const auto pageno = page_number(address);
 	auto& entry = m_wr_cache;
@@ -158,6 +180,14 @@ void Memory<W>::write_paging(address_t address, T value)
 		entry.page->template aligned_write<T>(offset, value);
 		return;
 	}
+	if constexpr (memory_traps_enabled) {
+		if (UNLIKELY(m_mmio.within(address))) {
+			if (const auto* region = m_mmio.find(address)) {
+				mmio_write<T>(*region, address, value);
+				return;
+			}
+		}
+	}
 
 	auto& page = create_writable_pageno(pageno);
 	if (LIKELY(page.attr.is_cacheable())) {
@@ -205,8 +235,37 @@ inline std::shared_ptr<DecodedExecuteSegment<W>>& Memory<W>::exec_segment_for(ad
 {
 	// Check main execute segment first, it's always present
 	if (m_main_exec_segment && m_main_exec_segment->is_within(vaddr)) return m_main_exec_segment;
+	// The last segment that begins at or below the address
+	auto it = std::upper_bound(m_exec_ranges.begin(), m_exec_ranges.end(), vaddr,
+		[] (address_t addr, const ExecuteRange& range) { return addr < range.begin; });
+	if (it != m_exec_ranges.begin()) {
+		auto& segment = m_exec[(it - 1)->slot];
+		if (segment->is_within(vaddr)) return segment;
+	}
+	// Segments may overlap, which is rare enough to look through them all
 	for (auto& segment : m_exec) {
 		if (segment && segment->is_within(vaddr)) return segment;
 	}
 	return CPU<W>::empty_execute_segment();
 }
+
+template <int W>
+inline void Memory<W>::journal_write(address_t addr, size_t len, int fill) const
+{
+#ifdef RISCV_REPLAY
+	if (UNLIKELY(m_journal != nullptr))
+		m_journal->ranges.push_back({addr, len, fill});
+#else
+	(void)addr; (void)len; (void)fill;
+#endif
+}
+
+template <int W>
+inline void Memory<W>::set_journal(MemoryJournal<W>* journal) noexcept
+{
+#ifdef RISCV_REPLAY
+	this->m_journal = journal;
+#else
+	(void)journal;
+#endif
+}
@@ -96,7 +96,8 @@ Page& Memory<W>::allocate_page(const address_t page, Args&&... args)
 template <int W>
 inline size_t Memory<W>::owned_pages_active() const noexcept
 {
-	size_t count = 0;
+	// Slab pages are non-owning, but are still allocated by this memory
+	size_t count = m_slab_pages_used;
 	for (const auto& it : m_pages) {
 		if (!it.second.attr.non_owning) count++;
 	}
@@ -130,4 +131,41 @@ inline void Memory<W>::trap(address_t page_addr, mmio_cb_t callback)
 	page.set_trap(callback);
 }
 
+template <int W>
+template <typename T> inline
+T Memory<W>::mmio_read(const typename MMIORegions<W>::Region& region, address_t address)
+{
+	const address_t offset = address - region.begin;
+	// Accesses must be scalar, and may not straddle the end of the region
+	if constexpr (sizeof(T) <= 8) {
+		if (LIKELY(offset + sizeof(T) <= region.end - region.begin)) {
+			if (region.ops.read != nullptr)
+				return T(region.ops.read(machine(), offset, sizeof(T)));
+			if (region.ops.host_ptr != nullptr) {
+				T value;
+				std::memcpy(&value, (const char *)region.ops.host_ptr + offset, sizeof(T));
+				return value;
+			}
+		}
+	}
+	protection_fault(address);
+}
+
+template <int W>
+template <typename T> inline
+void Memory<W>::mmio_write(const typename MMIORegions<W>::Region& region, address_t address, T value)
+{
+	const address_t offset = address - region.begin;
+	if constexpr (sizeof(T) <= 8) {
+		if (LIKELY(offset + sizeof(T) <= region.end - region.begin && region.ops.write != nullptr)) {
+			uint64_t raw = 0;
+			std::memcpy(&raw, &value, sizeof(T));
+			region.ops.write(machine(), offset, sizeof(T), raw);
+			return;
+		}
+	}
+	(void)value;
+	protection_fault(address);
+}
+
 #endif // RISCV_VIRTUAL_PAGING
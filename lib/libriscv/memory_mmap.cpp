@@ -41,6 +41,116 @@ namespace riscv
 		return relaxed;
 	}
 
+	template <int W>
+	bool Memory<W>::mmap_file(address_t addr, address_t size, int fd, uint64_t offset, PageAttributes attr)
+	{
+		if (addr % Page::size() != 0 || offset % Page::size() != 0)
+			return false;
+		size = (size + PageMask) & ~address_t{PageMask};
+		if (size == 0 || addr + size < addr)
+			return false;
+
+		// Inside the arena the file is mapped privately over the arena itself,
+		// so that the flat fast-paths keep working
+		if (this->uses_flat_memory_arena() && addr < this->memory_arena_size())
+		{
+			// Never replace the shared read-only image
+			if (addr < this->shared_rodata_end() || addr + size > this->memory_arena_size())
+				return false;
+			size_t mapped = 0;
+			if (!map_file_private(&((uint8_t *)m_arena.data)[addr], size, fd, offset, mapped))
+				return false;
+			this->m_arena_file_mapped = true;
+			journal_write(addr, mapped);
+			// Pages that begin past the end of the file are zeroes
+			if (mapped < size)
+				this->memdiscard(addr + mapped, size - mapped, true);
+			this->set_page_attr(addr, size, attr);
+			return true;
+		}
+
+		if constexpr (!virtual_paging_enabled)
+			return false;
+		auto file = open_mapped_file(fd);
+		if (file == nullptr)
+			return false;
+		// The tail of the last page is zeroes in the host mapping too
+		const uint64_t end = (file->size() + PageMask) & ~uint64_t(PageMask);
+		const address_t mapped = this->mmap_file_pages(addr, size, file, offset, end, attr);
+		if (mapped == 0 && offset < end)
+			return false;
+		// Pages that begin past the end of the file are zeroes
+		if (mapped < size) {
+			this->free_pages(addr + mapped, size - mapped);
+			this->set_page_attr(addr + mapped, size - mapped, attr);
+		}
+		return true;
+	}
+
+	template <int W>
+	address_type<W> Memory<W>::mmap_file_pages(address_t addr, address_t size,
+		const std::shared_ptr<MappedFile>& file, uint64_t offset, uint64_t end, PageAttributes attr)
+	{
+#ifdef RISCV_VIRTUAL_PAGING
+		const uint8_t* src = file->data() + offset;
+		if (offset >= end || addr % Page::size() != 0 || uintptr_t(src) % Page::size() != 0)
+			return 0;
+		// The arena is accessed directly, without looking at the page table
+		if (this->uses_flat_memory_arena() && addr < this->memory_arena_size())
+			return 0;
+		const address_t bytes = std::min(size, address_t(end - offset)) & ~address_t{PageMask};
+		if (bytes == 0)
+			return 0;
+		if (UNLIKELY(m_pages.size() + bytes / Page::size() > this->m_pages_max))
+			throw MachineException(OUT_OF_MEMORY, "Out of memory (page attributes)", this->m_pages_max);
+
+		this->free_pages(addr, bytes);
+		// Pages point straight into the shared mapping, which is never
+		// written to: writable pages are copy-on-write instead
+		PageAttributes file_attr = attr;
+		file_attr.is_cow = attr.write;
+		file_attr.write  = false;
+		this->insert_non_owned_memory(addr, (void *)src, bytes, file_attr);
+		if (std::find(m_mapped_files.begin(), m_mapped_files.end(), file) == m_mapped_files.end())
+			m_mapped_files.push_back(file);
+		return bytes;
+#else
+		(void)addr; (void)size; (void)file; (void)offset; (void)end; (void)attr;
+		return 0;
+#endif
+	}
+
+	template <int W>
+	void Memory<W>::munmap_file(address_t addr, address_t size)
+	{
+		if (!this->m_arena_file_mapped || addr % Page::size() != 0)
+			return;
+		const address_t arena_end = this->memory_arena_size();
+		const address_t rodata_end =
+			(this->shared_rodata_end() + PageMask) & ~address_t{PageMask};
+		const address_t begin = std::max(addr, rodata_end);
+		address_t end = (addr + size < addr) ? arena_end : std::min(address_t(addr + size), arena_end);
+		end = (end + PageMask) & ~address_t{PageMask};
+		if (begin >= end)
+			return;
+		// MADV_DONTNEED would bring back the file contents
+		if (!map_anonymous_over(&((uint8_t *)m_arena.data)[begin], end - begin))
+			std::memset(&((uint8_t *)m_arena.data)[begin], 0, end - begin);
+	}
+
+#ifdef RISCV_VIRTUAL_PAGING
+	template <int W>
+	bool Memory<W>::is_mapped_file_page(const Page& page) const noexcept
+	{
+		if (!page.attr.non_owning)
+			return false;
+		for (const auto& file : m_mapped_files)
+			if (file->contains(page.data()))
+				return true;
+		return false;
+	}
+#endif
+
 	INSTANTIATE_32_IF_ENABLED(Memory);
 	INSTANTIATE_64_IF_ENABLED(Memory);
 	INSTANTIATE_128_IF_ENABLED(Memory);
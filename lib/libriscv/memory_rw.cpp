@@ -34,6 +34,7 @@ namespace riscv
 			if (LIKELY(page.attr.write)) {
 				return page;
 			} else if (page.attr.is_cow) {
+				RISCV_STAT_INC(m_machine, cow_copies);
 				m_page_write_handler(*this, pageno, page);
 				// The page may be read-cached at this time
 				// and the page data has likely changed now.
@@ -42,6 +43,7 @@ namespace riscv
 			}
 		} else {
 			// Handler must produce a new page, or throw
+			RISCV_STAT_INC(m_machine, page_faults);
 			Page& page = m_page_fault_handler(*this, pageno, init);
 			if (LIKELY(page.attr.write)) {
 				this->invalidate_cache(pageno, &page);
@@ -51,6 +53,60 @@ namespace riscv
 		this->protection_fault(pageno * Page::size());
 	}
 
+	template <int W>
+	Page& Memory<W>::allocate_page_run(const address_t pageno, size_t count, bool init)
+	{
+		// The run ends at the first page that already exists
+		size_t n = 1;
+		while (n < count && address_t(pageno + n) > pageno
+			&& m_pages.find(pageno + n) == m_pages.end())
+			n++;
+
+		// Recycled slab pages are used first, then a new slab for the rest
+		const size_t recycled = std::min(n, m_free_slab_pages.size());
+		PageData* slab = (n > recycled) ? this->allocate_page_slab(n - recycled) : nullptr;
+
+		Page* first = nullptr;
+		for (size_t i = 0; i < n; i++)
+		{
+			PageData* data;
+			if (i < recycled) {
+				data = m_free_slab_pages.back();
+				m_free_slab_pages.pop_back();
+				// Only the faulting page may be handed out uninitialized
+				if (init || i > 0)
+					data->buffer8 = {};
+			} else {
+				data = &slab[i - recycled];
+			}
+			auto& page = m_pages.try_emplace(pageno + i, PageAttributes{}, data).first->second;
+			// The read cache may hold the zero-page for any of them
+			this->invalidate_cache(pageno + i, &page);
+			if (i == 0)
+				first = &page;
+		}
+		m_slab_pages_used += n;
+		return *first;
+	}
+
+	template <int W>
+	void Memory<W>::prefault(address_t addr, size_t len)
+	{
+		if (len == 0)
+			return;
+		if (UNLIKELY(addr + len < addr))
+			protection_fault(addr);
+		const address_t end = page_number(addr + len - 1) + 1;
+		for (address_t pageno = page_number(addr); pageno < end; pageno++)
+		{
+			if (m_pages.find(pageno) == m_pages.end()) {
+				RISCV_STAT_INC(m_machine, page_faults);
+				Page& page = m_page_fault_handler(*this, pageno, true);
+				this->invalidate_cache(pageno, &page);
+			}
+		}
+	}
+
 	template <int W>
 	void Memory<W>::set_pageno_attr(const address_t pageno, PageAttributes attr)
 	{
@@ -60,8 +116,9 @@ namespace riscv
 			// Keep non-owning and is_cow attributes
 			const bool is_cow = page.attr.is_cow;
 			page.attr.apply_regular_attributes(attr);
-			// If the page becomes writable and holds the CoW-page data, it's also copy-on-write
-			if (is_cow || (attr.write && page.is_cow_page())) {
+			// If the page becomes writable and holds the CoW-page data, or
+			// data from a read-only host file mapping, it's also copy-on-write
+			if (is_cow || (attr.write && (page.is_cow_page() || this->is_mapped_file_page(page)))) {
 				page.attr.is_cow = true;
 				page.attr.write = false;
 			}
@@ -95,6 +152,64 @@ namespace riscv
 		attr.non_owning = true;
 		m_pages.try_emplace(pageno, attr, Page::cow_page().m_page.get());
 	}
+
+	template <int W>
+	void Memory<W>::map_mmio(address_t begin, address_t end, MMIOOperations<W> ops)
+	{
+		if constexpr (!memory_traps_enabled) {
+			(void)begin; (void)end; (void)ops;
+			throw MachineException(FEATURE_DISABLED, "MMIO regions require RISCV_MEMORY_TRAPS");
+		}
+		if (UNLIKELY(begin >= end))
+			throw MachineException(ILLEGAL_OPERATION, "Invalid MMIO region", begin);
+		// The flat arena is accessed directly, bypassing the slow-path
+		if (UNLIKELY(this->uses_flat_memory_arena() && begin < this->memory_arena_size()))
+			throw MachineException(ILLEGAL_OPERATION, "MMIO region overlaps the memory arena", begin);
+		if (UNLIKELY(m_mmio.overlaps(begin, end)))
+			throw MachineException(ILLEGAL_OPERATION, "MMIO region overlaps another region", begin);
+
+		// Pages that a region touches must never enter the read/write caches,
+		// or cached accesses would skip the region check entirely.
+		const address_t last_pageno = page_number(end - 1);
+		for (address_t pageno = page_number(begin); pageno <= last_pageno; pageno++)
+		{
+			auto it = m_pages.find(pageno);
+			if (it == m_pages.end()) {
+				PageAttributes attr;
+				attr.is_cow = attr.write;
+				attr.write = false;
+				attr.non_owning = true;
+				it = m_pages.try_emplace(pageno, attr, Page::cow_page().m_page.get()).first;
+			}
+			it->second.attr.cacheable = false;
+		}
+		m_mmio.insert(begin, end, std::move(ops));
+		this->invalidate_reset_cache();
+	}
+
+	template <int W>
+	bool Memory<W>::unmap_mmio(address_t begin)
+	{
+		auto* region = m_mmio.find(begin);
+		if (region == nullptr || region->begin != begin)
+			return false;
+		const address_t first_pageno = page_number(region->begin);
+		const address_t last_pageno = page_number(region->end - 1);
+		m_mmio.erase(begin);
+
+		// Restore caching, unless another region or a page trap still needs the slow-path
+		for (address_t pageno = first_pageno; pageno <= last_pageno; pageno++)
+		{
+			const address_t page_begin = pageno * Page::size();
+			if (m_mmio.overlaps(page_begin, page_begin + Page::size()))
+				continue;
+			auto it = m_pages.find(pageno);
+			if (it != m_pages.end() && !it->second.has_trap())
+				it->second.attr.cacheable = true;
+		}
+		this->invalidate_reset_cache();
+		return true;
+	}
 #endif // RISCV_VIRTUAL_PAGING
 
 	template <int W>
@@ -121,6 +236,7 @@ namespace riscv
 	template <int W>
 	void Memory<W>::free_pages(address_t dst, size_t len)
 	{
+		journal_write(dst, len, 0);
 		if constexpr (!virtual_paging_enabled) {
 			(void)dst; (void)len;
 			return;
@@ -134,8 +250,10 @@ namespace riscv
 		{
 			for (auto it = m_pages.begin(); it != m_pages.end(); )
 			{
-				if (it->first >= pageno && it->first < end)
+				if (it->first >= pageno && it->first < end) {
+					this->recycle_slab_page(it->second);
 					it = m_pages.erase(it);
+				}
 				else
 					++it;
 			}
@@ -163,6 +281,7 @@ namespace riscv
 			return;
 		}
 		if (page.attr.is_cow) {
+			RISCV_STAT_INC(memory.m_machine, cow_copies);
 			memory.m_page_write_handler(memory, pageno, page);
 		}
 		const size_t offset = addr & (Page::size()-1);
@@ -191,6 +310,7 @@ namespace riscv
 	template <int W>
 	void Memory<W>::memdiscard(address_t dst, size_t len, bool ignore_protections)
 	{
+		journal_write(dst, len, 0);
 		if constexpr (!virtual_paging_enabled) {
 			(void)ignore_protections;
 			if (UNLIKELY(dst + len > memory_arena_size() || dst + len < dst))
@@ -313,7 +433,12 @@ namespace riscv
 	template <int W>
 	bool Memory<W>::free_pageno(address_t pageno)
 	{
-		return m_pages.erase(pageno) != 0;
+		auto it = m_pages.find(pageno);
+		if (it == m_pages.end())
+			return false;
+		this->recycle_slab_page(it->second);
+		m_pages.erase(it);
+		return true;
 	}
 
 	template <int W>
@@ -417,6 +542,7 @@ namespace riscv
 	void Memory<W>::insert_non_owned_memory(
 		address_t dst, void* src, size_t size, PageAttributes attr)
 	{
+		journal_write(dst, size);
 		assert(dst % Page::size() == 0);
 		assert((dst + size) % Page::size() == 0);
 		attr.non_owning = true;
@@ -453,6 +579,9 @@ namespace riscv
 				(page.attr.non_owning && page_number < m_arena.pages))
 					total += Page::size();
 		}
+		// Slab pages are non-owning, but belong to this memory
+		for (const auto& slab : m_page_slabs)
+			total += slab.pages * Page::size();
 #else
 		total += memory_arena_size();
 #endif
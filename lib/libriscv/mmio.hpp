@@ -0,0 +1,110 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "types.hpp"
+
+namespace riscv
+{
+	template <int W> struct Machine;
+
+	/// @brief Typed handlers for a memory-mapped I/O region, see Memory::map_mmio().
+	/// @details Offsets are relative to the beginning of the region, and the size
+	/// is the width of the guest access: 1, 2, 4 or 8 bytes. Wider accesses (vector
+	/// lanes, 128-bit loads) and atomics are protection faults inside a region.
+	template <int W>
+	struct MMIOOperations
+	{
+		using address_t = address_type<W>;
+
+		/// @brief Serve a guest load. When unset, loads are served from host_ptr.
+		std::function<uint64_t(Machine<W>&, address_t offset, unsigned size)> read = nullptr;
+		/// @brief Serve a guest store. When unset, stores are protection faults.
+		std::function<void(Machine<W>&, address_t offset, unsigned size, uint64_t value)> write = nullptr;
+		/// @brief Host memory that loads are copied directly out of, for
+		/// read-mostly regions. It must be at least as large as the region,
+		/// and outlive it. Ignored when a read handler is set.
+		const void* host_ptr = nullptr;
+	};
+
+	template <int W>
+	struct MMIORegions
+	{
+		using address_t = address_type<W>;
+
+		struct Region {
+			address_t begin;
+			address_t end;
+			MMIOOperations<W> ops;
+		};
+
+		// The single range check on the memory slow-path. The bounds enclose
+		// every region, and are empty when there are no regions at all.
+		bool within(address_t addr) const noexcept {
+			return addr - m_begin < m_size;
+		}
+
+		const Region* find(address_t addr) const noexcept
+		{
+			for (const auto& region : m_regions) {
+				if (addr >= region.begin && addr < region.end)
+					return &region;
+			}
+			return nullptr;
+		}
+
+		bool overlaps(address_t begin, address_t end) const noexcept
+		{
+			for (const auto& region : m_regions) {
+				if (begin < region.end && region.begin < end)
+					return true;
+			}
+			return false;
+		}
+
+		void insert(address_t begin, address_t end, MMIOOperations<W> ops)
+		{
+			m_regions.push_back(Region{begin, end, std::move(ops)});
+			this->update_bounds();
+		}
+
+		bool erase(address_t begin)
+		{
+			for (auto it = m_regions.begin(); it != m_regions.end(); ++it) {
+				if (it->begin == begin) {
+					m_regions.erase(it);
+					this->update_bounds();
+					return true;
+				}
+			}
+			return false;
+		}
+
+		bool empty() const noexcept { return m_regions.empty(); }
+		const auto& regions() const noexcept { return m_regions; }
+
+	private:
+		void update_bounds() noexcept
+		{
+			if (m_regions.empty()) {
+				m_begin = 0;
+				m_size  = 0;
+				return;
+			}
+			address_t lo = m_regions.front().begin;
+			address_t hi = m_regions.front().end;
+			for (const auto& region : m_regions) {
+				lo = std::min(lo, region.begin);
+				hi = std::max(hi, region.end);
+			}
+			m_begin = lo;
+			m_size  = hi - lo;
+		}
+
+		address_t m_begin = 0;
+		address_t m_size  = 0;
+		std::vector<Region> m_regions;
+	};
+
+} // riscv
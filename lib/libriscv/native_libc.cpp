@@ -174,6 +174,9 @@ void Machine<W>::setup_native_heap_internal(const size_t syscall_base)
 		machine.set_result(ret);
 		machine.penalize(COMPLEX_CALL_PENALTY);
 	});
+	// The heap lives in guest memory, and replays can run it again
+	for (size_t i = 0; i <= 4; i++)
+		Machine<W>::set_deterministic_syscall(syscall_base + i);
 }
 
 template <int W>
@@ -290,6 +293,9 @@ void Machine<W>::setup_native_memory(const size_t syscall_base)
 		m.set_result(0);
 		m.penalize(100 * COMPLEX_CALL_PENALTY);
 	}}});
+	// Replays run the memory and string functions again
+	for (size_t i : {0, 1, 2, 3, 5, 6})
+		Machine<W>::set_deterministic_syscall(syscall_base + i);
 }
 
 /**
@@ -677,11 +683,11 @@ static void run_libc_fastpath(Machine<W>& m, unsigned id)
 	}
 }
 
-/// @brief The EBREAK handler that all hot-patched libc functions land in.
+/// @brief The hot-patched libc function at the current PC, or FN_INVALID.
 template <int W>
-static void libc_fastpath_ebreak_handler(Machine<W>& m)
+static unsigned libc_fastpath_at_pc(const Machine<W>& m)
 {
-	auto& exec = m.cpu.current_execute_segment();
+	const auto& exec = m.cpu.current_execute_segment();
 	const auto pc = m.cpu.pc();
 
 	// The patched entry is always the last instruction of its block, so the
@@ -694,16 +700,26 @@ static void libc_fastpath_ebreak_handler(Machine<W>& m)
 			&& (instr & ~FASTPATH_ID_MASK) == FASTPATH_EBREAK))
 		{
 			const unsigned id = (instr & FASTPATH_ID_MASK) >> 7;
-			if (LIKELY(id != FN_INVALID && id < FN_MAX))
-			{
-				run_libc_fastpath<W>(m, id);
-				// Return to the caller. RV32I_BC_SYSTEM notices that the
-				// handler moved PC and resumes there instead of at pc+4.
-				m.cpu.registers().pc = m.cpu.reg(REG_RA);
-				return;
-			}
+			if (LIKELY(id < FN_MAX))
+				return id;
 		}
 	}
+	return FN_INVALID;
+}
+
+/// @brief The EBREAK handler that all hot-patched libc functions land in.
+template <int W>
+static void libc_fastpath_ebreak_handler(Machine<W>& m)
+{
+	const unsigned id = libc_fastpath_at_pc(m);
+	if (LIKELY(id != FN_INVALID))
+	{
+		run_libc_fastpath<W>(m, id);
+		// Return to the caller. RV32I_BC_SYSTEM notices that the
+		// handler moved PC and resumes there instead of at pc+4.
+		m.cpu.registers().pc = m.cpu.reg(REG_RA);
+		return;
+	}
 
 	// Not one of ours: this is a real breakpoint
 	Machine<W>::previous_ebreak_handler(m);
@@ -721,6 +737,11 @@ void Machine<W>::install_libc_fastpath_handler()
 		Machine<W>::m_previous_ebreak_handler = Machine<W>::syscall_handlers[SYSCALL_EBREAK];
 		Machine<W>::m_libc_fastpath_ebreak = libc_fastpath_ebreak_handler<W>;
 		Machine<W>::syscall_handlers[SYSCALL_EBREAK] = libc_fastpath_ebreak_handler<W>;
+		// The libc functions only touch guest memory, but a real breakpoint
+		// can do anything
+		Machine<W>::set_deterministic_syscall(SYSCALL_EBREAK, [] (const Machine<W>& m) {
+			return libc_fastpath_at_pc(m) != FN_INVALID;
+		});
 	}
 }
 
@@ -121,6 +121,9 @@ void Machine<W>::setup_native_threads(const size_t syscall_base)
 		// return value from exited thread
 		machine.set_result(retval);
 	});
+	// Thread switches only depend on the guest, and replays make them again
+	for (size_t i : {0, 1, 2, 3, 4, 5, 6, 8, 9})
+		this->set_deterministic_syscall(syscall_base + i);
 }
 
 #ifdef RISCV_32I
@@ -1,5 +1,6 @@
 #pragma once
 #include <functional>
+#include <memory>
 #include <string>
 #include <map>
 #include "../types.hpp"
@@ -9,6 +10,7 @@
 #endif
 
 namespace riscv {
+struct VirtualFS;
 
 struct FileDescriptors
 {
@@ -28,6 +30,15 @@ struct FileDescriptors
 	// Remove virtual FD and return real FD
     real_fd_type erase(int vfd);
 
+	// Open files of the virtual filesystem
+	struct VirtualFile {
+		uint32_t node;
+		uint64_t offset; // Position in the file, or the next directory entry
+	};
+	int assign_virtual(uint32_t node);
+	VirtualFile* get_virtual(int vfd);
+	bool erase_virtual(int vfd) { return virtual_files.erase(vfd) != 0; }
+
 	bool is_socket(int) const;
 	bool permit_write(int vfd) {
 		if (is_socket(vfd)) return true;
@@ -37,6 +48,12 @@ struct FileDescriptors
 	~FileDescriptors();
 
     std::map<int, real_fd_type> translation;
+	std::map<int, VirtualFile> virtual_files;
+
+	// Read-only filesystem that is consulted before the host filesystem.
+	// Paths that are not in it fall through to the host filesystem, which
+	// is still subject to permit_filesystem and filter_open.
+	std::shared_ptr<const VirtualFS> vfs = nullptr;
 
 	// Default working directory (fake root)
 	std::string cwd = "/home";
@@ -92,6 +109,21 @@ inline FileDescriptors::real_fd_type FileDescriptors::erase(int virtfd)
 	return -EBADF;
 }
 
+inline int FileDescriptors::assign_virtual(uint32_t node)
+{
+	const int virtfd = file_counter++;
+	virtual_files.emplace(virtfd, VirtualFile{node, 0});
+	return virtfd;
+}
+inline FileDescriptors::VirtualFile* FileDescriptors::get_virtual(int virtfd)
+{
+	if (virtual_files.empty())
+		return nullptr;
+	auto it = virtual_files.find(virtfd);
+	if (it != virtual_files.end()) return &it->second;
+	return nullptr;
+}
+
 inline bool FileDescriptors::is_socket(int virtfd) const
 {
 	return virtfd >= SOCKET_D_BASE;
@@ -87,6 +87,8 @@ namespace riscv
 		install_syscall_handler(80, syscall_stub_nosys<W>); // fstat
 		install_syscall_handler(93, syscall_exit<W>);
 		install_syscall_handler(214, syscall_brk<W>);
+		set_deterministic_syscall(93);
+		set_deterministic_syscall(214);
 	}
 
 #ifdef RISCV_32I
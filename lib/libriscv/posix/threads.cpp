@@ -1,16 +1,55 @@
 #include "../threads.hpp"
+#include <chrono>
 
 namespace riscv {
 
-template <int W>
+/// @brief The rdtime() at which a futex wait times out, or zero when it
+/// does not. FUTEX_WAIT has a relative timeout, and FUTEX_WAIT_BITSET an
+/// absolute one on the monotonic clock, or the realtime clock when asked.
+/// @return False when the timeout has already passed.
+template <int W, typename TimeT>
+static bool futex_deadline(Machine<W>& machine, address_type<W> timeout,
+	bool absolute, bool realtime, uint64_t& deadline)
+{
+	deadline = 0;
+	if (timeout == 0x0)
+		return true;
+	struct {
+		TimeT tv_sec;
+		TimeT tv_nsec;
+	} ts;
+	machine.copy_from_guest(&ts, timeout, sizeof(ts));
+	int64_t micros = int64_t(ts.tv_sec) * 1'000'000 + int64_t(ts.tv_nsec) / 1000;
+	if (absolute) {
+		// The guest clocks are the host clocks. Replays see the
+		// time that was left when recording.
+		const auto now = realtime
+			? std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count()
+			: std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		micros -= int64_t(now);
+		machine.replay_input(&micros, sizeof(micros));
+	}
+	if (micros <= 0)
+		return false;
+	deadline = machine.rdtime() + uint64_t(micros);
+	return true;
+}
+
+template <int W, typename TimeT>
 static inline void futex_op(Machine<W>& machine,
-	address_type<W> addr, int futex_op, int val, uint32_t val3)
+	address_type<W> addr, int futex_op, int val, address_type<W> timeout,
+	address_type<W> addr2, uint32_t val3)
 {
 	using address_t = address_type<W>;
 	#define FUTEX_WAIT           0
 	#define FUTEX_WAKE           1
+	#define FUTEX_REQUEUE        3
+	#define FUTEX_CMP_REQUEUE    4
 	#define FUTEX_WAIT_BITSET	 9
 	#define FUTEX_WAKE_BITSET	10
+	#define FUTEX_CLOCK_REALTIME 256
 
 	THPRINT(machine, ">>> futex(0x%lX, op=%d (0x%X), val=%d val3=0x%X)\n",
 		(long)addr, futex_op & 0xF, futex_op, val, val3);
@@ -21,7 +60,13 @@ static inline void futex_op(Machine<W>& machine,
 		if (machine.memory.template read<uint32_t> (addr) == (uint32_t)val) {
 			THPRINT(machine,
 				"FUTEX: Waiting (blocked)... uaddr=0x%lX val=%d, bitset=%d\n", (long)addr, val, is_bitset);
-			if (machine.threads().block(0, addr, is_bitset ? val3 : 0x0)) {
+			uint64_t deadline = 0;
+			if (!futex_deadline<W, TimeT>(machine, timeout,
+					is_bitset, (futex_op & FUTEX_CLOCK_REALTIME) != 0, deadline)) {
+				machine.set_result(-ETIMEDOUT);
+				return;
+			}
+			if (machine.threads().block(0, addr, is_bitset ? val3 : 0x0, deadline)) {
 				return;
 			}
 			//throw MachineException(DEADLOCK_REACHED, "FUTEX deadlock", addr);
@@ -40,13 +85,30 @@ static inline void futex_op(Machine<W>& machine,
 		const bool is_bitset = (futex_op & 0xF) == FUTEX_WAKE_BITSET;
 		THPRINT(machine,
 			"FUTEX: Waking %d others on 0x%lX, bitset=%d\n", val, (long)addr, is_bitset);
-		// XXX: Guaranteed not to expire early when
-		// timeout != 0x0.
 		unsigned awakened = machine.threads().wakeup_blocked(val, addr, is_bitset ? val3 : ~0x0);
 		machine.template set_result<unsigned>(awakened);
 		THPRINT(machine,
 			"FUTEX: Awakened: %u\n", awakened);
 		return;
+	} else if ((futex_op & 0xF) == FUTEX_REQUEUE || (futex_op & 0xF) == FUTEX_CMP_REQUEUE) {
+		// The timeout argument is the number of waiters to move
+		const size_t max_requeue = timeout;
+		if ((futex_op & 0xF) == FUTEX_CMP_REQUEUE
+			&& machine.memory.template read<uint32_t> (addr) != val3) {
+			machine.set_result(-EAGAIN);
+			return;
+		}
+		THPRINT(machine,
+			"FUTEX: Waking %d and moving %zu others from 0x%lX to 0x%lX\n",
+			val, max_requeue, (long)addr, (long)addr2);
+		const size_t awakened = machine.threads().wakeup_blocked(val, addr);
+		const size_t requeued = machine.threads().requeue_blocked(max_requeue, addr, addr2);
+		// FUTEX_REQUEUE only counts the threads that woke up
+		if ((futex_op & 0xF) == FUTEX_REQUEUE)
+			machine.template set_result<unsigned>(awakened);
+		else
+			machine.template set_result<unsigned>(awakened + requeued);
+		return;
 	}
 	THPRINT(machine,
 		"WARNING: Unhandled futex op: %X\n", futex_op);
@@ -74,8 +136,16 @@ void Machine<W>::setup_posix_threads()
 		machine.stop();
 		machine.set_result(status);
 	});
-	// exit_group
-	this->install_syscall_handler(94, syscall_handlers.at(93));
+	// exit_group: ends the process, from whichever thread
+	this->install_syscall_handler(94,
+	[] (Machine<W>& machine) {
+		const uint32_t status = machine.template sysarg<uint32_t> (0);
+		THPRINT(machine,
+			">>> Exit group on tid=%d, exit code = %d\n",
+				machine.threads().get_tid(), (int) status);
+		machine.stop();
+		machine.set_result(status);
+	});
 	// set_tid_address
 	this->install_syscall_handler(96,
 	[] (Machine<W>& machine) {
@@ -153,9 +223,11 @@ void Machine<W>::setup_posix_threads()
 		const auto addr = machine.template sysarg<address_type<W>> (0);
 		const int fx_op = machine.template sysarg<int> (1);
 		const int   val = machine.template sysarg<int> (2);
+		const auto timeout = machine.template sysarg<address_type<W>> (3);
+		const auto addr2 = machine.template sysarg<address_type<W>> (4);
 		const uint32_t val3 = machine.template sysarg<uint32_t> (5);
 
-		futex_op<W>(machine, addr, fx_op, val, val3);
+		futex_op<W, std::make_signed_t<address_type<W>>>(machine, addr, fx_op, val, timeout, addr2, val3);
 	});
 	// futex_time64
 	this->install_syscall_handler(422,
@@ -163,9 +235,11 @@ void Machine<W>::setup_posix_threads()
 		const auto addr = machine.template sysarg<address_type<W>> (0);
 		const int fx_op = machine.template sysarg<int> (1);
 		const int   val = machine.template sysarg<int> (2);
+		const auto timeout = machine.template sysarg<address_type<W>> (3);
+		const auto addr2 = machine.template sysarg<address_type<W>> (4);
 		const uint32_t val3 = machine.template sysarg<uint32_t> (5);
 
-		futex_op<W>(machine, addr, fx_op, val, val3);
+		futex_op<W, int64_t>(machine, addr, fx_op, val, timeout, addr2, val3);
 	});
 	// clone
 	this->install_syscall_handler(220,
@@ -273,6 +347,9 @@ void Machine<W>::setup_posix_threads()
 		THPRINT(machine,
 			">>> prlimit64(0x%X) = %d\n", resource, machine.return_value<int>());
 	});
+	// Thread switches only depend on the guest, and replays make them again
+	for (size_t sysnum : {93, 94, 96, 99, 124, 131, 178, 98, 422, 220, 435, 261})
+		this->set_deterministic_syscall(sysnum);
 }
 
 template <int W>
@@ -0,0 +1,343 @@
+#include "vfs.hpp"
+
+#include "../mapped_file.hpp"
+#include "../types.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace riscv {
+
+static constexpr size_t TAR_BLOCK = 512;
+static constexpr unsigned MAX_SYMLINKS = 40;
+
+// The ustar header, the first 500 bytes of each 512-byte block
+struct TarHeader {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+};
+static_assert(sizeof(TarHeader) == 500);
+
+static std::string_view tar_string(const char* field, size_t maxlen)
+{
+	return std::string_view(field, strnlen(field, maxlen));
+}
+
+// Numeric fields are octal, or base-256 when the high bit is set (GNU)
+static uint64_t tar_number(const char* field, size_t len)
+{
+	uint64_t value = 0;
+	if ((uint8_t)field[0] & 0x80) {
+		value = (uint8_t)field[0] & 0x7F;
+		for (size_t i = 1; i < len; i++)
+			value = (value << 8) | (uint8_t)field[i];
+		return value;
+	}
+	for (size_t i = 0; i < len && field[i] != 0; i++) {
+		if (field[i] >= '0' && field[i] <= '7')
+			value = (value << 3) | uint64_t(field[i] - '0');
+		else if (field[i] != ' ')
+			break;
+	}
+	return value;
+}
+
+static bool tar_checksum_ok(const uint8_t* block)
+{
+	const auto* hdr = (const TarHeader *)block;
+	const uint64_t expected = tar_number(hdr->chksum, sizeof(hdr->chksum));
+	uint64_t sum = 0;
+	for (size_t i = 0; i < TAR_BLOCK; i++) {
+		// The checksum field itself counts as spaces
+		const bool in_chksum = i >= offsetof(TarHeader, chksum)
+			&& i < offsetof(TarHeader, chksum) + sizeof(hdr->chksum);
+		sum += in_chksum ? uint8_t(' ') : block[i];
+	}
+	return sum == expected;
+}
+
+// Extended (pax) headers are records of the form "<len> <key>=<value>\n"
+static void pax_parse(std::string_view data, std::string& path, std::string& linkpath)
+{
+	while (!data.empty()) {
+		const size_t space = data.find(' ');
+		if (space == std::string_view::npos)
+			return;
+		const size_t reclen = std::strtoul(std::string(data.substr(0, space)).c_str(), nullptr, 10);
+		if (reclen <= space + 1 || reclen > data.size())
+			return;
+		const auto record = data.substr(space + 1, reclen - space - 2);
+		const size_t eq = record.find('=');
+		if (eq != std::string_view::npos) {
+			const auto key = record.substr(0, eq);
+			if (key == "path")
+				path = record.substr(eq + 1);
+			else if (key == "linkpath")
+				linkpath = record.substr(eq + 1);
+		}
+		data.remove_prefix(reclen);
+	}
+}
+
+uint32_t VirtualFS::Node::st_mode() const noexcept
+{
+	switch (type) {
+	case DIRECTORY: return 0040000 | mode;
+	case SYMLINK:   return 0120000 | mode;
+	default:        return 0100000 | mode;
+	}
+}
+
+VirtualFS::VirtualFS(std::string_view image, std::shared_ptr<MappedFile> file)
+	: m_image(image), m_file(std::move(file))
+{
+	Node root;
+	root.type = DIRECTORY;
+	root.mode = 0755;
+	root.parent = ROOT;
+	m_nodes.push_back(std::move(root));
+	this->parse_tar();
+}
+
+std::shared_ptr<VirtualFS> VirtualFS::from_tar(std::string_view image)
+{
+	return std::make_shared<VirtualFS>(image);
+}
+
+std::shared_ptr<VirtualFS> VirtualFS::open_tar(const std::string& path)
+{
+#ifndef _WIN32
+	const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		throw MachineException(INVALID_PROGRAM, "Unable to open filesystem image", errno);
+	auto file = open_mapped_file(fd);
+	::close(fd);
+	if (file == nullptr)
+		throw MachineException(INVALID_PROGRAM, "Unable to map filesystem image");
+	const std::string_view image((const char *)file->data(), file->size());
+	return std::make_shared<VirtualFS>(image, std::move(file));
+#else
+	(void)path;
+	throw MachineException(FEATURE_DISABLED, "Filesystem images are not supported on this platform");
+#endif
+}
+
+void VirtualFS::parse_tar()
+{
+	const auto* image = (const uint8_t *)m_image.data();
+	const size_t image_size = m_image.size();
+	// Names from GNU long name and pax headers apply to the next member
+	std::string next_path;
+	std::string next_link;
+
+	size_t pos = 0;
+	while (pos + TAR_BLOCK <= image_size)
+	{
+		const uint8_t* block = &image[pos];
+		// The archive ends with zero blocks
+		if (block[0] == 0)
+			break;
+		if (!tar_checksum_ok(block))
+			throw MachineException(INVALID_PROGRAM, "Invalid tar header checksum", pos);
+
+		const auto* hdr = (const TarHeader *)block;
+		const uint64_t size = tar_number(hdr->size, sizeof(hdr->size));
+		const size_t data_offset = pos + TAR_BLOCK;
+		if (size > image_size - data_offset)
+			throw MachineException(INVALID_PROGRAM, "Truncated tar member", pos);
+		const std::string_view data((const char *)&image[data_offset], size);
+		pos = data_offset + ((size + TAR_BLOCK - 1) & ~uint64_t(TAR_BLOCK - 1));
+
+		switch (hdr->typeflag) {
+		case 'L': // GNU long name
+			next_path = tar_string(data.data(), data.size());
+			continue;
+		case 'K': // GNU long link name
+			next_link = tar_string(data.data(), data.size());
+			continue;
+		case 'x': // pax extended header
+			pax_parse(data, next_path, next_link);
+			continue;
+		case 'g': // pax global header
+			continue;
+		default:
+			break;
+		}
+
+		std::string path = std::move(next_path);
+		std::string link = std::move(next_link);
+		next_path.clear();
+		next_link.clear();
+		if (path.empty()) {
+			const auto name = tar_string(hdr->name, sizeof(hdr->name));
+			const auto prefix = tar_string(hdr->prefix, sizeof(hdr->prefix));
+			if (std::memcmp(hdr->magic, "ustar", 5) == 0 && !prefix.empty()) {
+				path = prefix;
+				path += '/';
+			}
+			path += name;
+		}
+		if (link.empty())
+			link = tar_string(hdr->linkname, sizeof(hdr->linkname));
+
+		Type type;
+		switch (hdr->typeflag) {
+		case '0': case '\0': case '7': case '1':
+			type = REGULAR; break;
+		case '2':
+			type = SYMLINK; break;
+		case '5':
+			type = DIRECTORY; break;
+		default:
+			// Devices, FIFOs and the like are not served
+			continue;
+		}
+
+		const uint32_t idx = this->add_path(path, type);
+		if (idx == ROOT)
+			continue;
+		Node& n = m_nodes[idx];
+		n.mode  = uint32_t(tar_number(hdr->mode, sizeof(hdr->mode))) & 07777;
+		n.mtime = int64_t(tar_number(hdr->mtime, sizeof(hdr->mtime)));
+		if (hdr->typeflag == '1') {
+			// Hard links share the contents of an earlier member
+			const int target = this->lookup(link, ROOT, false);
+			if (target >= 0 && m_nodes[target].type == REGULAR) {
+				n.offset = m_nodes[target].offset;
+				n.size   = m_nodes[target].size;
+			}
+		} else if (type == SYMLINK) {
+			n.target = std::move(link);
+			n.size   = n.target.size();
+		} else if (type == REGULAR) {
+			n.offset = data_offset;
+			n.size   = size;
+		}
+	}
+}
+
+int VirtualFS::find_child(uint32_t dir, std::string_view name) const
+{
+	const auto& children = m_nodes[dir].children;
+	auto it = std::lower_bound(children.begin(), children.end(), name,
+		[this] (uint32_t idx, std::string_view name) { return m_nodes[idx].name < name; });
+	if (it != children.end() && m_nodes[*it].name == name)
+		return int(*it);
+	return -ENOENT;
+}
+
+uint32_t VirtualFS::add_path(std::string_view path, Type type)
+{
+	uint32_t cur = ROOT;
+	while (!path.empty())
+	{
+		const size_t slash = path.find('/');
+		const auto name = path.substr(0, slash);
+		path = (slash == std::string_view::npos) ? std::string_view{} : path.substr(slash + 1);
+		if (name.empty() || name == ".")
+			continue;
+		if (name == "..") {
+			cur = m_nodes[cur].parent;
+			continue;
+		}
+		const bool last = path.find_first_not_of('/') == std::string_view::npos;
+
+		const int child = this->find_child(cur, name);
+		if (child >= 0) {
+			// A member that replaces an earlier one with the same name
+			if (last)
+				m_nodes[child].type = type;
+			cur = uint32_t(child);
+			continue;
+		}
+
+		Node n;
+		n.name = name;
+		n.type = last ? type : DIRECTORY;
+		n.mode = 0755;
+		n.parent = cur;
+		const uint32_t idx = uint32_t(m_nodes.size());
+		m_nodes.push_back(std::move(n));
+
+		auto& children = m_nodes[cur].children;
+		auto it = std::lower_bound(children.begin(), children.end(), name,
+			[this] (uint32_t idx, std::string_view name) { return m_nodes[idx].name < name; });
+		children.insert(it, idx);
+		cur = idx;
+	}
+	return cur;
+}
+
+int VirtualFS::lookup(std::string_view path, uint32_t dir, bool follow) const
+{
+	if (path.empty())
+		return -ENOENT;
+	if (dir >= m_nodes.size())
+		return -EBADF;
+
+	std::string rest { path };
+	uint32_t cur = (rest[0] == '/') ? ROOT : dir;
+	unsigned links = 0;
+	size_t pos = 0;
+	while (true)
+	{
+		while (pos < rest.size() && rest[pos] == '/')
+			pos++;
+		if (pos >= rest.size()) {
+			if (rest.back() == '/' && !m_nodes[cur].is_dir())
+				return -ENOTDIR;
+			return int(cur);
+		}
+		if (!m_nodes[cur].is_dir())
+			return -ENOTDIR;
+
+		size_t end = rest.find('/', pos);
+		if (end == std::string::npos)
+			end = rest.size();
+		const std::string_view name(&rest[pos], end - pos);
+		const bool last = rest.find_first_not_of('/', end) == std::string::npos;
+
+		if (name == ".") {
+		} else if (name == "..") {
+			cur = m_nodes[cur].parent;
+		} else {
+			const int child = this->find_child(cur, name);
+			if (child < 0)
+				return child;
+			const Node& n = m_nodes[child];
+			if (n.type == SYMLINK && (follow || !last)) {
+				if (++links > MAX_SYMLINKS)
+					return -ELOOP;
+				// Continue with the link target, followed by the rest of the
+				// path. A relative target starts in the directory of the link.
+				if (!n.target.empty() && n.target[0] == '/')
+					cur = ROOT;
+				rest = n.target + rest.substr(end);
+				pos = 0;
+				continue;
+			}
+			cur = uint32_t(child);
+		}
+		pos = end;
+	}
+}
+
+} // riscv
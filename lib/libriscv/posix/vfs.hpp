@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace riscv {
+struct MappedFile;
+
+/// @brief An immutable, in-memory filesystem built from a tar archive.
+/// @details The index is built once, and the image is never modified, so
+/// one VirtualFS can be shared by any number of machines. File contents are
+/// served straight out of the image, without making host system calls.
+/// Assign it to FileDescriptors::vfs to make it visible to a guest.
+struct VirtualFS
+{
+	enum Type : uint8_t { REGULAR, DIRECTORY, SYMLINK };
+
+	struct Node {
+		std::string name;
+		Type     type = REGULAR;
+		uint32_t mode = 0;     // Permission bits
+		uint32_t parent = 0;
+		uint64_t size = 0;
+		int64_t  mtime = 0;
+		uint64_t offset = 0;   // Offset of the contents in the image
+		std::string target;    // Symbolic link target
+		std::vector<uint32_t> children; // Sorted by name
+
+		bool is_dir() const noexcept { return type == DIRECTORY; }
+		// Full st_mode, including the file type
+		uint32_t st_mode() const noexcept;
+	};
+	static constexpr uint32_t ROOT = 0;
+
+	/// @brief Build a filesystem from a tar image in memory. The image
+	/// must outlive the filesystem. Throws MachineException on a malformed
+	/// archive.
+	static std::shared_ptr<VirtualFS> from_tar(std::string_view image);
+	/// @brief Map a tar archive from the host filesystem, and build a
+	/// filesystem from it. File-backed guest mappings of page-aligned members
+	/// then point straight into the archive.
+	static std::shared_ptr<VirtualFS> open_tar(const std::string& path);
+
+	/// @brief Resolve a path to a node, relative to the given directory.
+	/// @return The node index, or a negative errno.
+	int lookup(std::string_view path, uint32_t dir = ROOT, bool follow = true) const;
+
+	const Node& node(uint32_t idx) const { return m_nodes.at(idx); }
+	size_t size() const noexcept { return m_nodes.size(); }
+
+	/// @brief The contents of a regular file.
+	const uint8_t* data(const Node& n) const noexcept {
+		return (const uint8_t *)m_image.data() + n.offset;
+	}
+	/// @brief The host mapping of the image, or nullptr when the image
+	/// was provided by the caller.
+	const std::shared_ptr<MappedFile>& image_file() const noexcept { return m_file; }
+
+	VirtualFS(std::string_view image, std::shared_ptr<MappedFile> file = nullptr);
+
+private:
+	void parse_tar();
+	uint32_t add_path(std::string_view path, Type type);
+	int find_child(uint32_t dir, std::string_view name) const;
+
+	std::string_view m_image;
+	std::shared_ptr<MappedFile> m_file;
+	std::vector<Node> m_nodes;
+};
+
+} // riscv
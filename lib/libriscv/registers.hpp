@@ -104,19 +104,22 @@ namespace riscv
 		RISCV_ALWAYS_INLINE register_t& get(uint32_t idx) noexcept { return m_reg[idx]; }
 		RISCV_ALWAYS_INLINE const register_t& get(uint32_t idx) const noexcept { return m_reg[idx]; }
 
-		RISCV_ALWAYS_INLINE fp64reg& getfl(uint32_t idx) noexcept { return m_regfl[idx]; }
+		// Handing out a writable FP register makes the FP file dirty
+		RISCV_ALWAYS_INLINE fp64reg& getfl(uint32_t idx) noexcept { m_fs = ExtState::Dirty; return m_regfl[idx]; }
 		RISCV_ALWAYS_INLINE const fp64reg& getfl(uint32_t idx) const noexcept { return m_regfl[idx]; }
 
 		register_t& at(uint32_t idx) { return m_reg.at(idx); }
 		const register_t& at(uint32_t idx) const { return m_reg.at(idx); }
 
-		FCSR& fcsr() noexcept { return m_fcsr; }
+		FCSR& fcsr() noexcept { m_fs = ExtState::Dirty; return m_fcsr; }
+		const FCSR& fcsr() const noexcept { return m_fcsr; }
 
 		std::string to_string() const;
 		std::string flp_to_string() const;
 
 #ifdef RISCV_EXT_VECTOR
 		auto& rvv() noexcept {
+			m_vs = ExtState::Dirty;
 			return m_rvv;
 		}
 		const auto& rvv() const noexcept {
@@ -125,13 +128,26 @@ namespace riscv
 #endif
 		bool has_vectors() const noexcept { return vector_extension; }
 
+		/// @brief The state of the FP and the vector register files, as
+		/// mstatus.FS and mstatus.VS encode it. Copies skip a file that has
+		/// never been written, and thread switches skip one that is unchanged
+		/// since the thread was last resumed.
+		enum class ExtState : uint8_t {
+			Initial = 1, // Holds its reset values
+			Clean   = 2, // Holds what the thread context it came from holds
+			Dirty   = 3, // Written to since
+		};
+		ExtState fp_state() const noexcept { return m_fs; }
+		ExtState vector_state() const noexcept { return m_vs; }
+		// For code generators, which mark the files dirty themselves
+		const ExtState& fp_state_ref() const noexcept { return m_fs; }
+		const ExtState& vector_state_ref() const noexcept { return m_vs; }
+
 		Registers() = default;
 		Registers(const Registers& other)
-			: m_reg { other.m_reg }, pc { other.pc }, m_fcsr { other.m_fcsr }, m_regfl { other.m_regfl }
+			: m_reg { other.m_reg }, pc { other.pc }
 		{
-#ifdef RISCV_EXT_VECTOR
-			m_rvv = other.m_rvv;
-#endif
+			this->copy_extensions_from(Options::Everything, other);
 		}
 		enum class Options { Everything, NoVectors };
 
@@ -142,17 +158,105 @@ namespace riscv
 		inline void copy_from(Options opts, const Registers& other) {
 			this->pc    = other.pc;
 			this->m_reg = other.m_reg;
-			this->m_fcsr = other.m_fcsr;
-			this->m_regfl = other.m_regfl;
+			this->copy_extensions_from(opts, other);
+		}
+
+		/// @brief Save the registers of the running thread into its context.
+		/// @details A file that is Clean still holds what @ctx holds, as the
+		/// context is the one the thread was resumed from, and is not copied.
+		inline void save_to(Options opts, Registers& ctx) noexcept {
+			ctx.pc    = this->pc;
+			ctx.m_reg = this->m_reg;
+			if (m_fs == ExtState::Dirty) {
+				ctx.m_fcsr  = m_fcsr;
+				ctx.m_regfl = m_regfl;
+				ctx.m_fs = m_fs = ExtState::Clean;
+			} else if (m_fs == ExtState::Initial) {
+				ctx.reset_fp();
+			}
+#ifdef RISCV_EXT_VECTOR
+			if (opts == Options::Everything) {
+				if (m_vs == ExtState::Dirty) {
+					ctx.m_rvv = m_rvv;
+					ctx.m_vs = m_vs = ExtState::Clean;
+				} else if (m_vs == ExtState::Initial) {
+					ctx.reset_vectors();
+				}
+			}
+#endif
+			(void)opts;
+		}
+		/// @brief Another thread takes over the registers as they are, so
+		/// a Clean file no longer holds what its context holds.
+		inline void leave_context() noexcept {
+			if (m_fs == ExtState::Clean)
+				m_fs = ExtState::Dirty;
+			if (m_vs == ExtState::Clean)
+				m_vs = ExtState::Dirty;
+		}
+		/// @brief Resume a thread from its context, see save_to().
+		inline void restore_from(Options opts, const Registers& ctx) noexcept {
+			this->pc    = ctx.pc;
+			this->m_reg = ctx.m_reg;
+			if (ctx.m_fs != ExtState::Initial) {
+				m_fcsr  = ctx.m_fcsr;
+				m_regfl = ctx.m_regfl;
+				m_fs = ExtState::Clean;
+			} else {
+				this->reset_fp();
+			}
 #ifdef RISCV_EXT_VECTOR
 			if (opts == Options::Everything) {
-				m_rvv = other.m_rvv;
+				if (ctx.m_vs != ExtState::Initial) {
+					m_rvv = ctx.m_rvv;
+					m_vs = ExtState::Clean;
+				} else {
+					this->reset_vectors();
+				}
 			}
 #endif
 			(void)opts;
 		}
 
 	private:
+		// A file in its initial state is all reset values, which need not be
+		// copied, only re-established where the destination has been used.
+		void copy_extensions_from(Options opts, const Registers& other) noexcept {
+			if (other.m_fs != ExtState::Initial) {
+				m_fcsr  = other.m_fcsr;
+				m_regfl = other.m_regfl;
+				m_fs = ExtState::Dirty;
+			} else {
+				this->reset_fp();
+			}
+#ifdef RISCV_EXT_VECTOR
+			if (opts == Options::Everything) {
+				if (other.m_vs != ExtState::Initial) {
+					m_rvv = other.m_rvv;
+					m_vs = ExtState::Dirty;
+				} else {
+					this->reset_vectors();
+				}
+			}
+#endif
+			(void)opts;
+		}
+		void reset_fp() noexcept {
+			if (m_fs != ExtState::Initial) {
+				m_fcsr  = {};
+				m_regfl = {};
+				m_fs = ExtState::Initial;
+			}
+		}
+#ifdef RISCV_EXT_VECTOR
+		void reset_vectors() noexcept {
+			if (m_vs != ExtState::Initial) {
+				m_rvv = {};
+				m_vs = ExtState::Initial;
+			}
+		}
+#endif
+
 		// General purpose registers
 		std::array<register_t, 32> m_reg {};
 	public:
@@ -160,6 +264,9 @@ namespace riscv
 	private:
 		// FP control register
 		FCSR m_fcsr {};
+		// FP and vector register file state, see ExtState
+		ExtState m_fs = ExtState::Initial;
+		ExtState m_vs = ExtState::Initial;
 		// General FP registers
 		std::array<fp64reg, 32> m_regfl {};
 #ifdef RISCV_EXT_VECTOR
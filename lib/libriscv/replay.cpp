@@ -0,0 +1,520 @@
+#include "machine.hpp"
+#include "internal_common.hpp"
+#ifdef RISCV_REPLAY
+#include "replay.hpp"
+#include <algorithm>
+#endif
+
+namespace riscv
+{
+#ifdef RISCV_REPLAY
+	static constexpr uint32_t REPLAY_MAGIC   = 0x50525652; // "RVRP"
+	static constexpr uint8_t  REPLAY_VERSION = 1;
+
+	enum ReplayEvent : uint8_t {
+		EVENT_SYSCALL = 1,
+		EVENT_RDTIME  = 2,
+		EVENT_INPUT   = 3,
+	};
+	// What changed during a recorded system call
+	enum SyscallChanges : unsigned {
+		CHANGED_REGISTERS    = 1u << 0,
+		CHANGED_FP_REGISTERS = 1u << 1,
+		CHANGED_PC           = 1u << 2,
+		CHANGED_COUNTER      = 1u << 3,
+		CHANGED_MAX_COUNTER  = 1u << 4,
+		CHANGED_MMAP_ADDRESS = 1u << 5,
+		CHANGED_BRK_ADDRESS  = 1u << 6,
+		CHANGED_FILLS        = 1u << 7,
+		CHANGED_MEMORY       = 1u << 8,
+		CHANGED_EXCEPTION    = 1u << 9,
+	};
+	enum ExceptionKind : uint8_t {
+		EXCEPTION_MACHINE = 0,
+		EXCEPTION_TIMEOUT = 1,
+		EXCEPTION_OTHER   = 2,
+	};
+
+	[[noreturn]] static void replay_diverged(const char* reason, uint64_t data)
+	{
+		throw MachineException(ILLEGAL_OPERATION, reason, data);
+	}
+
+	template <typename T>
+	static void put(std::vector<uint8_t>& log, T value)
+	{
+		do {
+			uint8_t byte = uint8_t(value & 0x7F);
+			value >>= 7;
+			if (value != 0)
+				byte |= 0x80;
+			log.push_back(byte);
+		} while (value != 0);
+	}
+	static void put_bytes(std::vector<uint8_t>& log, const void* data, size_t len)
+	{
+		const auto* bytes = (const uint8_t *)data;
+		log.insert(log.end(), bytes, bytes + len);
+	}
+
+	template <int W>
+	template <typename T>
+	T ExecutionReplay<W>::get()
+	{
+		T value = 0;
+		for (unsigned shift = 0; shift < sizeof(T) * 8; shift += 7)
+		{
+			if (UNLIKELY(position >= log.size()))
+				replay_diverged("Replay diverged: the log ended", position);
+			const uint8_t byte = log[position++];
+			value |= T(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+				return value;
+		}
+		replay_diverged("Replay diverged: corrupt log", position);
+	}
+
+	template <int W>
+	uint8_t ExecutionReplay<W>::next_event()
+	{
+		if (UNLIKELY(position >= log.size()))
+			replay_diverged("Replay diverged: the log ended", position);
+		return log[position++];
+	}
+
+	template <int W>
+	void ExecutionReplay<W>::write_header(const Machine<W>& machine)
+	{
+		const uint32_t magic = REPLAY_MAGIC;
+		put_bytes(log, &magic, sizeof(magic));
+		log.push_back(REPLAY_VERSION);
+		log.push_back(W);
+		put(log, machine.cpu.pc());
+		put(log, machine.instruction_counter());
+		for (unsigned i = 1; i < 32; i++)
+			put(log, machine.cpu.reg(i));
+	}
+
+	template <int W>
+	void ExecutionReplay<W>::read_header(const Machine<W>& machine)
+	{
+		uint32_t magic = 0;
+		if (log.size() < sizeof(magic) + 2)
+			throw MachineException(INVALID_PROGRAM, "Not an execution replay log");
+		std::memcpy(&magic, log.data(), sizeof(magic));
+		if (magic != REPLAY_MAGIC || log[4] != REPLAY_VERSION || log[5] != W)
+			throw MachineException(INVALID_PROGRAM, "Not an execution replay log for this architecture");
+		this->position = sizeof(magic) + 2;
+
+		bool same = get<address_t>() == machine.cpu.pc();
+		same &= get<uint64_t>() == machine.instruction_counter();
+		for (unsigned i = 1; i < 32; i++)
+			same &= get<address_t>() == machine.cpu.reg(i);
+		if (!same)
+			throw MachineException(INVALID_PROGRAM, "Machine is not in the state that the replay log was recorded from");
+	}
+
+	template <int W>
+	struct ExecutionReplay<W>::SavedState
+	{
+		std::array<address_t, 32> regs;
+		std::array<int64_t, 32> fregs;
+		address_t pc;
+		uint64_t  counter;
+		uint64_t  max_counter;
+		address_t mmap_address;
+		address_t brk_address;
+
+		SavedState(const Machine<W>& machine)
+			: regs(machine.cpu.registers().get()),
+			  pc(machine.cpu.pc()),
+			  counter(machine.instruction_counter()),
+			  max_counter(machine.max_instructions()),
+			  mmap_address(machine.memory.mmap_address()),
+			  brk_address(machine.memory.brk_address())
+		{
+			for (unsigned i = 0; i < 32; i++)
+				fregs[i] = machine.cpu.registers().getfl(i).i64;
+		}
+	};
+
+	template <int W>
+	void ExecutionReplay<W>::system_call(Machine<W>& machine, size_t sysnum)
+	{
+		// System calls made by guest code that a recorded handler runs are
+		// part of that handler. Deterministic ones run again during replay.
+		const auto filter = Machine<W>::deterministic_syscalls[sysnum];
+		if (this->in_handler || (filter != nullptr && filter(machine))) {
+			machine.execute_system_call(sysnum);
+			return;
+		}
+		if (this->recording)
+			this->record_system_call(machine, sysnum);
+		else
+			this->replay_system_call(machine, sysnum);
+	}
+
+	template <int W>
+	void ExecutionReplay<W>::record_system_call(Machine<W>& machine, size_t sysnum)
+	{
+		const SavedState before { machine };
+		journal.ranges.clear();
+		machine.memory.set_journal(&journal);
+		this->in_handler = true;
+		try {
+			machine.execute_system_call(sysnum);
+		} catch (const MachineTimeoutException& e) {
+			this->log_system_call(machine, before, sysnum, EXCEPTION_TIMEOUT, e.type(), e.data(), e.what());
+			throw;
+		} catch (const MachineException& e) {
+			this->log_system_call(machine, before, sysnum, EXCEPTION_MACHINE, e.type(), e.data(), e.what());
+			throw;
+		} catch (const std::exception& e) {
+			this->log_system_call(machine, before, sysnum, EXCEPTION_OTHER, SYSTEM_CALL_FAILED, 0, e.what());
+			throw;
+		} catch (...) {
+			this->log_system_call(machine, before, sysnum, EXCEPTION_OTHER, SYSTEM_CALL_FAILED, 0, "Unknown exception");
+			throw;
+		}
+		this->log_system_call(machine, before, sysnum, -1, 0, 0, nullptr);
+	}
+
+	template <int W>
+	void ExecutionReplay<W>::log_system_call(Machine<W>& machine, const SavedState& before,
+		size_t sysnum, int exception_kind, int type, uint64_t data, const char* what)
+	{
+		machine.memory.set_journal(nullptr);
+		this->in_handler = false;
+
+		const auto& regs = machine.cpu.registers();
+		uint32_t reg_mask = 0;
+		uint32_t freg_mask = 0;
+		for (unsigned i = 1; i < 32; i++) {
+			if (regs.get(i) != before.regs[i])
+				reg_mask |= 1u << i;
+		}
+		for (unsigned i = 0; i < 32; i++) {
+			if (regs.getfl(i).i64 != before.fregs[i])
+				freg_mask |= 1u << i;
+		}
+
+		// Fills are replayed in order, and then the final contents of every
+		// other range that was written to, which overrides the fills
+		size_t fills = 0;
+		std::vector<typename MemoryJournal<W>::Range> ranges;
+		for (const auto& range : journal.ranges) {
+			if (range.len == 0)
+				continue;
+			if (range.fill >= 0)
+				fills++;
+			else
+				ranges.push_back(range);
+		}
+		std::sort(ranges.begin(), ranges.end(),
+			[] (const auto& a, const auto& b) { return a.addr < b.addr; });
+		size_t merged = 0;
+		for (size_t i = 1; i < ranges.size(); i++) {
+			auto& last = ranges[merged];
+			if (ranges[i].addr <= last.addr + last.len && ranges[i].addr >= last.addr) {
+				const address_t end = std::max(address_t(last.addr + last.len),
+					address_t(ranges[i].addr + ranges[i].len));
+				last.len = end - last.addr;
+			} else {
+				ranges[++merged] = ranges[i];
+			}
+		}
+		if (!ranges.empty())
+			ranges.resize(merged + 1);
+
+		unsigned changes = 0;
+		if (reg_mask != 0) changes |= CHANGED_REGISTERS;
+		if (freg_mask != 0) changes |= CHANGED_FP_REGISTERS;
+		if (regs.pc != before.pc) changes |= CHANGED_PC;
+		if (machine.instruction_counter() != before.counter) changes |= CHANGED_COUNTER;
+		if (machine.max_instructions() != before.max_counter) changes |= CHANGED_MAX_COUNTER;
+		if (machine.memory.mmap_address() != before.mmap_address) changes |= CHANGED_MMAP_ADDRESS;
+		if (machine.memory.brk_address() != before.brk_address) changes |= CHANGED_BRK_ADDRESS;
+		if (fills != 0) changes |= CHANGED_FILLS;
+		if (!ranges.empty()) changes |= CHANGED_MEMORY;
+		if (exception_kind >= 0) changes |= CHANGED_EXCEPTION;
+
+		log.push_back(EVENT_SYSCALL);
+		put(log, uint64_t(sysnum));
+		put(log, before.pc);
+		put(log, changes);
+		if (changes & CHANGED_REGISTERS) {
+			put(log, reg_mask);
+			for (unsigned i = 1; i < 32; i++)
+				if (reg_mask & (1u << i)) put(log, regs.get(i));
+		}
+		if (changes & CHANGED_FP_REGISTERS) {
+			put(log, freg_mask);
+			for (unsigned i = 0; i < 32; i++)
+				if (freg_mask & (1u << i)) put(log, uint64_t(regs.getfl(i).i64));
+		}
+		if (changes & CHANGED_PC)
+			put(log, regs.pc);
+		if (changes & CHANGED_COUNTER)
+			put(log, machine.instruction_counter());
+		if (changes & CHANGED_MAX_COUNTER)
+			put(log, machine.max_instructions());
+		if (changes & CHANGED_MMAP_ADDRESS)
+			put(log, machine.memory.mmap_address());
+		if (changes & CHANGED_BRK_ADDRESS)
+			put(log, machine.memory.brk_address());
+		if (changes & CHANGED_FILLS) {
+			put(log, uint64_t(fills));
+			for (const auto& range : journal.ranges) {
+				if (range.len == 0 || range.fill < 0)
+					continue;
+				put(log, range.addr);
+				put(log, uint64_t(range.len));
+				log.push_back(uint8_t(range.fill));
+			}
+		}
+		if (changes & CHANGED_MEMORY) {
+			// A range can be gone by the end of the handler, eg. unmapped
+			std::vector<uint8_t> contents;
+			std::vector<std::pair<address_t, size_t>> readable;
+			for (const auto& range : ranges) {
+				const size_t offset = contents.size();
+				contents.resize(offset + range.len);
+				try {
+					machine.memory.memcpy_out(contents.data() + offset, range.addr, range.len);
+					readable.push_back({range.addr, range.len});
+				} catch (const MachineException&) {
+					contents.resize(offset);
+				}
+			}
+			put(log, uint64_t(readable.size()));
+			size_t offset = 0;
+			for (const auto& [addr, len] : readable) {
+				put(log, addr);
+				put(log, uint64_t(len));
+				put_bytes(log, contents.data() + offset, len);
+				offset += len;
+			}
+		}
+		if (changes & CHANGED_EXCEPTION) {
+			const size_t len = std::strlen(what);
+			log.push_back(uint8_t(exception_kind));
+			put(log, uint64_t(type));
+			put(log, data);
+			put(log, uint64_t(len));
+			put_bytes(log, what, len);
+		}
+		journal.ranges.clear();
+	}
+
+	template <int W>
+	void ExecutionReplay<W>::replay_system_call(Machine<W>& machine, size_t sysnum)
+	{
+		if (next_event() != EVENT_SYSCALL || get<uint64_t>() != sysnum)
+			replay_diverged("Replay diverged: unexpected system call", sysnum);
+		if (get<address_t>() != machine.cpu.pc())
+			replay_diverged("Replay diverged: system call from another location", sysnum);
+		const unsigned changes = get<unsigned>();
+
+		auto& regs = machine.cpu.registers();
+		if (changes & CHANGED_REGISTERS) {
+			const uint32_t mask = get<uint32_t>();
+			for (unsigned i = 1; i < 32; i++)
+				if (mask & (1u << i)) regs.get(i) = get<address_t>();
+		}
+		if (changes & CHANGED_FP_REGISTERS) {
+			const uint32_t mask = get<uint32_t>();
+			for (unsigned i = 0; i < 32; i++)
+				if (mask & (1u << i)) regs.getfl(i).i64 = int64_t(get<uint64_t>());
+		}
+		if (changes & CHANGED_PC)
+			regs.pc = get<address_t>();
+		if (changes & CHANGED_COUNTER)
+			machine.set_instruction_counter(get<uint64_t>());
+		if (changes & CHANGED_MAX_COUNTER)
+			machine.set_max_instructions(get<uint64_t>());
+		if (changes & CHANGED_MMAP_ADDRESS)
+			machine.memory.mmap_address() = get<address_t>();
+		if (changes & CHANGED_BRK_ADDRESS)
+			machine.memory.set_brk_address(get<address_t>());
+		if (changes & CHANGED_FILLS) {
+			for (uint64_t n = get<uint64_t>(); n > 0; n--) {
+				const address_t addr = get<address_t>();
+				const size_t len = get<uint64_t>();
+				const uint8_t value = next_event();
+				if (value == 0)
+					machine.memory.memdiscard(addr, len, true);
+				else
+					machine.memory.memset(addr, value, len);
+			}
+		}
+		if (changes & CHANGED_MEMORY) {
+			for (uint64_t n = get<uint64_t>(); n > 0; n--) {
+				const address_t addr = get<address_t>();
+				const size_t len = get<uint64_t>();
+				if (UNLIKELY(len > log.size() - position))
+					replay_diverged("Replay diverged: corrupt log", position);
+				machine.memory.memcpy(addr, &log[position], len);
+				position += len;
+			}
+		}
+		if (changes & CHANGED_EXCEPTION) {
+			const uint8_t kind = next_event();
+			const int type = get<uint64_t>();
+			const uint64_t data = get<uint64_t>();
+			const size_t len = get<uint64_t>();
+			if (UNLIKELY(len > log.size() - position))
+				replay_diverged("Replay diverged: corrupt log", position);
+			messages.emplace_back((const char *)&log[position], len);
+			position += len;
+			if (kind == EXCEPTION_TIMEOUT)
+				throw MachineTimeoutException(type, messages.back().c_str(), data);
+			throw MachineException(type, messages.back().c_str(), data);
+		}
+	}
+
+	template <int W>
+	uint64_t ExecutionReplay<W>::rdtime(const Machine<W>& machine)
+	{
+		if (this->recording) {
+			const uint64_t time = machine.m_rdtime(machine);
+			if (!this->in_handler) {
+				// Time moves forward in small steps, so store the difference
+				const int64_t delta = int64_t(time - last_rdtime);
+				log.push_back(EVENT_RDTIME);
+				put(log, uint64_t(delta << 1) ^ uint64_t(delta >> 63));
+				this->last_rdtime = time;
+			}
+			return time;
+		}
+		if (next_event() != EVENT_RDTIME)
+			replay_diverged("Replay diverged: unexpected RDTIME", machine.cpu.pc());
+		const uint64_t zigzag = get<uint64_t>();
+		const int64_t delta = int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1);
+		this->last_rdtime += uint64_t(delta);
+		return this->last_rdtime;
+	}
+
+	template <int W>
+	void ExecutionReplay<W>::input(void* data, size_t len)
+	{
+		if (this->recording) {
+			if (!this->in_handler) {
+				log.push_back(EVENT_INPUT);
+				put(log, uint64_t(len));
+				put_bytes(log, data, len);
+			}
+			return;
+		}
+		if (next_event() != EVENT_INPUT || get<uint64_t>() != len || len > log.size() - position)
+			replay_diverged("Replay diverged: unexpected host input", len);
+		std::memcpy(data, &log[position], len);
+		position += len;
+	}
+
+	template <int W>
+	void Machine<W>::replayed_system_call(size_t sysnum)
+	{
+		m_replay->system_call(*this, sysnum);
+	}
+
+	template <int W>
+	uint64_t Machine<W>::replayed_rdtime() const
+	{
+		return m_replay->rdtime(*this);
+	}
+#endif // RISCV_REPLAY
+
+	template <int W>
+	void Machine<W>::start_recording()
+	{
+#ifdef RISCV_REPLAY
+		auto replay = std::make_unique<ExecutionReplay<W>>(true);
+		replay->write_header(*this);
+		this->m_replay = std::move(replay);
+#else
+		throw MachineException(FEATURE_DISABLED, "Execution replay is not enabled (RISCV_REPLAY)");
+#endif
+	}
+
+	template <int W>
+	std::vector<uint8_t> Machine<W>::stop_recording()
+	{
+#ifdef RISCV_REPLAY
+		if (!this->is_recording())
+			return {};
+		std::vector<uint8_t> log = std::move(m_replay->log);
+		this->m_replay = nullptr;
+		return log;
+#else
+		return {};
+#endif
+	}
+
+	template <int W>
+	void Machine<W>::start_replay(std::vector<uint8_t> log)
+	{
+#ifdef RISCV_REPLAY
+		auto replay = std::make_unique<ExecutionReplay<W>>(false);
+		replay->log = std::move(log);
+		replay->read_header(*this);
+		this->m_replay = std::move(replay);
+#else
+		(void)log;
+		throw MachineException(FEATURE_DISABLED, "Execution replay is not enabled (RISCV_REPLAY)");
+#endif
+	}
+
+	template <int W>
+	bool Machine<W>::stop_replay()
+	{
+#ifdef RISCV_REPLAY
+		if (!this->is_replaying())
+			return false;
+		const bool complete = m_replay->position == m_replay->log.size();
+		this->m_replay = nullptr;
+		return complete;
+#else
+		return false;
+#endif
+	}
+
+	template <int W>
+	bool Machine<W>::is_recording() const noexcept
+	{
+#ifdef RISCV_REPLAY
+		return m_replay != nullptr && m_replay->recording;
+#else
+		return false;
+#endif
+	}
+
+	template <int W>
+	bool Machine<W>::is_replaying() const noexcept
+	{
+#ifdef RISCV_REPLAY
+		return m_replay != nullptr && !m_replay->recording;
+#else
+		return false;
+#endif
+	}
+
+	template <int W>
+	void Machine<W>::replay_input(void* data, size_t len)
+	{
+#ifdef RISCV_REPLAY
+		if (m_replay != nullptr)
+			m_replay->input(data, len);
+#else
+		(void)data; (void)len;
+#endif
+	}
+
+#ifdef RISCV_REPLAY
+	INSTANTIATE_32_IF_ENABLED(ExecutionReplay);
+	INSTANTIATE_64_IF_ENABLED(ExecutionReplay);
+	INSTANTIATE_128_IF_ENABLED(ExecutionReplay);
+#endif
+	INSTANTIATE_32_IF_ENABLED(Machine);
+	INSTANTIATE_64_IF_ENABLED(Machine);
+	INSTANTIATE_128_IF_ENABLED(Machine);
+} // riscv
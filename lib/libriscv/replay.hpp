@@ -0,0 +1,49 @@
+#pragma once
+#include "machine.hpp"
+#include <deque>
+#include <string>
+
+namespace riscv
+{
+	/// @brief The log of a machine that records its execution, or replays
+	/// a recorded one, see Machine::start_recording().
+	/// @details The log begins with a header that holds the registers and
+	/// the instruction counter when recording started, followed by events: the results of non-deterministic system calls,
+	/// RDTIME values and host inputs. Numbers are stored as LEB128, which
+	/// keeps the typical system call event below a dozen bytes.
+	template <int W>
+	struct ExecutionReplay
+	{
+		using address_t = address_type<W>;
+
+		ExecutionReplay(bool is_recording) : recording(is_recording) {}
+
+		void system_call(Machine<W>&, size_t sysnum);
+		uint64_t rdtime(const Machine<W>&);
+		void input(void* data, size_t len);
+
+		void write_header(const Machine<W>&);
+		// Verifies that the machine is where recording started
+		void read_header(const Machine<W>&);
+
+		const bool recording;
+		// A recorded system call handler is running. Nothing that it causes
+		// is logged, as replays will not run it.
+		bool in_handler = false;
+		std::vector<uint8_t> log;
+		size_t   position = 0; // Next event, when replaying
+		uint64_t last_rdtime = 0;
+		MemoryJournal<W> journal;
+		// Replayed exceptions refer to their messages
+		std::deque<std::string> messages;
+
+	private:
+		struct SavedState;
+		void record_system_call(Machine<W>&, size_t sysnum);
+		void log_system_call(Machine<W>&, const SavedState&, size_t sysnum,
+			int exception_kind, int type, uint64_t data, const char* what);
+		void replay_system_call(Machine<W>&, size_t sysnum);
+		uint8_t next_event();
+		template <typename T> T get();
+	};
+}
@@ -34,6 +34,14 @@ namespace riscv
 			return result;
 		}
 
+		// A context switch ends the LR/SC sequence of the thread it leaves,
+		// so that its SC can not succeed on a word that others have changed
+		void invalidate_reservation() noexcept
+		{
+			m_reservation = 0x0;
+			m_reservation_valid = false;
+		}
+
 	private:
 		inline bool check_alignment(int size, address_t addr) RISCV_INTERNAL
 		{
@@ -995,7 +995,7 @@ namespace riscv
 	INSTRUCTION(FENCE,
 	[] (auto& cpu, rv32i_instruction instr) RVINSTR_COLDATTR {
 		if (instr.Itype.funct3 == 0x1)
-			cpu.machine().memory.mark_execute_segments_stale();
+			cpu.machine().memory.flush_execute_segments();
 		// Do a full barrier, for now
 		std::atomic_thread_fence(std::memory_order_seq_cst);
 	},
@@ -0,0 +1,70 @@
+#pragma once
+#include "common.hpp"
+#include <array>
+#include <cstdint>
+
+namespace riscv
+{
+	/// @brief Event counters of a single machine, see Machine::enable_statistics().
+	/// @details Counting requires building with RISCV_STATISTICS. The counters
+	/// of several machines, such as all the forks of one machine, can be summed
+	/// up with operator+=.
+	struct MachineStatistics
+	{
+		struct SystemCall {
+			uint64_t calls = 0;
+			uint64_t nanoseconds = 0; // Wall time spent in the handler
+		};
+		std::array<SystemCall, RISCV_SYSCALLS_MAX> syscalls {};
+		uint64_t unknown_syscalls = 0;     // Numbers outside of the system call table
+		uint64_t page_faults = 0;          // Pages created by the page fault handler
+		uint64_t cow_copies = 0;           // Copy-on-write pages that were made writable
+		uint64_t execute_segments = 0;     // Execute segments created, eg. for JIT-compiled code
+		uint64_t segment_lookups = 0;      // Jumps outside of the current execute segment
+		uint64_t decoder_cache_misses = 0; // Lookups that found no decoded execute segment
+		uint64_t livepatch_switches = 0;   // Switches to a patched decoder cache
+		uint64_t bintr_entries = 0;        // Calls into binary translated code
+		uint64_t bintr_exits = 0;          // Returns from it to the interpreter
+		uint64_t asmjit_entries = 0;       // Calls into asmjit-generated code
+		uint64_t asmjit_exits = 0;         // Returns from it to the interpreter
+		uint64_t timeouts = 0;             // Simulations that ran out of instructions
+
+		uint64_t total_syscalls() const noexcept {
+			uint64_t total = unknown_syscalls;
+			for (const auto& sc : syscalls)
+				total += sc.calls;
+			return total;
+		}
+		void reset() noexcept { *this = MachineStatistics{}; }
+
+		MachineStatistics& operator += (const MachineStatistics& other) noexcept {
+			for (size_t i = 0; i < syscalls.size(); i++) {
+				syscalls[i].calls       += other.syscalls[i].calls;
+				syscalls[i].nanoseconds += other.syscalls[i].nanoseconds;
+			}
+			unknown_syscalls     += other.unknown_syscalls;
+			page_faults          += other.page_faults;
+			cow_copies           += other.cow_copies;
+			execute_segments     += other.execute_segments;
+			segment_lookups      += other.segment_lookups;
+			decoder_cache_misses += other.decoder_cache_misses;
+			livepatch_switches   += other.livepatch_switches;
+			bintr_entries        += other.bintr_entries;
+			bintr_exits          += other.bintr_exits;
+			asmjit_entries       += other.asmjit_entries;
+			asmjit_exits         += other.asmjit_exits;
+			timeouts             += other.timeouts;
+			return *this;
+		}
+	};
+} // riscv
+
+// Count an event on a machine, when it has statistics enabled. Without
+// RISCV_STATISTICS this compiles to nothing.
+#ifdef RISCV_STATISTICS
+#define RISCV_STAT_ADD(machine, counter, n) \
+	do { if (auto* stats_ = (machine).statistics(); UNLIKELY(stats_ != nullptr)) stats_->counter += (n); } while (0)
+#else
+#define RISCV_STAT_ADD(machine, counter, n) do {} while (0)
+#endif
+#define RISCV_STAT_INC(machine, counter) RISCV_STAT_ADD(machine, counter, 1)
@@ -36,6 +36,10 @@
 #define NEXT_C_INSTR() \
 	d += 1;            \
 	EXECUTE_CURRENT()
+#define SKIP_INSTR() \
+	d += (compressed_enabled ? 2 : 1);
+#define SKIP_C_INSTR() \
+	d += 1;
 
 #define RETURN_VALUES()   \
 	pc
@@ -168,9 +172,14 @@ namespace riscv
 #ifdef RISCV_BINARY_TRANSLATION
 	INSTRUCTION(RV32I_BC_TRANSLATOR, translated_function) {
 		VIEW_INSTR();
+		RISCV_STAT_INC(MACHINE(), bintr_entries);
+		const auto slice = interrupt_slice(counter.value()-1, counter.max());
 		auto new_values = 
-			exec->mapping_at(instr.whole)(CPU(), counter.value()-1, counter.max(), pc);
-		counter.set_counters(new_values.counter, new_values.max_counter);
+			exec->mapping_at(instr.whole)(CPU(), counter.value()-1, slice, pc);
+		RISCV_STAT_INC(MACHINE(), bintr_exits);
+		// A changed limit (eg. from stop()) replaces the real one
+		counter.set_counters(new_values.counter,
+			(new_values.max_counter == slice) ? counter.max() : new_values.max_counter);
 		if (new_values.max_counter == 0) {
 #ifdef RISCV_LIBTCC
 			// We need to check if we have a current exception
@@ -191,8 +200,16 @@ namespace riscv
 #ifdef RISCV_ASMJIT
 	INSTRUCTION(RV32I_BC_ASMJIT, asmjit_function) {
 		AjState<W> state { counter.value() - d->instruction_count(), counter.max(), pc };
+		uint64_t max = counter.max();
 		do {
+			RISCV_STAT_INC(MACHINE(), asmjit_entries);
+			const uint64_t slice = interrupt_slice(state.counter, max);
+			state.max_counter = slice;
 			exec->unchecked_asmjit_mapping_at(d->instr)(cpu, &state);
+			// A changed limit (eg. from stop()) replaces the real one
+			if (state.max_counter == slice)
+				state.max_counter = max;
+			max = state.max_counter;
 			if (UNLIKELY(cpu.has_current_exception())) {
 				const auto except = cpu.current_exception();
 				cpu.clear_current_exception();
@@ -202,13 +219,40 @@ namespace riscv
 			if (UNLIKELY(!(pc >= exec->exec_begin() && pc < exec->exec_end())))
 				break;
 			d = &exec->decoder_cache()[pc >> DecoderData<W>::SHIFT];
-		} while (state.counter < state.max_counter && d->get_bytecode() == RV32I_BC_ASMJIT);
+		} while (state.counter < state.max_counter && !counter.interrupted()
+			&& d->get_bytecode() == RV32I_BC_ASMJIT);
+		RISCV_STAT_INC(MACHINE(), asmjit_exits);
 		counter.set_counters(state.counter, state.max_counter);
 		OVERFLOW_CHECK();
 		UNCHECKED_JUMP();
 	}
 #endif
 
+	INSTRUCTION(RV32I_BC_TRACE, trace_function) {
+		auto* heads = exec->trace_heads();
+		if (d->m_handler != 0) {
+			// Still counting, so run the original instruction
+			auto* head = heads->hit(RECONSTRUCT_PC());
+			if (LIKELY(head == nullptr))
+				MUSTTAIL return computed_opcode<W>[d->m_handler](d, exec, cpu, pc, counter);
+			// The loop became hot: record it from the loop head
+			counter.increment_counter(-int64_t(d->instruction_count()));
+			cpu.registers().pc = RECONSTRUCT_PC();
+			counter.apply(MACHINE());
+			heads->record(cpu, *exec, *head);
+			counter.retrieve_counters(MACHINE());
+			pc = cpu.registers().pc;
+			OVERFLOW_CHECK();
+			UNCHECKED_JUMP();
+		}
+		const auto results = heads->trace_at(RECONSTRUCT_PC())->run(
+			cpu, counter.value() - d->instruction_count(), counter.max());
+		counter.set_counters(results.counter, counter.max());
+		pc = results.pc;
+		OVERFLOW_CHECK();
+		UNCHECKED_JUMP();
+	}
+
 	INSTRUCTION(RV32I_BC_SYSTEM, rv32i_system) {
 		VIEW_INSTR();
 		// Make the current PC visible
@@ -329,6 +373,9 @@ namespace riscv
 		[RV32I_BC_BSETI]  = rv32i_bseti,
 		[RV32I_BC_BEXTI]  = rv32i_bexti,
 
+		[RV32I_BC_LUI_ADDI]   = rv32i_lui_addi,
+		[RV32I_BC_AUIPC_ADDI] = rv32i_auipc_addi,
+
 #ifdef RISCV_64I
 		[RV64I_BC_ADDIW]  = rv64i_addiw,
 		[RV64I_BC_SLLIW]  = rv64i_slliw,
@@ -340,6 +387,9 @@ namespace riscv
 		[RV64I_BC_OP_ADD_UW] = rv64i_op_add_uw,
 		[RV64I_BC_OP_SH1ADD_UW] = rv64i_op_sh1add_uw,
 		[RV64I_BC_OP_SH2ADD_UW] = rv64i_op_sh2add_uw,
+		[RV64I_BC_LDD_LDD] = rv64i_ldd_ldd,
+		[RV64I_BC_STD_STD] = rv64i_std_std,
+		[RV64I_BC_AUIPC_LDD] = rv64i_auipc_ldd,
 #endif // RISCV_64I
 
 #ifdef RISCV_EXT_COMPRESSED
@@ -363,6 +413,8 @@ namespace riscv
 		[RV32C_BC_XOR]      = rv32c_xor,
 		[RV32C_BC_OR]       = rv32c_or,
 		[RV32C_BC_FUNCTION] = rv32c_func,
+		[RV32C_BC_LDD_LDD]  = rv32c_ldd_ldd,
+		[RV32C_BC_STD_STD]  = rv32c_std_std,
 #endif
 
 		[RV32I_BC_SYSCALL] = rv32i_syscall,
@@ -386,6 +438,7 @@ namespace riscv
 		[RV32I_BC_ASMJIT] = asmjit_function,
 #endif
 		[RV32I_BC_LIVEPATCH] = execute_livepatch,
+		[RV32I_BC_TRACE]     = trace_function,
 		[RV32I_BC_SYSTEM]  = rv32i_system,
 		};
 	}
@@ -393,7 +446,7 @@ namespace riscv
 	template <int W> inline RISCV_HOT_PATH()
 	bool CPU<W>::simulate(address_t pc, uint64_t inscounter, uint64_t maxcounter)
 	{
-		InstrCounter counter{inscounter, maxcounter};
+		InstrCounter counter{inscounter, maxcounter, machine().interrupt_flag()};
 
 		auto* exec = this->m_exec;
 
@@ -426,7 +479,7 @@ namespace riscv
 	{
 		machine().set_instruction_counter(0);
 		machine().set_max_instructions(UINT64_MAX);
-		InstrCounter counter{0, UINT64_MAX};
+		InstrCounter counter{0, UINT64_MAX, machine().interrupt_flag()};
 
 		auto* exec = this->m_exec;
 
@@ -69,6 +69,9 @@ static constexpr void *computed_opcode[] = {
 	[RV32I_BC_BSETI] = &&rv32i_bseti,
 	[RV32I_BC_BEXTI] = &&rv32i_bexti,
 
+	[RV32I_BC_LUI_ADDI] = &&rv32i_lui_addi,
+	[RV32I_BC_AUIPC_ADDI] = &&rv32i_auipc_addi,
+
 #ifdef RISCV_64I
 	[RV64I_BC_ADDIW] = &&rv64i_addiw,
 	[RV64I_BC_SLLIW] = &&rv64i_slliw,
@@ -80,6 +83,9 @@ static constexpr void *computed_opcode[] = {
 	[RV64I_BC_OP_ADD_UW] = &&rv64i_op_add_uw,
 	[RV64I_BC_OP_SH1ADD_UW] = &&rv64i_op_sh1add_uw,
 	[RV64I_BC_OP_SH2ADD_UW] = &&rv64i_op_sh2add_uw,
+	[RV64I_BC_LDD_LDD] = &&rv64i_ldd_ldd,
+	[RV64I_BC_STD_STD] = &&rv64i_std_std,
+	[RV64I_BC_AUIPC_LDD] = &&rv64i_auipc_ldd,
 #endif // RISCV_64I
 
 #ifdef RISCV_EXT_COMPRESSED
@@ -103,6 +109,8 @@ static constexpr void *computed_opcode[] = {
 	[RV32C_BC_XOR]  = &&rv32c_xor,
 	[RV32C_BC_OR]   = &&rv32c_or,
 	[RV32C_BC_FUNCTION] = &&rv32c_func,
+	[RV32C_BC_LDD_LDD] = &&rv32c_ldd_ldd,
+	[RV32C_BC_STD_STD] = &&rv32c_std_std,
 #endif
 
 	[RV32I_BC_SYSCALL] = &&rv32i_syscall,
@@ -126,5 +134,6 @@ static constexpr void *computed_opcode[] = {
 	[RV32I_BC_ASMJIT] = &&asmjit_function,
 #endif
 	[RV32I_BC_LIVEPATCH]  = &&execute_livepatch,
+	[RV32I_BC_TRACE]      = &&trace_function,
 	[RV32I_BC_SYSTEM] = &&rv32i_system,
 };
@@ -78,6 +78,9 @@ namespace riscv
 		RV32I_BC_BSETI,
 		RV32I_BC_BEXTI,
 
+		RV32I_BC_LUI_ADDI,
+		RV32I_BC_AUIPC_ADDI,
+
 #ifdef RISCV_64I
 		RV64I_BC_ADDIW,
 		RV64I_BC_SLLIW,
@@ -89,6 +92,9 @@ namespace riscv
 		RV64I_BC_OP_ADD_UW,
 		RV64I_BC_OP_SH1ADD_UW,
 		RV64I_BC_OP_SH2ADD_UW,
+		RV64I_BC_LDD_LDD,
+		RV64I_BC_STD_STD,
+		RV64I_BC_AUIPC_LDD,
 #endif
 
 #ifdef RISCV_EXT_COMPRESSED
@@ -112,6 +118,8 @@ namespace riscv
 		RV32C_BC_XOR,
 		RV32C_BC_OR,
 		RV32C_BC_FUNCTION,
+		RV32C_BC_LDD_LDD,
+		RV32C_BC_STD_STD,
 #endif
 
 		RV32I_BC_SYSCALL,
@@ -135,11 +143,41 @@ namespace riscv
 		RV32I_BC_ASMJIT,
 #endif
 		RV32I_BC_LIVEPATCH,
+		RV32I_BC_TRACE,
 		RV32I_BC_SYSTEM,
 		BYTECODES_MAX
 	};
 	static_assert(BYTECODES_MAX <= 256, "A bytecode must fit in a byte");
 
+	// Fused bytecodes execute two adjacent instructions with a single
+	// dispatch. They replace the bytecode of the first instruction only,
+	// and both payloads are left as-is, so the original can be restored.
+	inline unsigned unfused_bytecode(unsigned bytecode) noexcept
+	{
+		switch (bytecode) {
+		case RV32I_BC_LUI_ADDI:
+			return RV32I_BC_LUI;
+		case RV32I_BC_AUIPC_ADDI:
+			return RV32I_BC_AUIPC;
+#ifdef RISCV_64I
+		case RV64I_BC_LDD_LDD:
+			return RV32I_BC_LDD;
+		case RV64I_BC_STD_STD:
+			return RV32I_BC_STD;
+		case RV64I_BC_AUIPC_LDD:
+			return RV32I_BC_AUIPC;
+#endif
+#ifdef RISCV_EXT_COMPRESSED
+		case RV32C_BC_LDD_LDD:
+			return RV32C_BC_LDD;
+		case RV32C_BC_STD_STD:
+			return RV32C_BC_STD;
+#endif
+		default:
+			return bytecode;
+		}
+	}
+
 	union FasterItype
 	{
 		uint32_t whole;
@@ -577,4 +577,69 @@ namespace riscv
 		return bytecode;
 	}
 
+	// Pairs were chosen by profiling the fall-through bytecode pairs of
+	// real programs: register spills and reloads in function prologues
+	// and epilogues dominate, followed by address materialization.
+	static unsigned fused_bytecode_for(unsigned first, unsigned second)
+	{
+		switch (first) {
+		case RV32I_BC_LUI:
+			if (second == RV32I_BC_ADDI)
+				return RV32I_BC_LUI_ADDI;
+			break;
+		case RV32I_BC_AUIPC:
+			if (second == RV32I_BC_ADDI)
+				return RV32I_BC_AUIPC_ADDI;
+#ifdef RISCV_64I
+			if (second == RV32I_BC_LDD)
+				return RV64I_BC_AUIPC_LDD;
+			break;
+		case RV32I_BC_LDD:
+			if (second == RV32I_BC_LDD)
+				return RV64I_BC_LDD_LDD;
+			break;
+		case RV32I_BC_STD:
+			if (second == RV32I_BC_STD)
+				return RV64I_BC_STD_STD;
+#endif
+			break;
+#ifdef RISCV_EXT_COMPRESSED
+		case RV32C_BC_LDD:
+			if (second == RV32C_BC_LDD)
+				return RV32C_BC_LDD_LDD;
+			break;
+		case RV32C_BC_STD:
+			if (second == RV32C_BC_STD)
+				return RV32C_BC_STD_STD;
+			break;
+#endif
+		}
+		return first;
+	}
+
+	// Macro-op fusion: An instruction followed by another instruction in the
+	// same block may have its bytecode replaced by a fused bytecode that
+	// executes both. Only non-branching instructions are fused, and so the
+	// second instruction is always in the same block as the first. The second
+	// decoder entry is left untouched, as it may still be a jump target.
+	template <int W> RISCV_INTERNAL
+	void DecodedExecuteSegment<W>::threaded_fuse(address_t from, address_t to)
+	{
+		auto* exec_decoder = this->decoder_cache();
+		address_t pc = from;
+		while (pc < to)
+		{
+			const unsigned length = compressed_enabled
+				? read_instruction(this->exec_data(), pc, this->exec_end()).length() : 4;
+			if (pc + length >= to)
+				break;
+
+			auto& first = exec_decoder[pc / DecoderData<W>::DIVISOR];
+			const auto& second = exec_decoder[(pc + length) / DecoderData<W>::DIVISOR];
+			first.set_bytecode(fused_bytecode_for(first.get_bytecode(), second.get_bytecode()));
+
+			pc += length;
+		}
+	}
+
 } // riscv
@@ -1,11 +1,14 @@
 #pragma once
+#include <cerrno>
 #include <cstdio>
+#include <set>
 #include <unordered_map>
 #include "machine.hpp"
 
 namespace riscv {
 
 template <int W> struct MultiThreading;
+template <int W> struct Thread;
 static const int MAIN_THREAD_TID = 1;
 static const uint32_t PARENT_SETTID  = 0x00100000; /* set the TID in the parent */
 static const uint32_t CHILD_CLEARTID = 0x00200000; /* clear the TID in the child */
@@ -20,6 +23,31 @@ static const uint32_t CHILD_SETTID   = 0x01000000; /* set the TID in the child *
 #define THPRINT(fmt, ...) /* fmt */
 #endif
 
+/// @brief A FIFO of threads, linked through the threads themselves.
+/// @details A thread is in at most one queue at a time: the run queue,
+/// or the futex queue of the address it waits on. It can leave its
+/// queue from anywhere in constant time.
+template <int W>
+struct ThreadQueue
+{
+	using thread_t = Thread<W>;
+
+	bool      empty() const noexcept { return m_head == nullptr; }
+	size_t    size() const noexcept { return m_size; }
+	thread_t* front() const noexcept { return m_head; }
+	void      push_back(thread_t*) noexcept;
+	thread_t* pop_front() noexcept;
+	void      remove(thread_t*) noexcept;
+
+	ThreadQueue() = default;
+	ThreadQueue(const ThreadQueue&) = delete;
+	ThreadQueue& operator=(const ThreadQueue&) = delete;
+private:
+	thread_t* m_head = nullptr;
+	thread_t* m_tail = nullptr;
+	size_t    m_size = 0;
+};
+
 template <int W>
 struct Thread
 {
@@ -35,9 +63,15 @@ struct Thread
 	address_t stack_size;
 	// Address zeroed when exiting
 	address_t clear_tid = 0;
-	// The current or last blocked word
-	uint32_t block_word = 0;
+	// The current or last blocked word, eg. a futex address
+	address_t block_word = 0;
 	uint32_t block_extra = 0;
+	// rdtime() at which a timed wait ends, or zero
+	uint64_t block_deadline = 0;
+	// The queue this thread is in, and its neighbours there
+	ThreadQueue<W>* queue = nullptr;
+	Thread* queue_prev = nullptr;
+	Thread* queue_next = nullptr;
 
 	Thread(MultiThreading<W>&, int tid, address_t tls,
 		address_t stack, address_t stkbase, address_t stksize);
@@ -45,8 +79,12 @@ struct Thread
 	bool exit(); // Returns false when we *cannot* continue
 	void suspend();
 	void suspend(address_t return_value);
-	void block(uint32_t reason, uint32_t extra = 0);
-	void block_return(address_t return_value, uint32_t reason, uint32_t extra);
+	void block(address_t reason, uint32_t extra = 0);
+	void block_return(address_t return_value, address_t reason, uint32_t extra);
+	/* Leave the run queue or futex queue, and any timed wait. */
+	void dequeue() noexcept;
+	/* Save the registers of the CPU, as they are now, for later. */
+	void store_registers();
 	void activate();
 	void resume();
 };
@@ -67,27 +105,94 @@ struct MultiThreading
 	bool      yield_to(int tid, bool store_retval = true);
 	void      erase_thread(int tid);
 	void      wakeup_next();
-	bool      block(address_t retval, uint32_t reason, uint32_t extra = 0);
+	/* Block the current thread on a word, until woken or until the
+	   rdtime() deadline passes, if non-zero. */
+	bool      block(address_t retval, address_t reason, uint32_t extra = 0, uint64_t deadline = 0);
 	void      unblock(int tid);
-	size_t    wakeup_blocked(size_t max, uint32_t reason, uint32_t mask = ~0U);
+	size_t    wakeup_blocked(size_t max, address_t reason, uint32_t mask = ~0U);
+	/* Let the other threads run until the rdtime() deadline passes.
+	   Returns false when there is no other thread to run. */
+	bool      sleep(uint64_t deadline);
+	/* Move up to max threads blocked on one word over to another. */
+	size_t    requeue_blocked(size_t max, address_t reason, address_t new_reason);
 	/* A suspended thread can at any time be resumed. */
 	auto&     suspended_threads() { return m_suspended; }
 	/* A blocked thread can only be resumed by unblocking it. */
 	auto&     blocked_threads() { return m_blocked; }
+	size_t    blocked_count() const noexcept { return m_blocked_count; }
+
+	unsigned  max_threads() const noexcept { return m_max_threads; }
+	void      set_max_threads(unsigned max) noexcept { m_max_threads = max; }
+
+	/// @brief Run the guest with round-robin preemption of its threads.
+	/// @details Each runnable thread gets at most quantum instructions
+	/// before the next one in the run queue takes over.
+	/// @tparam Throw Throw a MachineTimeoutException if the instruction
+	/// limit is reached.
+	/// @param max_instructions The maximum number of instructions to
+	/// execute before stopping, for all threads together.
+	/// @param quantum The number of instructions in each time slice.
+	/// @return True if the machine stopped normally.
+	template <bool Throw = true>
+	bool simulate(uint64_t max_instructions, uint64_t quantum);
 
 	MultiThreading(Machine<W>&);
 	MultiThreading(Machine<W>&, const MultiThreading&);
 	Machine<W>& machine;
-	std::vector<thread_t*> m_blocked;
-	std::vector<thread_t*> m_suspended;
+	/* Blocked threads, in one queue per word they wait on */
+	std::unordered_map<address_t, ThreadQueue<W>> m_blocked;
+	ThreadQueue<W> m_suspended;
 	std::unordered_map<int, thread_t> m_threads;
+	/* Timed waits, ordered by deadline then tid */
+	std::set<std::pair<uint64_t, int>> m_timeouts;
+	size_t     m_blocked_count = 0;
 	unsigned   m_thread_counter = MAIN_THREAD_TID;
-	unsigned   m_max_threads = 50;
+	unsigned   m_max_threads = RISCV_MAX_THREADS;
 	thread_t*  m_current = nullptr;
+
+private:
+	void      unblock_thread(thread_t*) noexcept;
+	/* Make timed-out waiters runnable. When force is set, the first
+	   deadline passes even if it is in the future. */
+	void      expire_timeouts(bool force);
 };
 
 /** Implementation **/
 
+template <int W>
+inline void ThreadQueue<W>::push_back(thread_t* thread) noexcept
+{
+	thread->queue = this;
+	thread->queue_prev = m_tail;
+	thread->queue_next = nullptr;
+	if (m_tail) m_tail->queue_next = thread;
+	else m_head = thread;
+	m_tail = thread;
+	m_size ++;
+}
+
+template <int W>
+inline Thread<W>* ThreadQueue<W>::pop_front() noexcept
+{
+	thread_t* thread = m_head;
+	if (thread != nullptr)
+		this->remove(thread);
+	return thread;
+}
+
+template <int W>
+inline void ThreadQueue<W>::remove(thread_t* thread) noexcept
+{
+	if (thread->queue_prev) thread->queue_prev->queue_next = thread->queue_next;
+	else m_head = thread->queue_next;
+	if (thread->queue_next) thread->queue_next->queue_prev = thread->queue_prev;
+	else m_tail = thread->queue_prev;
+	thread->queue = nullptr;
+	thread->queue_prev = nullptr;
+	thread->queue_next = nullptr;
+	m_size --;
+}
+
 template <int W>
 inline MultiThreading<W>::MultiThreading(Machine<W>& mach)
 	: machine(mach)
@@ -109,16 +214,19 @@ inline MultiThreading<W>::MultiThreading(Machine<W>& mach, const MultiThreading<
 		const int tid = it.first;
 		m_threads.try_emplace(tid, *this, it.second);
 	}
-	/* Copy each suspended by pointer lookup */
-	m_suspended.reserve(other.m_suspended.size());
-	for (const auto* t : other.m_suspended) {
+	/* Copy each suspended by pointer lookup, in order */
+	for (const auto* t = other.m_suspended.front(); t != nullptr; t = t->queue_next) {
 		m_suspended.push_back(get_thread(t->tid));
 	}
-	/* Copy each blocked by pointer lookup */
-	m_blocked.reserve(other.m_blocked.size());
-	for (const auto* t : other.m_blocked) {
-		m_blocked.push_back(get_thread(t->tid));
+	/* Copy each blocked by pointer lookup, in order */
+	for (const auto& it : other.m_blocked) {
+		auto& queue = m_blocked[it.first];
+		for (const auto* t = it.second.front(); t != nullptr; t = t->queue_next) {
+			queue.push_back(get_thread(t->tid));
+		}
 	}
+	m_blocked_count = other.m_blocked_count;
+	m_timeouts = other.m_timeouts;
 	/* Copy current thread */
 	m_current = get_thread(other.m_current->tid);
 	if (UNLIKELY(m_current == nullptr))
@@ -130,8 +238,9 @@ inline void Thread<W>::resume()
 {
 	threading.m_current = this;
 	auto& m = threading.machine;
+	m.cpu.atomics().invalidate_reservation();
 	// restore registers (vector state too, unless opted out)
-	m.cpu.registers().copy_from(
+	m.cpu.registers().restore_from(
 		m.register_copy_options(),
 		this->stored_regs);
 	THPRINT(threading.machine,
@@ -143,14 +252,24 @@ inline void Thread<W>::resume()
 	m.cpu.aligned_jump(m.cpu.pc());
 }
 
+template <int W>
+inline void Thread<W>::store_registers()
+{
+	auto& m = threading.machine;
+	if (LIKELY(threading.m_current == this)) {
+		m.cpu.registers().save_to(m.register_copy_options(), this->stored_regs);
+	} else {
+		// A Clean register file refers to the context of the running thread
+		this->stored_regs.copy_from(m.register_copy_options(), m.cpu.registers());
+	}
+}
+
 template <int W>
 inline void Thread<W>::suspend()
 {
-	// copy all regs (vector state too, unless opted out)
-	this->stored_regs.copy_from(
-		threading.machine.register_copy_options(),
-		threading.machine.cpu.registers());
-	// add to suspended (NB: can throw)
+	// save all regs (vector state too, unless opted out)
+	this->store_registers();
+	// add to the back of the run queue
 	threading.m_suspended.push_back(this);
 }
 
@@ -163,20 +282,39 @@ inline void Thread<W>::suspend(address_t return_value)
 }
 
 template <int W>
-inline void Thread<W>::block(uint32_t reason, uint32_t extra)
+inline void Thread<W>::block(address_t reason, uint32_t extra)
 {
-	// copy all regs (vector state too, unless opted out)
-	this->stored_regs.copy_from(
-		threading.machine.register_copy_options(),
-		threading.machine.cpu.registers());
+	// add to the queue of the blocked word (NB: can throw)
+	auto& queue = threading.m_blocked[reason];
+	// save all regs (vector state too, unless opted out)
+	this->store_registers();
 	this->block_word = reason;
 	this->block_extra = extra;
-	// add to blocked (NB: can throw)
-	threading.m_blocked.push_back(this);
+	queue.push_back(this);
+	threading.m_blocked_count ++;
+}
+
+template <int W>
+inline void Thread<W>::dequeue() noexcept
+{
+	if (this->queue == &threading.m_suspended) {
+		threading.m_suspended.remove(this);
+	} else if (this->queue != nullptr) {
+		// remove from the futex queue, and the queue when it empties
+		auto* blocked = this->queue;
+		blocked->remove(this);
+		if (blocked->empty())
+			threading.m_blocked.erase(this->block_word);
+		threading.m_blocked_count --;
+	}
+	if (this->block_deadline != 0) {
+		threading.m_timeouts.erase({this->block_deadline, this->tid});
+		this->block_deadline = 0;
+	}
 }
 
 template <int W>
-inline void Thread<W>::block_return(address_t return_value, uint32_t reason, uint32_t extra)
+inline void Thread<W>::block_return(address_t return_value, address_t reason, uint32_t extra)
 {
 	this->block(reason, extra);
 	// set the block reason as the next return value
@@ -200,15 +338,19 @@ inline Thread<W>* MultiThreading<W>::get_thread(int tid)
 template <int W>
 inline void MultiThreading<W>::wakeup_next()
 {
-	// resume a waiting thread
+	// waiters whose time is up get in line, and when nothing else
+	// can run, the first one to time out stops waiting early
+	if (!m_timeouts.empty())
+		this->expire_timeouts(m_suspended.empty());
+	// resume the thread that has waited the longest
 	if (!m_suspended.empty()) {
-		auto* next = m_suspended.front();
-		m_suspended.erase(m_suspended.begin());
+		auto* next = m_suspended.pop_front();
 		// resume next thread
 		next->resume();
 	} else {
 		THPRINT(machine, "No more threads to resume. Fallback to main thread (*ERROR*)\n");
 		auto* next = get_thread(MAIN_THREAD_TID);
+		next->dequeue();
 		next->resume();
 	}
 }
@@ -228,7 +370,8 @@ inline Thread<W>::Thread(
 	MultiThreading<W>& mt, const Thread& other)
 	: threading(mt), tid(other.tid),
 	  stack_base(other.stack_base), stack_size(other.stack_size),
-	  clear_tid(other.clear_tid), block_word(other.block_word), block_extra(other.block_extra)
+	  clear_tid(other.clear_tid), block_word(other.block_word), block_extra(other.block_extra),
+	  block_deadline(other.block_deadline)
 {
 	stored_regs.copy_from(mt.machine.register_copy_options(), other.stored_regs);
 }
@@ -238,6 +381,8 @@ inline void Thread<W>::activate()
 {
 	threading.m_current = this;
 	auto& cpu = threading.machine.cpu;
+	// The new thread starts out with the registers of its parent
+	cpu.registers().leave_context();
 	cpu.reg(REG_TP) = this->stored_regs.get(REG_TP);
 	cpu.reg(REG_SP) = this->stored_regs.get(REG_SP);
 }
@@ -302,6 +447,8 @@ template <int W>
 inline bool MultiThreading<W>::preempt()
 {
 	auto* thread = get_thread();
+	if (!m_timeouts.empty())
+		this->expire_timeouts(false);
 	if (m_suspended.empty()) {
 		return false;
 	}
@@ -314,6 +461,8 @@ template <int W>
 inline bool MultiThreading<W>::suspend_and_yield(long result)
 {
 	auto* thread = get_thread();
+	if (!m_timeouts.empty())
+		this->expire_timeouts(false);
 	// don't go through the ardous yielding process when alone
 	if (m_suspended.empty()) {
 		// set the return value for sched_yield
@@ -328,15 +477,62 @@ inline bool MultiThreading<W>::suspend_and_yield(long result)
 }
 
 template <int W>
-inline bool MultiThreading<W>::block(address_t retval, uint32_t reason, uint32_t extra)
+inline bool MultiThreading<W>::block(address_t retval, address_t reason, uint32_t extra, uint64_t deadline)
 {
 	auto* thread = get_thread();
-	if (UNLIKELY(m_suspended.empty())) {
+	// a timed wait can always end, so it may block the last runnable thread
+	if (UNLIKELY(m_suspended.empty() && m_timeouts.empty() && deadline == 0)) {
 		// TODO: Stop the machine here?
 		return false; // continue immediately?
 	}
 	// block thread, write reason to future return value
 	thread->block_return(retval, reason, extra);
+	if (deadline != 0) {
+		try {
+			m_timeouts.emplace(deadline, thread->tid);
+		} catch (...) {
+			thread->dequeue();
+			throw;
+		}
+		thread->block_deadline = deadline;
+	}
+	// resume some other thread
+	this->wakeup_next();
+	return true;
+}
+
+template <int W>
+inline void MultiThreading<W>::expire_timeouts(bool force)
+{
+	const uint64_t now = machine.rdtime();
+	while (!m_timeouts.empty())
+	{
+		const auto [deadline, tid] = *m_timeouts.begin();
+		if (deadline > now && !force)
+			break;
+		force = false;
+		auto* thread = get_thread(tid);
+		// a wait on a word times out, while a sleep just ends
+		if (thread->queue != nullptr)
+			thread->stored_regs.get(REG_ARG0) = -ETIMEDOUT;
+		thread->dequeue();
+		m_suspended.push_back(thread);
+	}
+}
+
+template <int W>
+inline bool MultiThreading<W>::sleep(uint64_t deadline)
+{
+	auto* thread = get_thread();
+	if (!m_timeouts.empty())
+		this->expire_timeouts(false);
+	if (m_suspended.empty())
+		return false;
+	m_timeouts.emplace(deadline, thread->tid);
+	thread->block_deadline = deadline;
+	// save all regs (vector state too, unless opted out)
+	thread->store_registers();
+	thread->stored_regs.get(REG_ARG0) = 0;
 	// resume some other thread
 	this->wakeup_next();
 	return true;
@@ -361,13 +557,8 @@ inline bool MultiThreading<W>::yield_to(int tid, bool store_retval)
 		thread->suspend(0);
 	else
 		thread->suspend();
-	// remove the next thread from suspension
-	for (auto it = m_suspended.begin(); it != m_suspended.end(); ++it) {
-		if (*it == next) {
-			m_suspended.erase(it);
-			break;
-		}
-	}
+	// take the next thread out of whichever queue it is in
+	next->dequeue();
 	// resume next thread
 	next->resume();
 	return true;
@@ -376,48 +567,115 @@ inline bool MultiThreading<W>::yield_to(int tid, bool store_retval)
 template <int W>
 inline void MultiThreading<W>::unblock(int tid)
 {
-	for (auto it = m_blocked.begin(); it != m_blocked.end(); )
+	auto* thread = get_thread(tid);
+	if (thread != nullptr && thread->queue != nullptr && thread->queue != &m_suspended)
 	{
-		if ((*it)->tid == tid)
-		{
-			// suspend current thread
-			get_thread()->suspend(0);
-			// resume this thread
-			(*it)->resume();
-			m_blocked.erase(it);
-			return;
-		}
-		else ++it;
+		// suspend current thread
+		get_thread()->suspend(0);
+		// resume this thread
+		thread->dequeue();
+		thread->resume();
+		return;
 	}
 	// given thread id was not blocked
 	machine.cpu.reg(REG_ARG0) = -1;
 }
+
 template <int W>
-inline size_t MultiThreading<W>::wakeup_blocked(size_t max, uint32_t reason, uint32_t mask)
+inline void MultiThreading<W>::unblock_thread(thread_t* thread) noexcept
 {
+	// move to suspended
+	thread->dequeue();
+	m_suspended.push_back(thread);
+}
+
+template <int W>
+inline size_t MultiThreading<W>::wakeup_blocked(size_t max, address_t reason, uint32_t mask)
+{
+	auto it = m_blocked.find(reason);
+	if (it == m_blocked.end())
+		return 0;
 	size_t awakened = 0;
-	for (auto it = m_blocked.begin(); it != m_blocked.end() && awakened < max; )
+	// the queue goes away with its last thread
+	for (auto* t = it->second.front(); t != nullptr && awakened < max; )
 	{
-		// compare against block reason
-		const auto bits = (*it)->block_extra;
-		if ((*it)->block_word == reason && (bits == 0 || (bits & mask) != 0))
+		auto* next = t->queue_next;
+		// compare against block bitset
+		const auto bits = t->block_extra;
+		if (bits == 0 || (bits & mask) != 0)
 		{
-			// move to suspended
-			m_suspended.push_back(*it);
-			m_blocked.erase(it);
+			this->unblock_thread(t);
 			awakened ++;
 		}
-		else ++it;
+		t = next;
 	}
 	return awakened;
 }
 
+template <int W>
+inline size_t MultiThreading<W>::requeue_blocked(size_t max, address_t reason, address_t new_reason)
+{
+	if (max == 0 || reason == new_reason)
+		return 0;
+	auto it = m_blocked.find(reason);
+	if (it == m_blocked.end())
+		return 0;
+	// queues stay where they are when the table grows
+	auto& source = it->second;
+	auto& target = m_blocked[new_reason];
+	size_t requeued = 0;
+	while (!source.empty() && requeued < max)
+	{
+		auto* t = source.pop_front();
+		t->block_word = new_reason;
+		target.push_back(t);
+		requeued ++;
+	}
+	if (source.empty())
+		m_blocked.erase(reason);
+	return requeued;
+}
+
 template <int W>
 inline void MultiThreading<W>::erase_thread(int tid)
 {
 	auto it = m_threads.find(tid);
 	assert(it != m_threads.end());
+	it->second.dequeue();
 	m_threads.erase(it);
 }
 
+template <int W>
+template <bool Throw>
+inline bool MultiThreading<W>::simulate(uint64_t max_instructions, uint64_t quantum)
+{
+	machine.set_instruction_counter(0);
+	while (true)
+	{
+		const uint64_t counter = machine.instruction_counter();
+		const uint64_t slice = (max_instructions - counter > quantum)
+			? counter + quantum : max_instructions;
+		if (machine.template simulate<false>(slice, counter))
+			return true;
+		if (UNLIKELY(machine.interrupt_requested())) {
+			if constexpr (Throw)
+				throw MachineTimeoutException(EXECUTION_INTERRUPTED,
+					"Execution interrupted", max_instructions);
+			return false;
+		}
+		if (machine.instruction_counter() >= max_instructions) {
+			if constexpr (Throw)
+				throw MachineTimeoutException(MAX_INSTRUCTIONS_REACHED,
+					"Instruction count limit reached", max_instructions);
+			return false;
+		}
+		// the time slice is over: on to the next runnable thread. Threads
+		// are switched the way system calls do it, and those resume after
+		// their ECALL instruction.
+		machine.cpu.registers().pc -= 4;
+		this->preempt();
+		machine.cpu.jump(machine.cpu.pc() + 4);
+	}
+}
+
 } // riscv
@@ -323,6 +323,7 @@ typedef struct {
 	addr_t  r[32];
 	addr_t  pc;
 	uint32_t fcsr;
+	uint8_t fs, vs; /* Registers::ExtState of the FP and vector files */
 	fp64reg fr[32];
 #ifdef RISCV_EXT_VECTOR
 	RVV rvv;
@@ -400,6 +401,13 @@ VISIBLE const int32_t arena_offset_constant = RISCV_ARENA_OFFSET;
 INTERNAL static int32_t ic_offset;
 #define INS_COUNTER(cpu) (*(uint64_t *)((uintptr_t)cpu + ic_offset))
 #define MAX_COUNTER(cpu) (*(uint64_t *)((uintptr_t)cpu + ic_offset + 8))
+// Set from other threads by Machine::request_interrupt(), polled at back-edges
+// when instructions are not counted
+#ifdef RISCV_INTERRUPT_OFFSET
+#define INTERRUPTED(cpu) (*(volatile uint8_t *)((uintptr_t)cpu + RISCV_INTERRUPT_OFFSET))
+#else
+#define INTERRUPTED(cpu) (*(volatile uint8_t *)((uintptr_t)cpu + ic_offset + 16))
+#endif
 
 typedef struct {
 	addr_t pageno;
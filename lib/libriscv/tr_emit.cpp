@@ -6,6 +6,7 @@
 #include <optional>
 #include "rv32i_instr.hpp"
 #include "rvfd.hpp"
+#include "tr_ir.hpp"
 #include "tr_types.hpp"
 #ifdef RISCV_EXT_C
 #include "rvc.hpp"
@@ -66,6 +67,9 @@
 
 namespace riscv {
 static const std::string LOOP_EXPRESSION = "LIKELY(ic < max_ic)";
+// Without instruction counting, back-edges poll for interrupts instead. Counted
+// code is interrupted through its limit, see RISCV_INTERRUPT_SLICE.
+static const std::string UNCOUNTED_LOOP_EXPRESSION = "LIKELY(!INTERRUPTED(cpu))";
 static const std::string SIGNEXTW = "(int32_t)";
 static constexpr int ALIGN_MASK = (compressed_enabled) ? 0x1 : 0x3;
 
@@ -90,6 +94,8 @@ struct BranchInfo {
 	bool ignore_instruction_limit;
 	uint64_t jump_pc;
 	uint64_t call_pc;
+	// A comparison fused into the branch by the IR, replacing the operands
+	std::string condition {};
 };
 
 template <int W>
@@ -243,6 +249,31 @@ struct Emitter
 	std::string from_fpreg(int reg) {
 		return "cpu->fr[" + std::to_string(reg) + "]";
 	}
+	// Instructions that write the FP or the vector file mark it dirty, as
+	// Registers::getfl() and rvv() do for the interpreter
+	void mark_extension_state() {
+		const char* state = nullptr;
+		switch (instr.opcode()) {
+		case RV32F_LOAD: { // FLH, FLW and FLD, otherwise vector loads
+			const unsigned funct3 = rv32f_instruction{instr}.Itype.funct3;
+			state = (funct3 >= 0x1 && funct3 <= 0x3) ? "fs" : "vs";
+			} break;
+		case RV32F_FMADD:
+		case RV32F_FMSUB:
+		case RV32F_FNMADD:
+		case RV32F_FNMSUB:
+		case RV32F_FPFUNC:
+			state = "fs";
+			break;
+		case RV32V_OP:
+			state = "vs";
+			break;
+		default:
+			return;
+		}
+		code += "cpu->" + std::string(state) + " = "
+			+ std::to_string(int(Registers<W>::ExtState::Dirty)) + ";\n";
+	}
 #ifdef RISCV_EXT_VECTOR
 	std::string from_rvvreg(int reg) {
 		return "cpu->rvv.lane[" + std::to_string(reg) + "]";
@@ -1211,11 +1242,16 @@ struct Emitter
 			return true;
 		if (tinfo.use_automatic_nbit_address_space && tinfo.arena_ptr != 0)
 			return true;
+		// Masked accesses stay inside the window, where the guard pages fault
+		if (tinfo.use_guarded_arena && tinfo.arena_ptr != 0)
+			return true;
 		return false;
 	}
 	constexpr address_t get_Nbit_encompassing_arena_mask() noexcept {
 		if constexpr (riscv::encompassing_Nbit_arena != 0)
 			return riscv::encompassing_arena_mask;
+		else if (tinfo.use_guarded_arena)
+			return address_t(riscv::guarded_arena_mask);
 		else if (tinfo.use_automatic_nbit_address_space)
 			return this->m_encompassing_arena_mask;
 		else
@@ -1285,6 +1321,7 @@ struct Emitter
 	bool skip_load_bounds_check(int reg, int64_t offset, size_t size) {
 		if (tinfo.unsafe_remove_checks
 			|| uses_Nbit_encompassing_arena()) return true; // No bounds check
+		if (unchecked_in_loop(reg)) return true; // Checked at the back-edge
 		if (tinfo.use_virtual_paging_fallback) return false; // Always check
 
 		if (m_read_checked[reg].valid
@@ -1301,6 +1338,7 @@ struct Emitter
 	bool skip_store_bounds_check(int reg, int64_t offset, size_t size) {
 		if (tinfo.unsafe_remove_checks
 			|| uses_Nbit_encompassing_arena()) return true; // No bounds check
+		if (unchecked_in_loop(reg)) return true; // Checked at the back-edge
 		if (tinfo.use_virtual_paging_fallback) return false; // Always check
 
 		// NOTE: A live read check does *not* cover a write: the readable region
@@ -1517,6 +1555,192 @@ struct Emitter
 	void emit();
 	rv32i_instruction emit_rvc();
 
+	// Lower the block to the IR and run its passes. Compressed instructions
+	// are expanded here the same way emit() expands them.
+	void build_ir()
+	{
+		std::vector<rv32i_instruction> expanded;
+		expanded.reserve(tinfo.instr.size());
+		for (const auto original : tinfo.instr) {
+			this->instr = original;
+#ifdef RISCV_EXT_C
+			if (this->instr.is_compressed())
+				this->instr = this->emit_rvc();
+#endif
+			expanded.push_back(this->instr);
+		}
+		// Loads are only forwarded when they would read plain arena memory,
+		// and checks are only hoisted when there are checks
+		const bool checked = uses_flat_memory_arena()
+			&& !tinfo.unsafe_remove_checks && !uses_Nbit_encompassing_arena();
+		m_ir.build(tinfo, expanded, uses_flat_memory_arena(), checked);
+	}
+	static const char* load_type_of(unsigned funct3) {
+		switch (funct3) {
+		case 0x0: return "int8_t";
+		case 0x1: return "int16_t";
+		case 0x2: return "int32_t";
+		case 0x3: return "int64_t";
+		case 0x4: return "uint8_t";
+		case 0x5: return "uint16_t";
+		default:  return "uint32_t";
+		}
+	}
+	// Emit an instruction that the IR passes simplified. Returns false when
+	// it is left to the regular emitter.
+	bool emit_from_ir(const typename TransIR<W>::Op& op)
+	{
+		// Known operands let the emitter fold them, and use fixed addresses
+		if (op.src_known & 1)
+			this->track_register_value(op.instr.Rtype.rs1, op.src_value[0]);
+		if (op.src_known & 2)
+			this->track_register_value(op.instr.Rtype.rs2, op.src_value[1]);
+
+		if (op.dead) {
+			this->reset_tracked_register(op.rd);
+			return true;
+		}
+		if (op.kind == TransIR<W>::ALU && op.known) {
+			add_code(to_reg(op.rd) + " = " + STRADDR(op.value) + ";");
+			this->track_register_value(op.rd, op.value);
+			return true;
+		}
+		if (op.kind == TransIR<W>::LOAD && op.forward >= 0) {
+			add_code(to_reg(op.rd) + " = (addr_t)(" + load_type_of(op.instr.Itype.funct3) + ")"
+				+ from_reg(op.forward) + ";");
+			this->reset_tracked_register(op.rd);
+			return true;
+		}
+		return false;
+	}
+	// The loop with hoisted bounds checks that the current instruction is in
+	const HoistedLoop<W>* hoisted_loop() const noexcept {
+		if (m_next_loop >= m_ir.loops.size())
+			return nullptr;
+		const auto& loop = m_ir.loops[m_next_loop];
+		if (index() < loop.header || index() > loop.latch)
+			return nullptr;
+		return &loop;
+	}
+	std::string hoisted_label(const HoistedLoop<W>& loop, const char* suffix) {
+		return FUNCLABEL(m_ir.at(loop.header).pc) + suffix;
+	}
+	// A loop with hoisted bounds checks is emitted twice. The regular version
+	// comes first, and falls through past the version without checks.
+	void version_hoisted_loop(int& i, address_t& next_pc)
+	{
+		if (m_next_loop >= m_ir.loops.size() || size_t(i) != m_ir.loops[m_next_loop].latch + 1)
+			return;
+		const auto& loop = m_ir.loops[m_next_loop];
+		if (!m_loop_unchecked) {
+			code.append("goto " + hoisted_label(loop, "_loopend") + ";\n");
+			m_loop_unchecked = true;
+			i = int(loop.header);
+			next_pc = m_ir.at(loop.header).pc;
+		} else {
+			code.append(hoisted_label(loop, "_loopend") + ":;\n");
+			m_loop_unchecked = false;
+			m_next_loop++;
+		}
+	}
+	// The jump back to the header of a loop. At the latch of a loop with
+	// hoisted bounds checks, the regular version checks the ranges that the
+	// remaining iterations can access, and enters the version without checks
+	// when they are all inside the arena.
+	std::string backedge_goto(address_t target)
+	{
+		const auto* loop = this->hoisted_loop();
+		if (loop == nullptr || index() != loop->latch)
+			return "goto " + FUNCLABEL(target) + ";";
+		if (m_loop_unchecked)
+			return "goto " + hoisted_label(*loop, "_fast") + ";";
+
+		using HL = HoistedLoop<W>;
+		const std::string iv = from_reg(loop->iv);
+		const std::string bound = from_reg(loop->bound);
+		const std::string shift = std::to_string(HL::shift_of(loop->step));
+		std::string check = "{\naddr_t hl_d = " + ((loop->step > 0) ? bound + " - " + iv : iv + " - " + bound) + ";\n";
+		std::string cond;
+		switch (loop->condition) {
+		case HL::NOT_EQUAL:
+			check += "addr_t hl_n = hl_d >> " + shift + ";\n";
+			cond = "(hl_d & " + std::to_string((1u << HL::shift_of(loop->step)) - 1) + ") == 0 && ";
+			break;
+		case HL::BEFORE:
+			check += "addr_t hl_n = ((hl_d - 1) >> " + shift + ") + 1;\n";
+			break;
+		case HL::UP_TO:
+			check += "addr_t hl_n = (hl_d >> " + shift + ") + 1;\n";
+			break;
+		}
+		// Bounding the iterations keeps the ranges from overflowing
+		cond += "hl_n <= (ARENA_READ_BOUNDARY >> " + std::to_string(loop->max_shift) + ")";
+		for (const auto& range : loop->ranges) {
+			const std::string reg = "(addr_t)" + from_reg(range.reg);
+			const std::string extent = "(hl_n << " + std::to_string(HL::shift_of(range.step)) + ")";
+			std::string first = reg + " + " + from_imm(range.lo);
+			std::string last  = reg + " + " + from_imm(range.hi - 1);
+			if (range.step > 0)
+				last += " + " + extent;
+			else if (range.step < 0)
+				first += " - " + extent;
+			const char* inside = range.write ? "ARENA_WRITABLE" : "ARENA_READABLE";
+			cond += "\n && (addr_t)(" + first + ") <= (addr_t)(" + last + ")"
+				" && " + inside + "((addr_t)(" + first + "))"
+				" && " + inside + "((addr_t)(" + last + "))";
+		}
+		check += "if (" + cond + ") goto " + hoisted_label(*loop, "_fast") + ";\n";
+		return check + "goto " + FUNCLABEL(target) + "; }";
+	}
+	// Inside the version of a loop without checks, only the header is a
+	// label. It is only entered from the latch of the regular version.
+	void emit_unchecked_loop_label(int i)
+	{
+		const auto& loop = m_ir.loops[m_next_loop];
+		if (size_t(i) == loop.header) {
+			this->increment_counter_so_far();
+			code.append(hoisted_label(loop, "_fast") + ":;\n");
+			this->reset_all_tracked_registers();
+		} else if (mapping_labels.count(i) || tinfo.jump_locations.count(this->pc())) {
+			// Keep the state the same as in the regular version
+			this->increment_counter_so_far();
+			this->reset_all_tracked_registers();
+		}
+	}
+	bool unchecked_in_loop(int reg) const noexcept {
+		return m_loop_unchecked && m_ir.loops[m_next_loop].covers(reg);
+	}
+
+	// The condition of a BEQZ/BNEZ that the IR fused with the comparison in
+	// front of it, or an empty string.
+	std::string fused_branch_condition()
+	{
+		if (m_ir.empty() || m_ir.at(index()).fused < 0)
+			return {};
+		const auto& cmp = m_ir.at(m_ir.at(index()).fused).instr;
+		std::string test;
+		if (cmp.opcode() == RV32I_OP) {
+			const auto a = from_reg(cmp.Rtype.rs1);
+			const auto b = from_reg(cmp.Rtype.rs2);
+			switch (cmp.Rtype.jumptable_friendly_op()) {
+			case 0x2: // SLT
+				test = "(saddr_t)" + a + " < (saddr_t)" + b;
+				break;
+			case 0x3: // SLTU
+				test = a + " < " + b;
+				break;
+			default: // XOR, SUB: zero when equal
+				test = a + " != " + b;
+			}
+		} else if (cmp.Itype.funct3 == 0x2) { // SLTI
+			test = "(saddr_t)" + from_reg(cmp.Itype.rs1) + " < " + from_imm(cmp.Itype.signed_imm());
+		} else { // SLTIU
+			test = from_reg(cmp.Itype.rs1) + " < (addr_t)" + from_imm(cmp.Itype.signed_imm());
+		}
+		// BNEZ is taken when the comparison holds, BEQZ when it does not
+		return (instr.Btype.funct3 == 0x1) ? "(" + test + ")" : "!(" + test + ")";
+	}
+
 private:
 	static std::string speculation_safe(const std::string& address) {
 		return "SPECSAFE(" + address + ")";
@@ -1614,13 +1838,18 @@ private:
 	std::unordered_set<address_t> pagedata;
 
 	std::vector<std::string> m_forward_declared;
+	TransIR<W> m_ir;
+	size_t m_next_loop = 0;         // The next loop in m_ir.loops
+	bool m_loop_unchecked = false;  // Emitting the loop version without checks
 };
 
 template <int W>
 inline void Emitter<W>::emit_branch(const BranchInfo& binfo, const std::string& op)
 {
 	using address_t = address_type<W>;
-	if (binfo.sign == false)
+	if (!binfo.condition.empty())
+		code += "if (" + binfo.condition + ")";
+	else if (binfo.sign == false)
 		code += "if (" + from_reg(instr.Btype.rs1) + op + from_reg(instr.Btype.rs2) + ")";
 	else
 		code += "if ((saddr_t)" + from_reg(instr.Btype.rs1) + op + " (saddr_t)" + from_reg(instr.Btype.rs2) + ")";
@@ -1633,13 +1862,14 @@ inline void Emitter<W>::emit_branch(const BranchInfo& binfo, const std::string&
 	}
 
 	if (binfo.jump_pc != 0) {
-		if (binfo.jump_pc > this->pc() || binfo.ignore_instruction_limit) {
+		if (binfo.jump_pc > this->pc()) {
 			// unconditional forward jump + bracket
-			code += " goto " + FUNCLABEL(binfo.jump_pc) + ";\n";
+			code += " " + backedge_goto(binfo.jump_pc) + "\n";
 			return;
 		}
 		// backward jump
-		code += " {\nif (" + LOOP_EXPRESSION + ") goto " + FUNCLABEL(binfo.jump_pc) + ";\n";
+		const auto& loop_expression = (binfo.ignore_instruction_limit) ? UNCOUNTED_LOOP_EXPRESSION : LOOP_EXPRESSION;
+		code += " {\nif (" + loop_expression + ") " + backedge_goto(binfo.jump_pc) + "\n";
 	} else if (binfo.call_pc != 0 && binfo.call_pc > this->pc()) {
 		code += " {\n";
 		// potentially call a function
@@ -1689,8 +1919,8 @@ inline bool Emitter<W>::emit_function_call(address_t target_funcaddr, address_t
 		add_code("if (" + LOOP_EXPRESSION + ") { pc = cpu->pc; goto " + this->func + "_jumptbl; }");
 		add_code("RETURN_VALUES(ic, max_ic);");
 	} else {
-		add_code("if (max_ic) { pc = cpu->pc; goto " + this->func + "_jumptbl; }");
-		add_code("RETURN_VALUES(0, 0);");
+		add_code("if (max_ic && " + UNCOUNTED_LOOP_EXPRESSION + ") { pc = cpu->pc; goto " + this->func + "_jumptbl; }");
+		add_code("RETURN_VALUES(0, max_ic);");
 	}
 	return true;
 }
@@ -1755,8 +1985,14 @@ void Emitter<W>::emit()
 	address_t current_callable_pc = 0;
 	this->m_pc = tinfo.basepc;
 	this->m_last_pc = tinfo.basepc;
+	if constexpr (W != 16) {
+		// Tracing reveals every register after every instruction
+		if (tinfo.use_ir_passes && !tinfo.trace_instructions)
+			this->build_ir();
+	}
 
 	for (int i = 0; i < int(tinfo.instr.size()); i++) {
+		this->version_hoisted_loop(i, next_pc);
 		this->m_idx = i;
 		this->instr = tinfo.instr[i];
 		this->m_last_pc = this->m_pc;
@@ -1777,8 +2013,12 @@ void Emitter<W>::emit()
 			this->m_zero_insn_counter = 0;
 		}
 
+		if (m_loop_unchecked) {
+			this->emit_unchecked_loop_label(i);
+		}
 		// If the address is a return address or a global JAL target
-		if (i > 0 && (mapping_labels.count(i) || tinfo.global_jump_locations.count(this->pc()))) {
+		else if (i > 0 && (mapping_labels.count(i) || tinfo.global_jump_locations.count(this->pc())
+			|| tinfo.loop_heads.count(this->pc()))) {
 			this->increment_counter_so_far();
 			// Re-entry through the current function
 			code.append(FUNCLABEL(this->pc()) + ":;\n");
@@ -1797,7 +2037,8 @@ void Emitter<W>::emit()
 		}
 
 		// Rare: jump target at PC+2 inside a 4-byte instruction. Emit a skip-over trap.
-		if (UNLIKELY(compressed_enabled && this->m_instr_length == 4 && tinfo.jump_locations.count(this->pc() + 2))) {
+		if (UNLIKELY(compressed_enabled && this->m_instr_length == 4 && !m_loop_unchecked
+			&& tinfo.jump_locations.count(this->pc() + 2))) {
 			code.append("goto " + FUNCLABEL(this->pc() + 2) + "_skip;\n");
 			code.append(FUNCLABEL(this->pc() + 2) + ":;\n");
 			code.append("api.exception(cpu, " + STRADDR(this->pc() + 2) + ", MISALIGNED_INSTRUCTION); RETURN_VALUES(0, 0);\n");
@@ -1854,6 +2095,11 @@ void Emitter<W>::emit()
 		}
 #endif
 
+		this->mark_extension_state();
+
+		if (!m_ir.empty() && this->emit_from_ir(m_ir.at(i)))
+			continue;
+
 		switch (instr.opcode()) {
 		case RV32I_LOAD:
 			load_register(instr.Itype.rs1);
@@ -1937,28 +2183,29 @@ void Emitter<W>::emit()
 				// global jump location
 				call_pc = dest_pc;
 			}
+			const std::string fused = this->fused_branch_condition();
 			switch (instr.Btype.funct3) {
 			case 0x0: // EQ
-				emit_branch({ false, tinfo.ignore_instruction_limit, jump_pc, call_pc }, " == ");
+				emit_branch({ false, tinfo.ignore_instruction_limit, jump_pc, call_pc, fused }, " == ");
 				break;
 			case 0x1: // NE
-				emit_branch({ false, tinfo.ignore_instruction_limit, jump_pc, call_pc }, " != ");
+				emit_branch({ false, tinfo.ignore_instruction_limit, jump_pc, call_pc, fused }, " != ");
 				break;
 			case 0x2:
 			case 0x3:
 				UNKNOWN_INSTRUCTION();
 				break;
 			case 0x4: // LT
-				emit_branch({ true, tinfo.ignore_instruction_limit, jump_pc, call_pc }, " < ");
+				emit_branch({ true, tinfo.ignore_instruction_limit, jump_pc, call_pc, fused }, " < ");
 				break;
 			case 0x5: // GE
-				emit_branch({ true, tinfo.ignore_instruction_limit, jump_pc, call_pc }, " >= ");
+				emit_branch({ true, tinfo.ignore_instruction_limit, jump_pc, call_pc, fused }, " >= ");
 				break;
 			case 0x6: // LTU
-				emit_branch({ false, tinfo.ignore_instruction_limit, jump_pc, call_pc }, " < ");
+				emit_branch({ false, tinfo.ignore_instruction_limit, jump_pc, call_pc, fused }, " < ");
 				break;
 			case 0x7: // GEU
-				emit_branch({ false, tinfo.ignore_instruction_limit, jump_pc, call_pc }, " >= ");
+				emit_branch({ false, tinfo.ignore_instruction_limit, jump_pc, call_pc, fused }, " >= ");
 				break;
 			}
 			// Not-taken path: bounds-check windows survive (no register writes).
@@ -2009,7 +2256,7 @@ void Emitter<W>::emit()
 			if (!tinfo.ignore_instruction_limit)
 				code += "if (pc >= " + STRADDR(this->begin_pc()) + " && pc < " + STRADDR(this->end_pc()) + " && " + LOOP_EXPRESSION + ") goto " + this->func + "_jumptbl;\n";
 			else
-				code += "if (pc >= " + STRADDR(this->begin_pc()) + " && pc < " + STRADDR(this->end_pc()) + ") goto " + this->func + "_jumptbl;\n";
+				code += "if (pc >= " + STRADDR(this->begin_pc()) + " && pc < " + STRADDR(this->end_pc()) + " && " + UNCOUNTED_LOOP_EXPRESSION + ") goto " + this->func + "_jumptbl;\n";
 			exit_function("pc", false);
 			this->add_reentry_next();
 			} break;
@@ -2031,14 +2278,13 @@ void Emitter<W>::emit()
 					add_code("goto " + FUNCLABEL(dest_pc) + ";");
 					already_exited = true; // Unconditional jump
 				} else if (tinfo.ignore_instruction_limit) {
-					// jump backwards: without counters
-					add_code("goto " + FUNCLABEL(dest_pc) + ";");
+					// jump backwards: without counters, only checking for interrupts
+					add_code("if (" + UNCOUNTED_LOOP_EXPRESSION + ") goto " + FUNCLABEL(dest_pc) + ";");
 					// Random jumps around often have useful code immediately after,
 					// so make sure it's accessible (add a re-entry point)
 					// TODO: Check if the next instruction is a public symbol address
 					if (instr.Jtype.rd == 0)
 						add_reentry = true;
-					already_exited = true; // Unconditional jump
 				} else {
 					// jump backwards: use counters
 					add_code("if (" + LOOP_EXPRESSION + ") goto " + FUNCLABEL(dest_pc) + ";");
@@ -0,0 +1,631 @@
+#pragma once
+#include "common.hpp"
+#include "instruction_list.hpp"
+#include "loop_analysis.hpp"
+#include "rv32i_instr.hpp"
+#include "types.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace riscv
+{
+	template <int W> struct TransInfo;
+
+	/// @brief A block-level view of the instructions that make up one
+	/// translated function, and the optimization passes that run over it.
+	/// @details The emitter still produces C one instruction at a time, but
+	/// first looks up what the passes proved about the instruction: that its
+	/// result is a constant, that its write can never be observed, that a load
+	/// can be served from a register, or that a branch can test a comparison
+	/// directly. Facts are only carried along straight-line code, and are
+	/// forgotten wherever control flow may enter from elsewhere.
+	template <int W>
+	struct TransIR
+	{
+		using address_t = address_type<W>;
+		using saddr_t = signed_address_type<W>;
+		static constexpr unsigned XLEN = W * 8u;
+		static constexpr uint32_t ALL_REGISTERS = ~uint32_t(1);
+		// Loads and stores remembered at a time by the load forwarding pass
+		static constexpr size_t MAX_AVAILABLE = 16;
+
+		enum Kind : uint8_t {
+			ALU,    // Integer arithmetic that can neither trap nor exit
+			LOAD,   // Integer load
+			STORE,  // Integer store
+			BRANCH, // Conditional branch
+			OPAQUE, // Anything else: may observe every register
+		};
+
+		struct Op {
+			rv32i_instruction instr;   // Expanded, when compressed
+			address_t pc = 0;
+			Kind     kind = OPAQUE;
+			bool     label = false;    // Control may arrive from elsewhere
+			bool     observed = false; // Every register is observed in front of it
+			bool     clobbers_all = false; // May write any integer register
+			bool     writes_memory = true;
+			uint8_t  rd = 0;           // Integer register written, or 0
+			uint32_t reads = 0;        // Integer registers read, for ALU ops
+
+			// Constant propagation: rd after the op, and the sources before it
+			bool      known = false;
+			address_t value = 0;
+			uint8_t   src_known = 0;   // Bit 0: rs1, bit 1: rs2
+			std::array<address_t, 2> src_value {};
+			// Dead-write elimination: rd is overwritten before it can be read
+			bool      dead = false;
+			// Load forwarding: a register that already holds the loaded value
+			int8_t    forward = -1;
+			// Branch fusion: the index of the comparison that the branch tests
+			int       fused = -1;
+		};
+
+		bool empty() const noexcept { return ops.empty(); }
+		const Op& at(size_t idx) const { return ops.at(idx); }
+
+		/// @brief Lower the (expanded) instructions of a block, and run all passes.
+		/// @param tinfo The block, for its jump locations.
+		/// @param instr The instructions, with compressed ones already expanded.
+		/// @param forward_loads Whether loads may be served from registers, which
+		/// is only done when memory is a flat arena without side effects.
+		/// @param hoist_loops Whether to look for loops whose bounds checks
+		/// can be hoisted, which only pays off when accesses are checked.
+		void build(const TransInfo<W>& tinfo, const std::vector<rv32i_instruction>& instr,
+			bool forward_loads, bool hoist_loops)
+		{
+			this->lower(tinfo, instr);
+			this->propagate_constants(tinfo);
+			this->eliminate_dead_writes();
+			if (forward_loads)
+				this->forward_loads();
+			this->fuse_branches();
+			if (hoist_loops)
+				this->find_loops(tinfo);
+		}
+
+		std::vector<Op> ops;
+		// Loops with hoisted bounds checks, in order and not overlapping
+		std::vector<HoistedLoop<W>> loops;
+
+	private:
+		static constexpr uint32_t bit(unsigned reg) noexcept {
+			return (reg != 0) ? (1u << reg) : 0u;
+		}
+		static address_t sext32(uint32_t value) noexcept {
+			return address_t(saddr_t(int32_t(value)));
+		}
+		static unsigned load_size(unsigned funct3) noexcept {
+			return 1u << (funct3 & 0x3);
+		}
+		static bool valid_shamt(const rv32i_instruction& instr) noexcept {
+			return W != 4 || (instr.Itype.imm & 0x20) == 0;
+		}
+
+		// Integer arithmetic that the emitter writes inline, and which only
+		// depends on its register operands.
+		static bool is_pure_alu(const rv32i_instruction& instr) noexcept
+		{
+			switch (instr.opcode()) {
+			case RV32I_LUI:
+			case RV32I_AUIPC:
+				return true;
+			case RV32I_OP_IMM:
+				switch (instr.Itype.funct3) {
+				case 0x1: // SLLI
+					return instr.Itype.high_bits() == 0x0 && valid_shamt(instr);
+				case 0x5: // SRLI, SRAI
+					return (instr.Itype.high_bits() == 0x0 || instr.Itype.high_bits() == 0x400)
+						&& valid_shamt(instr);
+				default:
+					return true;
+				}
+			case RV32I_OP:
+				switch (instr.Rtype.jumptable_friendly_op()) {
+				case 0x0: case 0x200: case 0x1: case 0x2: case 0x3: // ADD SUB SLL SLT SLTU
+				case 0x4: case 0x5: case 0x205: case 0x6: case 0x7: // XOR SRL SRA OR AND
+				case 0x10: case 0x11: case 0x12: case 0x13:         // MUL MULH MULHSU MULHU
+				case 0x14: case 0x15: case 0x16: case 0x17:         // DIV DIVU REM REMU
+				case 0x102: case 0x104: case 0x106:                 // SH1ADD SH2ADD SH3ADD
+				case 0x204: case 0x206: case 0x207:                 // XNOR ORN ANDN
+				case 0x54: case 0x55: case 0x56: case 0x57:         // MIN MINU MAX MAXU
+				case 0x75: case 0x77:                               // CZERO.EQZ CZERO.NEZ
+					return true;
+				default:
+					return false;
+				}
+			case RV64I_OP_IMM32:
+				if constexpr (W < 8)
+					return false;
+				switch (instr.Itype.funct3) {
+				case 0x0: // ADDIW
+					return true;
+				case 0x1: // SLLIW
+					return instr.Itype.high_bits() == 0x0 && (instr.Itype.imm & 0x20) == 0;
+				case 0x5: // SRLIW, SRAIW
+					return (instr.Itype.high_bits() == 0x0 || instr.Itype.high_bits() == 0x400)
+						&& (instr.Itype.imm & 0x20) == 0;
+				default:
+					return false;
+				}
+			case RV64I_OP32:
+				if constexpr (W < 8)
+					return false;
+				switch (instr.Rtype.jumptable_friendly_op()) {
+				case 0x0: case 0x200: case 0x1: case 0x5: case 0x205: // ADDW SUBW SLLW SRLW SRAW
+				case 0x10: case 0x14: case 0x15: case 0x16: case 0x17: // MULW DIVW DIVUW REMW REMUW
+				case 0x40: case 0x102: case 0x104: case 0x106: // ADD.UW SHxADD.UW
+					return true;
+				default:
+					return false;
+				}
+			default:
+				return false;
+			}
+		}
+
+		static bool is_valid_load(unsigned funct3) noexcept {
+			if constexpr (W == 4)
+				return funct3 <= 2 || funct3 == 4 || funct3 == 5;
+			else
+				return funct3 <= 6;
+		}
+		static bool is_valid_store(unsigned funct3) noexcept {
+			return funct3 <= ((W == 4) ? 2u : 3u);
+		}
+
+		// The integer register written by an instruction that is not lowered
+		// to one of the other kinds, and whether it may write any register.
+		static void opaque_effects(Op& op)
+		{
+			const auto& instr = op.instr;
+			switch (instr.opcode()) {
+			case RV32I_JAL:
+			case RV32I_JALR:
+			case RV32I_LOAD:
+			case RV32I_OP_IMM:
+			case RV32I_OP:
+			case RV64I_OP_IMM32:
+			case RV64I_OP32:
+				op.rd = instr.Itype.rd;
+				op.writes_memory = false;
+				break;
+			case RV32F_LOAD:
+				op.writes_memory = false;
+				break;
+			case RV32F_STORE:
+			case RV32F_FMADD:
+			case RV32F_FMSUB:
+			case RV32F_FNMSUB:
+			case RV32F_FNMADD:
+				op.writes_memory = instr.opcode() == RV32F_STORE;
+				break;
+			case RV32F_FPFUNC:
+				// FEQ/FLT/FLE, FCVT.W[U].* and FMV.X.*/FCLASS write x[rd]
+				switch (instr.Rtype.funct7 >> 2) {
+				case RV32F__FEQ_LT_LE:
+				case RV32F__FCVT_W_SD:
+				case RV32F__FMV_X_W:
+					op.rd = instr.Rtype.rd;
+					break;
+				}
+				op.writes_memory = false;
+				break;
+			case RV32A_ATOMIC:
+				op.rd = instr.Atype.rd;
+				break;
+			default:
+				// System calls, CSRs, vector instructions and the unknown
+				op.clobbers_all = true;
+				break;
+			}
+		}
+
+		void lower(const TransInfo<W>& tinfo, const std::vector<rv32i_instruction>& instr)
+		{
+			ops.resize(instr.size());
+			address_t pc = tinfo.basepc;
+			bool previous_ends_flow = true;
+			for (size_t i = 0; i < instr.size(); i++)
+			{
+				Op& op = ops[i];
+				op.instr = instr[i];
+				op.pc = pc;
+				if constexpr (compressed_enabled)
+					pc += tinfo.instr[i].length();
+				else
+					pc += 4;
+
+				op.label = previous_ends_flow
+					|| tinfo.jump_locations.count(op.pc)
+					|| tinfo.global_jump_locations.count(op.pc);
+				// An EBREAK is injected in front of the instruction, which
+				// observes and may change everything
+				if (tinfo.ebreak_locations != nullptr && tinfo.ebreak_locations->count(op.pc)) {
+					op.label = true;
+					op.observed = true;
+				}
+
+				const auto& in = op.instr;
+				if (in.is_illegal() || in.is_compressed()) {
+					op.clobbers_all = true;
+				} else if (is_pure_alu(in)) {
+					op.kind = ALU;
+					op.rd = in.Itype.rd;
+					op.writes_memory = false;
+					switch (in.opcode()) {
+					case RV32I_LUI:
+					case RV32I_AUIPC:
+						break;
+					case RV32I_OP:
+					case RV64I_OP32:
+						op.reads = bit(in.Rtype.rs1) | bit(in.Rtype.rs2);
+						break;
+					default:
+						op.reads = bit(in.Itype.rs1);
+					}
+				} else if (in.opcode() == RV32I_LOAD && is_valid_load(in.Itype.funct3)) {
+					op.kind = LOAD;
+					op.rd = in.Itype.rd;
+					op.writes_memory = false;
+				} else if (in.opcode() == RV32I_STORE && is_valid_store(in.Stype.funct3)) {
+					op.kind = STORE;
+				} else if (in.opcode() == RV32I_BRANCH && in.Btype.funct3 != 2 && in.Btype.funct3 != 3) {
+					op.kind = BRANCH;
+					op.writes_memory = false;
+				} else {
+					opaque_effects(op);
+				}
+
+				// After these the emitter may leave the function, and add a
+				// re-entry point for whatever follows
+				switch (in.opcode()) {
+				case RV32I_JAL:
+				case RV32I_JALR:
+				case RV32I_FENCE:
+				case RV32I_SYSTEM:
+					previous_ends_flow = true;
+					break;
+				default:
+					previous_ends_flow = op.kind == OPAQUE && op.clobbers_all;
+				}
+			}
+		}
+
+		struct Constants {
+			uint32_t  known = 0;
+			std::array<address_t, 32> value {};
+
+			bool has(unsigned reg) const noexcept { return reg == 0 || (known & (1u << reg)); }
+			address_t get(unsigned reg) const noexcept { return (reg == 0) ? 0 : value[reg]; }
+			void set(unsigned reg, address_t v) noexcept {
+				if (reg != 0) { known |= 1u << reg; value[reg] = v; }
+			}
+			void kill(unsigned reg) noexcept { known &= ~bit(reg); }
+		};
+
+		// Evaluate an ALU op whose operands are known
+		static bool evaluate(const Op& op, const Constants& c, address_t& result)
+		{
+			const auto& in = op.instr;
+			switch (in.opcode()) {
+			case RV32I_LUI:
+				result = sext32(in.Utype.upper_imm());
+				return true;
+			case RV32I_AUIPC:
+				result = op.pc + sext32(in.Utype.upper_imm());
+				return true;
+			case RV32I_OP_IMM: {
+				if (!c.has(in.Itype.rs1))
+					return false;
+				const address_t a = c.get(in.Itype.rs1);
+				const address_t imm = sext32(in.Itype.signed_imm());
+				const unsigned shamt = in.Itype.shift64_imm() & (XLEN - 1);
+				switch (in.Itype.funct3) {
+				case 0x0: result = a + imm; return true;
+				case 0x1: result = a << shamt; return true;
+				case 0x2: result = (saddr_t(a) < saddr_t(imm)) ? 1 : 0; return true;
+				case 0x3: result = (a < imm) ? 1 : 0; return true;
+				case 0x4: result = a ^ imm; return true;
+				case 0x5:
+					if (in.Itype.high_bits() == 0x400)
+						result = address_t(saddr_t(a) >> shamt);
+					else
+						result = a >> shamt;
+					return true;
+				case 0x6: result = a | imm; return true;
+				case 0x7: result = a & imm; return true;
+				}
+				return false;
+			}
+			case RV32I_OP: {
+				if (!c.has(in.Rtype.rs1) || !c.has(in.Rtype.rs2))
+					return false;
+				const address_t a = c.get(in.Rtype.rs1);
+				const address_t b = c.get(in.Rtype.rs2);
+				switch (in.Rtype.jumptable_friendly_op()) {
+				case 0x0:   result = a + b; return true;
+				case 0x200: result = a - b; return true;
+				case 0x1:   result = a << (b & (XLEN - 1)); return true;
+				case 0x2:   result = (saddr_t(a) < saddr_t(b)) ? 1 : 0; return true;
+				case 0x3:   result = (a < b) ? 1 : 0; return true;
+				case 0x4:   result = a ^ b; return true;
+				case 0x5:   result = a >> (b & (XLEN - 1)); return true;
+				case 0x205: result = address_t(saddr_t(a) >> (b & (XLEN - 1))); return true;
+				case 0x6:   result = a | b; return true;
+				case 0x7:   result = a & b; return true;
+				case 0x10:  result = a * b; return true;
+				case 0x102: result = b + (a << 1); return true;
+				case 0x104: result = b + (a << 2); return true;
+				case 0x106: result = b + (a << 3); return true;
+				case 0x204: result = ~(a ^ b); return true;
+				case 0x206: result = a | ~b; return true;
+				case 0x207: result = a & ~b; return true;
+				}
+				return false;
+			}
+			case RV64I_OP_IMM32: {
+				if (!c.has(in.Itype.rs1))
+					return false;
+				const uint32_t a = uint32_t(c.get(in.Itype.rs1));
+				const unsigned shamt = in.Itype.shift_imm();
+				switch (in.Itype.funct3) {
+				case 0x0: result = sext32(a + uint32_t(in.Itype.signed_imm())); return true;
+				case 0x1: result = sext32(a << shamt); return true;
+				case 0x5:
+					if (in.Itype.high_bits() == 0x400)
+						result = sext32(uint32_t(int32_t(a) >> shamt));
+					else
+						result = sext32(a >> shamt);
+					return true;
+				}
+				return false;
+			}
+			case RV64I_OP32: {
+				if (!c.has(in.Rtype.rs1) || !c.has(in.Rtype.rs2))
+					return false;
+				const uint32_t a = uint32_t(c.get(in.Rtype.rs1));
+				const uint32_t b = uint32_t(c.get(in.Rtype.rs2));
+				switch (in.Rtype.jumptable_friendly_op()) {
+				case 0x0:   result = sext32(a + b); return true;
+				case 0x200: result = sext32(a - b); return true;
+				case 0x1:   result = sext32(a << (b & 31)); return true;
+				case 0x5:   result = sext32(a >> (b & 31)); return true;
+				case 0x205: result = sext32(uint32_t(int32_t(a) >> (b & 31))); return true;
+				case 0x10:  result = sext32(a * b); return true;
+				}
+				return false;
+			}
+			}
+			return false;
+		}
+
+		// Forward pass: which registers hold a constant before and after each op
+		void propagate_constants(const TransInfo<W>& tinfo)
+		{
+			Constants c;
+			// The emitter treats GP as a constant, except where the program
+			// sets it up, so only assume it where nothing else is known
+			const auto reset = [&] {
+				c.known = 0;
+				if (tinfo.gp != 0)
+					c.set(3, tinfo.gp);
+			};
+			reset();
+			for (auto& op : ops)
+			{
+				if (op.label)
+					reset();
+
+				const auto& in = op.instr;
+				if (op.kind == ALU || op.kind == LOAD || op.kind == STORE || op.kind == BRANCH) {
+					// LUI and AUIPC have no sources, and their fields are not registers
+					const bool has_sources = op.kind != ALU
+						|| (in.opcode() != RV32I_LUI && in.opcode() != RV32I_AUIPC);
+					if (has_sources && c.has(in.Rtype.rs1)) {
+						op.src_known |= 1;
+						op.src_value[0] = c.get(in.Rtype.rs1);
+					}
+					const bool has_rs2 = op.kind == STORE || op.kind == BRANCH
+						|| (op.kind == ALU && (in.opcode() == RV32I_OP || in.opcode() == RV64I_OP32));
+					if (has_rs2 && c.has(in.Rtype.rs2)) {
+						op.src_known |= 2;
+						op.src_value[1] = c.get(in.Rtype.rs2);
+					}
+				}
+
+				if (op.clobbers_all) {
+					reset();
+					continue;
+				}
+				if (op.rd == 0)
+					continue;
+				address_t result = 0;
+				if (op.kind == ALU && evaluate(op, c, result)) {
+					op.known = true;
+					op.value = result;
+					c.set(op.rd, result);
+				} else {
+					c.kill(op.rd);
+				}
+			}
+		}
+
+		// Backward pass: a write is dead when the register is written again
+		// before anything can read it. Only ALU ops run in between, as every
+		// other op may exit the function, trap or call out, and so observe
+		// all registers.
+		void eliminate_dead_writes()
+		{
+			uint32_t live = ALL_REGISTERS;
+			for (size_t i = ops.size(); i-- > 0; )
+			{
+				Op& op = ops[i];
+				if (op.kind != ALU) {
+					live = ALL_REGISTERS;
+				} else if (op.rd != 0 && (live & bit(op.rd)) == 0) {
+					op.dead = true;
+				} else {
+					live &= ~bit(op.rd);
+					live |= op.reads;
+				}
+				if (op.observed)
+					live = ALL_REGISTERS;
+			}
+		}
+
+		struct Available {
+			uint8_t base;
+			uint8_t val;
+			uint8_t funct3;
+			bool    store;
+			int32_t imm;
+		};
+
+		// Forward pass: loads from an address that was just loaded from or
+		// stored to, through the same base register, are served from the
+		// register that holds the value.
+		void forward_loads()
+		{
+			std::vector<Available> avail;
+			auto kill_register = [&avail] (unsigned reg) {
+				if (reg == 0) return;
+				avail.erase(std::remove_if(avail.begin(), avail.end(),
+					[reg] (const Available& a) { return a.base == reg || a.val == reg; }), avail.end());
+			};
+			auto remember = [&avail] (Available a) {
+				if (avail.size() >= MAX_AVAILABLE)
+					avail.erase(avail.begin());
+				avail.push_back(a);
+			};
+
+			for (auto& op : ops)
+			{
+				if (op.label)
+					avail.clear();
+				const auto& in = op.instr;
+
+				if (op.kind == LOAD) {
+					const unsigned funct3 = in.Itype.funct3;
+					const int32_t imm = in.Itype.signed_imm();
+					for (auto it = avail.rbegin(); it != avail.rend(); ++it) {
+						if (it->base != in.Itype.rs1 || it->imm != imm)
+							continue;
+						const bool matches = it->store
+							? load_size(funct3) <= load_size(it->funct3)
+							: it->funct3 == funct3;
+						if (matches && op.rd != 0) {
+							op.forward = int8_t(it->val);
+						}
+						break;
+					}
+					kill_register(op.rd);
+					if (op.rd != 0 && op.rd != in.Itype.rs1)
+						remember({ uint8_t(in.Itype.rs1), op.rd, uint8_t(funct3), false, imm });
+					continue;
+				}
+				if (op.kind == STORE) {
+					const int64_t begin = in.Stype.signed_imm();
+					const int64_t end = begin + load_size(in.Stype.funct3);
+					avail.erase(std::remove_if(avail.begin(), avail.end(),
+						[&] (const Available& a) {
+							if (a.base != in.Stype.rs1)
+								return true; // May alias
+							const int64_t abegin = a.imm;
+							const int64_t aend = abegin + load_size(a.funct3);
+							return abegin < end && begin < aend;
+						}), avail.end());
+					remember({ uint8_t(in.Stype.rs1), uint8_t(in.Stype.rs2),
+						uint8_t(in.Stype.funct3), true, in.Stype.signed_imm() });
+					continue;
+				}
+				if (op.clobbers_all || op.writes_memory) {
+					avail.clear();
+					continue;
+				}
+				kill_register(op.rd);
+			}
+		}
+
+		// A BEQZ/BNEZ right after the comparison that produced its operand
+		// tests the comparison itself.
+		void fuse_branches()
+		{
+			for (size_t i = 1; i < ops.size(); i++)
+			{
+				Op& op = ops[i];
+				const Op& prev = ops[i - 1];
+				if (op.kind != BRANCH || op.label || prev.kind != ALU || prev.known)
+					continue;
+				const auto& br = op.instr;
+				if (br.Btype.funct3 > 1) // BEQ and BNE only
+					continue;
+				unsigned reg = 0;
+				if (br.Btype.rs2 == 0)
+					reg = br.Btype.rs1;
+				else if (br.Btype.rs1 == 0)
+					reg = br.Btype.rs2;
+				if (reg == 0 || reg != prev.rd)
+					continue;
+				// The operands of the comparison must still be intact
+				if (prev.reads & bit(prev.rd))
+					continue;
+				const auto& cmp = prev.instr;
+				bool fusable = false;
+				if (cmp.opcode() == RV32I_OP) {
+					switch (cmp.Rtype.jumptable_friendly_op()) {
+					case 0x2: case 0x3: case 0x4: case 0x200: // SLT SLTU XOR SUB
+						fusable = true;
+					}
+				} else if (cmp.opcode() == RV32I_OP_IMM) {
+					fusable = cmp.Itype.funct3 == 0x2 || cmp.Itype.funct3 == 0x3; // SLTI SLTIU
+				}
+				if (fusable)
+					op.fused = int(i - 1);
+			}
+		}
+
+		// Loops are versioned when the emitter jumps back to their header,
+		// and nothing inside them is a breakpoint or a global entry point.
+		void find_loops(const TransInfo<W>& tinfo)
+		{
+			// Leave room for what follows the loop, where both versions meet
+			for (size_t latch = 1; latch + 1 < ops.size(); latch++)
+			{
+				const Op& br = ops[latch];
+				if (br.kind != BRANCH || br.instr.Btype.signed_imm() >= 0)
+					continue;
+				const address_t target = br.pc + br.instr.Btype.signed_imm();
+				if (!tinfo.jump_locations.count(target))
+					continue;
+				size_t header = latch;
+				while (header > 0 && ops[header].pc > target)
+					header--;
+				if (ops[header].pc != target)
+					continue;
+				if (!loops.empty() && header <= loops.back().latch)
+					continue;
+
+				std::vector<address_t> pcs;
+				std::vector<rv32i_instruction> body;
+				bool breakpoint_or_entry = false;
+				for (size_t i = header; i <= latch; i++) {
+					if (ops[i].observed || (i > header && tinfo.global_jump_locations.count(ops[i].pc)))
+						breakpoint_or_entry = true;
+					pcs.push_back(ops[i].pc);
+					body.push_back(ops[i].instr);
+				}
+				if (breakpoint_or_entry)
+					continue;
+				auto loop = HoistedLoop<W>::analyze(pcs, body);
+				if (!loop)
+					continue;
+				loop->header = header;
+				loop->latch = latch;
+				loops.push_back(std::move(*loop));
+			}
+		}
+	};
+}
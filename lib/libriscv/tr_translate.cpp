@@ -127,6 +127,8 @@ namespace riscv
 			// The CPU mirror itself, while we are at it
 			check("__builtin_offsetof(CPU, r)",  reg_offset(regs.get().data()));
 			check("__builtin_offsetof(CPU, pc)", reg_offset(&regs.pc));
+			check("__builtin_offsetof(CPU, fs)", reg_offset(&regs.fp_state_ref()));
+			check("__builtin_offsetof(CPU, vs)", reg_offset(&regs.vector_state_ref()));
 			check("__builtin_offsetof(CPU, fr)", reg_offset(&regs.getfl(0)));
 			check("sizeof(CPU)", sizeof(Registers<W>));
 			return checks;
@@ -280,6 +282,22 @@ inline DecoderData<W>& decoder_entry_at(DecoderData<W>* cache, address_type<W> a
 	return cache[addr / DecoderData<W>::DIVISOR];
 }
 
+#if defined(RISCV_STATISTICS) || defined(RISCV_REPLAY)
+// Translated code calls system call handlers straight out of the table. With
+// statistics or replay, each entry goes through Machine::system_call() instead,
+// which counts the call and records or replays it when the machine asks for it.
+template <int W, size_t... N>
+static constexpr auto make_counted_syscall_handlers(std::index_sequence<N...>)
+{
+	return std::array<typename Machine<W>::syscall_t, sizeof...(N)> {
+		[] (Machine<W>& machine) { machine.system_call(N); } ...
+	};
+}
+template <int W>
+static auto counted_syscall_handlers =
+	make_counted_syscall_handlers<W>(std::make_index_sequence<RISCV_SYSCALLS_MAX>{});
+#endif
+
 template <int W>
 static std::unordered_map<std::string, std::string> create_defines_for(const Machine<W>& machine, const MachineOptions<W>& options)
 {
@@ -304,6 +322,18 @@ static std::unordered_map<std::string, std::string> create_defines_for(const Mac
 	// and embedded translations from a differently-laid-out build are rejected.
 	defines.emplace("RISCV_ARENA_OFFSET",
 		std::to_string(uintptr_t(&machine.memory.memory_arena_ptr_ref()) - uintptr_t(&machine)));
+	// Emitted code marks the FP and vector files dirty, see ExtState. A cached
+	// translation from a build that does not would have them saved as Clean
+	// on a thread switch, so the state's offset is part of the hash too.
+	{
+		const Registers<W> regs {};
+		defines.emplace("RISCV_EXT_STATE_OFFSET",
+			std::to_string(uintptr_t(&regs.fp_state_ref()) - uintptr_t(&regs)));
+	}
+	// Emitted loops poll the interrupt flag of the machine. A cached
+	// translation from a build that does not would never be interrupted.
+	defines.emplace("RISCV_INTERRUPT_OFFSET",
+		std::to_string(uintptr_t(&machine.interrupt_flag()) - uintptr_t(&machine)));
 	if constexpr (W == 16) {
 		defines.emplace("RISCV_ARENA_END", std::to_string(uint64_t(arena_end)));
 		defines.emplace("RISCV_ARENA_ROEND", std::to_string(uint64_t(initial_rodata_end)));
@@ -338,6 +368,10 @@ static std::unordered_map<std::string, std::string> create_defines_for(const Mac
 	if constexpr (encompassing_Nbit_arena != 0) {
 		defines.emplace("RISCV_NBIT_UNBOUNDED", std::to_string(encompassing_Nbit_arena));
 	}
+	// Code without bounds-checks must never run in a machine without guard pages
+	if (machine.memory.uses_guarded_arena() && options.translation_use_arena) {
+		defines.emplace("RISCV_GUARDED_ARENA", std::to_string(guarded_arena_bits));
+	}
 	return defines;
 }
 
@@ -411,7 +445,9 @@ int CPU<W>::load_translation(const MachineOptions<W>& options,
 
 				const int32_t ins_counter_offset = uintptr_t(&counters.first) - uintptr_t(&m);
 				const int32_t max_counter_offset = uintptr_t(&counters.second) - uintptr_t(&m);
-				if (ins_counter_offset + sizeof(uint64_t) != max_counter_offset) {
+				const int32_t interrupt_offset = uintptr_t(&m.interrupt_flag()) - uintptr_t(&m);
+				if (ins_counter_offset + sizeof(uint64_t) != max_counter_offset
+					|| max_counter_offset + sizeof(uint64_t) != interrupt_offset) {
 					throw MachineException(INVALID_PROGRAM, "Invalid counter offsets in emulator");
 				}
 				const int32_t arena_offset = uintptr_t(&machine().memory.memory_arena_ptr_ref()) - uintptr_t(&m);
@@ -587,6 +623,8 @@ void CPU<W>::binary_translate(const MachineOptions<W>& options, DecodedExecuteSe
 	const uintptr_t arena_ponter_ref = (uintptr_t)machine().memory.memory_arena_ptr_ref();
 	const address_t arena_roend = machine().memory.initial_rodata_end();
 	const address_t arena_size  = machine().memory.memory_arena_size();
+	// Generated code may only rely on the guard pages when it uses the arena
+	const bool use_guarded_arena = machine().memory.uses_guarded_arena() && options.translation_use_arena;
 
 	address_t gp = 0;
 if constexpr (SCAN_FOR_GP) {
@@ -683,6 +721,7 @@ if constexpr (SCAN_FOR_GP) {
 
 		auto block_end = pc;
 		std::unordered_set<address_t> jump_locations;
+		std::unordered_set<address_t> loop_heads;
 		std::vector<rv32i_instruction> block_instructions;
 		block_instructions.reserve(block_insns);
 
@@ -745,14 +784,20 @@ if constexpr (SCAN_FOR_GP) {
 					global_jump_locations.insert(pc + instruction.length());
 				}
 
-				if (location >= block && location < block_end)
+				if (location >= block && location < block_end) {
 					jump_locations.insert(location);
+					if (location <= pc)
+						loop_heads.insert(location);
+				}
 			}
 			// loop detection (negative branch offsets)
 			else if (is_branch) {
 				// only accept branches relative to current block
-				if (location >= block && location < block_end)
+				if (location >= block && location < block_end) {
 					jump_locations.insert(location);
+					if (location <= pc)
+						loop_heads.insert(location);
+				}
 				else
 					global_jump_locations.insert(location);
 			}
@@ -788,7 +833,10 @@ if constexpr (SCAN_FOR_GP) {
 				options.translate_automatic_nbit_address_space,
 				options.translate_use_virtual_paging_fallback,
 				options.translate_unsafe_remove_checks,
+				options.translate_ir_passes,
+				use_guarded_arena,
 				std::move(jump_locations),
+				std::move(loop_heads),
 				std::move(single_return_locations),
 				nullptr, // blocks
 				&ebreak_locations,
@@ -1419,7 +1467,11 @@ CallbackTable<W> create_bintr_callback_table(DecodedExecuteSegment<W>&)
 			(void)cpu; (void)addr; (void)vd;
 #endif
 		},
+#if defined(RISCV_STATISTICS) || defined(RISCV_REPLAY)
+		.syscalls = counted_syscall_handlers<W>.data(),
+#else
 		.syscalls = Machine<W>::syscall_handlers.data(),
+#endif
 		.system_call = [] (CPU<W>& cpu, address_type<W> pc, uint64_t ic, uint64_t max_ic, int sysno) -> uint64_t {
 			try {
 				cpu.machine().set_instruction_counter(ic);
@@ -1607,7 +1659,9 @@ bool CPU<W>::initialize_translated_segment(DecodedExecuteSegment<W>& exec, void*
 
 	const int32_t ins_counter_offset = uintptr_t(&counters.first) - uintptr_t(&machine);
 	const int32_t max_counter_offset = uintptr_t(&counters.second) - uintptr_t(&machine);
-	if (ins_counter_offset + sizeof(uint64_t) != max_counter_offset) {
+	const int32_t interrupt_offset = uintptr_t(&machine.interrupt_flag()) - uintptr_t(&machine);
+	if (ins_counter_offset + sizeof(uint64_t) != max_counter_offset
+		|| max_counter_offset + sizeof(uint64_t) != interrupt_offset) {
 		throw MachineException(INVALID_PROGRAM, "Invalid counter offsets in emulator");
 	}
 	const int32_t arena_offset = uintptr_t(&machine.memory.memory_arena_ptr_ref()) - uintptr_t(&machine);
@@ -35,7 +35,12 @@ namespace riscv
 		bool use_automatic_nbit_address_space;
 		bool use_virtual_paging_fallback;
 		bool unsafe_remove_checks;
+		bool use_ir_passes;
+		bool use_guarded_arena;
 		std::unordered_set<address_type<W>> jump_locations;
+		// Targets of backward jumps. Loops that run out of instructions
+		// leave through their heads, so they are also entry points.
+		std::unordered_set<address_type<W>> loop_heads;
 		std::unordered_map<address_type<W>, address_type<W>> single_return_locations;
 		// Pointer to all the other blocks (including current)
 		std::vector<TransInfo<W>>* blocks = nullptr;
@@ -0,0 +1,741 @@
+#include "machine.hpp"
+#include "decoder_cache.hpp"
+#include "internal_common.hpp"
+#include "safe_instr_loader.hpp"
+#include "threaded_bytecodes.hpp"
+#include <algorithm>
+
+namespace riscv
+{
+	// Longest loop body that will be recorded, in instructions
+	static constexpr unsigned MAX_TRACE_INSTRUCTIONS = 256;
+
+	template <int W>
+	using TraceOp = typename Trace<W>::Op;
+
+	// Operands of a micro-op
+	enum : unsigned { WRITES_RD = 1, READS_RS1 = 2, READS_RS2 = 4 };
+
+	template <int W>
+	static unsigned operands_of(unsigned code)
+	{
+		using T = Trace<W>;
+		switch (code) {
+		case T::LI:
+			return WRITES_RD;
+		case T::MV:
+		case T::ADDI: case T::SLTI: case T::SLTIU: case T::XORI: case T::ORI: case T::ANDI:
+		case T::SLLI: case T::SRLI: case T::SRAI:
+		case T::ZEXT_H: case T::SEXT_B: case T::SEXT_H:
+		case T::ADDIW: case T::SLLIW: case T::SRLIW: case T::SRAIW:
+		case T::LB: case T::LBU: case T::LH: case T::LHU: case T::LW: case T::LWU: case T::LD:
+			return WRITES_RD | READS_RS1;
+		case T::SB: case T::SH: case T::SW: case T::SD:
+		case T::BEQ: case T::BNE: case T::BLT: case T::BGE: case T::BLTU: case T::BGEU:
+		case T::LOOP_BEQ: case T::LOOP_BNE: case T::LOOP_BLT:
+		case T::LOOP_BGE: case T::LOOP_BLTU: case T::LOOP_BGEU:
+			return READS_RS1 | READS_RS2;
+		case T::LOOP: case T::EXIT:
+			return 0;
+		default:
+			return WRITES_RD | READS_RS1 | READS_RS2;
+		}
+	}
+
+	// One guest instruction, as read back from the decoder cache
+	template <int W>
+	struct TraceStep
+	{
+		enum Kind { PLAIN, BRANCH, JUMP } kind = PLAIN;
+		TraceOp<W> op {};
+		unsigned length = 4;
+		int32_t  offset = 0;
+	};
+
+	// Decode the bytecode of a decoder entry into a micro-op over guest
+	// registers. Returns false for anything the trace tier does not handle.
+	template <int W>
+	static bool decode_step(unsigned bytecode, uint32_t payload, address_type<W> pc, TraceStep<W>& step)
+	{
+		using T = Trace<W>;
+		using address_t = address_type<W>;
+		FasterItype fi;     fi.whole = payload;
+		FasterOpType fo;    fo.whole = payload;
+		FasterMove fm;      fm.whole = payload;
+		FasterImmediate fl; fl.whole = payload;
+		FasterJtype fj;     fj.whole = payload;
+
+		auto emit = [&] (unsigned code, unsigned rd, unsigned rs1, unsigned rs2, address_t imm) {
+			step.op.code = code;
+			step.op.rd   = rd;
+			step.op.rs1  = rs1;
+			step.op.rs2  = rs2;
+			step.op.imm  = imm;
+			return rd < 32 && rs1 < 32 && rs2 < 32;
+		};
+		auto branch = [&] (unsigned code, unsigned rs1, unsigned rs2, int32_t offset) {
+			step.kind   = TraceStep<W>::BRANCH;
+			step.offset = offset;
+			return emit(code, 0, rs1, rs2, 0);
+		};
+		// Signed and unsigned immediates of FasterItype
+		const address_t simm = address_t(fi.signed_imm());
+		const address_t uimm = fi.unsigned_imm();
+
+		switch (bytecode) {
+		case RV32I_BC_ADDI:  return emit(T::ADDI,  fi.rs1, fi.rs2, 0, simm);
+		case RV32I_BC_SLTI:  return emit(T::SLTI,  fi.rs1, fi.rs2, 0, simm);
+		case RV32I_BC_SLTIU: return emit(T::SLTIU, fi.rs1, fi.rs2, 0, simm);
+		case RV32I_BC_XORI:  return emit(T::XORI,  fi.rs1, fi.rs2, 0, simm);
+		case RV32I_BC_ORI:   return emit(T::ORI,   fi.rs1, fi.rs2, 0, simm);
+		case RV32I_BC_ANDI:  return emit(T::ANDI,  fi.rs1, fi.rs2, 0, simm);
+		case RV32I_BC_SLLI:  return emit(T::SLLI,  fi.rs1, fi.rs2, 0, uimm);
+		case RV32I_BC_SRLI:  return emit(T::SRLI,  fi.rs1, fi.rs2, 0, uimm);
+		case RV32I_BC_SRAI:  return emit(T::SRAI,  fi.rs1, fi.rs2, 0, uimm);
+		case RV32I_BC_SEXT_B: return emit(T::SEXT_B, fi.rs1, fi.rs2, 0, 0);
+		case RV32I_BC_SEXT_H: return emit(T::SEXT_H, fi.rs1, fi.rs2, 0, 0);
+		case RV32I_BC_LI:    return emit(T::LI, fl.rd, 0, 0, address_t(fl.signed_imm()));
+		case RV32I_BC_MV:    return emit(T::MV, fm.rd, fm.rs1, 0, 0);
+		// Upper immediates become constants, as the PC is known
+		case RV32I_BC_LUI:   return emit(T::LI, fj.rd, 0, 0, address_t(fj.upper_imm()));
+		case RV32I_BC_AUIPC: return emit(T::LI, fj.rd, 0, 0, pc + fj.upper_imm());
+
+		case RV32I_BC_LDB:  return emit(T::LB,  fi.rs1, fi.rs2, 0, simm);
+		case RV32I_BC_LDBU: return emit(T::LBU, fi.rs1, fi.rs2, 0, simm);
+		case RV32I_BC_LDH:  return emit(T::LH,  fi.rs1, fi.rs2, 0, simm);
+		case RV32I_BC_LDHU: return emit(T::LHU, fi.rs1, fi.rs2, 0, simm);
+		case RV32I_BC_LDW:  return emit(T::LW,  fi.rs1, fi.rs2, 0, simm);
+		case RV32I_BC_STB:  return emit(T::SB,  0, fi.rs1, fi.rs2, simm);
+		case RV32I_BC_STH:  return emit(T::SH,  0, fi.rs1, fi.rs2, simm);
+		case RV32I_BC_STW:  return emit(T::SW,  0, fi.rs1, fi.rs2, simm);
+
+		case RV32I_BC_BEQ:
+		case RV32I_BC_BEQ_FW: return branch(T::BEQ, fi.rs1, fi.rs2, fi.signed_imm());
+		case RV32I_BC_BNE:
+		case RV32I_BC_BNE_FW: return branch(T::BNE, fi.rs1, fi.rs2, fi.signed_imm());
+		case RV32I_BC_BLT:  return branch(T::BLT,  fi.rs1, fi.rs2, fi.signed_imm());
+		case RV32I_BC_BGE:  return branch(T::BGE,  fi.rs1, fi.rs2, fi.signed_imm());
+		case RV32I_BC_BLTU: return branch(T::BLTU, fi.rs1, fi.rs2, fi.signed_imm());
+		case RV32I_BC_BGEU: return branch(T::BGEU, fi.rs1, fi.rs2, fi.signed_imm());
+		case RV32I_BC_FAST_JAL:
+			step.kind   = TraceStep<W>::JUMP;
+			step.offset = int32_t(payload);
+			return emit(T::LOOP, 0, 0, 0, 0);
+
+		case RV32I_BC_OP_ADD:    return emit(T::ADD,    fo.rd, fo.rs1, fo.rs2, 0);
+		case RV32I_BC_OP_SUB:    return emit(T::SUB,    fo.rd, fo.rs1, fo.rs2, 0);
+		case RV32I_BC_OP_SLL:    return emit(T::SLL,    fo.rd, fo.rs1, fo.rs2, 0);
+		case RV32I_BC_OP_SLT:    return emit(T::SLT,    fo.rd, fo.rs1, fo.rs2, 0);
+		case RV32I_BC_OP_SLTU:   return emit(T::SLTU,   fo.rd, fo.rs1, fo.rs2, 0);
+		case RV32I_BC_OP_XOR:    return emit(T::XOR,    fo.rd, fo.rs1, fo.rs2, 0);
+		case RV32I_BC_OP_SRL:    return emit(T::SRL,    fo.rd, fo.rs1, fo.rs2, 0);
+		case RV32I_BC_OP_SRA:    return emit(T::SRA,    fo.rd, fo.rs1, fo.rs2, 0);
+		case RV32I_BC_OP_OR:     return emit(T::OR,     fo.rd, fo.rs1, fo.rs2, 0);
+		case RV32I_BC_OP_AND:    return emit(T::AND,    fo.rd, fo.rs1, fo.rs2, 0);
+		case RV32I_BC_OP_MUL:    return emit(T::MUL,    fo.rd, fo.rs1, fo.rs2, 0);
+		case RV32I_BC_OP_SH1ADD: return emit(T::SH1ADD, fo.rd, fo.rs1, fo.rs2, 0);
+		case RV32I_BC_OP_SH2ADD: return emit(T::SH2ADD, fo.rd, fo.rs1, fo.rs2, 0);
+		case RV32I_BC_OP_SH3ADD: return emit(T::SH3ADD, fo.rd, fo.rs1, fo.rs2, 0);
+		case RV32I_BC_OP_ZEXT_H: return emit(T::ZEXT_H, fo.rd, fo.rs1, 0, 0);
+
+#ifdef RISCV_64I
+		case RV32I_BC_LDWU:
+		case RV32I_BC_LDD:
+		case RV32I_BC_STD:
+		case RV64I_BC_ADDIW:
+		case RV64I_BC_SLLIW:
+		case RV64I_BC_SRLIW:
+		case RV64I_BC_SRAIW:
+		case RV64I_BC_OP_ADDW:
+		case RV64I_BC_OP_SUBW:
+		case RV64I_BC_OP_MULW:
+		case RV64I_BC_OP_ADD_UW:
+		case RV64I_BC_OP_SH1ADD_UW:
+		case RV64I_BC_OP_SH2ADD_UW:
+			if constexpr (W >= 8) {
+				switch (bytecode) {
+				case RV32I_BC_LDWU:   return emit(T::LWU,   fi.rs1, fi.rs2, 0, simm);
+				case RV32I_BC_LDD:    return emit(T::LD,    fi.rs1, fi.rs2, 0, simm);
+				case RV32I_BC_STD:    return emit(T::SD,    0, fi.rs1, fi.rs2, simm);
+				case RV64I_BC_ADDIW:  return emit(T::ADDIW, fi.rs1, fi.rs2, 0, simm);
+				case RV64I_BC_SLLIW:  return emit(T::SLLIW, fi.rs1, fi.rs2, 0, uimm);
+				case RV64I_BC_SRLIW:  return emit(T::SRLIW, fi.rs1, fi.rs2, 0, uimm);
+				case RV64I_BC_SRAIW:  return emit(T::SRAIW, fi.rs1, fi.rs2, 0, uimm);
+				case RV64I_BC_OP_ADDW:   return emit(T::ADDW,   fo.rd, fo.rs1, fo.rs2, 0);
+				case RV64I_BC_OP_SUBW:   return emit(T::SUBW,   fo.rd, fo.rs1, fo.rs2, 0);
+				case RV64I_BC_OP_MULW:   return emit(T::MULW,   fo.rd, fo.rs1, fo.rs2, 0);
+				case RV64I_BC_OP_ADD_UW: return emit(T::ADD_UW, fo.rd, fo.rs1, fo.rs2, 0);
+				case RV64I_BC_OP_SH1ADD_UW: return emit(T::SH1ADD_UW, fo.rd, fo.rs1, fo.rs2, 0);
+				case RV64I_BC_OP_SH2ADD_UW: return emit(T::SH2ADD_UW, fo.rd, fo.rs1, fo.rs2, 0);
+				}
+			}
+			return false;
+#endif
+
+#ifdef RISCV_EXT_COMPRESSED
+		case RV32C_BC_ADDI:
+		case RV32C_BC_LI:
+			step.length = 2;
+			return emit(T::ADDI, fi.rs1, fi.rs2, 0, simm);
+		case RV32C_BC_MV:
+			step.length = 2;
+			return emit(T::MV, fm.rd, fm.rs1, 0, 0);
+		// The remaining compressed arithmetic is performed in-place on rs1
+		case RV32C_BC_SLLI:
+			step.length = 2;
+			return emit(T::SLLI, fi.rs1, fi.rs1, 0, uimm);
+		case RV32C_BC_SRLI:
+			step.length = 2;
+			return emit(T::SRLI, fi.rs1, fi.rs1, 0, uimm);
+		case RV32C_BC_ANDI:
+			step.length = 2;
+			return emit(T::ANDI, fi.rs1, fi.rs1, 0, simm);
+		case RV32C_BC_ADD:
+			step.length = 2;
+			return emit(T::ADD, fi.rs1, fi.rs1, fi.rs2, 0);
+		case RV32C_BC_XOR:
+			step.length = 2;
+			return emit(T::XOR, fi.rs1, fi.rs1, fi.rs2, 0);
+		case RV32C_BC_OR:
+			step.length = 2;
+			return emit(T::OR, fi.rs1, fi.rs1, fi.rs2, 0);
+		case RV32C_BC_LDW:
+			step.length = 2;
+			return emit(T::LW, fi.rs1, fi.rs2, 0, simm);
+		case RV32C_BC_STW:
+			step.length = 2;
+			return emit(T::SW, 0, fi.rs1, fi.rs2, simm);
+		case RV32C_BC_BEQZ:
+			step.length = 2;
+			return branch(T::BEQ, fi.rs1, 0, fi.signed_imm());
+		case RV32C_BC_BNEZ:
+			step.length = 2;
+			return branch(T::BNE, fi.rs1, 0, fi.signed_imm());
+		case RV32C_BC_JMP:
+			step.length = 2;
+			step.kind   = TraceStep<W>::JUMP;
+			step.offset = fi.signed_imm();
+			return emit(T::LOOP, 0, 0, 0, 0);
+		case RV32C_BC_LDD:
+		case RV32C_BC_STD:
+		case RV32C_BC_JAL_ADDIW:
+			step.length = 2;
+			if constexpr (W >= 8) {
+				if (bytecode == RV32C_BC_LDD)
+					return emit(T::LD, fi.rs1, fi.rs2, 0, simm);
+				if (bytecode == RV32C_BC_STD)
+					return emit(T::SD, 0, fi.rs1, fi.rs2, simm);
+				// C.ADDIW
+				return emit(T::ADDIW, fi.rs1, fi.rs1, 0, simm);
+			}
+			return false;
+#endif
+		default:
+			return false;
+		}
+	}
+
+	template <int W>
+	static bool is_traceable(unsigned bytecode)
+	{
+		TraceStep<W> step;
+		return decode_step<W>(unfused_bytecode(bytecode), 0, 0, step);
+	}
+
+	template <int W>
+	TraceHeads<W>::TraceHeads(size_t n, unsigned threshold)
+		: m_heads(new Head[n]), m_size(n), m_threshold(threshold)
+	{
+	}
+
+	template <int W>
+	std::unique_ptr<TraceHeads<W>> TraceHeads<W>::install(DecodedExecuteSegment<W>& exec,
+		address_t begin, address_t end, unsigned threshold)
+	{
+		auto* exec_decoder = exec.decoder_cache();
+		// Instruction boundaries, so that branches into the middle of an
+		// instruction do not become loop heads
+		std::vector<bool> starts((end - begin) / DecoderData<W>::DIVISOR + 1);
+		std::vector<address_t> targets;
+
+		address_t pc = begin;
+		while (pc < end)
+		{
+			const unsigned length = compressed_enabled
+				? read_instruction(exec.exec_data(), pc, exec.exec_end()).length() : 4;
+			starts[(pc - begin) / DecoderData<W>::DIVISOR] = true;
+
+			// Backward branches and jumps close a loop
+			const auto& entry = exec_decoder[pc / DecoderData<W>::DIVISOR];
+			TraceStep<W> step;
+			if (decode_step<W>(entry.get_bytecode(), entry.instr, pc, step)
+				&& step.kind != TraceStep<W>::PLAIN && step.offset < 0)
+			{
+				targets.push_back(pc + step.offset);
+			}
+			pc += length;
+		}
+
+		std::sort(targets.begin(), targets.end());
+		targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+		targets.erase(std::remove_if(targets.begin(), targets.end(),
+			[&] (address_t target) {
+				return target < begin || target >= end
+					|| !starts[(target - begin) / DecoderData<W>::DIVISOR]
+					|| !is_traceable<W>(exec_decoder[target / DecoderData<W>::DIVISOR].get_bytecode());
+			}), targets.end());
+		if (targets.empty())
+			return nullptr;
+
+		auto heads = std::make_unique<TraceHeads<W>>(targets.size(), threshold);
+		for (size_t i = 0; i < targets.size(); i++)
+		{
+			auto& head  = heads->m_heads[i];
+			auto& entry = exec_decoder[targets[i] / DecoderData<W>::DIVISOR];
+			head.pc = targets[i];
+			head.bytecode = entry.get_bytecode();
+			// While counting, m_handler holds the original bytecode
+			entry.set_atomic_bytecode_and_handler(RV32I_BC_TRACE, head.bytecode);
+		}
+		return heads;
+	}
+
+	template <int W>
+	typename TraceHeads<W>::Head* TraceHeads<W>::find(address_t pc) const noexcept
+	{
+		auto* begin = m_heads.get();
+		auto* end   = begin + m_size;
+		auto* it = std::lower_bound(begin, end, pc,
+			[] (const Head& head, address_t pc) { return head.pc < pc; });
+		if (it != end && it->pc == pc)
+			return it;
+		return nullptr;
+	}
+
+	template <int W>
+	typename TraceHeads<W>::Head* TraceHeads<W>::hit(address_t pc) noexcept
+	{
+		auto* head = this->find(pc);
+		if (head == nullptr)
+			return nullptr;
+		if (head->hits.fetch_add(1, std::memory_order_relaxed) + 1 < m_threshold)
+			return nullptr;
+		// Only one caller gets to record the loop
+		uint8_t expected = COUNTING;
+		if (head->state.compare_exchange_strong(expected, RECORDING))
+			return head;
+		return nullptr;
+	}
+
+	template <int W>
+	const Trace<W>* TraceHeads<W>::trace_at(address_t pc) const noexcept
+	{
+		auto* head = this->find(pc);
+		if (head != nullptr && head->state.load(std::memory_order_acquire) == COMPILED)
+			return head->trace.get();
+		return nullptr;
+	}
+
+	template <int W>
+	size_t TraceHeads<W>::compiled() const noexcept
+	{
+		size_t count = 0;
+		for (size_t i = 0; i < m_size; i++)
+			count += m_heads[i].state.load(std::memory_order_relaxed) == COMPILED;
+		return count;
+	}
+
+	template <int W>
+	void TraceHeads<W>::restore(DecodedExecuteSegment<W>& exec, Head& head) noexcept
+	{
+		head.state.store(FAILED, std::memory_order_release);
+		auto& entry = exec.decoder_cache()[head.pc / DecoderData<W>::DIVISOR];
+		if (entry.get_bytecode() == RV32I_BC_TRACE) {
+			// m_handler is unused by every traceable bytecode, and keeping the
+			// original bytecode in it lets a concurrent dispatch of the old
+			// entry still find its way to the original instruction.
+			entry.set_atomic_bytecode_and_handler(head.bytecode, head.bytecode);
+		}
+	}
+
+	template <int W>
+	void TraceHeads<W>::uninstall(DecodedExecuteSegment<W>& exec) noexcept
+	{
+		for (size_t i = 0; i < m_size; i++)
+			this->restore(exec, m_heads[i]);
+	}
+
+	template <int W>
+	void TraceHeads<W>::record(CPU<W>& cpu, DecodedExecuteSegment<W>& exec, Head& head)
+	{
+		std::unique_ptr<Trace<W>> trace;
+		try {
+			trace = this->compile(cpu, exec, head);
+		} catch (...) {
+			this->restore(exec, head);
+			throw;
+		}
+		if (trace == nullptr) {
+			// Ran out of instructions while recording: try again later
+			if (head.state.load() == RECORDING) {
+				head.hits.store(0, std::memory_order_relaxed);
+				head.state.store(COUNTING);
+			}
+			return;
+		}
+		if (!trace->ops.empty()) {
+			head.trace = std::move(trace);
+			uint8_t expected = RECORDING;
+			if (head.state.compare_exchange_strong(expected, COMPILED, std::memory_order_acq_rel)) {
+				auto& entry = exec.decoder_cache()[head.pc / DecoderData<W>::DIVISOR];
+				entry.set_atomic_bytecode_and_handler(RV32I_BC_TRACE, 0);
+			}
+			return;
+		}
+		this->restore(exec, head);
+	}
+
+	// Record one iteration of the loop by stepping through it, and build the
+	// trace from the path that was taken. Returns a trace without micro-ops
+	// when the loop cannot be traced, and nullptr when recording must be
+	// retried because the instruction counter ran out.
+	template <int W>
+	std::unique_ptr<Trace<W>> TraceHeads<W>::compile(CPU<W>& cpu, DecodedExecuteSegment<W>& exec, Head& head)
+	{
+		using T = Trace<W>;
+		auto& machine = cpu.machine();
+		auto* exec_decoder = exec.decoder_cache();
+		auto trace = std::make_unique<Trace<W>>();
+		trace->head = head.pc;
+
+		// Guest register to window slot, where 0 means not yet cached
+		uint8_t slot_of[32] {};
+		auto slot_for = [&] (unsigned reg) -> int {
+			if (reg == 0)
+				return 0;
+			if (slot_of[reg] == 0) {
+				if (trace->slots == T::WINDOW)
+					return -1;
+				slot_of[reg] = trace->slots;
+				trace->window[trace->slots++] = reg;
+			}
+			return slot_of[reg];
+		};
+		auto failed = [&] {
+			trace->ops.clear();
+			return std::move(trace);
+		};
+		auto add_op = [&] (TraceOp<W> op, address_t pc) -> bool {
+			const unsigned operands = operands_of<W>(op.code);
+			const int rs1 = (operands & READS_RS1) ? slot_for(op.rs1) : 0;
+			const int rs2 = (operands & READS_RS2) ? slot_for(op.rs2) : 0;
+			// Writes to x0 are discarded into slot 1
+			const int rd = !(operands & WRITES_RD) ? 0 : (op.rd == 0) ? 1 : slot_for(op.rd);
+			if (rs1 < 0 || rs2 < 0 || rd < 0)
+				return false;
+			if (operands & WRITES_RD)
+				trace->dirty |= 1u << rd;
+			op.rd = rd; op.rs1 = rs1; op.rs2 = rs2;
+			trace->ops.push_back(op);
+			trace->op_pc.push_back(pc);
+			return true;
+		};
+		auto add_exit = [&] (unsigned code, TraceOp<W> op, address_t pc, address_t exit_pc, uint32_t icount) {
+			op.code = code;
+			op.exit = trace->exits.size();
+			trace->exits.push_back({exit_pc, icount});
+			return add_op(op, pc);
+		};
+		// Branch conditions, inverted and as back-edges
+		auto inverted = [] (unsigned code) -> unsigned {
+			switch (code) {
+			case T::BEQ: return T::BNE;
+			case T::BNE: return T::BEQ;
+			case T::BLT: return T::BGE;
+			case T::BGE: return T::BLT;
+			case T::BLTU: return T::BGEU;
+			default: return T::BLTU;
+			}
+		};
+		auto back_edge = [] (unsigned code) -> unsigned {
+			return code - T::BEQ + T::LOOP_BEQ;
+		};
+
+		std::vector<address_t> visited;
+		address_t pc = head.pc;
+		for (uint32_t icount = 1; icount <= MAX_TRACE_INSTRUCTIONS; icount++)
+		{
+			if (machine.instruction_counter() >= machine.max_instructions())
+				return nullptr;
+
+			// The original bytecode of a loop head is kept in its Head
+			const auto& entry = exec_decoder[pc / DecoderData<W>::DIVISOR];
+			unsigned bytecode = entry.get_bytecode();
+			if (bytecode == RV32I_BC_TRACE) {
+				auto* other = this->find(pc);
+				if (other == nullptr)
+					return failed();
+				bytecode = other->bytecode;
+			}
+			TraceStep<W> step;
+			if (!decode_step<W>(unfused_bytecode(bytecode), entry.instr, pc, step))
+				return failed();
+
+			// Execute the instruction for real, to find the path taken
+			cpu.step_one();
+			const address_t next = cpu.registers().pc;
+			const address_t fallthrough = pc + step.length;
+			const address_t target = pc + step.offset;
+			const bool closes = (next == head.pc);
+			visited.push_back(pc);
+
+			bool ok = true;
+			bool looped = false;
+			if (step.kind == TraceStep<W>::PLAIN) {
+				if (next != fallthrough)
+					return failed();
+				ok = add_op(step.op, pc);
+			}
+			else if (step.kind == TraceStep<W>::BRANCH && target != fallthrough) {
+				const bool taken = (next == target);
+				if (!taken && next != fallthrough)
+					return failed();
+				if (taken && closes) {
+					// Loop back while the condition holds, otherwise leave
+					auto loop = step.op;
+					loop.code = back_edge(step.op.code);
+					ok = add_op(loop, pc)
+						&& add_exit(T::EXIT, step.op, pc, fallthrough, icount);
+					looped = true;
+				} else if (taken) {
+					ok = add_exit(inverted(step.op.code), step.op, pc, fallthrough, icount);
+				} else {
+					ok = add_exit(step.op.code, step.op, pc, target, icount);
+				}
+			}
+			else if (step.kind == TraceStep<W>::JUMP && next != target) {
+				return failed();
+			}
+			if (!ok)
+				return failed();
+
+			if (closes) {
+				if (!looped) {
+					TraceOp<W> loop {};
+					loop.code = T::LOOP;
+					add_op(loop, pc);
+				}
+				trace->iteration_icount = icount;
+				return trace;
+			}
+			// Inner loops and paths that leave the segment are not traced
+			if (!exec.is_within(next)
+				|| std::find(visited.begin(), visited.end(), next) != visited.end())
+				return failed();
+			pc = next;
+		}
+		return failed();
+	}
+
+	template <int W>
+	TraceResults<W> Trace<W>::run(CPU<W>& cpu, uint64_t counter, uint64_t max) const
+	{
+		using saddr_t = signed_address_type<W>;
+		static constexpr unsigned XLEN = W * 8;
+		auto& regs = cpu.registers().get();
+		auto& memory = cpu.memory();
+		auto& interrupt = cpu.machine().interrupt_flag();
+
+		address_t w[WINDOW];
+		w[0] = 0;
+		for (unsigned i = 2; i < this->slots; i++)
+			w[i] = regs[this->window[i]];
+
+		auto write_back = [&] {
+			for (unsigned i = 2; i < this->slots; i++) {
+				if (this->dirty & (1u << i))
+					regs[this->window[i]] = w[i];
+			}
+		};
+
+#ifdef __GNUC__
+		static constexpr void* trace_ops[] = {
+			[LI] = &&trace_op_LI,
+			[MV] = &&trace_op_MV,
+			[ADDI] = &&trace_op_ADDI,
+			[SLTI] = &&trace_op_SLTI,
+			[SLTIU] = &&trace_op_SLTIU,
+			[XORI] = &&trace_op_XORI,
+			[ORI] = &&trace_op_ORI,
+			[ANDI] = &&trace_op_ANDI,
+			[SLLI] = &&trace_op_SLLI,
+			[SRLI] = &&trace_op_SRLI,
+			[SRAI] = &&trace_op_SRAI,
+			[ADD] = &&trace_op_ADD,
+			[SUB] = &&trace_op_SUB,
+			[SLL] = &&trace_op_SLL,
+			[SLT] = &&trace_op_SLT,
+			[SLTU] = &&trace_op_SLTU,
+			[XOR] = &&trace_op_XOR,
+			[SRL] = &&trace_op_SRL,
+			[SRA] = &&trace_op_SRA,
+			[OR] = &&trace_op_OR,
+			[AND] = &&trace_op_AND,
+			[MUL] = &&trace_op_MUL,
+			[SH1ADD] = &&trace_op_SH1ADD,
+			[SH2ADD] = &&trace_op_SH2ADD,
+			[SH3ADD] = &&trace_op_SH3ADD,
+			[ZEXT_H] = &&trace_op_ZEXT_H,
+			[SEXT_B] = &&trace_op_SEXT_B,
+			[SEXT_H] = &&trace_op_SEXT_H,
+			[ADDIW] = &&trace_op_ADDIW,
+			[SLLIW] = &&trace_op_SLLIW,
+			[SRLIW] = &&trace_op_SRLIW,
+			[SRAIW] = &&trace_op_SRAIW,
+			[ADDW] = &&trace_op_ADDW,
+			[SUBW] = &&trace_op_SUBW,
+			[MULW] = &&trace_op_MULW,
+			[ADD_UW] = &&trace_op_ADD_UW,
+			[SH1ADD_UW] = &&trace_op_SH1ADD_UW,
+			[SH2ADD_UW] = &&trace_op_SH2ADD_UW,
+			[LB] = &&trace_op_LB,
+			[LBU] = &&trace_op_LBU,
+			[LH] = &&trace_op_LH,
+			[LHU] = &&trace_op_LHU,
+			[LW] = &&trace_op_LW,
+			[LWU] = &&trace_op_LWU,
+			[LD] = &&trace_op_LD,
+			[SB] = &&trace_op_SB,
+			[SH] = &&trace_op_SH,
+			[SW] = &&trace_op_SW,
+			[SD] = &&trace_op_SD,
+			[BEQ] = &&trace_op_BEQ,
+			[BNE] = &&trace_op_BNE,
+			[BLT] = &&trace_op_BLT,
+			[BGE] = &&trace_op_BGE,
+			[BLTU] = &&trace_op_BLTU,
+			[BGEU] = &&trace_op_BGEU,
+			[LOOP_BEQ] = &&trace_op_LOOP_BEQ,
+			[LOOP_BNE] = &&trace_op_LOOP_BNE,
+			[LOOP_BLT] = &&trace_op_LOOP_BLT,
+			[LOOP_BGE] = &&trace_op_LOOP_BGE,
+			[LOOP_BLTU] = &&trace_op_LOOP_BLTU,
+			[LOOP_BGEU] = &&trace_op_LOOP_BGEU,
+			[LOOP] = &&trace_op_LOOP,
+			[EXIT] = &&trace_op_EXIT,
+		};
+#define TRACE_OP(x)  trace_op_##x
+#define TRACE_DISPATCH() goto *trace_ops[op->code]
+#else
+#define TRACE_OP(x)  case x
+#define TRACE_DISPATCH() goto dispatch
+#endif
+#define TRACE_NEXT() op++; TRACE_DISPATCH();
+		const Op* op = this->ops.data();
+		address_t exit_pc;
+		try {
+#ifdef __GNUC__
+			TRACE_DISPATCH();
+#else
+		dispatch:
+			switch (op->code) {
+#endif
+			TRACE_OP(LI): w[op->rd] = op->imm; TRACE_NEXT();
+			TRACE_OP(MV): w[op->rd] = w[op->rs1]; TRACE_NEXT();
+			TRACE_OP(ADDI): w[op->rd] = w[op->rs1] + op->imm; TRACE_NEXT();
+			TRACE_OP(SLTI): w[op->rd] = saddr_t(w[op->rs1]) < saddr_t(op->imm); TRACE_NEXT();
+			TRACE_OP(SLTIU): w[op->rd] = w[op->rs1] < op->imm; TRACE_NEXT();
+			TRACE_OP(XORI): w[op->rd] = w[op->rs1] ^ op->imm; TRACE_NEXT();
+			TRACE_OP(ORI): w[op->rd] = w[op->rs1] | op->imm; TRACE_NEXT();
+			TRACE_OP(ANDI): w[op->rd] = w[op->rs1] & op->imm; TRACE_NEXT();
+			TRACE_OP(SLLI): w[op->rd] = w[op->rs1] << op->imm; TRACE_NEXT();
+			TRACE_OP(SRLI): w[op->rd] = w[op->rs1] >> op->imm; TRACE_NEXT();
+			TRACE_OP(SRAI): w[op->rd] = saddr_t(w[op->rs1]) >> op->imm; TRACE_NEXT();
+			TRACE_OP(ADD): w[op->rd] = w[op->rs1] + w[op->rs2]; TRACE_NEXT();
+			TRACE_OP(SUB): w[op->rd] = w[op->rs1] - w[op->rs2]; TRACE_NEXT();
+			TRACE_OP(SLL): w[op->rd] = w[op->rs1] << (w[op->rs2] & (XLEN - 1)); TRACE_NEXT();
+			TRACE_OP(SLT): w[op->rd] = saddr_t(w[op->rs1]) < saddr_t(w[op->rs2]); TRACE_NEXT();
+			TRACE_OP(SLTU): w[op->rd] = w[op->rs1] < w[op->rs2]; TRACE_NEXT();
+			TRACE_OP(XOR): w[op->rd] = w[op->rs1] ^ w[op->rs2]; TRACE_NEXT();
+			TRACE_OP(SRL): w[op->rd] = w[op->rs1] >> (w[op->rs2] & (XLEN - 1)); TRACE_NEXT();
+			TRACE_OP(SRA): w[op->rd] = saddr_t(w[op->rs1]) >> (w[op->rs2] & (XLEN - 1)); TRACE_NEXT();
+			TRACE_OP(OR): w[op->rd] = w[op->rs1] | w[op->rs2]; TRACE_NEXT();
+			TRACE_OP(AND): w[op->rd] = w[op->rs1] & w[op->rs2]; TRACE_NEXT();
+			TRACE_OP(MUL): w[op->rd] = w[op->rs1] * w[op->rs2]; TRACE_NEXT();
+			TRACE_OP(SH1ADD): w[op->rd] = w[op->rs2] + (w[op->rs1] << 1); TRACE_NEXT();
+			TRACE_OP(SH2ADD): w[op->rd] = w[op->rs2] + (w[op->rs1] << 2); TRACE_NEXT();
+			TRACE_OP(SH3ADD): w[op->rd] = w[op->rs2] + (w[op->rs1] << 3); TRACE_NEXT();
+			TRACE_OP(ZEXT_H): w[op->rd] = uint16_t(w[op->rs1]); TRACE_NEXT();
+			TRACE_OP(SEXT_B): w[op->rd] = saddr_t(int8_t(w[op->rs1])); TRACE_NEXT();
+			TRACE_OP(SEXT_H): w[op->rd] = saddr_t(int16_t(w[op->rs1])); TRACE_NEXT();
+			TRACE_OP(ADDIW): w[op->rd] = int32_t(uint32_t(w[op->rs1]) + uint32_t(op->imm)); TRACE_NEXT();
+			TRACE_OP(SLLIW): w[op->rd] = int32_t(uint32_t(w[op->rs1]) << op->imm); TRACE_NEXT();
+			TRACE_OP(SRLIW): w[op->rd] = int32_t(uint32_t(w[op->rs1]) >> op->imm); TRACE_NEXT();
+			TRACE_OP(SRAIW): w[op->rd] = int32_t(w[op->rs1]) >> op->imm; TRACE_NEXT();
+			TRACE_OP(ADDW): w[op->rd] = int32_t(uint32_t(w[op->rs1]) + uint32_t(w[op->rs2])); TRACE_NEXT();
+			TRACE_OP(SUBW): w[op->rd] = int32_t(uint32_t(w[op->rs1]) - uint32_t(w[op->rs2])); TRACE_NEXT();
+			TRACE_OP(MULW): w[op->rd] = int32_t(uint32_t(w[op->rs1]) * uint32_t(w[op->rs2])); TRACE_NEXT();
+			TRACE_OP(ADD_UW): w[op->rd] = w[op->rs2] + uint32_t(w[op->rs1]); TRACE_NEXT();
+			TRACE_OP(SH1ADD_UW): w[op->rd] = w[op->rs2] + (address_t(uint32_t(w[op->rs1])) << 1); TRACE_NEXT();
+			TRACE_OP(SH2ADD_UW): w[op->rd] = w[op->rs2] + (address_t(uint32_t(w[op->rs1])) << 2); TRACE_NEXT();
+			TRACE_OP(LB): w[op->rd] = saddr_t(int8_t(memory.template read<uint8_t>(w[op->rs1] + op->imm))); TRACE_NEXT();
+			TRACE_OP(LBU): w[op->rd] = memory.template read<uint8_t>(w[op->rs1] + op->imm); TRACE_NEXT();
+			TRACE_OP(LH): w[op->rd] = saddr_t(int16_t(memory.template read<uint16_t>(w[op->rs1] + op->imm))); TRACE_NEXT();
+			TRACE_OP(LHU): w[op->rd] = memory.template read<uint16_t>(w[op->rs1] + op->imm); TRACE_NEXT();
+			TRACE_OP(LW): w[op->rd] = saddr_t(int32_t(memory.template read<uint32_t>(w[op->rs1] + op->imm))); TRACE_NEXT();
+			TRACE_OP(LWU): w[op->rd] = memory.template read<uint32_t>(w[op->rs1] + op->imm); TRACE_NEXT();
+			TRACE_OP(LD): w[op->rd] = saddr_t(int64_t(memory.template read<uint64_t>(w[op->rs1] + op->imm))); TRACE_NEXT();
+			TRACE_OP(SB): memory.template write<uint8_t>(w[op->rs1] + op->imm, w[op->rs2]); TRACE_NEXT();
+			TRACE_OP(SH): memory.template write<uint16_t>(w[op->rs1] + op->imm, w[op->rs2]); TRACE_NEXT();
+			TRACE_OP(SW): memory.template write<uint32_t>(w[op->rs1] + op->imm, w[op->rs2]); TRACE_NEXT();
+			TRACE_OP(SD): memory.template write<uint64_t>(w[op->rs1] + op->imm, w[op->rs2]); TRACE_NEXT();
+			TRACE_OP(BEQ): if (w[op->rs1] == w[op->rs2]) goto side_exit; TRACE_NEXT();
+			TRACE_OP(BNE): if (w[op->rs1] != w[op->rs2]) goto side_exit; TRACE_NEXT();
+			TRACE_OP(BLT): if (saddr_t(w[op->rs1]) <  saddr_t(w[op->rs2])) goto side_exit; TRACE_NEXT();
+			TRACE_OP(BGE): if (saddr_t(w[op->rs1]) >= saddr_t(w[op->rs2])) goto side_exit; TRACE_NEXT();
+			TRACE_OP(BLTU): if (w[op->rs1] <  w[op->rs2]) goto side_exit; TRACE_NEXT();
+			TRACE_OP(BGEU): if (w[op->rs1] >= w[op->rs2]) goto side_exit; TRACE_NEXT();
+			TRACE_OP(LOOP_BEQ): if (w[op->rs1] == w[op->rs2]) goto next_iteration; TRACE_NEXT();
+			TRACE_OP(LOOP_BNE): if (w[op->rs1] != w[op->rs2]) goto next_iteration; TRACE_NEXT();
+			TRACE_OP(LOOP_BLT): if (saddr_t(w[op->rs1]) <  saddr_t(w[op->rs2])) goto next_iteration; TRACE_NEXT();
+			TRACE_OP(LOOP_BGE): if (saddr_t(w[op->rs1]) >= saddr_t(w[op->rs2])) goto next_iteration; TRACE_NEXT();
+			TRACE_OP(LOOP_BLTU): if (w[op->rs1] <  w[op->rs2]) goto next_iteration; TRACE_NEXT();
+			TRACE_OP(LOOP_BGEU): if (w[op->rs1] >= w[op->rs2]) goto next_iteration; TRACE_NEXT();
+			TRACE_OP(LOOP): goto next_iteration;
+			TRACE_OP(EXIT): goto side_exit;
+#ifndef __GNUC__
+			default: RISCV_UNREACHABLE();
+			}
+#endif
+		next_iteration:
+			counter += this->iteration_icount;
+			if (UNLIKELY(counter >= max || interrupt.load(std::memory_order_relaxed))) {
+				exit_pc = this->head;
+				goto leave;
+			}
+			op = this->ops.data();
+			TRACE_DISPATCH();
+		side_exit:
+			counter += this->exits[op->exit].icount;
+			exit_pc = this->exits[op->exit].pc;
+		} catch (...) {
+			// Make the faulting instruction and the registers visible
+			write_back();
+			cpu.registers().pc = this->op_pc[op - this->ops.data()];
+			throw;
+		}
+	leave:
+		write_back();
+		return {counter, exit_pc};
+#undef TRACE_NEXT
+#undef TRACE_DISPATCH
+#undef TRACE_OP
+	}
+
+	INSTANTIATE_32_IF_ENABLED(Trace);
+	INSTANTIATE_32_IF_ENABLED(TraceHeads);
+	INSTANTIATE_64_IF_ENABLED(Trace);
+	INSTANTIATE_64_IF_ENABLED(TraceHeads);
+	INSTANTIATE_128_IF_ENABLED(Trace);
+	INSTANTIATE_128_IF_ENABLED(TraceHeads);
+} // riscv
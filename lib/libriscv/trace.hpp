@@ -0,0 +1,146 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "libriscv_settings.h"
+#include "types.hpp"
+
+namespace riscv
+{
+	template <int W> struct CPU;
+	template <int W> struct DecoderData;
+	template <int W> struct DecodedExecuteSegment;
+
+	// The trace tier needs a dispatch mode that can re-dispatch the original
+	// bytecode of a loop head while it is still counting, so it is only
+	// installed with threaded and tail-call dispatch.
+#if (defined(RISCV_THREADED) || defined(RISCV_TAILCALL_DISPATCH)) && !defined(RISCV_ASM_DISPATCH)
+	static constexpr bool trace_tier_available = true;
+#else
+	static constexpr bool trace_tier_available = false;
+#endif
+
+	template <int W>
+	struct TraceResults {
+		uint64_t counter;
+		address_type<W> pc;
+	};
+
+	// Micro-ops of the trace tier
+	struct TraceOpcodes
+	{
+		enum Opcode : uint8_t {
+			LI, MV,
+			ADDI, SLTI, SLTIU, XORI, ORI, ANDI, SLLI, SRLI, SRAI,
+			ADD, SUB, SLL, SLT, SLTU, XOR, SRL, SRA, OR, AND, MUL,
+			SH1ADD, SH2ADD, SH3ADD, ZEXT_H, SEXT_B, SEXT_H,
+			ADDIW, SLLIW, SRLIW, SRAIW, ADDW, SUBW, MULW,
+			ADD_UW, SH1ADD_UW, SH2ADD_UW,
+			LB, LBU, LH, LHU, LW, LWU, LD,
+			SB, SH, SW, SD,
+			// Side exits, taken when the condition holds
+			BEQ, BNE, BLT, BGE, BLTU, BGEU,
+			// Back-edges to the loop head, taken when the condition holds
+			LOOP_BEQ, LOOP_BNE, LOOP_BLT, LOOP_BGE, LOOP_BLTU, LOOP_BGEU,
+			LOOP, EXIT,
+		};
+	};
+
+	/// @brief A hot loop recorded from the decoder cache, and rewritten into
+	/// micro-ops that operate on a small window of cached guest registers.
+	/// @details Guest registers are loaded into the window once when the trace
+	/// is entered, and the modified ones are written back on exit. Any path
+	/// the recording did not take is a side exit back into the decoder cache.
+	template <int W>
+	struct Trace : public TraceOpcodes
+	{
+		using address_t = address_type<W>;
+		// Slot 0 is always zero and slot 1 discards writes to x0
+		static constexpr unsigned WINDOW = 16;
+
+		struct Op {
+			uint8_t   code;
+			uint8_t   rd;
+			uint8_t   rs1;
+			uint8_t   rs2;
+			uint32_t  exit; // Index into exits
+			address_t imm;
+		};
+		struct Exit {
+			address_t pc;
+			uint32_t  icount; // Instructions retired from the loop head
+		};
+
+		/// @brief Run the loop until it exits or the instruction counter
+		/// reaches max. Returns the new counter and the guest PC to resume at.
+		TraceResults<W> run(CPU<W>& cpu, uint64_t counter, uint64_t max) const;
+
+		address_t head = 0;
+		uint32_t  iteration_icount = 0;
+		unsigned  slots = 2;
+		uint32_t  dirty = 0; // Bitmask of window slots written to by the loop
+		uint8_t   window[WINDOW] {}; // Guest register held by each slot
+		std::vector<Op> ops;
+		std::vector<address_t> op_pc; // Guest PC of each micro-op, for faults
+		std::vector<Exit> exits;
+	};
+
+	/// @brief The loop heads of an execute segment, and their traces.
+	/// @details A loop head is the target of a backward branch or jump. Its
+	/// decoder entry is replaced by RV32I_BC_TRACE, which counts entries
+	/// while m_handler holds the original bytecode, and runs the compiled
+	/// trace once m_handler is zero. Traces never modify the payload of the
+	/// decoder entry, so the original instruction can always be restored.
+	template <int W>
+	struct TraceHeads
+	{
+		using address_t = address_type<W>;
+		enum State : uint8_t { COUNTING, RECORDING, COMPILED, FAILED };
+
+		struct Head {
+			address_t pc = 0;
+			uint8_t   bytecode = 0;
+			std::atomic<uint32_t> hits { 0 };
+			std::atomic<uint8_t>  state { COUNTING };
+			std::unique_ptr<Trace<W>> trace = nullptr;
+		};
+
+		/// @brief Find loop heads in the decoded range and install counting
+		/// entries for them. Returns nullptr when there are none.
+		static std::unique_ptr<TraceHeads> install(DecodedExecuteSegment<W>&,
+			address_t begin, address_t end, unsigned threshold);
+
+		/// @brief Count an entry into the loop head at pc. Returns the head
+		/// when it just became hot, and the caller must record it.
+		Head* hit(address_t pc) noexcept;
+
+		/// @brief Step the machine through one iteration of the loop at the
+		/// current PC, and compile it into a trace. The machine counters must
+		/// be applied, and the caller resumes from the new PC afterwards.
+		void record(CPU<W>& cpu, DecodedExecuteSegment<W>& exec, Head& head);
+
+		/// @brief The compiled trace for the loop head at pc.
+		const Trace<W>* trace_at(address_t pc) const noexcept;
+
+		/// @brief Restore the original bytecode of every loop head, so that
+		/// the decoder cache can be patched safely.
+		void uninstall(DecodedExecuteSegment<W>&) noexcept;
+
+		size_t size() const noexcept { return m_size; }
+		size_t compiled() const noexcept;
+		unsigned threshold() const noexcept { return m_threshold; }
+
+		TraceHeads(size_t n, unsigned threshold);
+
+	private:
+		Head* find(address_t pc) const noexcept;
+		std::unique_ptr<Trace<W>> compile(CPU<W>& cpu, DecodedExecuteSegment<W>& exec, Head& head);
+		void restore(DecodedExecuteSegment<W>&, Head& head) noexcept;
+
+		std::unique_ptr<Head[]> m_heads; // Sorted by PC
+		size_t   m_size;
+		unsigned m_threshold;
+	};
+
+} // riscv
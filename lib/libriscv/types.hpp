@@ -44,6 +44,7 @@ namespace riscv
 		INVALID_PROGRAM,
 		SYSTEM_CALL_FAILED,
 		EXECUTION_LOOP_DETECTED,
+		EXECUTION_INTERRUPTED,
 		UNKNOWN_EXCEPTION
 	};
 
@@ -28,6 +28,7 @@ put on the initial stack */
 #define AT_HWCAP2 26    /* extension of AT_HWCAP */
 
 #define AT_EXECFN  31   /* filename of program */
+#define AT_SYSINFO_EHDR 33 /* address of the vDSO ELF header */
 
 template<typename T>
 struct AuxVec
@@ -0,0 +1,276 @@
+/**
+ * A minimal vDSO for Linux guests, advertised through AT_SYSINFO_EHDR.
+ *
+ * glibc and musl look up __vdso_clock_gettime and __vdso_gettimeofday
+ * in it, and call them instead of making a system call. The functions
+ * read the RDTIME counter and scale it using a data page right below
+ * the image, so reading the time costs a handful of instructions
+ * instead of a full ECALL dispatch. Clocks other than CLOCK_REALTIME
+ * and CLOCK_MONOTONIC, and machines with a custom RDTIME function,
+ * fall back to the regular system call.
+ *
+ * Layout:
+ *  [data page] VdsoData, refreshed by the host on each simulate()
+ *  [ELF image] headers, dynamic symbols and the code, read+execute
+**/
+#include "machine.hpp"
+#include "internal_common.hpp"
+#include "util/auxvec.hpp"
+#include <chrono>
+
+namespace riscv
+{
+	static_assert(Page::size() == 4096, "The vDSO code addresses its data page with AUIPC");
+
+	struct VdsoData {
+		uint64_t ns_per_tick;       // Zero: always use the system call
+		int64_t  realtime_offset;   // CLOCK_REALTIME = ticks * ns_per_tick + offset
+		int64_t  monotonic_offset;  // CLOCK_MONOTONIC = ticks * ns_per_tick + offset
+	};
+
+	namespace {
+		// Just enough of an assembler for the vDSO functions
+		struct VdsoAssembler
+		{
+			enum Reg : uint32_t { ZERO = 0, T0 = 5, T1 = 6, T2 = 7, A0 = 10, A1 = 11, A7 = 17, T3 = 28 };
+
+			void I(uint32_t op, uint32_t f3, Reg rd, Reg rs1, int32_t imm) {
+				emit((uint32_t(imm) << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | op);
+			}
+			void R(uint32_t f7, uint32_t f3, Reg rd, Reg rs1, Reg rs2) {
+				emit((f7 << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | 0x33);
+			}
+			void addi(Reg rd, Reg rs1, int32_t imm) { I(0x13, 0, rd, rs1, imm); }
+			void slli(Reg rd, Reg rs1, int32_t sh) { I(0x13, 1, rd, rs1, sh); }
+			void ld(Reg rd, Reg rs1, int32_t imm) { I(0x03, 3, rd, rs1, imm); }
+			void rdtime(Reg rd) { I(0x73, 2, rd, ZERO, 0xC01); }
+			void ret() { I(0x67, 0, ZERO, Reg(1), 0); }
+			void ecall() { emit(0x73); }
+			void add(Reg rd, Reg rs1, Reg rs2) { R(0x00, 0, rd, rs1, rs2); }
+			void mul(Reg rd, Reg rs1, Reg rs2) { R(0x01, 0, rd, rs1, rs2); }
+			void divu(Reg rd, Reg rs1, Reg rs2) { R(0x01, 5, rd, rs1, rs2); }
+			void remu(Reg rd, Reg rs1, Reg rs2) { R(0x01, 7, rd, rs1, rs2); }
+			void sd(Reg rs2, Reg rs1, int32_t imm) {
+				emit(((uint32_t(imm) >> 5) << 25) | (rs2 << 20) | (rs1 << 15) | (3 << 12) | ((imm & 0x1F) << 7) | 0x23);
+			}
+			void lui(Reg rd, uint32_t imm20) { emit((imm20 << 12) | (rd << 7) | 0x37); }
+			void li_1e9(Reg rd) { lui(rd, 0x3B9AD); addi(rd, rd, -1536); }
+			// rd = the vDSO data page, from the current function at image offset
+			void data_page(Reg rd) {
+				emit((0xFFFFFu << 12) | (rd << 7) | 0x17); // auipc rd, -1
+				addi(rd, rd, -int32_t(pos()));
+			}
+
+			// Branches are emitted forward, and bound to a label later
+			size_t branch(uint32_t f3, Reg rs1, Reg rs2) {
+				emit((rs2 << 20) | (rs1 << 15) | (f3 << 12) | 0x63);
+				return code.size() - 1;
+			}
+			size_t beqz(Reg rs1) { return branch(0, rs1, ZERO); }
+			size_t bnez(Reg rs1) { return branch(1, rs1, ZERO); }
+			size_t bltu(Reg rs1, Reg rs2) { return branch(6, rs1, rs2); }
+			void bind(size_t idx) {
+				const uint32_t imm = (code.size() - idx) * 4;
+				code[idx] |= (((imm >> 12) & 1) << 31) | (((imm >> 5) & 0x3F) << 25)
+					| (((imm >> 1) & 0xF) << 8) | (((imm >> 11) & 1) << 7);
+			}
+
+			void emit(uint32_t instr) { code.push_back(instr); }
+			// Image offsets of the last and the next instruction
+			uint32_t pos() const noexcept { return next() - 4; }
+			uint32_t next() const noexcept { return base + code.size() * 4; }
+
+			uint32_t base;
+			std::vector<uint32_t> code;
+		};
+
+		struct Dyn64 {
+			int64_t  d_tag;
+			uint64_t d_val;
+		};
+		static constexpr int64_t DT_NULL = 0, DT_HASH = 4, DT_STRTAB = 5, DT_SYMTAB = 6,
+			DT_STRSZ = 10, DT_SYMENT = 11, DT_SONAME = 14;
+
+		// The vDSO image, with virtual addresses relative to its beginning
+		struct VdsoImage {
+			using Elf = riscv::Elf<8>;
+			static constexpr uint32_t TEXT_OFFSET = 0x200;
+
+			Elf::Header header;
+			Elf::ProgramHeader phdr[2];
+			uint32_t hash[6];
+			Elf::Sym dynsym[3];
+			Dyn64 dynamic[7];
+			char dynstr[64];
+		};
+		static_assert(sizeof(VdsoImage) <= VdsoImage::TEXT_OFFSET);
+
+		static constexpr char VDSO_STRINGS[] =
+			"\0__vdso_clock_gettime\0__vdso_gettimeofday\0linux-vdso.so.1";
+		static constexpr uint32_t STR_CLOCK_GETTIME = 1;
+		static constexpr uint32_t STR_GETTIMEOFDAY = 22;
+		static constexpr uint32_t STR_SONAME = 42;
+		static_assert(sizeof(VDSO_STRINGS) <= sizeof(VdsoImage::dynstr));
+
+		static std::vector<uint8_t> build_vdso_image()
+		{
+			using Elf = VdsoImage::Elf;
+			std::vector<uint8_t> result(Page::size());
+			VdsoAssembler as { VdsoImage::TEXT_OFFSET, {} };
+
+			// int __vdso_clock_gettime(clockid_t a0, struct timespec* a1)
+			const uint32_t clock_gettime_offset = as.next();
+			as.data_page(VdsoAssembler::T0);
+			as.addi(VdsoAssembler::T1, VdsoAssembler::ZERO, 1);
+			const auto cgt_unknown_clock = as.bltu(VdsoAssembler::T1, VdsoAssembler::A0);
+			as.ld(VdsoAssembler::T2, VdsoAssembler::T0, offsetof(VdsoData, ns_per_tick));
+			const auto cgt_no_rdtime = as.beqz(VdsoAssembler::T2);
+			as.slli(VdsoAssembler::T1, VdsoAssembler::A0, 3);
+			as.add(VdsoAssembler::T0, VdsoAssembler::T0, VdsoAssembler::T1);
+			as.ld(VdsoAssembler::T1, VdsoAssembler::T0, offsetof(VdsoData, realtime_offset));
+			as.rdtime(VdsoAssembler::T3);
+			as.mul(VdsoAssembler::T3, VdsoAssembler::T3, VdsoAssembler::T2);
+			as.add(VdsoAssembler::T3, VdsoAssembler::T3, VdsoAssembler::T1);
+			as.li_1e9(VdsoAssembler::T1);
+			as.divu(VdsoAssembler::T2, VdsoAssembler::T3, VdsoAssembler::T1);
+			as.remu(VdsoAssembler::T3, VdsoAssembler::T3, VdsoAssembler::T1);
+			as.sd(VdsoAssembler::T2, VdsoAssembler::A1, 0);
+			as.sd(VdsoAssembler::T3, VdsoAssembler::A1, 8);
+			as.addi(VdsoAssembler::A0, VdsoAssembler::ZERO, 0);
+			as.ret();
+			as.bind(cgt_unknown_clock);
+			as.bind(cgt_no_rdtime);
+			as.addi(VdsoAssembler::A7, VdsoAssembler::ZERO, 113); // clock_gettime
+			as.ecall();
+			as.ret();
+
+			// int __vdso_gettimeofday(struct timeval* a0, struct timezone* a1)
+			const uint32_t gettimeofday_offset = as.next();
+			as.data_page(VdsoAssembler::T0);
+			as.ld(VdsoAssembler::T2, VdsoAssembler::T0, offsetof(VdsoData, ns_per_tick));
+			const auto gtod_no_rdtime = as.beqz(VdsoAssembler::T2);
+			const auto gtod_timezone = as.bnez(VdsoAssembler::A1);
+			const auto gtod_no_tv = as.beqz(VdsoAssembler::A0);
+			as.ld(VdsoAssembler::T1, VdsoAssembler::T0, offsetof(VdsoData, realtime_offset));
+			as.rdtime(VdsoAssembler::T3);
+			as.mul(VdsoAssembler::T3, VdsoAssembler::T3, VdsoAssembler::T2);
+			as.add(VdsoAssembler::T3, VdsoAssembler::T3, VdsoAssembler::T1);
+			as.li_1e9(VdsoAssembler::T1);
+			as.divu(VdsoAssembler::T2, VdsoAssembler::T3, VdsoAssembler::T1);
+			as.remu(VdsoAssembler::T3, VdsoAssembler::T3, VdsoAssembler::T1);
+			as.addi(VdsoAssembler::T1, VdsoAssembler::ZERO, 1000);
+			as.divu(VdsoAssembler::T3, VdsoAssembler::T3, VdsoAssembler::T1);
+			as.sd(VdsoAssembler::T2, VdsoAssembler::A0, 0);
+			as.sd(VdsoAssembler::T3, VdsoAssembler::A0, 8);
+			as.bind(gtod_no_tv);
+			as.addi(VdsoAssembler::A0, VdsoAssembler::ZERO, 0);
+			as.ret();
+			as.bind(gtod_no_rdtime);
+			as.bind(gtod_timezone);
+			as.addi(VdsoAssembler::A7, VdsoAssembler::ZERO, 169); // gettimeofday
+			as.ecall();
+			as.ret();
+
+			const uint32_t text_size = as.code.size() * 4;
+			if (VdsoImage::TEXT_OFFSET + text_size > Page::size())
+				throw MachineException(INVALID_PROGRAM, "vDSO image too large");
+			std::memcpy(result.data() + VdsoImage::TEXT_OFFSET, as.code.data(), text_size);
+
+			VdsoImage image {};
+			auto& hdr = image.header;
+			const unsigned char ident[] = { 0x7F, 'E', 'L', 'F', ELFCLASS64, 1 /* LSB */, 1 /* EV_CURRENT */ };
+			std::memcpy(hdr.e_ident, ident, sizeof(ident));
+			hdr.e_type = Elf::Header::ET_DYN;
+			hdr.e_machine = Elf::Header::EM_RISCV;
+			hdr.e_version = 1;
+			hdr.e_phoff = offsetof(VdsoImage, phdr);
+			hdr.e_flags = 0x5; // RVC, double-float ABI
+			hdr.e_ehsize = sizeof(Elf::Header);
+			hdr.e_phentsize = sizeof(Elf::ProgramHeader);
+			hdr.e_phnum = 2;
+
+			image.phdr[0].p_type = Elf::PT_LOAD;
+			image.phdr[0].p_flags = Elf::PF_R | Elf::PF_X;
+			image.phdr[0].p_filesz = Page::size();
+			image.phdr[0].p_memsz = Page::size();
+			image.phdr[0].p_align = Page::size();
+			image.phdr[1].p_type = Elf::PT_DYNAMIC;
+			image.phdr[1].p_flags = Elf::PF_R;
+			image.phdr[1].p_offset = offsetof(VdsoImage, dynamic);
+			image.phdr[1].p_vaddr = offsetof(VdsoImage, dynamic);
+			image.phdr[1].p_paddr = offsetof(VdsoImage, dynamic);
+			image.phdr[1].p_filesz = sizeof(image.dynamic);
+			image.phdr[1].p_memsz = sizeof(image.dynamic);
+			image.phdr[1].p_align = 8;
+
+			// A single hash bucket chaining through both symbols
+			const uint32_t hash[6] = { 1, 3, 1, 0, 2, 0 };
+			std::memcpy(image.hash, hash, sizeof(hash));
+
+			const unsigned char func_info = (Elf::STB_GLOBAL << 4) | Elf::STT_FUNC;
+			image.dynsym[1] = { STR_CLOCK_GETTIME, func_info, 0, 1,
+				clock_gettime_offset, gettimeofday_offset - clock_gettime_offset };
+			image.dynsym[2] = { STR_GETTIMEOFDAY, func_info, 0, 1,
+				gettimeofday_offset, VdsoImage::TEXT_OFFSET + text_size - gettimeofday_offset };
+
+			const Dyn64 dynamic[7] = {
+				{ DT_HASH,   offsetof(VdsoImage, hash) },
+				{ DT_STRTAB, offsetof(VdsoImage, dynstr) },
+				{ DT_SYMTAB, offsetof(VdsoImage, dynsym) },
+				{ DT_STRSZ,  sizeof(VDSO_STRINGS) },
+				{ DT_SYMENT, sizeof(Elf::Sym) },
+				{ DT_SONAME, STR_SONAME },
+				{ DT_NULL,   0 },
+			};
+			std::memcpy(image.dynamic, dynamic, sizeof(dynamic));
+			std::memcpy(image.dynstr, VDSO_STRINGS, sizeof(VDSO_STRINGS));
+
+			std::memcpy(result.data(), &image, sizeof(image));
+			return result;
+		}
+	} // anonymous
+
+	template <int W>
+	void Machine<W>::setup_linux_vdso()
+	{
+		if constexpr (W != 8) {
+			throw MachineException(FEATURE_DISABLED, "The vDSO is only available for 64-bit RISC-V");
+		} else {
+			static const std::vector<uint8_t> vdso_image = build_vdso_image();
+
+			const address_t data = memory.mmap_allocate(2 * Page::size());
+			const address_t text = data + Page::size();
+			memory.memcpy(text, vdso_image.data(), vdso_image.size());
+			memory.set_page_attr(text, Page::size(), {.read = true, .write = false, .exec = true});
+			// Decode the code page up-front, as it may not be paged
+			cpu.init_execute_area(vdso_image.data(), text, Page::size());
+
+			this->m_vdso_data = data;
+			this->update_vdso();
+		}
+	}
+
+	template <int W>
+	void Machine<W>::update_vdso()
+	{
+		VdsoData data {};
+		// The time is only derivable from RDTIME when we know its unit
+		if (this->m_rdtime == default_rdtime) {
+			using namespace std::chrono;
+			static constexpr int64_t NS_PER_TICK = 1000; // Microseconds
+			const int64_t ticks = int64_t(this->rdtime()) * NS_PER_TICK;
+			const int64_t realtime = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+			const int64_t monotonic = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+			data.ns_per_tick = NS_PER_TICK;
+			data.realtime_offset  = realtime - ticks;
+			data.monotonic_offset = monotonic - ticks;
+		}
+		// The host clocks are inputs to the guest
+		this->replay_input(&data, sizeof(data));
+		memory.memcpy(this->m_vdso_data, &data, sizeof(data));
+	}
+
+	INSTANTIATE_32_IF_ENABLED(Machine);
+	INSTANTIATE_64_IF_ENABLED(Machine);
+	INSTANTIATE_128_IF_ENABLED(Machine);
+} // riscv
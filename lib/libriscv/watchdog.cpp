@@ -0,0 +1,93 @@
+#include "watchdog.hpp"
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace riscv
+{
+	struct WatchdogState
+	{
+		using clock = Watchdog::clock;
+		struct Entry {
+			uint64_t id;
+			std::atomic<uint8_t>* flag;
+		};
+
+		std::mutex mutex;
+		std::condition_variable cv;
+		// Armed deadlines, earliest first
+		std::multimap<clock::time_point, Entry> deadlines;
+		std::unordered_map<uint64_t, std::multimap<clock::time_point, Entry>::iterator> armed;
+		// The point in time the thread sleeps until
+		clock::time_point wakeup = clock::time_point::max();
+		uint64_t next_id = 1;
+		bool started = false;
+
+		void run();
+	};
+
+	// The state is never destroyed, as the thread may still be
+	// waiting on it while static destructors run at exit.
+	static WatchdogState& watchdog_state()
+	{
+		static WatchdogState* state = new WatchdogState;
+		return *state;
+	}
+
+	void WatchdogState::run()
+	{
+		std::unique_lock lock(mutex);
+		while (true)
+		{
+			const auto now = clock::now();
+			while (!deadlines.empty() && deadlines.begin()->first <= now)
+			{
+				auto it = deadlines.begin();
+				it->second.flag->store(1, std::memory_order_relaxed);
+				armed.erase(it->second.id);
+				deadlines.erase(it);
+			}
+			if (deadlines.empty()) {
+				wakeup = clock::time_point::max();
+				cv.wait(lock);
+			} else {
+				wakeup = deadlines.begin()->first;
+				cv.wait_until(lock, wakeup);
+			}
+		}
+	}
+
+	uint64_t Watchdog::arm(std::atomic<uint8_t>& flag, clock::time_point deadline)
+	{
+		auto& state = watchdog_state();
+		std::lock_guard lock(state.mutex);
+		if (!state.started) {
+			std::thread([&state] { state.run(); }).detach();
+			state.started = true;
+		}
+		const uint64_t id = state.next_id++;
+		state.armed.emplace(id, state.deadlines.emplace(deadline, WatchdogState::Entry{id, &flag}));
+		// Only wake the thread if it would otherwise sleep past this deadline
+		if (deadline < state.wakeup) {
+			state.wakeup = deadline;
+			state.cv.notify_one();
+		}
+		return id;
+	}
+
+	bool Watchdog::disarm(uint64_t id)
+	{
+		auto& state = watchdog_state();
+		std::lock_guard lock(state.mutex);
+		auto it = state.armed.find(id);
+		if (it == state.armed.end())
+			return true;
+		state.deadlines.erase(it->second);
+		state.armed.erase(it);
+		return false;
+	}
+
+} // riscv
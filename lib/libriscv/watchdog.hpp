@@ -0,0 +1,29 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace riscv
+{
+	/// @brief Wall-clock deadlines for running machines, see Machine::simulate_for().
+	/// @details A single process-wide thread sleeps until the earliest deadline,
+	/// and requests an interrupt by setting its flag. The thread is started on
+	/// first use. Arming a deadline that is later than the one the thread is
+	/// already sleeping towards does not wake it up, so repeatedly arming and
+	/// disarming costs little more than taking a lock.
+	struct Watchdog
+	{
+		using clock = std::chrono::steady_clock;
+
+		/// @brief Set @flag to 1 once @deadline has passed.
+		/// @param flag The flag to set, usually the interrupt flag of a machine.
+		/// @param deadline The point in time after which the flag is set.
+		/// @return An identifier for disarm().
+		static uint64_t arm(std::atomic<uint8_t>& flag, clock::time_point deadline);
+
+		/// @brief Cancel a deadline.
+		/// @param id The identifier returned by arm().
+		/// @return True if the deadline had already passed, and the flag was set.
+		static bool disarm(uint64_t id);
+	};
+}
@@ -2,6 +2,7 @@
 #include <catch2/matchers/catch_matchers_string.hpp>
 
 #include <libriscv/machine.hpp>
+#include <libriscv/posix/vfs.hpp>
 extern std::vector<uint8_t> build_and_load(const std::string& code,
 	const std::string& args = "-O2 -static", bool cpp = false);
 static const uint64_t MAX_MEMORY = 8ul << 20; /* 8MB */
@@ -227,3 +228,244 @@ TEST_CASE("Count using EBREAK", "[Compute]")
 	else
 		REQUIRE(machine.return_value<long>() == 46368L);
 }
+
+TEST_CASE("Read the time through the vDSO", "[Runtime]")
+{
+	const auto binary = build_and_load(R"M(
+	#include <time.h>
+	#include <sys/time.h>
+	int main() {
+		struct timespec ts1, ts2;
+		clock_gettime(CLOCK_MONOTONIC, &ts1);
+		clock_gettime(CLOCK_MONOTONIC, &ts2);
+		if (ts2.tv_sec < ts1.tv_sec || (ts2.tv_sec == ts1.tv_sec && ts2.tv_nsec < ts1.tv_nsec))
+			return 1;
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		clock_gettime(CLOCK_REALTIME, &ts1);
+		if (ts1.tv_sec < tv.tv_sec)
+			return 2;
+		return 666;
+	})M");
+
+	riscv::Machine<RISCV64> machine { binary, { .memory_max = MAX_MEMORY } };
+	machine.setup_linux_syscalls(false, false);
+	machine.setup_linux_vdso();
+	machine.setup_linux(
+		{"basic"},
+		{"LC_TYPE=C", "LC_ALL=C", "USER=root"});
+	REQUIRE(machine.vdso_address() != 0);
+
+	// Time system calls are not needed with the vDSO
+	static unsigned time_syscalls = 0;
+	const auto clock_gettime = Machine<RISCV64>::syscall_handlers.at(113);
+	const auto gettimeofday = Machine<RISCV64>::syscall_handlers.at(169);
+	machine.install_syscall_handler(113, [] (auto&) { time_syscalls++; });
+	machine.install_syscall_handler(169, [] (auto&) { time_syscalls++; });
+
+	machine.simulate(MAX_INSTRUCTIONS);
+
+	machine.install_syscall_handler(113, clock_gettime);
+	machine.install_syscall_handler(169, gettimeofday);
+	REQUIRE(time_syscalls == 0);
+	REQUIRE(machine.return_value<int>() == 666);
+}
+
+TEST_CASE("Batched page faults and pre-faulting", "[Runtime]")
+{
+	const auto binary = build_and_load(R"M(
+	#include <stdlib.h>
+	#include <string.h>
+	#include <sys/mman.h>
+	int main() {
+		const size_t len = 1 << 20;
+		char* p = malloc(len);
+		memset(p, 1, len);
+		long sum = 0;
+		for (size_t i = 0; i < len; i += 4096)
+			sum += p[i];
+		char* q = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+		if (q == MAP_FAILED || q[len-1] != 0)
+			return 1;
+		q[len-1] = 1;
+		return (sum == len / 4096 && q[len-1] == 1) ? 666 : 2;
+	})M");
+
+	riscv::Machine<RISCV64> machine { binary, {
+		.memory_max = MAX_MEMORY,
+		.use_memory_arena = false,
+		.page_fault_batch = 16
+	} };
+	machine.setup_linux_syscalls();
+	machine.setup_linux(
+		{"basic"},
+		{"LC_TYPE=C", "LC_ALL=C", "USER=root"});
+	machine.simulate(MAX_INSTRUCTIONS);
+	REQUIRE(machine.return_value<int>() == 666);
+
+	// Pre-faulted pages are created writable and zeroed
+	static constexpr uint64_t ADDR = 0x40000000;
+	static constexpr size_t LEN = 64 * Page::size();
+	const size_t pages = machine.memory.pages_active();
+	machine.memory.prefault(ADDR, LEN);
+	REQUIRE(machine.memory.pages_active() == pages + 64);
+	REQUIRE(machine.memory.read<uint64_t>(ADDR + LEN - 8) == 0);
+	machine.memory.write<uint64_t>(ADDR, 0x1234);
+
+	// Freed pages are recycled by the next page run
+	const size_t owned = machine.memory.owned_pages_active();
+	const uint64_t usage = machine.memory.memory_usage_total();
+	machine.memory.free_pages(ADDR, LEN);
+	REQUIRE(machine.memory.owned_pages_active() == owned - 64);
+	machine.memory.prefault(ADDR, LEN);
+	REQUIRE(machine.memory.owned_pages_active() == owned);
+	REQUIRE(machine.memory.memory_usage_total() == usage);
+	REQUIRE(machine.memory.read<uint64_t>(ADDR) == 0);
+}
+
+TEST_CASE("File-backed mmap", "[Runtime]")
+{
+	const auto binary = build_and_load(R"M(
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <unistd.h>
+	int main(int argc, char** argv) {
+		const int fd = open(argv[1], O_RDONLY);
+		if (fd < 0)
+			return 1;
+		unsigned char* p = mmap(NULL, 4 * 4096, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE, fd, 4096);
+		close(fd);
+		if (p == MAP_FAILED)
+			return 2;
+		if (p[0] != 1 || p[4096] != 2 || p[2 * 4096 + 99] != 3 || p[2 * 4096 + 100] != 0)
+			return 3;
+		p[0] = 42; // Private: the file is not modified
+		if (p[0] != 42)
+			return 4;
+		munmap(p, 4 * 4096);
+		unsigned char* q = mmap(p, 4 * 4096, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+		if (q != p || q[0] != 0 || q[4096] != 0)
+			return 5;
+		return 666;
+	})M");
+
+	// One page of 0xAA, then two pages of 1s and 2s, then 100 bytes of 3s
+	const std::string path = "/tmp/libriscv-mmap-test.dat";
+	{
+		std::string data(4096, char(0xAA));
+		data += std::string(4096, char(1));
+		data += std::string(4096, char(2));
+		data += std::string(100, char(3));
+		FILE* f = fopen(path.c_str(), "wb");
+		REQUIRE(f != nullptr);
+		REQUIRE(fwrite(data.data(), 1, data.size(), f) == data.size());
+		fclose(f);
+	}
+
+	for (const bool arena : {true, false})
+	{
+		riscv::Machine<RISCV64> machine { binary, {
+			.memory_max = MAX_MEMORY,
+			.use_memory_arena = arena
+		} };
+		machine.setup_linux_syscalls();
+		machine.fds().permit_filesystem = true;
+		machine.fds().filter_open = [] (void*, std::string& path) {
+			return path == "/tmp/libriscv-mmap-test.dat";
+		};
+		machine.setup_linux(
+			{"basic", path},
+			{"LC_TYPE=C", "LC_ALL=C", "USER=root"});
+		machine.simulate(MAX_INSTRUCTIONS);
+		REQUIRE(machine.return_value<int>() == 666);
+	}
+
+	FILE* f = fopen(path.c_str(), "rb");
+	REQUIRE(f != nullptr);
+	REQUIRE(fseek(f, 4096, SEEK_SET) == 0);
+	REQUIRE(fgetc(f) == 1);
+	fclose(f);
+	remove(path.c_str());
+}
+
+// A minimal ustar archive with regular files
+static std::string make_tar(const std::vector<std::pair<std::string, std::string>>& files)
+{
+	std::string tar;
+	for (const auto& [name, contents] : files) {
+		char hdr[512] = {};
+		snprintf(hdr + 0, 100, "%s", name.c_str());
+		snprintf(hdr + 100, 8, "%07o", 0644);
+		snprintf(hdr + 124, 12, "%011o", unsigned(contents.size()));
+		snprintf(hdr + 136, 12, "%011o", 0u);
+		hdr[156] = '0';
+		memcpy(hdr + 257, "ustar", 6);
+		memcpy(hdr + 263, "00", 2);
+		memset(hdr + 148, ' ', 8);
+		unsigned sum = 0;
+		for (unsigned char c : hdr) sum += c;
+		snprintf(hdr + 148, 8, "%06o", sum);
+		tar.append(hdr, sizeof(hdr));
+		tar += contents;
+		tar.append((512 - contents.size() % 512) % 512, '\0');
+	}
+	tar.append(1024, '\0');
+	return tar;
+}
+
+TEST_CASE("Read-only virtual filesystem", "[Runtime]")
+{
+	const auto binary = build_and_load(R"M(
+	#include <dirent.h>
+	#include <stdio.h>
+	#include <string.h>
+	#include <sys/stat.h>
+	int main() {
+		FILE* f = fopen("/data/hello.txt", "r");
+		if (f == NULL)
+			return 1;
+		char buffer[64] = {};
+		fread(buffer, 1, sizeof(buffer)-1, f);
+		fclose(f);
+		if (strcmp(buffer, "Hello VFS!") != 0)
+			return 2;
+		struct stat st;
+		if (stat("/data/sub/big.bin", &st) != 0 || st.st_size != 10000)
+			return 3;
+		if (fopen("/data/hello.txt", "w") != NULL || fopen("/data/nope", "r") != NULL)
+			return 4;
+		DIR* dir = opendir("/data");
+		if (dir == NULL)
+			return 5;
+		int entries = 0;
+		while (readdir(dir) != NULL)
+			entries++;
+		closedir(dir);
+		return (entries == 4) ? 666 : 6; // ., .., hello.txt and sub
+	})M");
+
+	const std::string image = make_tar({
+		{"data/hello.txt", "Hello VFS!"},
+		{"data/sub/big.bin", std::string(10000, 'x')},
+	});
+	auto vfs = VirtualFS::from_tar(image);
+	REQUIRE(vfs->lookup("/data/sub/big.bin") > 0);
+	REQUIRE(vfs->lookup("/data/sub/../hello.txt") > 0);
+	REQUIRE(vfs->lookup("/data/nope") == -ENOENT);
+
+	// The filesystem is shared by every machine
+	for (int i = 0; i < 2; i++)
+	{
+		riscv::Machine<RISCV64> machine { binary, { .memory_max = MAX_MEMORY } };
+		machine.setup_linux_syscalls(true, false);
+		machine.fds().vfs = vfs;
+		machine.setup_linux(
+			{"basic"},
+			{"LC_TYPE=C", "LC_ALL=C", "USER=root"});
+		machine.simulate(MAX_INSTRUCTIONS);
+		REQUIRE(machine.return_value<int>() == 666);
+	}
+}
@@ -109,6 +109,76 @@ TEST_CASE("Read and write traps", "[Memory Traps]")
 	REQUIRE(machine.return_value() == 1234);
 }
 
+TEST_CASE("Sub-page MMIO regions", "[Memory Traps]")
+{
+	const auto binary = build_and_load(R"M(
+	__attribute__((used, retain))
+	void mmio_write(unsigned value) {
+		*(volatile unsigned *)0xF0000104 = value;
+	}
+	__attribute__((used, retain))
+	long mmio_read() {
+		return *(volatile unsigned *)0xF0000104;
+	}
+	__attribute__((used, retain))
+	long regular_rw(long value) {
+		// Same page as the MMIO region, but outside of it
+		*(volatile long *)0xF0000200 = value;
+		return *(volatile long *)0xF0000200;
+	}
+
+	int main() {
+		return 666;
+	})M");
+
+	riscv::Machine<RISCV64> machine { binary };
+	machine.setup_linux_syscalls();
+	machine.setup_linux(
+		{"vmcall"},
+		{"LC_TYPE=C", "LC_ALL=C", "USER=root"});
+
+	machine.simulate(MAX_INSTRUCTIONS);
+	REQUIRE(machine.return_value<int>() == 666);
+
+	uint64_t mmio_value = 0;
+	unsigned accesses = 0;
+	machine.memory.map_mmio(0xF0000100, 0xF0000110, {
+		.read = [&] (auto&, uint64_t offset, unsigned size) -> uint64_t {
+			REQUIRE(offset == 4);
+			REQUIRE(size == 4);
+			accesses++;
+			return mmio_value + 1;
+		},
+		.write = [&] (auto&, uint64_t offset, unsigned size, uint64_t value) {
+			REQUIRE(offset == 4);
+			REQUIRE(size == 4);
+			accesses++;
+			mmio_value = value;
+		},
+	});
+	REQUIRE(machine.memory.mmio_regions().size() == 1);
+
+	machine.vmcall("mmio_write", 1234);
+	REQUIRE(mmio_value == 1234);
+	machine.vmcall("mmio_read");
+	REQUIRE(machine.return_value() == 1235);
+	REQUIRE(accesses == 2);
+
+	// The rest of the page is still ordinary memory
+	machine.vmcall("regular_rw", 5678);
+	REQUIRE(machine.return_value() == 5678);
+	REQUIRE(accesses == 2);
+
+	// Overlapping regions are rejected
+	REQUIRE_THROWS(machine.memory.map_mmio(0xF000010C, 0xF0000120, {}));
+
+	REQUIRE(machine.memory.unmap_mmio(0xF0000100));
+	REQUIRE(machine.memory.mmio_regions().empty());
+	machine.vmcall("mmio_write", 99);
+	REQUIRE(mmio_value == 1234);
+	REQUIRE(accesses == 2);
+}
+
 TEST_CASE("Execute traps", "[Memory Traps]")
 {
 	const auto binary = build_and_load(R"M(